@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "../Util/Loss.h"
+#include "../Util/Matrix.h"
+#include "../Util/Quantize.h"
+#include "../Util/Reduction.h"
+#include "Solver.h"
+
+// Inference-only copy of a trained Solver with 8 bit weights and activations. Weights are signed with one scale per
+// output (row), activations unsigned with one scale per sample, chosen from the range of its ReLU outputs as each
+// hidden layer writes them. Input bytes are used as they are, so a batch of pixels needs no conversion at all. Only
+// the logits of the last layer are float.
+class QuantizedNetwork
+{
+	size_t m_batchSize;
+
+	std::vector<math::PackedWeights> m_weights;
+	std::vector<math::Matrix<float>> m_biases;
+	// m_activations[l] is the output of hidden layer l, with one row per sample of the last batch.
+	std::vector<math::QuantizedMatrix<uint8_t>> m_activations;
+	math::Matrix<float> m_logits;
+
+public:
+	template<typename T>
+	inline explicit QuantizedNetwork(const Solver<T>& solver);
+
+	inline size_t layers() const;
+	inline size_t batchSize() const;
+	inline const math::PackedWeights& weights(size_t l) const;
+
+	// Computes the logits for up to batchSize() samples (one per row). The result is a view of an internal buffer
+	// that is valid until the next call.
+	inline math::Matrix<float> logits(const math::QuantizedMatrix<uint8_t>& inputs);
+	// Loss and accuracy over a whole dataset, whose bytes stand for their value times scale.
+	inline Solver<float>::Stats evaluate(const math::Matrix<uint8_t>& inputs, const math::Matrix<uint8_t>& labels, float scale = 1.0f / 255);
+};
+
+template<typename T>
+inline QuantizedNetwork::QuantizedNetwork(const Solver<T>& solver) :
+	m_batchSize(solver.batchSize()),
+	m_logits(solver.batchSize(), solver.weights(solver.layers() - 1).iSize(), 0.0f)
+{
+	m_weights.reserve(solver.layers());
+	m_biases.reserve(solver.layers());
+	for (size_t l = 0; l < solver.layers(); l++)
+	{
+		m_weights.emplace_back(math::QuantizedMatrix<int8_t>::quantize(math::convert<float>(solver.weights(l)), math::Granularity::Row));
+		m_biases.push_back(math::convert<float>(solver.biases(l)));
+		if (l + 1 < solver.layers())
+		{
+			m_activations.emplace_back(m_batchSize, solver.weights(l).iSize(), math::Granularity::Row);
+		}
+	}
+}
+
+inline size_t QuantizedNetwork::layers() const
+{
+	return m_weights.size();
+}
+
+inline size_t QuantizedNetwork::batchSize() const
+{
+	return m_batchSize;
+}
+
+inline const math::PackedWeights& QuantizedNetwork::weights(size_t l) const
+{
+	return m_weights[l];
+}
+
+inline math::Matrix<float> QuantizedNetwork::logits(const math::QuantizedMatrix<uint8_t>& inputs)
+{
+	if (inputs.iSize() == 0 || inputs.iSize() > m_batchSize || inputs.jSize() != m_weights[0].jSize())
+	{
+		throw std::invalid_argument("inputs must have at most batchSize() rows of the input size");
+	}
+	size_t rows = inputs.iSize();
+	for (size_t l = 0; l + 1 < layers(); l++)
+	{
+		// Only a short last batch reallocates.
+		if (m_activations[l].iSize() != rows)
+		{
+			m_activations[l] = math::QuantizedMatrix<uint8_t>(rows, m_weights[l].iSize(), math::Granularity::Row);
+		}
+		math::linearInto(m_activations[l], l == 0 ? inputs : m_activations[l - 1], m_weights[l], m_biases[l], true);
+	}
+	math::Matrix<float> z = m_logits.shareSubmatrix((size_t)0, (size_t)0, rows, m_logits.jSize());
+	math::linearInto(z, layers() == 1 ? inputs : m_activations.back(), m_weights.back(), m_biases.back());
+	return z;
+}
+
+inline Solver<float>::Stats QuantizedNetwork::evaluate(const math::Matrix<uint8_t>& inputs, const math::Matrix<uint8_t>& labels, float scale)
+{
+	Solver<float>::Stats stats;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t begin = 0; begin < inputs.iSize(); begin += m_batchSize)
+	{
+		size_t size = std::min(m_batchSize, inputs.iSize() - begin);
+		const math::QuantizedMatrix<uint8_t> batch(inputs.shareSubmatrix(begin, (size_t)0, size, inputs.jSize()), scale, 0);
+		const math::Matrix<uint8_t> batchLabels = labels.shareSubmatrix(begin, (size_t)0, size, labels.jSize());
+		math::Matrix<float> z = logits(batch);
+		math::Matrix<size_t> best = math::argmax(z, math::Axis::Rows);
+		for (size_t i = 0; i < size; i++)
+		{
+			stats.correct += best(i, 0) == batchLabels(i, 0);
+		}
+		stats.loss += math::softmaxCrossEntropy(z, batchLabels) * size;
+		stats.samples += size;
+	}
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stats.loss = stats.samples > 0 ? stats.loss / stats.samples : 0;
+	return stats;
+}
@@ -1,9 +1,454 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "../Util/Batch Loader.h"
+#include "../Util/Checkpoint.h"
+#include "../Util/Functional.h"
+#include "../Util/Loss.h"
 #include "../Util/Matrix.h"
+#include "../Util/Reduction.h"
+#include "../Util/Sparse Matrix.h"
 
+// Feed-forward network with ReLU hidden layers and a softmax output layer, trained by mini-batch gradient descent on
+// the mean cross-entropy loss. Layer l's weights are the Jacobian of its pre-activation w.r.t. its input, so they
+// are sizes[l + 1] x sizes[l] in the numerator layout, and gradients w.r.t. a sample are rows (see main.cpp). A
+// mini-batch stacks one sample per row, which turns every pass over a layer into a single matrix product:
+// Z = A * W^T + b going forward, dA = dZ * W and dW = dZ^T * A going backward.
 template<typename T>
 class Solver
 {
+	static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>, "Solver needs a GEMM accelerated type");
+
+public:
+	struct Stats
+	{
+		size_t samples = 0;
+		size_t correct = 0;
+		// Mean cross-entropy loss.
+		T loss = 0;
+		double seconds = 0;
+
+		inline double samplesPerSecond() const;
+		inline double accuracy() const;
+	};
+
+private:
+	struct ReLUGradient
+	{
+		inline T operator()(const T& delta, const T& activation) const;
+	};
+
+	std::vector<size_t> m_sizes;
+	size_t m_batchSize;
+
+	// All buffers are allocated up front. Activations and deltas have one row per sample of a full batch; smaller
+	// batches use views of their first rows.
+	std::vector<math::Matrix<T>> m_weights;
+	std::vector<math::Matrix<T>> m_biases;
+	std::vector<math::Matrix<T>> m_weightGradients;
+	std::vector<math::Matrix<T>> m_biasGradients;
+	// m_activations[l] is the output of layer l (the input to layer l + 1).
+	std::vector<math::Matrix<T>> m_activations;
+	// m_deltas[l] is the gradient of the loss w.r.t. the pre-activation of layer l.
+	std::vector<math::Matrix<T>> m_deltas;
+
+	// The batch of the last forward pass, dense or sparse.
+	const math::Matrix<T>* m_input = nullptr;
+	const math::SparseMatrix<T>* m_sparseInput = nullptr;
+	size_t m_rows = 0;
+
+	static inline math::Matrix<T> rows(math::Matrix<T>& mat, size_t rows);
+
+	// Runs every layer but the softmax and returns a view of the output logits. Inputs is a Matrix or SparseMatrix.
+	template<typename Inputs>
+	inline math::Matrix<T> logits(const Inputs& inputs);
+	// Backward pass from the gradient w.r.t. the output logits in m_deltas.back().
+	inline void backpropagate();
+
+public:
+	// sizes lists the width of every layer, input first. Weights are drawn with He initialization.
+	inline Solver(const std::vector<size_t>& sizes, size_t batchSize, uint64_t seed = 0);
+	inline Solver(const Solver&) = delete;
+	inline Solver& operator=(const Solver&) = delete;
+
+	inline size_t layers() const;
+	inline size_t batchSize() const;
+	inline const math::Matrix<T>& weights(size_t l) const;
+	inline const math::Matrix<T>& biases(size_t l) const;
+
+	// Writes the weights and biases of layer l as "weights.l" and "biases.l".
+	inline void save(const std::string& path) const;
+	// Restores a checkpoint written by save(). The parameters become views of the mapped file, which training
+	// modifies copy-on-write. Throws std::runtime_error if the file does not match the layer sizes.
+	inline void load(const std::string& path);
+
+	// Computes class probabilities for up to batchSize() samples (one per row). The result is a view of an internal
+	// buffer that is valid until the next call.
+	inline math::Matrix<T> forward(const math::Matrix<T>& inputs);
+	// The products of the first layer with sparse inputs, going forward and for its weight gradients, take time
+	// proportional to their nonzeros (see Sparse Matrix.h).
+	inline math::Matrix<T> forward(const math::SparseMatrix<T>& inputs);
+	// Sum of the cross-entropy losses of the last forward pass against labels (one class index per row).
+	inline T crossEntropy(const math::Matrix<uint8_t>& labels) const;
+	// Number of samples of the last forward pass whose most likely class matches the label. Training
+	// passes stop at the logits, which have the same largest element as the probabilities.
+	inline size_t correct(const math::Matrix<uint8_t>& labels) const;
+	// Computes the gradients of the mean loss of the last forward pass w.r.t. all weights and biases.
+	inline void backward(const math::Matrix<uint8_t>& labels);
+	inline void step(T learningRate);
+
+	// Forward pass, backward pass and step on one batch. Returns the mean loss before the step.
+	inline T train(const math::Matrix<T>& inputs, const math::Matrix<uint8_t>& labels, T learningRate);
+	inline T train(const math::SparseMatrix<T>& inputs, const math::Matrix<uint8_t>& labels, T learningRate);
+	// Trains on up to batches batches from loader.
+	inline Stats fit(io::BatchLoader& loader, T learningRate, size_t batches);
+	// Loss and accuracy over a whole dataset, with inputs converted from bytes by multiplying with scale.
+	inline Stats evaluate(const math::Matrix<uint8_t>& inputs, const math::Matrix<uint8_t>& labels, T scale = T(1) / 255);
+};
+
+template<typename T>
+inline double Solver<T>::Stats::samplesPerSecond() const
+{
+	return seconds > 0 ? samples / seconds : 0;
+}
+
+template<typename T>
+inline double Solver<T>::Stats::accuracy() const
+{
+	return samples > 0 ? double(correct) / samples : 0;
+}
+
+template<typename T>
+inline T Solver<T>::ReLUGradient::operator()(const T& delta, const T& activation) const
+{
+	return activation > 0 ? delta : T(0);
+}
+
+template<typename T>
+inline math::Matrix<T> Solver<T>::rows(math::Matrix<T>& mat, size_t rows)
+{
+	return mat.shareSubmatrix((size_t)0, (size_t)0, rows, mat.jSize());
+}
+
+template<typename T>
+inline Solver<T>::Solver(const std::vector<size_t>& sizes, size_t batchSize, uint64_t seed) :
+	m_sizes(sizes),
+	m_batchSize(batchSize)
+{
+	if (sizes.size() < 2 || batchSize == 0)
+	{
+		throw std::invalid_argument("Solver needs at least an input and an output layer and a positive batch size");
+	}
+	size_t layers = sizes.size() - 1;
+	m_weights.reserve(layers);
+	m_biases.reserve(layers);
+	m_weightGradients.reserve(layers);
+	m_biasGradients.reserve(layers);
+	m_activations.reserve(layers);
+	m_deltas.reserve(layers);
+	std::mt19937_64 random(seed);
+	for (size_t l = 0; l < layers; l++)
+	{
+		size_t in = sizes[l];
+		size_t out = sizes[l + 1];
+		math::Matrix<T>& weights = m_weights.emplace_back(out, in);
+		std::normal_distribution<T> distribution(T(0), std::sqrt(T(2) / in));
+		for (size_t i = 0; i < out; i++)
+		{
+			for (size_t j = 0; j < in; j++)
+			{
+				weights(i, j) = distribution(random);
+			}
+		}
+		m_biases.emplace_back(1, out, T(0));
+		m_weightGradients.emplace_back(out, in, T(0));
+		m_biasGradients.emplace_back(1, out, T(0));
+		m_activations.emplace_back(batchSize, out, T(0));
+		m_deltas.emplace_back(batchSize, out, T(0));
+	}
+}
+
+template<typename T>
+inline size_t Solver<T>::layers() const
+{
+	return m_weights.size();
+}
+
+template<typename T>
+inline size_t Solver<T>::batchSize() const
+{
+	return m_batchSize;
+}
+
+template<typename T>
+inline const math::Matrix<T>& Solver<T>::weights(size_t l) const
+{
+	return m_weights[l];
+}
+
+template<typename T>
+inline const math::Matrix<T>& Solver<T>::biases(size_t l) const
+{
+	return m_biases[l];
+}
 
-};
\ No newline at end of file
+template<typename T>
+inline void Solver<T>::save(const std::string& path) const
+{
+	io::CheckpointWriter writer(path);
+	for (size_t l = 0; l < layers(); l++)
+	{
+		writer.add("weights." + std::to_string(l), m_weights[l]);
+		writer.add("biases." + std::to_string(l), m_biases[l]);
+	}
+	writer.close();
+}
+
+template<typename T>
+inline void Solver<T>::load(const std::string& path)
+{
+	io::Checkpoint checkpoint(path);
+	std::vector<math::Matrix<T>> weights;
+	std::vector<math::Matrix<T>> biases;
+	weights.reserve(layers());
+	biases.reserve(layers());
+	// Everything is checked before anything is replaced.
+	for (size_t l = 0; l < layers(); l++)
+	{
+		math::Matrix<T>& weight = weights.emplace_back(checkpoint.get<T>("weights." + std::to_string(l)));
+		math::Matrix<T>& bias = biases.emplace_back(checkpoint.get<T>("biases." + std::to_string(l)));
+		if (weight.iSize() != m_weights[l].iSize() || weight.jSize() != m_weights[l].jSize() ||
+			bias.iSize() != 1 || bias.jSize() != m_biases[l].jSize())
+		{
+			throw std::runtime_error(path + ": layer " + std::to_string(l) + " has different sizes");
+		}
+	}
+	for (size_t l = 0; l < layers(); l++)
+	{
+		m_weights[l].swap(weights[l]);
+		m_biases[l].swap(biases[l]);
+	}
+}
+
+template<typename T>
+template<typename Inputs>
+inline math::Matrix<T> Solver<T>::logits(const Inputs& inputs)
+{
+	if constexpr (std::is_same_v<Inputs, math::SparseMatrix<T>>)
+	{
+		if (inputs.iSize() == 0 || inputs.iSize() > m_batchSize || inputs.jSize() != m_sizes[0])
+		{
+			throw std::invalid_argument("inputs must have at most batchSize() rows of the input size");
+		}
+		m_input = nullptr;
+		m_sparseInput = &inputs;
+	}
+	else
+	{
+		if (inputs.iSize() == 0 || inputs.iSize() > m_batchSize || inputs.jSize() != m_sizes[0] || !inputs.isAffine())
+		{
+			throw std::invalid_argument("inputs must be an affine matrix of at most batchSize() rows of the input size");
+		}
+		m_input = &inputs;
+		m_sparseInput = nullptr;
+	}
+	m_rows = inputs.iSize();
+	for (size_t l = 0; l < layers(); l++)
+	{
+		math::Matrix<T> z = rows(m_activations[l], m_rows);
+		const T* bias = &m_biases[l](0, 0);
+		for (size_t i = 0; i < m_rows; i++)
+		{
+			std::copy(bias, bias + z.jSize(), &z(i, 0));
+		}
+		if (l == 0)
+		{
+			math::matMulInto(T(1), inputs, m_weights[l], T(1), z, false, true);
+		}
+		else
+		{
+			math::matMulInto(T(1), rows(m_activations[l - 1], m_rows), m_weights[l], T(1), z, false, true);
+		}
+		if (l + 1 < layers())
+		{
+			z.assignElementWise(func::max<>(), T(0));
+		}
+	}
+	return rows(m_activations.back(), m_rows);
+}
+
+template<typename T>
+inline math::Matrix<T> Solver<T>::forward(const math::Matrix<T>& inputs)
+{
+	math::Matrix<T> z = logits(inputs);
+	math::softmaxInto(z, z);
+	return z;
+}
+
+template<typename T>
+inline math::Matrix<T> Solver<T>::forward(const math::SparseMatrix<T>& inputs)
+{
+	math::Matrix<T> z = logits(inputs);
+	math::softmaxInto(z, z);
+	return z;
+}
+
+template<typename T>
+inline T Solver<T>::crossEntropy(const math::Matrix<uint8_t>& labels) const
+{
+	const math::Matrix<T>& probabilities = m_activations.back();
+	T loss = 0;
+	for (size_t i = 0; i < m_rows; i++)
+	{
+		loss -= std::log(std::max(probabilities(i, labels(i, 0)), std::numeric_limits<T>::min()));
+	}
+	return loss;
+}
+
+template<typename T>
+inline size_t Solver<T>::correct(const math::Matrix<uint8_t>& labels) const
+{
+	const math::Matrix<T>& outputs = m_activations.back();
+	math::Matrix<size_t> best = math::argmax(outputs.shareSubmatrix((size_t)0, (size_t)0, m_rows, outputs.jSize()), math::Axis::Rows);
+	size_t correct = 0;
+	for (size_t i = 0; i < m_rows; i++)
+	{
+		correct += best(i, 0) == labels(i, 0);
+	}
+	return correct;
+}
+
+template<typename T>
+inline void Solver<T>::backward(const math::Matrix<uint8_t>& labels)
+{
+	// The gradient of the mean cross-entropy w.r.t. the logits of a softmax output is (p - onehot(label)) / rows.
+	T scale = T(1) / m_rows;
+	math::Matrix<T> delta = rows(m_deltas.back(), m_rows);
+	const math::Matrix<T>& probabilities = m_activations.back();
+	for (size_t i = 0; i < m_rows; i++)
+	{
+		for (size_t j = 0; j < delta.jSize(); j++)
+		{
+			delta(i, j) = probabilities(i, j) * scale;
+		}
+		delta(i, labels(i, 0)) -= scale;
+	}
+	backpropagate();
+}
+
+template<typename T>
+inline void Solver<T>::backpropagate()
+{
+	math::Matrix<T> delta = rows(m_deltas.back(), m_rows);
+	for (size_t l = layers(); l-- > 0;)
+	{
+		if (l == 0 && m_sparseInput)
+		{
+			math::matMulInto(T(1), delta, *m_sparseInput, T(0), m_weightGradients[l], true);
+		}
+		else if (l == 0)
+		{
+			math::matMulInto(T(1), delta, *m_input, T(0), m_weightGradients[l], true);
+		}
+		else
+		{
+			math::matMulInto(T(1), delta, rows(m_activations[l - 1], m_rows), T(0), m_weightGradients[l], true);
+		}
+		math::sumInto(m_biasGradients[l], delta, math::Axis::Cols);
+		if (l > 0)
+		{
+			math::Matrix<T> previous = rows(m_deltas[l - 1], m_rows);
+			math::matMulInto(T(1), delta, m_weights[l], T(0), previous);
+			// ReLU passes the gradient through wherever it passed the input through.
+			previous.assignElementWise(ReLUGradient(), rows(m_activations[l - 1], m_rows));
+			delta.swap(previous);
+		}
+	}
+}
+
+template<typename T>
+inline void Solver<T>::step(T learningRate)
+{
+	for (size_t l = 0; l < layers(); l++)
+	{
+		m_weights[l] -= m_weightGradients[l] * learningRate;
+		m_biases[l] -= m_biasGradients[l] * learningRate;
+	}
+}
+
+template<typename T>
+inline T Solver<T>::train(const math::Matrix<T>& inputs, const math::Matrix<uint8_t>& labels, T learningRate)
+{
+	T loss = math::softmaxCrossEntropy(logits(inputs), labels, rows(m_deltas.back(), m_rows));
+	backpropagate();
+	step(learningRate);
+	return loss;
+}
+
+template<typename T>
+inline T Solver<T>::train(const math::SparseMatrix<T>& inputs, const math::Matrix<uint8_t>& labels, T learningRate)
+{
+	T loss = math::softmaxCrossEntropy(logits(inputs), labels, rows(m_deltas.back(), m_rows));
+	backpropagate();
+	step(learningRate);
+	return loss;
+}
+
+template<typename T>
+inline typename Solver<T>::Stats Solver<T>::fit(io::BatchLoader& loader, T learningRate, size_t batches)
+{
+	static_assert(std::is_same_v<T, float>, "BatchLoader produces float batches");
+	Stats stats;
+	io::Batch batch;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t b = 0; b < batches && loader.next(batch); b++)
+	{
+		math::Matrix<T> z = logits(batch.inputs);
+		stats.correct += correct(batch.labels);
+		stats.loss += math::softmaxCrossEntropy(z, batch.labels, rows(m_deltas.back(), m_rows)) * m_rows;
+		backpropagate();
+		step(learningRate);
+		stats.samples += m_rows;
+	}
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stats.loss = stats.samples > 0 ? stats.loss / stats.samples : T(0);
+	return stats;
+}
+
+template<typename T>
+inline typename Solver<T>::Stats Solver<T>::evaluate(const math::Matrix<uint8_t>& inputs, const math::Matrix<uint8_t>& labels, T scale)
+{
+	Stats stats;
+	math::Matrix<T> buffer(m_batchSize, inputs.jSize());
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t begin = 0; begin < inputs.iSize(); begin += m_batchSize)
+	{
+		size_t size = std::min(m_batchSize, inputs.iSize() - begin);
+		math::Matrix<T> batch = rows(buffer, size);
+		for (size_t i = 0; i < size; i++)
+		{
+			for (size_t j = 0; j < inputs.jSize(); j++)
+			{
+				batch(i, j) = inputs(begin + i, j) * scale;
+			}
+		}
+		const math::Matrix<uint8_t> batchLabels = labels.shareSubmatrix(begin, (size_t)0, size, labels.jSize());
+		math::Matrix<T> z = logits(batch);
+		stats.correct += correct(batchLabels);
+		stats.loss += math::softmaxCrossEntropy(z, batchLabels) * size;
+		stats.samples += size;
+	}
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stats.loss = stats.samples > 0 ? stats.loss / stats.samples : T(0);
+	return stats;
+}
@@ -0,0 +1,501 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Storage allocation for Matrix. Every block handed out is 64 byte aligned and preceded by a Block header that
+// records the allocator owning it, so a block can be released without knowing which allocator was current when it
+// was allocated. The header also holds the reference count of matrix storage, which saves a separate allocation.
+//
+// Matrix allocates through the calling thread's current allocator, which is the process wide pool unless a Scope
+// says otherwise. A training loop can install an Arena for one batch and reset it afterwards, as long as no matrix
+// allocated from it survives the reset.
+//
+// Storage that lives elsewhere, such as a memory mapped file, can still be shared by matrices through an external
+// block: a header without elements whose allocator is the owner of that storage.
+//
+// Reference counts are atomic, so matrices sharing storage can be copied, shared and destroyed on different threads.
+// Define ALLOC_SINGLE_THREADED before including this file to make them plain integers instead.
+
+namespace alloc
+{
+	inline constexpr size_t alignment = 64;
+
+	struct Stats
+	{
+		// Allocations served from memory that was released to (or reserved by) the allocator earlier.
+		size_t hits = 0;
+		// Allocations that had to call the global allocator.
+		size_t misses = 0;
+		// Blocks allocated and not yet released.
+		size_t live = 0;
+	};
+
+	class Allocator
+	{
+	public:
+		virtual ~Allocator() = default;
+
+		// bytes includes the Block header. Returned memory is aligned to alignment.
+		virtual void* allocate(size_t bytes) = 0;
+		virtual void deallocate(void* ptr, size_t bytes) = 0;
+		virtual Stats stats() const = 0;
+	};
+
+	// Plain aligned global new/delete. Every allocation is a miss.
+	class Heap final : public Allocator
+	{
+		mutable std::mutex m_mutex;
+		Stats m_stats;
+
+	public:
+		inline void* allocate(size_t bytes) override;
+		inline void deallocate(void* ptr, size_t bytes) override;
+		inline Stats stats() const override;
+	};
+
+	// Keeps released blocks on free lists by size class and hands them out again. Sizes are rounded up to multiples
+	// of alignment below 4 * alignment and to four classes per power of two above, so at most 25% is wasted.
+	// Blocks larger than maxBlockBytes bypass the free lists, as the global allocator maps and unmaps those directly
+	// anyway, and a class keeps at most maxClassBytes of free blocks, releasing any more to the global allocator.
+	// Thread safe.
+	class Pool final : public Allocator
+	{
+		static constexpr size_t classCount = 4 + 4 * (sizeof(size_t) * 8 - 8);
+
+		mutable std::mutex m_mutex;
+		Stats m_stats;
+		std::array<void*, classCount> m_free{};
+		// Bytes of the free blocks of each class.
+		std::array<size_t, classCount> m_freeBytes{};
+		size_t m_maxBlockBytes;
+		size_t m_maxClassBytes;
+
+		static inline size_t sizeClass(size_t bytes, size_t& classBytes);
+
+	public:
+		inline explicit Pool(size_t maxBlockBytes = 4 << 20, size_t maxClassBytes = 16 << 20);
+		inline Pool(const Pool&) = delete;
+		inline Pool& operator=(const Pool&) = delete;
+		inline ~Pool();
+
+		inline void* allocate(size_t bytes) override;
+		inline void deallocate(void* ptr, size_t bytes) override;
+		inline Stats stats() const override;
+
+		// Returns every free block to the global allocator.
+		inline void trim();
+	};
+
+	// Bump allocator over a list of chunks. Releasing is a no-op; reset() makes all chunks available again, so after
+	// the first iteration an arena that is reset between iterations no longer calls the global allocator. Not thread
+	// safe.
+	class Arena final : public Allocator
+	{
+		struct Chunk
+		{
+			char* data;
+			size_t size;
+		};
+
+		std::vector<Chunk> m_chunks;
+		size_t m_chunk = 0;
+		size_t m_used = 0;
+		size_t m_chunkSize;
+		Stats m_stats;
+
+	public:
+		inline explicit Arena(size_t chunkSize = 1 << 20);
+		inline Arena(const Arena&) = delete;
+		inline Arena& operator=(const Arena&) = delete;
+		inline ~Arena();
+
+		inline void* allocate(size_t bytes) override;
+		inline void deallocate(void* ptr, size_t bytes) override;
+		inline Stats stats() const override;
+
+		// Invalidates every block allocated since the last reset.
+		inline void reset();
+	};
+
+	// Increments are relaxed, as a new reference can only be made from an existing one. Decrements are
+	// acquire-release, so whoever releases the last reference sees every write made through the others.
+	class ReferenceCount
+	{
+#ifdef ALLOC_SINGLE_THREADED
+		size_t m_count;
+#else
+		std::atomic<size_t> m_count;
+#endif
+
+	public:
+		inline ReferenceCount(size_t count);
+		inline ReferenceCount(const ReferenceCount&) = delete;
+		inline ReferenceCount& operator=(const ReferenceCount&) = delete;
+
+		inline void increment();
+		// Returns true if this released the last reference.
+		inline bool decrement();
+		inline size_t get() const;
+	};
+
+	// referenceCount comes first, so a block can be found from a pointer to its reference count. views counts the
+	// references that belong to writable views of the data (see math::Matrix::shareSubmatrix).
+	struct alignas(alignment) Block
+	{
+		ReferenceCount referenceCount;
+		Allocator* allocator;
+		size_t bytes;
+		size_t count;
+		ReferenceCount views;
+	};
+
+	inline Heap& heap();
+	inline Pool& pool();
+
+	// The calling thread's current allocator, settable through setCurrent/Scope.
+	inline Allocator*& currentSlot();
+	inline Allocator& current();
+	// Returns the previously current allocator.
+	inline Allocator& setCurrent(Allocator& allocator);
+
+	// Makes an allocator current for the calling thread until the end of the scope.
+	class Scope
+	{
+		Allocator& m_previous;
+
+	public:
+		inline explicit Scope(Allocator& allocator);
+		inline Scope(const Scope&) = delete;
+		inline Scope& operator=(const Scope&) = delete;
+		inline ~Scope();
+	};
+
+	// Default constructs size elements in a new block from the current allocator, with a reference count of 1.
+	template<typename T>
+	inline T* allocate(size_t size);
+	// Destroys the elements of a block returned by allocate and releases it to its allocator. Null is ignored.
+	template<typename T>
+	inline void deallocate(T* ptr);
+
+	// Creates a block without elements, allocated from and eventually released to owner, with a reference count of 1.
+	inline ReferenceCount* external(Allocator& owner);
+	// Destroys the elements of the block holding referenceCount (if any) and releases it to its allocator.
+	template<typename T>
+	inline void release(ReferenceCount* referenceCount);
+
+	template<typename T>
+	inline Block& block(T* ptr);
+	inline Block& block(ReferenceCount* referenceCount);
+
+	inline ReferenceCount::ReferenceCount(size_t count) :
+		m_count(count)
+	{}
+
+	inline void ReferenceCount::increment()
+	{
+#ifdef ALLOC_SINGLE_THREADED
+		m_count++;
+#else
+		m_count.fetch_add(1, std::memory_order_relaxed);
+#endif
+	}
+
+	inline bool ReferenceCount::decrement()
+	{
+#ifdef ALLOC_SINGLE_THREADED
+		return --m_count == 0;
+#else
+		return m_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#endif
+	}
+
+	inline size_t ReferenceCount::get() const
+	{
+#ifdef ALLOC_SINGLE_THREADED
+		return m_count;
+#else
+		return m_count.load(std::memory_order_relaxed);
+#endif
+	}
+
+	inline void* Heap::allocate(size_t bytes)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.misses++;
+			m_stats.live++;
+		}
+		return ::operator new(bytes, std::align_val_t(alignment));
+	}
+
+	inline void Heap::deallocate(void* ptr, size_t)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.live--;
+		}
+		::operator delete(ptr, std::align_val_t(alignment));
+	}
+
+	inline Stats Heap::stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	inline size_t Pool::sizeClass(size_t bytes, size_t& classBytes)
+	{
+		if (bytes <= 4 * alignment)
+		{
+			size_t multiple = bytes <= alignment ? 1 : (bytes + alignment - 1) / alignment;
+			classBytes = multiple * alignment;
+			return multiple - 1;
+		}
+		size_t log = 0;
+		while ((bytes - 1) >> (log + 1))
+		{
+			log++;
+		}
+		size_t shift = log - 2;
+		size_t step = (bytes - 1) >> shift;
+		classBytes = (step + 1) << shift;
+		return 4 + (shift - 6) * 4 + (step - 4);
+	}
+
+	inline Pool::Pool(size_t maxBlockBytes, size_t maxClassBytes) :
+		m_maxBlockBytes(maxBlockBytes),
+		m_maxClassBytes(maxClassBytes)
+	{}
+
+	inline Pool::~Pool()
+	{
+		trim();
+	}
+
+	inline void* Pool::allocate(size_t bytes)
+	{
+		if (bytes > m_maxBlockBytes)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stats.live++;
+				m_stats.misses++;
+			}
+			return ::operator new(bytes, std::align_val_t(alignment));
+		}
+		size_t classBytes;
+		size_t index = sizeClass(bytes, classBytes);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.live++;
+			void* ptr = m_free[index];
+			if (ptr != nullptr)
+			{
+				m_free[index] = *static_cast<void**>(ptr);
+				m_freeBytes[index] -= classBytes;
+				m_stats.hits++;
+				return ptr;
+			}
+			m_stats.misses++;
+		}
+		return ::operator new(classBytes, std::align_val_t(alignment));
+	}
+
+	inline void Pool::deallocate(void* ptr, size_t bytes)
+	{
+		if (bytes <= m_maxBlockBytes)
+		{
+			size_t classBytes;
+			size_t index = sizeClass(bytes, classBytes);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.live--;
+			if (m_freeBytes[index] + classBytes <= m_maxClassBytes)
+			{
+				*static_cast<void**>(ptr) = m_free[index];
+				m_free[index] = ptr;
+				m_freeBytes[index] += classBytes;
+				return;
+			}
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.live--;
+		}
+		::operator delete(ptr, std::align_val_t(alignment));
+	}
+
+	inline Stats Pool::stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	inline void Pool::trim()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (void*& head : m_free)
+		{
+			while (head != nullptr)
+			{
+				void* next = *static_cast<void**>(head);
+				::operator delete(head, std::align_val_t(alignment));
+				head = next;
+			}
+		}
+		m_freeBytes.fill(0);
+	}
+
+	inline Arena::Arena(size_t chunkSize) :
+		m_chunkSize(chunkSize)
+	{}
+
+	inline Arena::~Arena()
+	{
+		for (const Chunk& chunk : m_chunks)
+		{
+			::operator delete(chunk.data, std::align_val_t(alignment));
+		}
+	}
+
+	inline void* Arena::allocate(size_t bytes)
+	{
+		bytes = (bytes + alignment - 1) / alignment * alignment;
+		m_stats.live++;
+		if (m_chunk < m_chunks.size() && m_used + bytes <= m_chunks[m_chunk].size)
+		{
+			m_stats.hits++;
+			void* ptr = m_chunks[m_chunk].data + m_used;
+			m_used += bytes;
+			return ptr;
+		}
+		// Move on to the next chunk, inserting a new one if it is missing or too small.
+		if (m_chunk < m_chunks.size())
+		{
+			m_chunk++;
+		}
+		m_used = bytes;
+		if (m_chunk < m_chunks.size() && bytes <= m_chunks[m_chunk].size)
+		{
+			m_stats.hits++;
+			return m_chunks[m_chunk].data;
+		}
+		m_stats.misses++;
+		size_t size = std::max(bytes, m_chunkSize);
+		char* data = static_cast<char*>(::operator new(size, std::align_val_t(alignment)));
+		m_chunks.insert(m_chunks.begin() + m_chunk, Chunk{ data, size });
+		return data;
+	}
+
+	inline void Arena::deallocate(void*, size_t)
+	{
+		m_stats.live--;
+	}
+
+	inline Stats Arena::stats() const
+	{
+		return m_stats;
+	}
+
+	inline void Arena::reset()
+	{
+		m_chunk = 0;
+		m_used = 0;
+	}
+
+	inline Heap& heap()
+	{
+		// Leaked on purpose, so that matrices with static storage duration can still be destroyed at exit.
+		static Heap* heap = new Heap();
+		return *heap;
+	}
+
+	inline Pool& pool()
+	{
+		static Pool* pool = new Pool();
+		return *pool;
+	}
+
+	inline Allocator*& currentSlot()
+	{
+		thread_local Allocator* allocator = &pool();
+		return allocator;
+	}
+
+	inline Allocator& current()
+	{
+		return *currentSlot();
+	}
+
+	inline Allocator& setCurrent(Allocator& allocator)
+	{
+		Allocator& previous = current();
+		currentSlot() = &allocator;
+		return previous;
+	}
+
+	inline Scope::Scope(Allocator& allocator) :
+		m_previous(setCurrent(allocator))
+	{}
+
+	inline Scope::~Scope()
+	{
+		setCurrent(m_previous);
+	}
+
+	template<typename T>
+	inline T* allocate(size_t size)
+	{
+		static_assert(alignof(T) <= alignment, "over-aligned element type");
+		Allocator& allocator = current();
+		size_t bytes = sizeof(Block) + sizeof(T) * size;
+		Block* header = new (allocator.allocate(bytes)) Block{ 1, &allocator, bytes, size, 0 };
+		T* data = reinterpret_cast<T*>(header + 1);
+		std::uninitialized_default_construct_n(data, size);
+		return data;
+	}
+
+	template<typename T>
+	inline void deallocate(T* ptr)
+	{
+		if (ptr == nullptr)
+		{
+			return;
+		}
+		Block& header = block(ptr);
+		std::destroy_n(ptr, header.count);
+		header.allocator->deallocate(&header, header.bytes);
+	}
+
+	inline ReferenceCount* external(Allocator& owner)
+	{
+		Block* header = new (owner.allocate(sizeof(Block))) Block{ 1, &owner, sizeof(Block), 0, 0 };
+		return &header->referenceCount;
+	}
+
+	template<typename T>
+	inline void release(ReferenceCount* referenceCount)
+	{
+		Block& header = block(referenceCount);
+		std::destroy_n(reinterpret_cast<T*>(&header + 1), header.count);
+		header.allocator->deallocate(&header, header.bytes);
+	}
+
+	template<typename T>
+	inline Block& block(T* ptr)
+	{
+		return reinterpret_cast<Block*>(const_cast<std::remove_const_t<T>*>(ptr))[-1];
+	}
+
+	inline Block& block(ReferenceCount* referenceCount)
+	{
+		return *reinterpret_cast<Block*>(referenceCount);
+	}
+}
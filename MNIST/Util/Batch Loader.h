@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Matrix.h"
+
+namespace io
+{
+	// Bounded lock-free queue for exactly one producer thread and one consumer thread. Elements are exchanged
+	// through swap, so neither side copies or allocates.
+	template<typename T>
+	class SpscQueue
+	{
+		std::vector<T> m_slots;
+		// Total pushes and pops so far. Slot k % capacity holds element k.
+		alignas(64) std::atomic<size_t> m_pushed{ 0 };
+		alignas(64) std::atomic<size_t> m_popped{ 0 };
+
+	public:
+		inline explicit SpscQueue(size_t capacity);
+
+		// Each returns false without waiting if the queue is full/empty. On success, val holds whatever was in the
+		// slot before (a default constructed or previously popped element for tryPush).
+		inline bool tryPush(T& val);
+		inline bool tryPop(T& val);
+	};
+
+	struct Batch
+	{
+		// batchSize x columns, scaled to [0, 1] by default.
+		math::Matrix<float> inputs;
+		// batchSize x label columns.
+		math::Matrix<uint8_t> labels;
+		size_t epoch = 0;
+		// Index of the batch within its epoch.
+		size_t index = 0;
+
+		inline void swap(Batch& batch) noexcept;
+	};
+
+	// Produces shuffled mini-batches of a dataset on a background thread. Every epoch visits the rows in a new random
+	// order. A batch gathers its rows into contiguous matrices, converting the inputs to float on the way, and waits
+	// in a queue of config.depth batches until the consumer asks for it. The batches the consumer passes back through
+	// next() return to the producer, which gathers into their matrices again while the batch size stays the same, so
+	// in steady state no batch allocates.
+	class BatchLoader
+	{
+	public:
+		struct Config
+		{
+			size_t batchSize = 64;
+			// Number of prepared batches the producer may run ahead by.
+			size_t depth = 4;
+			// 0 runs until the loader is destroyed.
+			size_t epochs = 0;
+			// Skips the last batch of an epoch if it would be smaller than batchSize.
+			bool dropLast = false;
+			float scale = 1.0f / 255.0f;
+			uint64_t seed = 0;
+		};
+
+	private:
+		const math::Matrix<uint8_t> m_inputs;
+		const math::Matrix<uint8_t> m_labels;
+		Config m_config;
+		SpscQueue<Batch> m_queue;
+		std::atomic<bool> m_stop{ false };
+		std::atomic<bool> m_finished{ false };
+		std::thread m_producer;
+
+		static inline void wait(size_t& attempts);
+
+		inline void produce();
+		inline void gather(const std::vector<size_t>& order, size_t begin, size_t size, Batch& batch) const;
+
+	public:
+		// Both are shared, not copied. Throws std::invalid_argument if they differ in their number of rows.
+		inline BatchLoader(const math::Matrix<uint8_t>& inputs, const math::Matrix<uint8_t>& labels, const Config& config);
+		inline BatchLoader(const BatchLoader&) = delete;
+		inline BatchLoader& operator=(const BatchLoader&) = delete;
+		inline ~BatchLoader();
+
+		inline size_t batchesPerEpoch() const;
+
+		// Waits for the next batch and hands the previous contents of batch back for reuse, so views of its matrices
+		// must not outlive the call (copies may). Returns false once the last epoch has been consumed.
+		inline bool next(Batch& batch);
+	};
+
+	template<typename T>
+	inline SpscQueue<T>::SpscQueue(size_t capacity) :
+		m_slots(std::max<size_t>(capacity, 1))
+	{}
+
+	template<typename T>
+	inline bool SpscQueue<T>::tryPush(T& val)
+	{
+		size_t pushed = m_pushed.load(std::memory_order_relaxed);
+		if (pushed - m_popped.load(std::memory_order_acquire) == m_slots.size())
+		{
+			return false;
+		}
+		m_slots[pushed % m_slots.size()].swap(val);
+		m_pushed.store(pushed + 1, std::memory_order_release);
+		return true;
+	}
+
+	template<typename T>
+	inline bool SpscQueue<T>::tryPop(T& val)
+	{
+		size_t popped = m_popped.load(std::memory_order_relaxed);
+		if (m_pushed.load(std::memory_order_acquire) == popped)
+		{
+			return false;
+		}
+		m_slots[popped % m_slots.size()].swap(val);
+		m_popped.store(popped + 1, std::memory_order_release);
+		return true;
+	}
+
+	inline void Batch::swap(Batch& batch) noexcept
+	{
+		inputs.swap(batch.inputs);
+		labels.swap(batch.labels);
+		std::swap(epoch, batch.epoch);
+		std::swap(index, batch.index);
+	}
+
+	inline BatchLoader::BatchLoader(const math::Matrix<uint8_t>& inputs, const math::Matrix<uint8_t>& labels, const Config& config) :
+		m_inputs(inputs.shareSubmatrix((size_t)0, (size_t)0, inputs.iSize(), inputs.jSize())),
+		m_labels(labels.shareSubmatrix((size_t)0, (size_t)0, labels.iSize(), labels.jSize())),
+		m_config(config),
+		m_queue(config.depth)
+	{
+		if (inputs.iSize() != labels.iSize())
+		{
+			throw std::invalid_argument("inputs and labels must have the same number of rows");
+		}
+		m_config.batchSize = std::max<size_t>(m_config.batchSize, 1);
+		m_producer = std::thread(&BatchLoader::produce, this);
+	}
+
+	inline BatchLoader::~BatchLoader()
+	{
+		m_stop.store(true, std::memory_order_relaxed);
+		m_producer.join();
+	}
+
+	inline size_t BatchLoader::batchesPerEpoch() const
+	{
+		size_t rows = m_inputs.iSize();
+		return m_config.dropLast ? rows / m_config.batchSize : (rows + m_config.batchSize - 1) / m_config.batchSize;
+	}
+
+	inline void BatchLoader::wait(size_t& attempts)
+	{
+		// Yield while the other side is likely to catch up soon, then stop burning a core.
+		if (attempts < 64)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		attempts++;
+	}
+
+	inline void BatchLoader::produce()
+	{
+		std::mt19937_64 random(m_config.seed);
+		std::vector<size_t> order(m_inputs.iSize());
+		std::iota(order.begin(), order.end(), size_t(0));
+		size_t batches = batchesPerEpoch();
+		// Holds whichever batch the last push swapped out of the queue.
+		Batch batch;
+		for (size_t epoch = 0; m_config.epochs == 0 || epoch < m_config.epochs; epoch++)
+		{
+			std::shuffle(order.begin(), order.end(), random);
+			for (size_t b = 0; b < batches; b++)
+			{
+				size_t begin = b * m_config.batchSize;
+				gather(order, begin, std::min(m_config.batchSize, order.size() - begin), batch);
+				batch.epoch = epoch;
+				batch.index = b;
+				size_t attempts = 0;
+				while (!m_queue.tryPush(batch))
+				{
+					if (m_stop.load(std::memory_order_relaxed))
+					{
+						return;
+					}
+					wait(attempts);
+				}
+			}
+			if (batches == 0)
+			{
+				break;
+			}
+		}
+		m_finished.store(true, std::memory_order_release);
+	}
+
+	inline void BatchLoader::gather(const std::vector<size_t>& order, size_t begin, size_t size, Batch& batch) const
+	{
+		size_t inputSize = m_inputs.jSize();
+		size_t labelSize = m_labels.jSize();
+		if (batch.inputs.iSize() != size || batch.inputs.jSize() != inputSize || !batch.inputs.isContiguous())
+		{
+			batch.inputs = math::Matrix<float>(size, inputSize);
+		}
+		if (batch.labels.iSize() != size || batch.labels.jSize() != labelSize)
+		{
+			batch.labels = math::Matrix<uint8_t>(size, labelSize);
+		}
+		math::Matrix<float>& inputs = batch.inputs;
+		math::Matrix<uint8_t>& labels = batch.labels;
+		bool contiguous = m_inputs.isAffine() && (m_inputs.jStride() == 1 || inputSize <= 1);
+		float scale = m_config.scale;
+		for (size_t k = 0; k < size; k++)
+		{
+			size_t i = order[begin + k];
+			float* dst = &inputs(k, 0);
+			if (contiguous)
+			{
+				const uint8_t* src = &m_inputs(i, 0);
+				for (size_t j = 0; j < inputSize; j++)
+				{
+					dst[j] = src[j] * scale;
+				}
+			}
+			else
+			{
+				const math::Matrix<uint8_t>::RowCol src = m_inputs[i];
+				for (size_t j = 0; j < inputSize; j++)
+				{
+					dst[j] = src[j] * scale;
+				}
+			}
+			for (size_t j = 0; j < labelSize; j++)
+			{
+				labels(k, j) = m_labels(i, j);
+			}
+		}
+	}
+
+	inline bool BatchLoader::next(Batch& batch)
+	{
+		size_t attempts = 0;
+		while (!m_queue.tryPop(batch))
+		{
+			// The producer publishes m_finished after its last push, so one more attempt catches that batch.
+			if (m_finished.load(std::memory_order_acquire))
+			{
+				return m_queue.tryPop(batch);
+			}
+			wait(attempts);
+		}
+		return true;
+	}
+}
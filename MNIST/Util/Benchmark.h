@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Timing harness for microbenchmarks. Every case is warmed up, calibrated so that a timed sample repeats the
+// operation for at least Config::minSampleSeconds (which keeps tiny matrices above the clock resolution), and then
+// sampled repeatedly. Results report the median and percentiles of the time per operation, along with throughput
+// derived from the flop and byte counts the caller attributes to one operation.
+
+namespace bench
+{
+	struct Config
+	{
+		// Untimed runs before calibration, to fault in memory and fill caches and pools.
+		size_t warmup = 2;
+		size_t samples = 15;
+		double minSampleSeconds = 1e-3;
+		// Stops sampling a case after this long, as long as it has at least one sample.
+		double maxCaseSeconds = 2;
+	};
+
+	struct Result
+	{
+		std::string name;
+		std::string dtype;
+		std::string view;
+		size_t iSize = 0;
+		size_t jSize = 0;
+		// Work attributed to one operation.
+		double flops = 0;
+		double bytes = 0;
+		// Operations per sample.
+		size_t iterations = 0;
+		size_t samples = 0;
+		// Seconds per operation.
+		double min = 0;
+		double p10 = 0;
+		double median = 0;
+		double p90 = 0;
+
+		inline double gflops() const;
+		inline double gbps() const;
+	};
+
+	class Report
+	{
+		std::vector<Result> m_results;
+
+		static inline void writeString(std::ostream& stream, const std::string& str);
+
+	public:
+		inline void add(const Result& result);
+		inline const std::vector<Result>& results() const;
+
+		// Writes {"threads": threads, "results": [...]} with one object per result and times in nanoseconds.
+		inline void writeJson(std::ostream& stream, size_t threads) const;
+	};
+
+	template<typename T>
+	inline const char* typeName();
+
+	// Keeps the compiler from discarding a result that is otherwise unused.
+	template<typename T>
+	inline void keep(const T& val);
+
+	// Linear interpolation between the closest ranks of sorted, for q in [0, 1].
+	inline double percentile(const std::vector<double>& sorted, double q);
+
+	// Times op() and fills in the timing fields of result.
+	template<typename F>
+	inline void measure(const Config& config, const F& op, Result& result);
+
+	inline double Result::gflops() const
+	{
+		return median > 0 ? flops / median * 1e-9 : 0;
+	}
+
+	inline double Result::gbps() const
+	{
+		return median > 0 ? bytes / median * 1e-9 : 0;
+	}
+
+	inline void Report::add(const Result& result)
+	{
+		m_results.push_back(result);
+	}
+
+	inline const std::vector<Result>& Report::results() const
+	{
+		return m_results;
+	}
+
+	inline void Report::writeString(std::ostream& stream, const std::string& str)
+	{
+		stream << '"';
+		for (char c : str)
+		{
+			if (c == '"' || c == '\\')
+			{
+				stream << '\\';
+			}
+			stream << c;
+		}
+		stream << '"';
+	}
+
+	inline void Report::writeJson(std::ostream& stream, size_t threads) const
+	{
+		stream << "{\n\t\"threads\": " << threads << ",\n\t\"results\": [";
+		for (size_t r = 0; r < m_results.size(); r++)
+		{
+			const Result& result = m_results[r];
+			stream << (r > 0 ? ",\n\t\t{" : "\n\t\t{");
+			stream << "\"name\": ";
+			writeString(stream, result.name);
+			stream << ", \"dtype\": ";
+			writeString(stream, result.dtype);
+			stream << ", \"view\": ";
+			writeString(stream, result.view);
+			stream << ", \"iSize\": " << result.iSize << ", \"jSize\": " << result.jSize
+				<< ", \"iterations\": " << result.iterations << ", \"samples\": " << result.samples
+				<< ", \"min_ns\": " << result.min * 1e9 << ", \"p10_ns\": " << result.p10 * 1e9
+				<< ", \"median_ns\": " << result.median * 1e9 << ", \"p90_ns\": " << result.p90 * 1e9
+				<< ", \"gflops\": " << result.gflops() << ", \"gbps\": " << result.gbps() << '}';
+		}
+		stream << "\n\t]\n}\n";
+	}
+
+	template<typename T>
+	inline const char* typeName()
+	{
+		if constexpr (std::is_same_v<T, float>)
+		{
+			return "float";
+		}
+		else if constexpr (std::is_same_v<T, double>)
+		{
+			return "double";
+		}
+		else if constexpr (std::is_same_v<T, bool>)
+		{
+			return "bool";
+		}
+		else if constexpr (std::is_integral_v<T>)
+		{
+			return std::is_signed_v<T> ?
+				(sizeof(T) == 1 ? "int8" : sizeof(T) == 2 ? "int16" : sizeof(T) == 4 ? "int32" : "int64") :
+				(sizeof(T) == 1 ? "uint8" : sizeof(T) == 2 ? "uint16" : sizeof(T) == 4 ? "uint32" : "uint64");
+		}
+		else
+		{
+			return "other";
+		}
+	}
+
+	template<typename T>
+	inline void keep(const T& val)
+	{
+		[[maybe_unused]] static const void* volatile sink;
+		sink = &val;
+	}
+
+	inline double percentile(const std::vector<double>& sorted, double q)
+	{
+		if (sorted.empty())
+		{
+			return 0;
+		}
+		double rank = q * (sorted.size() - 1);
+		size_t lower = size_t(rank);
+		size_t upper = std::min(lower + 1, sorted.size() - 1);
+		return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - lower);
+	}
+
+	template<typename F>
+	inline void measure(const Config& config, const F& op, Result& result)
+	{
+		using clock = std::chrono::steady_clock;
+		double last = 0;
+		for (size_t w = 0; w < std::max<size_t>(config.warmup, 1); w++)
+		{
+			clock::time_point start = clock::now();
+			op();
+			last = std::chrono::duration<double>(clock::now() - start).count();
+		}
+		size_t iterations = last > 0 ? size_t(std::ceil(config.minSampleSeconds / last)) : 1000;
+		iterations = std::max<size_t>(iterations, 1);
+		std::vector<double> times;
+		clock::time_point caseStart = clock::now();
+		while (times.size() < std::max<size_t>(config.samples, 1))
+		{
+			clock::time_point start = clock::now();
+			for (size_t k = 0; k < iterations; k++)
+			{
+				op();
+			}
+			clock::time_point end = clock::now();
+			times.push_back(std::chrono::duration<double>(end - start).count() / iterations);
+			if (std::chrono::duration<double>(end - caseStart).count() > config.maxCaseSeconds)
+			{
+				break;
+			}
+		}
+		std::sort(times.begin(), times.end());
+		result.iterations = iterations;
+		result.samples = times.size();
+		result.min = times.front();
+		result.p10 = percentile(times, 0.1);
+		result.median = percentile(times, 0.5);
+		result.p90 = percentile(times, 0.9);
+	}
+}
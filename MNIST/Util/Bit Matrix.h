@@ -0,0 +1,538 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <utility>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include "Allocator.h"
+#include "Matrix.h"
+#include "Thread Pool.h"
+
+namespace math
+{
+	// Boolean matrix storing 64 elements per word, row by row. Each row starts on a new word, and the bits past
+	// jSize() in the last word of a row are always zero, so whole words can be combined and counted directly.
+	// Element-wise logic works on 64 elements per instruction, and the boolean product ANDs a packed row of the
+	// left operand with a packed column (a row of the transposed right operand) at a time.
+	class BitMatrix
+	{
+	public:
+		using Word = uint64_t;
+
+		static constexpr size_t wordBits = 64;
+
+	private:
+		size_t m_iSize;
+		size_t m_jSize;
+		// Words per row.
+		size_t m_words;
+
+		Word* m_data;
+
+		static inline size_t wordsFor(size_t bits);
+		// Transposes a 64 x 64 block given as 64 row words in place.
+		static inline void transposeBlock(Word* block);
+
+		// Bits of the last word of a row that hold elements.
+		inline Word lastMask() const;
+		inline void clearPadding();
+
+	public:
+		static inline size_t popcount(Word word);
+
+		inline BitMatrix();
+		inline BitMatrix(size_t iSize, size_t jSize);
+		inline BitMatrix(size_t iSize, size_t jSize, bool fill);
+		inline explicit BitMatrix(const Matrix<bool>& mat);
+		// Packs the result of an element-wise expression (comparisons, typically) without materializing it as a
+		// Matrix<bool> first. Nonzero results become true.
+		template<typename Op, typename... Ts>
+		inline explicit BitMatrix(const ElementWiseExpr<Op, Ts...>& expr);
+		inline ~BitMatrix();
+
+		inline BitMatrix(const BitMatrix& mat);
+		inline BitMatrix(BitMatrix&& mat) noexcept;
+		inline BitMatrix& operator=(const BitMatrix& mat);
+		inline BitMatrix& operator=(BitMatrix&& mat) noexcept;
+
+		inline void swap(BitMatrix& mat) noexcept;
+
+		inline size_t iSize() const;
+		inline size_t jSize() const;
+		inline size_t words() const;
+		inline Word* data();
+		inline const Word* data() const;
+		// The words of row i. Element (i, j) is bit j % wordBits of row(i)[j / wordBits].
+		inline Word* row(size_t i);
+		inline const Word* row(size_t i) const;
+
+		inline bool get(size_t i, size_t j) const;
+		inline bool operator()(size_t i, size_t j) const;
+		inline void set(size_t i, size_t j, bool val);
+
+		// Number of true elements.
+		inline size_t count() const;
+
+		inline Matrix<bool> toMatrix() const;
+		inline BitMatrix copyTranspose() const;
+
+		// Negates every element in place.
+		inline BitMatrix& flip();
+		inline BitMatrix& operator&=(const BitMatrix& mat);
+		inline BitMatrix& operator|=(const BitMatrix& mat);
+		inline BitMatrix& operator^=(const BitMatrix& mat);
+	};
+
+	inline BitMatrix operator&(const BitMatrix& lhs, const BitMatrix& rhs);
+	inline BitMatrix operator|(const BitMatrix& lhs, const BitMatrix& rhs);
+	inline BitMatrix operator^(const BitMatrix& lhs, const BitMatrix& rhs);
+	inline BitMatrix operator~(const BitMatrix& mat);
+	inline bool operator==(const BitMatrix& lhs, const BitMatrix& rhs);
+	inline bool operator!=(const BitMatrix& lhs, const BitMatrix& rhs);
+
+	// Boolean product, as for Matrix<bool>: element (i, j) is true if lhs(i, k) && rhs(k, j) for any k.
+	inline BitMatrix operator&&(const BitMatrix& lhs, const BitMatrix& rhs);
+	// Element (i, j) is the number of k with lhs(i, k) && rhs(k, j), e.g. the number of paths of length 2 from i to
+	// j if both operands are the adjacency matrix of a graph.
+	inline Matrix<size_t> countProduct(const BitMatrix& lhs, const BitMatrix& rhs);
+
+	inline std::ostream& operator<<(std::ostream& stream, const BitMatrix& mat);
+
+	inline size_t BitMatrix::wordsFor(size_t bits)
+	{
+		return (bits + wordBits - 1) / wordBits;
+	}
+
+	inline void BitMatrix::transposeBlock(Word* block)
+	{
+		// Swaps the off-diagonal halves of ever smaller sub-blocks: 32 x 32, then 16 x 16 and so on down to 1 x 1.
+		Word mask = 0x00000000FFFFFFFF;
+		for (size_t width = 32; width > 0; width >>= 1, mask ^= mask << width)
+		{
+			for (size_t k = 0; k < wordBits; k = ((k | width) + 1) & ~width)
+			{
+				Word swapped = ((block[k] >> width) ^ block[k | width]) & mask;
+				block[k] ^= swapped << width;
+				block[k | width] ^= swapped;
+			}
+		}
+	}
+
+	inline size_t BitMatrix::popcount(Word word)
+	{
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64) && defined(__AVX__)
+		return size_t(__popcnt64(word));
+#elif defined(__GNUC__) || defined(__clang__)
+		return size_t(__builtin_popcountll(word));
+#else
+		word = word - ((word >> 1) & 0x5555555555555555);
+		word = (word & 0x3333333333333333) + ((word >> 2) & 0x3333333333333333);
+		word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0F;
+		return size_t((word * 0x0101010101010101) >> 56);
+#endif
+	}
+
+	inline BitMatrix::Word BitMatrix::lastMask() const
+	{
+		size_t bits = m_jSize % wordBits;
+		return bits == 0 ? ~Word(0) : (Word(1) << bits) - 1;
+	}
+
+	inline void BitMatrix::clearPadding()
+	{
+		if (m_words == 0)
+		{
+			return;
+		}
+		Word mask = lastMask();
+		for (size_t i = 0; i < m_iSize; i++)
+		{
+			row(i)[m_words - 1] &= mask;
+		}
+	}
+
+	inline BitMatrix::BitMatrix() :
+		m_iSize(0),
+		m_jSize(0),
+		m_words(0),
+		m_data(nullptr)
+	{}
+
+	inline BitMatrix::BitMatrix(size_t iSize, size_t jSize) :
+		BitMatrix(iSize, jSize, false)
+	{}
+
+	inline BitMatrix::BitMatrix(size_t iSize, size_t jSize, bool fill) :
+		m_iSize(iSize),
+		m_jSize(jSize),
+		m_words(wordsFor(jSize)),
+		m_data(alloc::allocate<Word>(iSize * wordsFor(jSize)))
+	{
+		std::fill(m_data, m_data + m_iSize * m_words, fill ? ~Word(0) : Word(0));
+		clearPadding();
+	}
+
+	inline BitMatrix::BitMatrix(const Matrix<bool>& mat) :
+		BitMatrix(mat.iSize(), mat.jSize())
+	{
+		for (size_t i = 0; i < m_iSize; i++)
+		{
+			const Matrix<bool>::RowCol src = mat[i];
+			Word* dst = row(i);
+			for (size_t w = 0; w < m_words; w++)
+			{
+				size_t begin = w * wordBits;
+				size_t n = std::min(wordBits, m_jSize - begin);
+				Word word = 0;
+				for (size_t b = 0; b < n; b++)
+				{
+					word |= Word(src[begin + b]) << b;
+				}
+				dst[w] = word;
+			}
+		}
+	}
+
+	template<typename Op, typename... Ts>
+	inline BitMatrix::BitMatrix(const ElementWiseExpr<Op, Ts...>& expr) :
+		BitMatrix(expr.iSize(), expr.jSize())
+	{
+		using value_type = typename ElementWiseExpr<Op, Ts...>::value_type;
+		constexpr size_t chunkSize = ElementWiseHelper::chunkSize;
+		static_assert(chunkSize % wordBits == 0, "chunks must cover whole words");
+		// Rows own their words, so they can be packed in parallel.
+		parallel::forRange(m_iSize, m_iSize * m_jSize, [&](size_t begin, size_t end)
+		{
+			std::array<value_type, chunkSize> buffer;
+			for (size_t i = begin; i < end; i++)
+			{
+				Word* dst = row(i);
+				for (size_t j = 0; j < m_jSize; j += chunkSize)
+				{
+					size_t n = std::min(chunkSize, m_jSize - j);
+					expr.evaluate(i, j, n, false, buffer.data());
+					for (size_t k = 0; k < n; k += wordBits)
+					{
+						size_t bits = std::min(wordBits, n - k);
+						Word word = 0;
+						for (size_t b = 0; b < bits; b++)
+						{
+							word |= Word(buffer[k + b] != value_type(0)) << b;
+						}
+						dst[(j + k) / wordBits] = word;
+					}
+				}
+			}
+		});
+	}
+
+	inline BitMatrix::~BitMatrix()
+	{
+		alloc::deallocate(m_data);
+	}
+
+	inline BitMatrix::BitMatrix(const BitMatrix& mat) :
+		m_iSize(mat.m_iSize),
+		m_jSize(mat.m_jSize),
+		m_words(mat.m_words),
+		m_data(alloc::allocate<Word>(mat.m_iSize * mat.m_words))
+	{
+		if (m_iSize * m_words > 0)
+		{
+			memcpy(m_data, mat.m_data, sizeof(Word) * m_iSize * m_words);
+		}
+	}
+
+	inline BitMatrix::BitMatrix(BitMatrix&& mat) noexcept :
+		BitMatrix()
+	{
+		swap(mat);
+	}
+
+	inline BitMatrix& BitMatrix::operator=(const BitMatrix& mat)
+	{
+		if (&mat != this)
+		{
+			BitMatrix copy(mat);
+			swap(copy);
+		}
+		return *this;
+	}
+
+	inline BitMatrix& BitMatrix::operator=(BitMatrix&& mat) noexcept
+	{
+		BitMatrix moved(std::move(mat));
+		swap(moved);
+		return *this;
+	}
+
+	inline void BitMatrix::swap(BitMatrix& mat) noexcept
+	{
+		std::swap(m_iSize, mat.m_iSize);
+		std::swap(m_jSize, mat.m_jSize);
+		std::swap(m_words, mat.m_words);
+		std::swap(m_data, mat.m_data);
+	}
+
+	inline size_t BitMatrix::iSize() const
+	{
+		return m_iSize;
+	}
+
+	inline size_t BitMatrix::jSize() const
+	{
+		return m_jSize;
+	}
+
+	inline size_t BitMatrix::words() const
+	{
+		return m_words;
+	}
+
+	inline BitMatrix::Word* BitMatrix::data()
+	{
+		return m_data;
+	}
+
+	inline const BitMatrix::Word* BitMatrix::data() const
+	{
+		return m_data;
+	}
+
+	inline BitMatrix::Word* BitMatrix::row(size_t i)
+	{
+		return m_data + i * m_words;
+	}
+
+	inline const BitMatrix::Word* BitMatrix::row(size_t i) const
+	{
+		return m_data + i * m_words;
+	}
+
+	inline bool BitMatrix::get(size_t i, size_t j) const
+	{
+		return (row(i)[j / wordBits] >> (j % wordBits)) & 1;
+	}
+
+	inline bool BitMatrix::operator()(size_t i, size_t j) const
+	{
+		return get(i, j);
+	}
+
+	inline void BitMatrix::set(size_t i, size_t j, bool val)
+	{
+		Word& word = row(i)[j / wordBits];
+		Word bit = Word(1) << (j % wordBits);
+		word = val ? word | bit : word & ~bit;
+	}
+
+	inline size_t BitMatrix::count() const
+	{
+		size_t count = 0;
+		for (size_t w = 0; w < m_iSize * m_words; w++)
+		{
+			count += popcount(m_data[w]);
+		}
+		return count;
+	}
+
+	inline Matrix<bool> BitMatrix::toMatrix() const
+	{
+		Matrix<bool> res(m_iSize, m_jSize);
+		for (size_t i = 0; i < m_iSize; i++)
+		{
+			const Word* src = row(i);
+			bool* dst = &res(i, 0);
+			for (size_t j = 0; j < m_jSize; j++)
+			{
+				dst[j] = (src[j / wordBits] >> (j % wordBits)) & 1;
+			}
+		}
+		return res;
+	}
+
+	inline BitMatrix BitMatrix::copyTranspose() const
+	{
+		BitMatrix res(m_jSize, m_iSize);
+		// Each 64 x 64 block is gathered, transposed in registers and scattered to the mirrored position.
+		std::array<Word, wordBits> block;
+		for (size_t bi = 0; bi < res.m_words; bi++)
+		{
+			size_t rows = std::min(wordBits, m_iSize - bi * wordBits);
+			for (size_t w = 0; w < m_words; w++)
+			{
+				for (size_t k = 0; k < rows; k++)
+				{
+					block[k] = row(bi * wordBits + k)[w];
+				}
+				std::fill(block.begin() + rows, block.end(), Word(0));
+				transposeBlock(block.data());
+				size_t cols = std::min(wordBits, m_jSize - w * wordBits);
+				for (size_t k = 0; k < cols; k++)
+				{
+					res.row(w * wordBits + k)[bi] = block[k];
+				}
+			}
+		}
+		return res;
+	}
+
+	inline BitMatrix& BitMatrix::flip()
+	{
+		for (size_t w = 0; w < m_iSize * m_words; w++)
+		{
+			m_data[w] = ~m_data[w];
+		}
+		clearPadding();
+		return *this;
+	}
+
+	inline BitMatrix& BitMatrix::operator&=(const BitMatrix& mat)
+	{
+		for (size_t w = 0; w < m_iSize * m_words; w++)
+		{
+			m_data[w] &= mat.m_data[w];
+		}
+		return *this;
+	}
+
+	inline BitMatrix& BitMatrix::operator|=(const BitMatrix& mat)
+	{
+		for (size_t w = 0; w < m_iSize * m_words; w++)
+		{
+			m_data[w] |= mat.m_data[w];
+		}
+		return *this;
+	}
+
+	inline BitMatrix& BitMatrix::operator^=(const BitMatrix& mat)
+	{
+		for (size_t w = 0; w < m_iSize * m_words; w++)
+		{
+			m_data[w] ^= mat.m_data[w];
+		}
+		return *this;
+	}
+
+	inline BitMatrix operator&(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		BitMatrix res(lhs);
+		return res &= rhs;
+	}
+
+	inline BitMatrix operator|(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		BitMatrix res(lhs);
+		return res |= rhs;
+	}
+
+	inline BitMatrix operator^(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		BitMatrix res(lhs);
+		return res ^= rhs;
+	}
+
+	inline BitMatrix operator~(const BitMatrix& mat)
+	{
+		BitMatrix res(mat);
+		return res.flip();
+	}
+
+	inline bool operator==(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		return lhs.iSize() == rhs.iSize() && lhs.jSize() == rhs.jSize() &&
+			std::equal(lhs.data(), lhs.data() + lhs.iSize() * lhs.words(), rhs.data());
+	}
+
+	inline bool operator!=(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		return !(lhs == rhs);
+	}
+
+	inline BitMatrix operator&&(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		BitMatrix cols = rhs.copyTranspose();
+		BitMatrix res(lhs.iSize(), rhs.jSize());
+		size_t words = lhs.words();
+		parallel::forRange(lhs.iSize(), lhs.iSize() * rhs.jSize() * words, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const BitMatrix::Word* lhsRow = lhs.row(i);
+				BitMatrix::Word* resRow = res.row(i);
+				for (size_t j = 0; j < cols.iSize(); j++)
+				{
+					const BitMatrix::Word* rhsCol = cols.row(j);
+					// Stops at the first common bit.
+					size_t w = 0;
+					while (w < words && (lhsRow[w] & rhsCol[w]) == 0)
+					{
+						w++;
+					}
+					resRow[j / BitMatrix::wordBits] |= BitMatrix::Word(w < words) << (j % BitMatrix::wordBits);
+				}
+			}
+		});
+		return res;
+	}
+
+	inline Matrix<size_t> countProduct(const BitMatrix& lhs, const BitMatrix& rhs)
+	{
+		BitMatrix cols = rhs.copyTranspose();
+		Matrix<size_t> res(lhs.iSize(), rhs.jSize());
+		size_t words = lhs.words();
+		parallel::forRange(lhs.iSize(), lhs.iSize() * rhs.jSize() * words, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const BitMatrix::Word* lhsRow = lhs.row(i);
+				Matrix<size_t>::RowCol resRow = res[i];
+				for (size_t j = 0; j < cols.iSize(); j++)
+				{
+					const BitMatrix::Word* rhsCol = cols.row(j);
+					size_t count = 0;
+					for (size_t w = 0; w < words; w++)
+					{
+						count += BitMatrix::popcount(lhsRow[w] & rhsCol[w]);
+					}
+					resRow[j] = count;
+				}
+			}
+		});
+		return res;
+	}
+
+	template<>
+	inline Matrix<bool> operator&&(const Matrix<bool>& lhs, const Matrix<bool>& rhs)
+	{
+		return (BitMatrix(lhs) && BitMatrix(rhs)).toMatrix();
+	}
+
+	inline std::ostream& operator<<(std::ostream& stream, const BitMatrix& mat)
+	{
+		std::streamsize width = stream.width();
+		for (size_t i = 0; i < mat.iSize(); i++)
+		{
+			if (i > 0)
+			{
+				stream << std::endl;
+			}
+			for (size_t j = 0; j < mat.jSize(); j++)
+			{
+				if (j > 0)
+				{
+					stream << ' ';
+				}
+				stream << std::setw(width) << mat(i, j);
+			}
+		}
+		return stream;
+	}
+}
@@ -0,0 +1,480 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Mapped File.h"
+#include "Matrix.h"
+
+// Binary container for named matrices, e.g. model weights. Layout, in native byte order:
+//   Header (64 bytes)
+//   the raw elements of every matrix, each starting at a multiple of 64 bytes
+//   the directory: one Record (64 bytes) per matrix, each followed by its name padded to a multiple of 8 bytes
+// The directory comes last so matrices can be streamed out without knowing their number in advance. Elements are
+// stored densely in row-major order (iStride == jSize, jStride == 1) or column-major order (iStride == 1,
+// jStride == iSize), whichever the saved matrix already had. Loading maps the file and hands out views into the
+// mapping, so it costs page faults rather than parsing. Saving writes a temporary file next to the target and renames
+// it over the target once complete, so matrices still mapped from an earlier version of the file stay valid.
+
+namespace io
+{
+	enum class DType : uint8_t
+	{
+		Bool = 1,
+		Int8,
+		UInt8,
+		Int16,
+		UInt16,
+		Int32,
+		UInt32,
+		Int64,
+		UInt64,
+		Float32,
+		Float64
+	};
+
+	template<typename T>
+	inline constexpr DType dtypeOf();
+
+	// Streaming 64 bit checksum over 8 byte words (the tail is zero padded).
+	class Checksum
+	{
+		uint64_t m_hash = 0x9E3779B97F4A7C15;
+		uint64_t m_pending = 0;
+		size_t m_pendingBytes = 0;
+
+		inline void mix(uint64_t word);
+
+	public:
+		inline void update(const void* data, size_t bytes);
+		inline uint64_t value() const;
+	};
+
+	class Checkpoint
+	{
+	public:
+		static constexpr char magic[8] = { 'M', 'A', 'T', 'R', 'I', 'X', 'C', 'P' };
+		static constexpr uint32_t version = 1;
+		// Written natively, so a file from a machine of the other byte order reads back differently.
+		static constexpr uint32_t byteOrder = 0x01020304;
+		static constexpr size_t alignment = 64;
+
+		struct Header
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t byteOrder;
+			uint64_t count;
+			uint64_t directoryOffset;
+			uint64_t directorySize;
+			uint8_t reserved[24];
+		};
+
+		struct Record
+		{
+			uint64_t iSize;
+			uint64_t jSize;
+			uint64_t iStride;
+			uint64_t jStride;
+			// Of the first element, from the start of the file.
+			uint64_t offset;
+			uint64_t checksum;
+			uint32_t nameSize;
+			DType dtype;
+			uint8_t elementSize;
+			uint8_t reserved[10];
+		};
+
+		static_assert(sizeof(Header) == 64 && sizeof(Record) == 64, "checkpoint headers must be packed");
+
+		struct Entry
+		{
+			std::string name;
+			Record record;
+
+			inline size_t bytes() const;
+		};
+
+	private:
+		MappedFile m_file;
+		std::vector<Entry> m_entries;
+
+		inline const Entry& entry(const std::string& name) const;
+
+	public:
+		// Maps the file and reads its directory. Throws std::runtime_error if the file is missing or malformed.
+		inline explicit Checkpoint(const std::string& path);
+
+		inline const std::vector<Entry>& entries() const;
+		inline bool contains(const std::string& name) const;
+
+		// A view of the named matrix backed by the mapping, which stays alive as long as the view does. Writes to
+		// the view are private to this process and never reach the file. Throws std::runtime_error if there is no
+		// such matrix or it holds another element type.
+		template<typename T>
+		inline math::Matrix<T> get(const std::string& name) const;
+
+		// Recomputes the checksum of every matrix and throws std::runtime_error on the first mismatch. This reads
+		// the whole file, so it is left to the caller.
+		inline void verify() const;
+	};
+
+	// Writes a checkpoint file. Matrices are written as they are added and the directory on close().
+	class CheckpointWriter
+	{
+		std::ofstream m_stream;
+		std::string m_path;
+		// The file being written, renamed to m_path by close().
+		std::string m_tempPath;
+		std::vector<Checkpoint::Entry> m_entries;
+		uint64_t m_position = 0;
+
+		inline void write(const void* data, size_t bytes);
+		inline void pad();
+
+	public:
+		// Throws std::runtime_error if the file cannot be created.
+		inline explicit CheckpointWriter(const std::string& path);
+		inline CheckpointWriter(const CheckpointWriter&) = delete;
+		inline CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+		// Closes the file if close() was not called. Errors are lost then.
+		inline ~CheckpointWriter();
+
+		// Copies the elements of mat to the file. Names must be unique. Throws std::runtime_error on write errors.
+		template<typename T>
+		inline void add(const std::string& name, const math::Matrix<T>& mat);
+		// Writes the directory and header and replaces the file at path. Throws std::runtime_error on write errors or
+		// if the file cannot be replaced, e.g. on Windows while matrices loaded from it are still alive.
+		inline void close();
+	};
+
+	template<typename T>
+	inline constexpr DType dtypeOf()
+	{
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			return DType::Bool;
+		}
+		else if constexpr (std::is_same_v<T, float>)
+		{
+			static_assert(sizeof(float) == 4, "float must be IEEE single precision");
+			return DType::Float32;
+		}
+		else if constexpr (std::is_same_v<T, double>)
+		{
+			return DType::Float64;
+		}
+		else
+		{
+			static_assert(std::is_integral_v<T> && sizeof(T) <= 8, "unsupported checkpoint element type");
+			constexpr DType types[] = { DType::Int8, DType::UInt8, DType::Int16, DType::UInt16, DType::Int32, DType::UInt32, DType::Int64, DType::UInt64 };
+			constexpr size_t log = sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3;
+			return types[2 * log + (std::is_signed_v<T> ? 0 : 1)];
+		}
+	}
+
+	inline void Checksum::mix(uint64_t word)
+	{
+		m_hash = (m_hash ^ word) * 0xFF51AFD7ED558CCD;
+		m_hash ^= m_hash >> 32;
+	}
+
+	inline void Checksum::update(const void* data, size_t bytes)
+	{
+		const uint8_t* src = static_cast<const uint8_t*>(data);
+		while (bytes > 0 && m_pendingBytes > 0)
+		{
+			m_pending |= uint64_t(*src) << (8 * m_pendingBytes);
+			src++;
+			bytes--;
+			if (++m_pendingBytes == 8)
+			{
+				mix(m_pending);
+				m_pending = 0;
+				m_pendingBytes = 0;
+			}
+		}
+		for (; bytes >= 8; src += 8, bytes -= 8)
+		{
+			uint64_t word;
+			memcpy(&word, src, 8);
+			mix(word);
+		}
+		for (; bytes > 0; src++, bytes--)
+		{
+			m_pending |= uint64_t(*src) << (8 * m_pendingBytes);
+			m_pendingBytes++;
+		}
+	}
+
+	inline uint64_t Checksum::value() const
+	{
+		if (m_pendingBytes == 0)
+		{
+			return m_hash;
+		}
+		Checksum copy = *this;
+		copy.mix(m_pending);
+		return copy.m_hash;
+	}
+
+	inline size_t Checkpoint::Entry::bytes() const
+	{
+		return size_t(record.iSize * record.jSize * record.elementSize);
+	}
+
+	inline Checkpoint::Checkpoint(const std::string& path) :
+		m_file(path)
+	{
+		const uint8_t* data = m_file.data();
+		size_t size = m_file.size();
+		if (size < sizeof(Header))
+		{
+			throw std::runtime_error(path + ": not a checkpoint");
+		}
+		Header header;
+		memcpy(&header, data, sizeof(Header));
+		if (memcmp(header.magic, magic, sizeof(magic)) != 0)
+		{
+			throw std::runtime_error(path + ": not a checkpoint");
+		}
+		if (header.version != version || header.byteOrder != byteOrder)
+		{
+			throw std::runtime_error(path + ": unsupported checkpoint version or byte order");
+		}
+		if (header.directoryOffset > size || header.directorySize > size - header.directoryOffset)
+		{
+			throw std::runtime_error(path + ": truncated directory");
+		}
+		const uint8_t* directory = data + header.directoryOffset;
+		size_t position = 0;
+		m_entries.reserve(size_t(std::min<uint64_t>(header.count, header.directorySize / sizeof(Record))));
+		for (uint64_t e = 0; e < header.count; e++)
+		{
+			Entry entry;
+			if (header.directorySize - position < sizeof(Record))
+			{
+				throw std::runtime_error(path + ": truncated directory");
+			}
+			memcpy(&entry.record, directory + position, sizeof(Record));
+			position += sizeof(Record);
+			const Record& record = entry.record;
+			size_t nameSize = (size_t(record.nameSize) + 7) / 8 * 8;
+			if (header.directorySize - position < nameSize)
+			{
+				throw std::runtime_error(path + ": truncated directory");
+			}
+			entry.name.assign(reinterpret_cast<const char*>(directory + position), record.nameSize);
+			position += nameSize;
+			bool rowMajor = record.iStride == record.jSize && record.jStride == 1;
+			bool colMajor = record.iStride == 1 && record.jStride == record.iSize;
+			uint64_t elements = record.iSize * record.jSize;
+			if ((!rowMajor && !colMajor) || record.elementSize == 0 || record.offset % alignment != 0 || record.offset > size ||
+				(record.jSize != 0 && record.iSize > (size - record.offset) / record.elementSize / record.jSize) ||
+				(elements != 0 && record.elementSize > (size - record.offset) / elements))
+			{
+				throw std::runtime_error(path + ": bad record for " + entry.name);
+			}
+			m_entries.push_back(std::move(entry));
+		}
+	}
+
+	inline const Checkpoint::Entry& Checkpoint::entry(const std::string& name) const
+	{
+		for (const Entry& entry : m_entries)
+		{
+			if (entry.name == name)
+			{
+				return entry;
+			}
+		}
+		throw std::runtime_error("checkpoint has no matrix named " + name);
+	}
+
+	inline const std::vector<Checkpoint::Entry>& Checkpoint::entries() const
+	{
+		return m_entries;
+	}
+
+	inline bool Checkpoint::contains(const std::string& name) const
+	{
+		return std::any_of(m_entries.begin(), m_entries.end(), [&](const Entry& entry) { return entry.name == name; });
+	}
+
+	template<typename T>
+	inline math::Matrix<T> Checkpoint::get(const std::string& name) const
+	{
+		const Record& record = entry(name).record;
+		if (record.dtype != dtypeOf<T>() || record.elementSize != sizeof(T))
+		{
+			throw std::runtime_error("checkpoint matrix " + name + " has a different element type");
+		}
+		size_t iSize = size_t(record.iSize);
+		size_t jSize = size_t(record.jSize);
+		if (record.iStride == jSize && record.jStride == 1)
+		{
+			return m_file.view<T>(size_t(record.offset), iSize, jSize);
+		}
+		// Column-major, as checked by the constructor.
+		return m_file.view<T>(size_t(record.offset), jSize, iSize).shareTranspose();
+	}
+
+	inline void Checkpoint::verify() const
+	{
+		for (const Entry& entry : m_entries)
+		{
+			Checksum checksum;
+			checksum.update(m_file.data() + entry.record.offset, entry.bytes());
+			if (checksum.value() != entry.record.checksum)
+			{
+				throw std::runtime_error("checksum mismatch for checkpoint matrix " + entry.name);
+			}
+		}
+	}
+
+	inline CheckpointWriter::CheckpointWriter(const std::string& path) :
+		m_path(path),
+		m_tempPath(path + ".tmp")
+	{
+		// A file that is mapped must not be truncated: reading its pages would fault.
+		m_stream.open(m_tempPath, std::ios::binary | std::ios::trunc);
+		if (!m_stream)
+		{
+			throw std::runtime_error("cannot create " + m_tempPath);
+		}
+		// Placeholder until close() knows the directory.
+		Checkpoint::Header header{};
+		write(&header, sizeof(header));
+	}
+
+	inline CheckpointWriter::~CheckpointWriter()
+	{
+		if (m_stream.is_open())
+		{
+			try
+			{
+				close();
+			}
+			catch (const std::exception&)
+			{}
+		}
+	}
+
+	inline void CheckpointWriter::write(const void* data, size_t bytes)
+	{
+		m_stream.write(static_cast<const char*>(data), std::streamsize(bytes));
+		if (!m_stream)
+		{
+			throw std::runtime_error("cannot write " + m_tempPath);
+		}
+		m_position += bytes;
+	}
+
+	inline void CheckpointWriter::pad()
+	{
+		static const char zeros[Checkpoint::alignment] = {};
+		size_t padding = size_t((Checkpoint::alignment - m_position % Checkpoint::alignment) % Checkpoint::alignment);
+		write(zeros, padding);
+	}
+
+	template<typename T>
+	inline void CheckpointWriter::add(const std::string& name, const math::Matrix<T>& mat)
+	{
+		if (std::any_of(m_entries.begin(), m_entries.end(), [&](const Checkpoint::Entry& entry) { return entry.name == name; }))
+		{
+			throw std::runtime_error("duplicate checkpoint matrix " + name);
+		}
+		pad();
+		Checkpoint::Entry entry;
+		entry.name = name;
+		Checkpoint::Record& record = entry.record;
+		record = Checkpoint::Record{};
+		record.iSize = mat.iSize();
+		record.jSize = mat.jSize();
+		record.offset = m_position;
+		record.nameSize = uint32_t(name.size());
+		record.dtype = dtypeOf<T>();
+		record.elementSize = uint8_t(sizeof(T));
+		Checksum checksum;
+		size_t iSize = mat.iSize();
+		size_t jSize = mat.jSize();
+		bool affine = iSize > 0 && jSize > 0 && mat.isAffine();
+		if (affine && mat.jStride() == 1 && (mat.iStride() == jSize || iSize == 1))
+		{
+			// Dense row-major: one write.
+			record.iStride = jSize;
+			record.jStride = 1;
+			checksum.update(&mat(0, 0), sizeof(T) * iSize * jSize);
+			write(&mat(0, 0), sizeof(T) * iSize * jSize);
+		}
+		else if (affine && mat.iStride() == 1 && mat.jStride() == iSize)
+		{
+			// Dense column-major, typically a transposed view: kept as is.
+			record.iStride = 1;
+			record.jStride = iSize;
+			checksum.update(&mat(0, 0), sizeof(T) * iSize * jSize);
+			write(&mat(0, 0), sizeof(T) * iSize * jSize);
+		}
+		else
+		{
+			record.iStride = jSize;
+			record.jStride = 1;
+			// Gathers one row at a time.
+			math::Matrix<T> buffer(1, jSize);
+			for (size_t i = 0; i < iSize; i++)
+			{
+				const typename math::Matrix<T>::RowCol row = mat[i];
+				for (size_t j = 0; j < jSize; j++)
+				{
+					buffer(0, j) = row[j];
+				}
+				checksum.update(buffer.data(), sizeof(T) * jSize);
+				write(buffer.data(), sizeof(T) * jSize);
+			}
+		}
+		record.checksum = checksum.value();
+		m_entries.push_back(std::move(entry));
+	}
+
+	inline void CheckpointWriter::close()
+	{
+		pad();
+		Checkpoint::Header header{};
+		memcpy(header.magic, Checkpoint::magic, sizeof(header.magic));
+		header.version = Checkpoint::version;
+		header.byteOrder = Checkpoint::byteOrder;
+		header.count = m_entries.size();
+		header.directoryOffset = m_position;
+		for (const Checkpoint::Entry& entry : m_entries)
+		{
+			static const char zeros[8] = {};
+			write(&entry.record, sizeof(entry.record));
+			write(entry.name.data(), entry.name.size());
+			write(zeros, (8 - entry.name.size() % 8) % 8);
+		}
+		header.directorySize = m_position - header.directoryOffset;
+		m_stream.seekp(0);
+		m_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		m_stream.close();
+		if (!m_stream)
+		{
+			throw std::runtime_error("cannot write " + m_tempPath);
+		}
+#if defined(_WIN32)
+		bool replaced = MoveFileExA(m_tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		bool replaced = std::rename(m_tempPath.c_str(), m_path.c_str()) == 0;
+#endif
+		if (!replaced)
+		{
+			throw std::runtime_error("cannot replace " + m_path + " with " + m_tempPath);
+		}
+	}
+}
@@ -14,7 +14,7 @@ namespace extra_traits
 	struct is_specialization<Temp, Temp<Ts...>> : std::true_type {};
 
 	template<typename Type, template<typename...> typename Temp>
-	inline constexpr bool is_specialization_v = is_specialization<Type, Temp...>::value;
+	inline constexpr bool is_specialization_v = is_specialization<Temp, Type>::value;
 
 	template<typename Type, template<typename> typename Temp>
 	struct remove_template
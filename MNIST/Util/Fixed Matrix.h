@@ -0,0 +1,753 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+#include "Functional.h"
+#include "Matrix.h"
+
+// Matrices whose size is a compile time constant, for small operands such as per-neuron Jacobians and tiny output
+// layers. Elements live in an std::array inside the object, so a FixedMatrix never touches the heap, and every
+// operation is expanded over index sequences into straight-line code the compiler can keep in registers. The operator
+// set matches Matrix (with && as matrix multiplication), but results are computed eagerly and all operations are
+// usable in constant expressions. Mixing a FixedMatrix with a Matrix gives a Matrix.
+
+namespace math
+{
+	template<typename T, size_t I, size_t J>
+	class FixedMatrix
+	{
+		std::array<T, I * J> m_data;
+
+	public:
+		using value_type = T;
+
+		inline constexpr FixedMatrix();
+		inline constexpr explicit FixedMatrix(const T& fill);
+		// Row by row.
+		inline constexpr FixedMatrix(const std::array<T, I * J>& data);
+		// mat must be I x J.
+		inline explicit FixedMatrix(const Matrix<T>& mat);
+
+		// Converting to a Matrix allocates, so it is never implicit.
+		inline Matrix<T> toMatrix() const;
+		inline explicit operator Matrix<T>() const;
+
+		static inline constexpr size_t iSize();
+		static inline constexpr size_t jSize();
+		static inline constexpr size_t size();
+
+		inline constexpr T* data();
+		inline constexpr const T* data() const;
+
+		inline constexpr T& get(size_t i, size_t j);
+		inline constexpr const T& get(size_t i, size_t j) const;
+		// Row i, which is contiguous.
+		inline constexpr T* operator[](size_t i);
+		inline constexpr const T* operator[](size_t i) const;
+		inline constexpr T& operator()(size_t i, size_t j);
+		inline constexpr const T& operator()(size_t i, size_t j) const;
+
+		inline constexpr FixedMatrix<T, J, I> copyTranspose() const;
+
+		template<typename Op, typename... Ts>
+		inline constexpr FixedMatrix& assignElementWise(const Op& op, const Ts&... params);
+		inline constexpr FixedMatrix& operator+=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator+=(const T& val);
+		inline constexpr FixedMatrix& operator-=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator-=(const T& val);
+		inline constexpr FixedMatrix& operator*=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator*=(const T& val);
+		inline constexpr FixedMatrix& operator/=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator/=(const T& val);
+		inline constexpr FixedMatrix& operator%=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator%=(const T& val);
+		inline constexpr FixedMatrix& operator&=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator&=(const T& val);
+		inline constexpr FixedMatrix& operator|=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator|=(const T& val);
+		inline constexpr FixedMatrix& operator^=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator^=(const T& val);
+		inline constexpr FixedMatrix& operator<<=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator<<=(const T& val);
+		inline constexpr FixedMatrix& operator>>=(const FixedMatrix& mat);
+		inline constexpr FixedMatrix& operator>>=(const T& val);
+	};
+
+	// Scalars and dynamic matrices count as 0 x 0.
+	template<typename T>
+	struct FixedShape
+	{
+		static constexpr bool fixed = false;
+		static constexpr bool dynamic = false;
+		static constexpr size_t iSize = 0;
+		static constexpr size_t jSize = 0;
+		using value_type = T;
+	};
+
+	template<typename T, size_t I, size_t J>
+	struct FixedShape<FixedMatrix<T, I, J>>
+	{
+		static constexpr bool fixed = true;
+		static constexpr bool dynamic = false;
+		static constexpr size_t iSize = I;
+		static constexpr size_t jSize = J;
+		using value_type = T;
+	};
+
+	template<typename T>
+	struct FixedShape<Matrix<T>>
+	{
+		static constexpr bool fixed = false;
+		static constexpr bool dynamic = true;
+		static constexpr size_t iSize = 0;
+		static constexpr size_t jSize = 0;
+		using value_type = T;
+	};
+
+	// An operand of the fixed operators: a fixed matrix, a dynamic matrix or a scalar.
+	template<typename T>
+	using FixedValue_t = typename FixedShape<T>::value_type;
+
+	// At least one fixed matrix, every other operand a scalar, a dynamic matrix or a fixed matrix of the same shape,
+	// and all of the same element type.
+	template<typename... Ts>
+	inline constexpr bool isFixedOperation = false;
+
+	template<typename T>
+	inline constexpr bool isFixedOperation<T> = FixedShape<T>::fixed;
+
+	template<typename L, typename R>
+	inline constexpr bool isFixedOperation<L, R> =
+		(FixedShape<L>::fixed || FixedShape<R>::fixed) && std::is_same_v<FixedValue_t<L>, FixedValue_t<R>> &&
+		!(FixedShape<L>::fixed && FixedShape<R>::fixed && !std::is_same_v<L, R>);
+
+	template<typename Op, typename... Ts>
+	using FixedRes = extra_traits::remove_const_reference_t<std::invoke_result_t<Op, FixedValue_t<Ts>...>>;
+
+	class FixedHelper
+	{
+	public:
+		template<typename T>
+		static inline constexpr const T& at(const T& val, size_t k);
+		template<typename T, size_t I, size_t J>
+		static inline constexpr const T& at(const FixedMatrix<T, I, J>& mat, size_t k);
+
+		// Passes everything but fixed matrices through unchanged.
+		template<typename T>
+		static inline const T& dynamic(const T& val);
+		template<typename T, size_t I, size_t J>
+		static inline Matrix<T> dynamic(const FixedMatrix<T, I, J>& mat);
+
+		template<typename Op, typename... Ts>
+		static inline constexpr FixedRes<Op, Ts...> element(const Op& op, size_t k, const Ts&... params);
+		template<typename R, size_t I, size_t J, typename Op, size_t... Ks, typename... Ts>
+		static inline constexpr FixedMatrix<R, I, J> elementWise(const Op& op, std::index_sequence<Ks...>, const Ts&... params);
+
+		template<size_t K, typename Add, typename Mul, typename T, size_t I, typename U, size_t J, size_t... Ks>
+		static inline constexpr MatMulRes<Mul, T, U> dot(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const FixedMatrix<U, K, J>& rhs, size_t i, size_t j, std::index_sequence<Ks...>);
+		template<typename Add, typename Mul, typename T, size_t I, size_t K, typename U, size_t J, size_t... Ks>
+		static inline constexpr FixedMatrix<MatMulRes<Mul, T, U>, I, J> matMul(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const FixedMatrix<U, K, J>& rhs, std::index_sequence<Ks...>);
+
+		// The fixed result of op, or the dynamic one if any operand is a dynamic matrix.
+		template<typename Op, typename... Ts>
+		using Result = std::conditional_t<(FixedShape<Ts>::dynamic || ...), Matrix<FixedRes<Op, Ts...>>,
+			FixedMatrix<FixedRes<Op, Ts...>, std::max({ FixedShape<Ts>::iSize... }), std::max({ FixedShape<Ts>::jSize... })>>;
+
+		template<typename Op, typename... Ts>
+		static inline constexpr Result<Op, Ts...> apply(const Op& op, const Ts&... params);
+	};
+
+	// Fixed counterpart of elementWise, fully unrolled. params are fixed matrices of the same size as mat and
+	// scalars. With a dynamic matrix among them, the result is a Matrix instead.
+	template<typename Op, typename T, size_t I, size_t J, typename... Ts>
+	inline constexpr FixedHelper::Result<Op, FixedMatrix<T, I, J>, Ts...> elementWise(const Op& op, const FixedMatrix<T, I, J>& mat, const Ts&... params);
+
+	template<typename Add, typename Mul, typename T, size_t I, size_t K, typename U, size_t J>
+	inline constexpr FixedMatrix<MatMulRes<Mul, T, U>, I, J> matMul(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const FixedMatrix<U, K, J>& rhs);
+	template<typename Add, typename Mul, typename T, size_t I, size_t K, typename U>
+	inline Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const Matrix<U>& rhs);
+	template<typename Add, typename Mul, typename T, typename U, size_t K, size_t J>
+	inline Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const Matrix<T>& lhs, const FixedMatrix<U, K, J>& rhs);
+
+	template<typename T, typename = std::enable_if_t<isFixedOperation<T>>>
+	inline constexpr FixedHelper::Result<std::negate<>, T> operator-(const T& mat);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::plus<>, L, R> operator+(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::minus<>, L, R> operator-(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::multiplies<>, L, R> operator*(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::divides<>, L, R> operator/(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::modulus<>, L, R> operator%(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::bit_and<>, L, R> operator&(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::bit_or<>, L, R> operator|(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::bit_xor<>, L, R> operator^(const L& lhs, const R& rhs);
+	template<typename T, typename = std::enable_if_t<isFixedOperation<T>>>
+	inline constexpr FixedHelper::Result<std::bit_not<>, T> operator~(const T& mat);
+	template<typename T, typename = std::enable_if_t<isFixedOperation<T>>>
+	inline constexpr FixedHelper::Result<std::logical_not<>, T> operator!(const T& mat);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<func::left_shift<>, L, R> operator<<(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<func::right_shift<>, L, R> operator>>(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<func::min<>, L, R> min(const L& lhs, const R& rhs);
+	// Overload for operands of identical type, which would otherwise be ambiguous with std::min.
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J> min(const FixedMatrix<T, I, J>& lhs, const FixedMatrix<T, I, J>& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<func::max<>, L, R> max(const L& lhs, const R& rhs);
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J> max(const FixedMatrix<T, I, J>& lhs, const FixedMatrix<T, I, J>& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::equal_to<>, L, R> operator==(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::not_equal_to<>, L, R> operator!=(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::greater<>, L, R> operator>(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::less<>, L, R> operator<(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::greater_equal<>, L, R> operator>=(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isFixedOperation<L, R>>>
+	inline constexpr FixedHelper::Result<std::less_equal<>, L, R> operator<=(const L& lhs, const R& rhs);
+
+	// Matrix multiplication, as for Matrix, with elements of type ProductRes<T>. bool matrices give the boolean
+	// product, summing with || and multiplying with &&.
+	template<typename T, size_t I, size_t K, size_t J>
+	inline constexpr FixedMatrix<ProductRes<T>, I, J> operator&&(const FixedMatrix<T, I, K>& lhs, const FixedMatrix<T, K, J>& rhs);
+	template<typename T, size_t I, size_t K>
+	inline Matrix<ProductRes<T>> operator&&(const FixedMatrix<T, I, K>& lhs, const Matrix<T>& rhs);
+	template<typename T, size_t K, size_t J>
+	inline Matrix<ProductRes<T>> operator&&(const Matrix<T>& lhs, const FixedMatrix<T, K, J>& rhs);
+
+	template<typename T, size_t I, size_t J>
+	inline std::ostream& operator<<(std::ostream& stream, const FixedMatrix<T, I, J>& mat);
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>::FixedMatrix() :
+		m_data()
+	{}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>::FixedMatrix(const T& fill) :
+		m_data()
+	{
+		for (size_t k = 0; k < I * J; k++)
+		{
+			m_data[k] = fill;
+		}
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>::FixedMatrix(const std::array<T, I * J>& data) :
+		m_data(data)
+	{}
+
+	template<typename T, size_t I, size_t J>
+	inline FixedMatrix<T, I, J>::FixedMatrix(const Matrix<T>& mat) :
+		m_data()
+	{
+		for (size_t i = 0; i < I; i++)
+		{
+			const typename Matrix<T>::RowCol matRow = mat[i];
+			for (size_t j = 0; j < J; j++)
+			{
+				m_data[i * J + j] = matRow[j];
+			}
+		}
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline Matrix<T> FixedMatrix<T, I, J>::toMatrix() const
+	{
+		Matrix<T> mat(I, J);
+		for (size_t k = 0; k < I * J; k++)
+		{
+			mat.data()[k] = m_data[k];
+		}
+		return mat;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline FixedMatrix<T, I, J>::operator Matrix<T>() const
+	{
+		return toMatrix();
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr size_t FixedMatrix<T, I, J>::iSize()
+	{
+		return I;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr size_t FixedMatrix<T, I, J>::jSize()
+	{
+		return J;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr size_t FixedMatrix<T, I, J>::size()
+	{
+		return I * J;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr T* FixedMatrix<T, I, J>::data()
+	{
+		return m_data.data();
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr const T* FixedMatrix<T, I, J>::data() const
+	{
+		return m_data.data();
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr T& FixedMatrix<T, I, J>::get(size_t i, size_t j)
+	{
+		return m_data[i * J + j];
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr const T& FixedMatrix<T, I, J>::get(size_t i, size_t j) const
+	{
+		return m_data[i * J + j];
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr T* FixedMatrix<T, I, J>::operator[](size_t i)
+	{
+		return m_data.data() + i * J;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr const T* FixedMatrix<T, I, J>::operator[](size_t i) const
+	{
+		return m_data.data() + i * J;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr T& FixedMatrix<T, I, J>::operator()(size_t i, size_t j)
+	{
+		return m_data[i * J + j];
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr const T& FixedMatrix<T, I, J>::operator()(size_t i, size_t j) const
+	{
+		return m_data[i * J + j];
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, J, I> FixedMatrix<T, I, J>::copyTranspose() const
+	{
+		FixedMatrix<T, J, I> res;
+		for (size_t i = 0; i < I; i++)
+		{
+			for (size_t j = 0; j < J; j++)
+			{
+				res(j, i) = m_data[i * J + j];
+			}
+		}
+		return res;
+	}
+
+	template<typename T, size_t I, size_t J>
+	template<typename Op, typename... Ts>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::assignElementWise(const Op& op, const Ts&... params)
+	{
+		return *this = FixedHelper::elementWise<T, I, J>(op, std::make_index_sequence<I * J>(), *this, params...);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator+=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::plus(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator+=(const T& val)
+	{
+		return assignElementWise(std::plus(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator-=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::minus(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator-=(const T& val)
+	{
+		return assignElementWise(std::minus(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator*=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::multiplies(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator*=(const T& val)
+	{
+		return assignElementWise(std::multiplies(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator/=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::divides(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator/=(const T& val)
+	{
+		return assignElementWise(std::divides(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator%=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::modulus(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator%=(const T& val)
+	{
+		return assignElementWise(std::modulus(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator&=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::bit_and(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator&=(const T& val)
+	{
+		return assignElementWise(std::bit_and(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator|=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::bit_or(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator|=(const T& val)
+	{
+		return assignElementWise(std::bit_or(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator^=(const FixedMatrix& mat)
+	{
+		return assignElementWise(std::bit_xor(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator^=(const T& val)
+	{
+		return assignElementWise(std::bit_xor(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator<<=(const FixedMatrix& mat)
+	{
+		return assignElementWise(func::left_shift(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator<<=(const T& val)
+	{
+		return assignElementWise(func::left_shift(), val);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator>>=(const FixedMatrix& mat)
+	{
+		return assignElementWise(func::right_shift(), mat);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J>& FixedMatrix<T, I, J>::operator>>=(const T& val)
+	{
+		return assignElementWise(func::right_shift(), val);
+	}
+
+	template<typename T>
+	inline constexpr const T& FixedHelper::at(const T& val, size_t)
+	{
+		return val;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr const T& FixedHelper::at(const FixedMatrix<T, I, J>& mat, size_t k)
+	{
+		return mat.data()[k];
+	}
+
+	template<typename T>
+	inline const T& FixedHelper::dynamic(const T& val)
+	{
+		return val;
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline Matrix<T> FixedHelper::dynamic(const FixedMatrix<T, I, J>& mat)
+	{
+		return mat.toMatrix();
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr FixedRes<Op, Ts...> FixedHelper::element(const Op& op, size_t k, const Ts&... params)
+	{
+		return op(at(params, k)...);
+	}
+
+	template<typename R, size_t I, size_t J, typename Op, size_t... Ks, typename... Ts>
+	inline constexpr FixedMatrix<R, I, J> FixedHelper::elementWise(const Op& op, std::index_sequence<Ks...>, const Ts&... params)
+	{
+		return FixedMatrix<R, I, J>(std::array<R, I * J>{ R(element(op, Ks, params...))... });
+	}
+
+	template<size_t K, typename Add, typename Mul, typename T, size_t I, typename U, size_t J, size_t... Ks>
+	inline constexpr MatMulRes<Mul, T, U> FixedHelper::dot(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const FixedMatrix<U, K, J>& rhs, size_t i, size_t j, std::index_sequence<Ks...>)
+	{
+		// Accumulates in the same order as the generic matMul.
+		MatMulRes<Mul, T, U> res = 0;
+		((res = add(res, mul(lhs(i, Ks), rhs(Ks, j)))), ...);
+		return res;
+	}
+
+	template<typename Add, typename Mul, typename T, size_t I, size_t K, typename U, size_t J, size_t... Ks>
+	inline constexpr FixedMatrix<MatMulRes<Mul, T, U>, I, J> FixedHelper::matMul(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const FixedMatrix<U, K, J>& rhs, std::index_sequence<Ks...>)
+	{
+		return FixedMatrix<MatMulRes<Mul, T, U>, I, J>(std::array<MatMulRes<Mul, T, U>, I * J>{
+			dot<K>(add, mul, lhs, rhs, Ks / J, Ks % J, std::make_index_sequence<K>())... });
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr FixedHelper::Result<Op, Ts...> FixedHelper::apply(const Op& op, const Ts&... params)
+	{
+		if constexpr ((FixedShape<Ts>::dynamic || ...))
+		{
+			// Fixed operands become temporaries, which live until the expression has been evaluated.
+			return Matrix<FixedRes<Op, Ts...>>(math::elementWise(op, dynamic(params)...));
+		}
+		else
+		{
+			using Res = Result<Op, Ts...>;
+			return elementWise<FixedRes<Op, Ts...>, Res::iSize(), Res::jSize()>(op, std::make_index_sequence<Res::size()>(), params...);
+		}
+	}
+
+	template<typename Op, typename T, size_t I, size_t J, typename... Ts>
+	inline constexpr FixedHelper::Result<Op, FixedMatrix<T, I, J>, Ts...> elementWise(const Op& op, const FixedMatrix<T, I, J>& mat, const Ts&... params)
+	{
+		return FixedHelper::apply(op, mat, params...);
+	}
+
+	template<typename Add, typename Mul, typename T, size_t I, size_t K, typename U, size_t J>
+	inline constexpr FixedMatrix<MatMulRes<Mul, T, U>, I, J> matMul(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const FixedMatrix<U, K, J>& rhs)
+	{
+		return FixedHelper::matMul(add, mul, lhs, rhs, std::make_index_sequence<I * J>());
+	}
+
+	template<typename Add, typename Mul, typename T, size_t I, size_t K, typename U>
+	inline Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const FixedMatrix<T, I, K>& lhs, const Matrix<U>& rhs)
+	{
+		return matMul(add, mul, lhs.toMatrix(), rhs);
+	}
+
+	template<typename Add, typename Mul, typename T, typename U, size_t K, size_t J>
+	inline Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const Matrix<T>& lhs, const FixedMatrix<U, K, J>& rhs)
+	{
+		return matMul(add, mul, lhs, rhs.toMatrix());
+	}
+
+	template<typename T, typename>
+	inline constexpr FixedHelper::Result<std::negate<>, T> operator-(const T& mat)
+	{
+		return FixedHelper::apply(std::negate(), mat);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::plus<>, L, R> operator+(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::plus(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::minus<>, L, R> operator-(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::minus(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::multiplies<>, L, R> operator*(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::multiplies(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::divides<>, L, R> operator/(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::divides(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::modulus<>, L, R> operator%(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::modulus(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::bit_and<>, L, R> operator&(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::bit_and(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::bit_or<>, L, R> operator|(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::bit_or(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::bit_xor<>, L, R> operator^(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::bit_xor(), lhs, rhs);
+	}
+
+	template<typename T, typename>
+	inline constexpr FixedHelper::Result<std::bit_not<>, T> operator~(const T& mat)
+	{
+		return FixedHelper::apply(std::bit_not(), mat);
+	}
+
+	template<typename T, typename>
+	inline constexpr FixedHelper::Result<std::logical_not<>, T> operator!(const T& mat)
+	{
+		return FixedHelper::apply(std::logical_not(), mat);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<func::left_shift<>, L, R> operator<<(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(func::left_shift(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<func::right_shift<>, L, R> operator>>(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(func::right_shift(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<func::min<>, L, R> min(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(func::min(), lhs, rhs);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J> min(const FixedMatrix<T, I, J>& lhs, const FixedMatrix<T, I, J>& rhs)
+	{
+		return FixedHelper::apply(func::min(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<func::max<>, L, R> max(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(func::max(), lhs, rhs);
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline constexpr FixedMatrix<T, I, J> max(const FixedMatrix<T, I, J>& lhs, const FixedMatrix<T, I, J>& rhs)
+	{
+		return FixedHelper::apply(func::max(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::equal_to<>, L, R> operator==(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::equal_to(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::not_equal_to<>, L, R> operator!=(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::not_equal_to(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::greater<>, L, R> operator>(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::greater(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::less<>, L, R> operator<(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::less(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::greater_equal<>, L, R> operator>=(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::greater_equal(), lhs, rhs);
+	}
+
+	template<typename L, typename R, typename>
+	inline constexpr FixedHelper::Result<std::less_equal<>, L, R> operator<=(const L& lhs, const R& rhs)
+	{
+		return FixedHelper::apply(std::less_equal(), lhs, rhs);
+	}
+
+	template<typename T, size_t I, size_t K, size_t J>
+	inline constexpr FixedMatrix<ProductRes<T>, I, J> operator&&(const FixedMatrix<T, I, K>& lhs, const FixedMatrix<T, K, J>& rhs)
+	{
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			return matMul(std::logical_or(), std::logical_and(), lhs, rhs);
+		}
+		else
+		{
+			return matMul(std::plus(), std::multiplies(), lhs, rhs);
+		}
+	}
+
+	template<typename T, size_t I, size_t K>
+	inline Matrix<ProductRes<T>> operator&&(const FixedMatrix<T, I, K>& lhs, const Matrix<T>& rhs)
+	{
+		return lhs.toMatrix() && rhs;
+	}
+
+	template<typename T, size_t K, size_t J>
+	inline Matrix<ProductRes<T>> operator&&(const Matrix<T>& lhs, const FixedMatrix<T, K, J>& rhs)
+	{
+		return lhs && rhs.toMatrix();
+	}
+
+	template<typename T, size_t I, size_t J>
+	inline std::ostream& operator<<(std::ostream& stream, const FixedMatrix<T, I, J>& mat)
+	{
+		return stream << mat.toMatrix();
+	}
+}
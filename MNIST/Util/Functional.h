@@ -1,9 +1,29 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
 
 namespace func
 {
+	template<typename T = void>
+	struct identity
+	{
+		inline constexpr const T& operator()(const T& val) const
+		{
+			return val;
+		}
+	};
+
+	template<>
+	struct identity<void>
+	{
+		template<typename T>
+		inline constexpr const T& operator()(const T& val) const
+		{
+			return val;
+		}
+	};
+
 	template<typename T = void>
 	struct left_shift
 	{
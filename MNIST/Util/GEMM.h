@@ -0,0 +1,542 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+#include "Half.h"
+#include "SIMD.h"
+#include "Thread Pool.h"
+
+// Packed, cache-blocked general matrix multiplication for float and double (C = alpha * A * B + beta * C).
+// A is m x k, B is k x n and C is m x n. Every operand is described by a pointer to element (0, 0) and a
+// row stride and column stride, so transposed and offset views can be multiplied without copying. A and B may
+// also hold half or bfloat16 values, which are widened to float block by block before packing. The micro-kernel is
+// chosen at runtime like the loops in SIMD.h: AVX2 with FMA where the CPU has them, portable code otherwise.
+
+namespace gemm
+{
+	// MR x NR is the register tile computed by the micro-kernel. A MC x KC block of A is packed to stay in L2,
+	// a KC x NR sliver of B is streamed through L1 and a KC x NC panel of B is packed to stay in L3.
+	template<typename T>
+	struct Blocking
+	{
+		static constexpr size_t MR = 4;
+		static constexpr size_t NR = 8;
+		static constexpr size_t MC = 128;
+		static constexpr size_t KC = 256;
+		static constexpr size_t NC = 4096;
+
+		// Computes the MR x NR product of a packed MR x kc sliver of A and a packed kc x NR sliver of B into tile.
+		static inline void microKernel(size_t kc, const T* ap, const T* bp, T* tile);
+	};
+
+#ifdef SIMD_X86
+	// Larger tiles for the 16 vector registers of AVX2, updated with fused multiply-adds. Only used when
+	// simd::hasFMA() is true.
+	namespace avx2
+	{
+		template<typename T>
+		struct Blocking;
+
+		template<>
+		struct Blocking<float>
+		{
+			static constexpr size_t MR = 6;
+			static constexpr size_t NR = 16;
+			static constexpr size_t MC = 144;
+			static constexpr size_t KC = 256;
+			static constexpr size_t NC = 4080;
+
+			static inline void microKernel(size_t kc, const float* ap, const float* bp, float* tile);
+		};
+
+		template<>
+		struct Blocking<double>
+		{
+			static constexpr size_t MR = 6;
+			static constexpr size_t NR = 8;
+			static constexpr size_t MC = 72;
+			static constexpr size_t KC = 256;
+			static constexpr size_t NC = 4080;
+
+			static inline void microKernel(size_t kc, const double* ap, const double* bp, double* tile);
+		};
+	}
+#endif
+
+	// Element types gemm can read. Products are computed in math::Accumulator of the element type.
+	template<typename T>
+	inline constexpr bool isOperand = std::is_same_v<T, float> || std::is_same_v<T, double> || math::isHalfPrecision<T>;
+
+	// True if matMul(add, mul, Matrix<T>, Matrix<U>) computes an ordinary real matrix product that gemm can take over,
+	// with a result of type math::Accumulator<T>.
+	template<typename Add, typename Mul, typename T, typename U>
+	inline constexpr bool isAccelerated =
+		isOperand<T> && isOperand<U> &&
+		std::is_same_v<math::Accumulator<T>, math::Accumulator<U>> &&
+		(std::is_same_v<Add, std::plus<>> || std::is_same_v<Add, std::plus<math::Accumulator<T>>>) &&
+		(std::is_same_v<Mul, std::multiplies<>> || std::is_same_v<Mul, std::multiplies<math::Accumulator<T>>>);
+
+	// Grow-only, 64 byte aligned scratch memory for packed panels. One per thread, reused across calls.
+	template<typename T>
+	class PackBuffer
+	{
+		T* m_data = nullptr;
+		size_t m_capacity = 0;
+
+	public:
+		inline PackBuffer() = default;
+		inline PackBuffer(const PackBuffer&) = delete;
+		inline PackBuffer& operator=(const PackBuffer&) = delete;
+		inline ~PackBuffer();
+
+		inline T* reserve(size_t size);
+	};
+
+	// Widens a rows x cols block of half precision values into buf with simd's bulk conversions, along whichever
+	// direction is contiguous, and updates the strides to those of the copy. Other operands are used in place.
+	template<typename T, typename S>
+	inline const T* widen(size_t rows, size_t cols, const S* src, size_t& rs, size_t& cs, PackBuffer<T>& buf);
+
+	// The functions below taking a Block work with the tile sizes and micro-kernel of Blocking or avx2::Blocking.
+	template<typename Block, typename T>
+	inline void packA(size_t mc, size_t kc, const T* a, size_t rsA, size_t csA, T* ap);
+	template<typename Block, typename T>
+	inline void packB(size_t kc, size_t nc, const T* b, size_t rsB, size_t csB, T* bp);
+
+	template<typename Block, typename T>
+	inline void storeTile(size_t mr, size_t nr, const T* tile, T alpha, T beta, T* c, size_t rsC, size_t csC);
+
+	template<typename Block, typename T>
+	inline void macroKernel(size_t mc, size_t nc, size_t kc, T alpha, const T* ap, const T* bp, T beta, T* c, size_t rsC, size_t csC);
+
+	template<typename T>
+	inline void scale(size_t m, size_t n, T beta, T* c, size_t rsC, size_t csC);
+
+	// Single threaded product for one tile of C.
+	template<typename Block, typename T, typename A, typename B>
+	inline void gemmTile(size_t m, size_t n, size_t k, T alpha, const A* a, size_t rsA, size_t csA, const B* b, size_t rsB, size_t csB, T beta, T* c, size_t rsC, size_t csC);
+
+	// Chooses how many row and column tiles to split an m x n product into for the given number of threads.
+	template<typename Block>
+	inline void tiling(size_t m, size_t n, size_t threads, size_t& rowTiles, size_t& colTiles);
+
+	// Splits C into tiles computed in parallel on the thread pool. Each tile packs its own panels of A and B, which
+	// costs little compared to the multiplication as long as tiles span at least a few micro-kernel tiles.
+	template<typename Block, typename T, typename A, typename B>
+	inline void gemmBlocked(size_t m, size_t n, size_t k, T alpha, const A* a, size_t rsA, size_t csA, const B* b, size_t rsB, size_t csB, T beta, T* c, size_t rsC, size_t csC);
+
+	// Runs gemmBlocked with the fastest blocking the CPU supports.
+	template<typename T, typename A, typename B>
+	inline void gemm(size_t m, size_t n, size_t k, T alpha, const A* a, size_t rsA, size_t csA, const B* b, size_t rsB, size_t csB, T beta, T* c, size_t rsC, size_t csC);
+
+	template<typename T>
+	inline PackBuffer<T>::~PackBuffer()
+	{
+		::operator delete[](m_data, std::align_val_t(64));
+	}
+
+	template<typename T>
+	inline T* PackBuffer<T>::reserve(size_t size)
+	{
+		if (size > m_capacity)
+		{
+			::operator delete[](m_data, std::align_val_t(64));
+			m_data = static_cast<T*>(::operator new[](sizeof(T) * size, std::align_val_t(64)));
+			m_capacity = size;
+		}
+		return m_data;
+	}
+
+	template<typename T, typename S>
+	inline const T* widen(size_t rows, size_t cols, const S* src, size_t& rs, size_t& cs, PackBuffer<T>& buf)
+	{
+		if constexpr (std::is_same_v<S, T>)
+		{
+			return src;
+		}
+		else
+		{
+			T* dst = buf.reserve(rows * cols);
+			if (rs == 1 && cs != 1)
+			{
+				for (size_t j = 0; j < cols; j++)
+				{
+					math::convert(rows, src + j * cs, dst + j * rows);
+				}
+				cs = rows;
+			}
+			else
+			{
+				for (size_t i = 0; i < rows; i++)
+				{
+					if (cs == 1)
+					{
+						math::convert(cols, src + i * rs, dst + i * cols);
+					}
+					else
+					{
+						for (size_t j = 0; j < cols; j++)
+						{
+							dst[i * cols + j] = T(src[i * rs + j * cs]);
+						}
+					}
+				}
+				rs = cols;
+				cs = 1;
+			}
+			return dst;
+		}
+	}
+
+	// Packs rows of A into consecutive MR row slivers, each stored column by column. Rows past mc are zero padded.
+	template<typename Block, typename T>
+	inline void packA(size_t mc, size_t kc, const T* a, size_t rsA, size_t csA, T* ap)
+	{
+		constexpr size_t MR = Block::MR;
+		for (size_t ir = 0; ir < mc; ir += MR)
+		{
+			size_t mr = std::min(MR, mc - ir);
+			const T* sliver = a + ir * rsA;
+			for (size_t p = 0; p < kc; p++)
+			{
+				const T* col = sliver + p * csA;
+				size_t i = 0;
+				for (; i < mr; i++)
+				{
+					ap[i] = col[i * rsA];
+				}
+				for (; i < MR; i++)
+				{
+					ap[i] = 0;
+				}
+				ap += MR;
+			}
+		}
+	}
+
+	// Packs columns of B into consecutive NR column slivers, each stored row by row. Columns past nc are zero padded.
+	template<typename Block, typename T>
+	inline void packB(size_t kc, size_t nc, const T* b, size_t rsB, size_t csB, T* bp)
+	{
+		constexpr size_t NR = Block::NR;
+		for (size_t jr = 0; jr < nc; jr += NR)
+		{
+			size_t nr = std::min(NR, nc - jr);
+			const T* sliver = b + jr * csB;
+			for (size_t p = 0; p < kc; p++)
+			{
+				const T* row = sliver + p * rsB;
+				size_t j = 0;
+				for (; j < nr; j++)
+				{
+					bp[j] = row[j * csB];
+				}
+				for (; j < NR; j++)
+				{
+					bp[j] = 0;
+				}
+				bp += NR;
+			}
+		}
+	}
+
+	template<typename T>
+	inline void Blocking<T>::microKernel(size_t kc, const T* ap, const T* bp, T* tile)
+	{
+		T acc[MR * NR] = {};
+		for (size_t p = 0; p < kc; p++)
+		{
+			for (size_t i = 0; i < MR; i++)
+			{
+				T aVal = ap[i];
+				for (size_t j = 0; j < NR; j++)
+				{
+					acc[i * NR + j] += aVal * bp[j];
+				}
+			}
+			ap += MR;
+			bp += NR;
+		}
+		std::copy(acc, acc + MR * NR, tile);
+	}
+
+#ifdef SIMD_X86
+	namespace avx2
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+	inline void Blocking<float>::microKernel(size_t kc, const float* ap, const float* bp, float* tile)
+	{
+		__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+		__m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+		__m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+		__m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+		__m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+		__m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+		for (size_t p = 0; p < kc; p++)
+		{
+			__m256 b0 = _mm256_load_ps(bp);
+			__m256 b1 = _mm256_load_ps(bp + 8);
+			__m256 a;
+			a = _mm256_broadcast_ss(ap + 0);
+			c00 = _mm256_fmadd_ps(a, b0, c00);
+			c01 = _mm256_fmadd_ps(a, b1, c01);
+			a = _mm256_broadcast_ss(ap + 1);
+			c10 = _mm256_fmadd_ps(a, b0, c10);
+			c11 = _mm256_fmadd_ps(a, b1, c11);
+			a = _mm256_broadcast_ss(ap + 2);
+			c20 = _mm256_fmadd_ps(a, b0, c20);
+			c21 = _mm256_fmadd_ps(a, b1, c21);
+			a = _mm256_broadcast_ss(ap + 3);
+			c30 = _mm256_fmadd_ps(a, b0, c30);
+			c31 = _mm256_fmadd_ps(a, b1, c31);
+			a = _mm256_broadcast_ss(ap + 4);
+			c40 = _mm256_fmadd_ps(a, b0, c40);
+			c41 = _mm256_fmadd_ps(a, b1, c41);
+			a = _mm256_broadcast_ss(ap + 5);
+			c50 = _mm256_fmadd_ps(a, b0, c50);
+			c51 = _mm256_fmadd_ps(a, b1, c51);
+			ap += 6;
+			bp += 16;
+		}
+		_mm256_store_ps(tile + 0, c00);
+		_mm256_store_ps(tile + 8, c01);
+		_mm256_store_ps(tile + 16, c10);
+		_mm256_store_ps(tile + 24, c11);
+		_mm256_store_ps(tile + 32, c20);
+		_mm256_store_ps(tile + 40, c21);
+		_mm256_store_ps(tile + 48, c30);
+		_mm256_store_ps(tile + 56, c31);
+		_mm256_store_ps(tile + 64, c40);
+		_mm256_store_ps(tile + 72, c41);
+		_mm256_store_ps(tile + 80, c50);
+		_mm256_store_ps(tile + 88, c51);
+	}
+
+	inline void Blocking<double>::microKernel(size_t kc, const double* ap, const double* bp, double* tile)
+	{
+		__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+		__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+		__m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+		__m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+		__m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+		__m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+		for (size_t p = 0; p < kc; p++)
+		{
+			__m256d b0 = _mm256_load_pd(bp);
+			__m256d b1 = _mm256_load_pd(bp + 4);
+			__m256d a;
+			a = _mm256_broadcast_sd(ap + 0);
+			c00 = _mm256_fmadd_pd(a, b0, c00);
+			c01 = _mm256_fmadd_pd(a, b1, c01);
+			a = _mm256_broadcast_sd(ap + 1);
+			c10 = _mm256_fmadd_pd(a, b0, c10);
+			c11 = _mm256_fmadd_pd(a, b1, c11);
+			a = _mm256_broadcast_sd(ap + 2);
+			c20 = _mm256_fmadd_pd(a, b0, c20);
+			c21 = _mm256_fmadd_pd(a, b1, c21);
+			a = _mm256_broadcast_sd(ap + 3);
+			c30 = _mm256_fmadd_pd(a, b0, c30);
+			c31 = _mm256_fmadd_pd(a, b1, c31);
+			a = _mm256_broadcast_sd(ap + 4);
+			c40 = _mm256_fmadd_pd(a, b0, c40);
+			c41 = _mm256_fmadd_pd(a, b1, c41);
+			a = _mm256_broadcast_sd(ap + 5);
+			c50 = _mm256_fmadd_pd(a, b0, c50);
+			c51 = _mm256_fmadd_pd(a, b1, c51);
+			ap += 6;
+			bp += 8;
+		}
+		_mm256_store_pd(tile + 0, c00);
+		_mm256_store_pd(tile + 4, c01);
+		_mm256_store_pd(tile + 8, c10);
+		_mm256_store_pd(tile + 12, c11);
+		_mm256_store_pd(tile + 16, c20);
+		_mm256_store_pd(tile + 20, c21);
+		_mm256_store_pd(tile + 24, c30);
+		_mm256_store_pd(tile + 28, c31);
+		_mm256_store_pd(tile + 32, c40);
+		_mm256_store_pd(tile + 36, c41);
+		_mm256_store_pd(tile + 40, c50);
+		_mm256_store_pd(tile + 44, c51);
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+#endif
+
+	// C is only read when beta is nonzero, so uninitialized output memory is fine with beta == 0.
+	template<typename Block, typename T>
+	inline void storeTile(size_t mr, size_t nr, const T* tile, T alpha, T beta, T* c, size_t rsC, size_t csC)
+	{
+		constexpr size_t NR = Block::NR;
+		for (size_t i = 0; i < mr; i++)
+		{
+			T* cRow = c + i * rsC;
+			const T* tileRow = tile + i * NR;
+			if (beta == 0)
+			{
+				for (size_t j = 0; j < nr; j++)
+				{
+					cRow[j * csC] = alpha * tileRow[j];
+				}
+			}
+			else
+			{
+				for (size_t j = 0; j < nr; j++)
+				{
+					cRow[j * csC] = alpha * tileRow[j] + beta * cRow[j * csC];
+				}
+			}
+		}
+	}
+
+	template<typename Block, typename T>
+	inline void macroKernel(size_t mc, size_t nc, size_t kc, T alpha, const T* ap, const T* bp, T beta, T* c, size_t rsC, size_t csC)
+	{
+		constexpr size_t MR = Block::MR;
+		constexpr size_t NR = Block::NR;
+		alignas(64) T tile[MR * NR];
+		for (size_t jr = 0; jr < nc; jr += NR)
+		{
+			size_t nr = std::min(NR, nc - jr);
+			for (size_t ir = 0; ir < mc; ir += MR)
+			{
+				size_t mr = std::min(MR, mc - ir);
+				Block::microKernel(kc, ap + ir * kc, bp + jr * kc, tile);
+				storeTile<Block>(mr, nr, tile, alpha, beta, c + ir * rsC + jr * csC, rsC, csC);
+			}
+		}
+	}
+
+	template<typename T>
+	inline void scale(size_t m, size_t n, T beta, T* c, size_t rsC, size_t csC)
+	{
+		for (size_t i = 0; i < m; i++)
+		{
+			for (size_t j = 0; j < n; j++)
+			{
+				T& val = c[i * rsC + j * csC];
+				val = beta == 0 ? 0 : beta * val;
+			}
+		}
+	}
+
+	template<typename Block, typename T, typename A, typename B>
+	inline void gemmTile(size_t m, size_t n, size_t k, T alpha, const A* a, size_t rsA, size_t csA, const B* b, size_t rsB, size_t csB, T beta, T* c, size_t rsC, size_t csC)
+	{
+		thread_local PackBuffer<T> aBuffer;
+		thread_local PackBuffer<T> bBuffer;
+		thread_local PackBuffer<T> wideBuffer;
+		T* ap = aBuffer.reserve(Block::MC * Block::KC);
+		T* bp = bBuffer.reserve(Block::KC * Block::NC);
+		for (size_t jc = 0; jc < n; jc += Block::NC)
+		{
+			size_t nc = std::min(Block::NC, n - jc);
+			for (size_t pc = 0; pc < k; pc += Block::KC)
+			{
+				size_t kc = std::min(Block::KC, k - pc);
+				// Only the first pass over k may scale the existing contents of C, later passes accumulate.
+				T blockBeta = pc == 0 ? beta : T(1);
+				// Half precision blocks are widened first; rs and cs become the strides of whatever is packed.
+				size_t rs = rsB;
+				size_t cs = csB;
+				const T* wide = widen(kc, nc, b + pc * rsB + jc * csB, rs, cs, wideBuffer);
+				packB<Block>(kc, nc, wide, rs, cs, bp);
+				for (size_t ic = 0; ic < m; ic += Block::MC)
+				{
+					size_t mc = std::min(Block::MC, m - ic);
+					rs = rsA;
+					cs = csA;
+					wide = widen(mc, kc, a + ic * rsA + pc * csA, rs, cs, wideBuffer);
+					packA<Block>(mc, kc, wide, rs, cs, ap);
+					macroKernel<Block>(mc, nc, kc, alpha, ap, bp, blockBeta, c + ic * rsC + jc * csC, rsC, csC);
+				}
+			}
+		}
+	}
+
+	template<typename Block>
+	inline void tiling(size_t m, size_t n, size_t threads, size_t& rowTiles, size_t& colTiles)
+	{
+		size_t maxRows = (m + Block::MR - 1) / Block::MR;
+		size_t maxCols = (n + Block::NR - 1) / Block::NR;
+		rowTiles = 1;
+		colTiles = 1;
+		size_t best = m + n;
+		// Among the grids using as many threads as possible, pick the one with the squarest tiles, which minimizes
+		// the panels each tile has to pack.
+		for (size_t rows = 1; rows <= std::min(threads, maxRows); rows++)
+		{
+			size_t cols = std::min(threads / rows, maxCols);
+			size_t perimeter = (m + rows - 1) / rows + (n + cols - 1) / cols;
+			if (rows * cols > rowTiles * colTiles || (rows * cols == rowTiles * colTiles && perimeter < best))
+			{
+				rowTiles = rows;
+				colTiles = cols;
+				best = perimeter;
+			}
+		}
+	}
+
+	template<typename Block, typename T, typename A, typename B>
+	inline void gemmBlocked(size_t m, size_t n, size_t k, T alpha, const A* a, size_t rsA, size_t csA, const B* b, size_t rsB, size_t csB, T beta, T* c, size_t rsC, size_t csC)
+	{
+		if (m == 0 || n == 0)
+		{
+			return;
+		}
+		if (k == 0 || alpha == 0)
+		{
+			scale(m, n, beta, c, rsC, csC);
+			return;
+		}
+		size_t work = m * n * k;
+		if (work < parallel::config().threshold)
+		{
+			gemmTile<Block>(m, n, k, alpha, a, rsA, csA, b, rsB, csB, beta, c, rsC, csC);
+			return;
+		}
+		size_t rowTiles;
+		size_t colTiles;
+		tiling<Block>(m, n, parallel::pool().size(), rowTiles, colTiles);
+		// Tile edges are rounded to whole register tiles so that only the last tile in each direction is ragged.
+		size_t mt = ((m + rowTiles - 1) / rowTiles + Block::MR - 1) / Block::MR * Block::MR;
+		size_t nt = ((n + colTiles - 1) / colTiles + Block::NR - 1) / Block::NR * Block::NR;
+		rowTiles = (m + mt - 1) / mt;
+		colTiles = (n + nt - 1) / nt;
+		parallel::forRange(rowTiles * colTiles, work, [&](size_t begin, size_t end)
+		{
+			for (size_t t = begin; t < end; t++)
+			{
+				size_t i = t / colTiles * mt;
+				size_t j = t % colTiles * nt;
+				gemmTile<Block>(std::min(mt, m - i), std::min(nt, n - j), k, alpha, a + i * rsA, rsA, csA, b + j * csB, rsB, csB, beta, c + i * rsC + j * csC, rsC, csC);
+			}
+		});
+	}
+
+	template<typename T, typename A, typename B>
+	inline void gemm(size_t m, size_t n, size_t k, T alpha, const A* a, size_t rsA, size_t csA, const B* b, size_t rsB, size_t csB, T beta, T* c, size_t rsC, size_t csC)
+	{
+#ifdef SIMD_X86
+		if (simd::hasFMA())
+		{
+			gemmBlocked<avx2::Blocking<T>>(m, n, k, alpha, a, rsA, csA, b, rsB, csB, beta, c, rsC, csC);
+			return;
+		}
+#endif
+		gemmBlocked<Blocking<T>>(m, n, k, alpha, a, rsA, csA, b, rsB, csB, beta, c, rsC, csC);
+	}
+}
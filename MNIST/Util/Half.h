@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+
+#include "SIMD.h"
+
+// 16 bit floating point storage types. Both exist to halve the bytes of large matrices (weights, activations), not to
+// compute in: every operator converts to float, so arithmetic on them yields float, and matMul and the reductions
+// accumulate in float (see Accumulator). Converting a float back is explicit, as it rounds.
+
+namespace math
+{
+	// IEEE 754 binary16: 5 exponent and 10 mantissa bits. Finite up to 65504, about 3 significant decimal digits.
+	class half
+	{
+		uint16_t m_bits;
+
+	public:
+		inline half() = default;
+		inline explicit half(float val);
+
+		inline operator float() const;
+
+		static inline constexpr half fromBits(uint16_t bits);
+		inline constexpr uint16_t bits() const;
+	};
+
+	// The upper half of a float: 8 exponent and 7 mantissa bits. Same range as float, about 2 significant decimal
+	// digits.
+	class bfloat16
+	{
+		uint16_t m_bits;
+
+	public:
+		inline bfloat16() = default;
+		inline explicit bfloat16(float val);
+
+		inline operator float() const;
+
+		static inline constexpr bfloat16 fromBits(uint16_t bits);
+		inline constexpr uint16_t bits() const;
+	};
+
+	template<typename T>
+	struct AccumulatorOf
+	{
+		using type = T;
+	};
+
+	template<>
+	struct AccumulatorOf<half>
+	{
+		using type = float;
+	};
+
+	template<>
+	struct AccumulatorOf<bfloat16>
+	{
+		using type = float;
+	};
+
+	// Type that sums and products of T are carried out in.
+	template<typename T>
+	using Accumulator = typename AccumulatorOf<T>::type;
+
+	template<typename T>
+	inline constexpr bool isHalfPrecision = std::is_same_v<T, half> || std::is_same_v<T, bfloat16>;
+
+	// out[i] = U(in[i]) for i < n. Conversions between float and half or bfloat16 go through simd's bulk loops.
+	template<typename T, typename U>
+	inline void convert(size_t n, const T* in, U* out);
+
+	inline std::ostream& operator<<(std::ostream& stream, const half& val);
+	inline std::istream& operator>>(std::istream& stream, half& val);
+	inline std::ostream& operator<<(std::ostream& stream, const bfloat16& val);
+	inline std::istream& operator>>(std::istream& stream, bfloat16& val);
+
+	static_assert(sizeof(half) == 2 && std::is_trivially_copyable_v<half>, "half must be stored as its bits");
+	static_assert(sizeof(bfloat16) == 2 && std::is_trivially_copyable_v<bfloat16>, "bfloat16 must be stored as its bits");
+
+	inline half::half(float val) :
+		m_bits(simd::floatToHalf(val))
+	{}
+
+	inline half::operator float() const
+	{
+		return simd::halfToFloat(m_bits);
+	}
+
+	inline constexpr half half::fromBits(uint16_t bits)
+	{
+		half res{};
+		res.m_bits = bits;
+		return res;
+	}
+
+	inline constexpr uint16_t half::bits() const
+	{
+		return m_bits;
+	}
+
+	inline bfloat16::bfloat16(float val) :
+		m_bits(simd::floatToBfloat16(val))
+	{}
+
+	inline bfloat16::operator float() const
+	{
+		return simd::bfloat16ToFloat(m_bits);
+	}
+
+	inline constexpr bfloat16 bfloat16::fromBits(uint16_t bits)
+	{
+		bfloat16 res{};
+		res.m_bits = bits;
+		return res;
+	}
+
+	inline constexpr uint16_t bfloat16::bits() const
+	{
+		return m_bits;
+	}
+
+	template<typename T, typename U>
+	inline void convert(size_t n, const T* in, U* out)
+	{
+		// Both types are standard layout wrappers around their bits.
+		if constexpr (std::is_same_v<T, half> && std::is_same_v<U, float>)
+		{
+			simd::halfToFloat(n, reinterpret_cast<const uint16_t*>(in), out);
+		}
+		else if constexpr (std::is_same_v<T, float> && std::is_same_v<U, half>)
+		{
+			simd::floatToHalf(n, in, reinterpret_cast<uint16_t*>(out));
+		}
+		else if constexpr (std::is_same_v<T, bfloat16> && std::is_same_v<U, float>)
+		{
+			simd::bfloat16ToFloat(n, reinterpret_cast<const uint16_t*>(in), out);
+		}
+		else if constexpr (std::is_same_v<T, float> && std::is_same_v<U, bfloat16>)
+		{
+			simd::floatToBfloat16(n, in, reinterpret_cast<uint16_t*>(out));
+		}
+		else
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				out[i] = U(in[i]);
+			}
+		}
+	}
+
+	inline std::ostream& operator<<(std::ostream& stream, const half& val)
+	{
+		return stream << float(val);
+	}
+
+	inline std::istream& operator>>(std::istream& stream, half& val)
+	{
+		float read;
+		if (stream >> read)
+		{
+			val = half(read);
+		}
+		return stream;
+	}
+
+	inline std::ostream& operator<<(std::ostream& stream, const bfloat16& val)
+	{
+		return stream << float(val);
+	}
+
+	inline std::istream& operator>>(std::istream& stream, bfloat16& val)
+	{
+		float read;
+		if (stream >> read)
+		{
+			val = bfloat16(read);
+		}
+		return stream;
+	}
+}
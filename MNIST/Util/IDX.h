@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "Mapped File.h"
+#include "Matrix.h"
+
+// Reader for the IDX files the MNIST dataset is distributed in. An IDX file starts with the magic number
+// 0x00 0x00 <type> <dimension count>, followed by one big-endian 32 bit size per dimension and the data itself.
+
+namespace io
+{
+	inline constexpr uint8_t idxUnsignedByte = 0x08;
+
+	// Views an IDX file of unsigned bytes as a matrix with one row per item, i.e. N x 1 for labels (idx1) and
+	// N x 784 for 28 x 28 images (idx3). The matrix points straight into the mapped file. Throws std::runtime_error
+	// if the file is missing, truncated or not an unsigned byte IDX file.
+	inline math::Matrix<uint8_t> loadIdx(const std::string& path);
+	inline math::Matrix<uint8_t> loadIdx(const MappedFile& file, const std::string& name = "IDX file");
+
+	inline math::Matrix<uint8_t> loadIdx(const std::string& path)
+	{
+		return loadIdx(MappedFile(path), path);
+	}
+
+	inline math::Matrix<uint8_t> loadIdx(const MappedFile& file, const std::string& name)
+	{
+		const uint8_t* data = file.data();
+		size_t size = file.size();
+		if (size < 4 || data[0] != 0 || data[1] != 0)
+		{
+			throw std::runtime_error(name + ": bad magic number");
+		}
+		if (data[2] != idxUnsignedByte)
+		{
+			throw std::runtime_error(name + ": elements are not unsigned bytes");
+		}
+		size_t dimensions = data[3];
+		size_t header = 4 + 4 * dimensions;
+		if (dimensions == 0 || size < header)
+		{
+			throw std::runtime_error(name + ": truncated header");
+		}
+		size_t items = 0;
+		size_t itemSize = 1;
+		for (size_t d = 0; d < dimensions; d++)
+		{
+			const uint8_t* field = data + 4 + 4 * d;
+			size_t dim = size_t(field[0]) << 24 | size_t(field[1]) << 16 | size_t(field[2]) << 8 | size_t(field[3]);
+			if (d == 0)
+			{
+				items = dim;
+			}
+			else if (dim != 0 && itemSize > (size - header) / dim)
+			{
+				throw std::runtime_error(name + ": truncated data");
+			}
+			else
+			{
+				itemSize *= dim;
+			}
+		}
+		if (itemSize != 0 && items > (size - header) / itemSize)
+		{
+			throw std::runtime_error(name + ": truncated data");
+		}
+		return file.view<uint8_t>(header, items, itemSize);
+	}
+}
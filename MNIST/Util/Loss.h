@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Matrix.h"
+#include "Thread Pool.h"
+
+// Softmax and the softmax cross-entropy loss over a batch of logits, one sample per row. Each row is handled in one
+// sweep while it sits in cache: its maximum, the exponentials of the shifted logits (written straight into the
+// destination), and a final scaling pass over the destination. Labels are class indices, so no one-hot matrix is
+// ever built. Rows are spread over the thread pool; partial losses are added in a fixed order, so results do not
+// depend on the number of threads.
+
+namespace math
+{
+	// Row-wise softmax of logits into dst, which must have the same size and may be logits itself.
+	template<typename T>
+	inline Matrix<T>& softmaxInto(Matrix<T>& dst, const Matrix<T>& logits);
+	template<typename T>
+	inline void softmaxInto(Matrix<T>&& dst, const Matrix<T>& logits);
+
+	// Mean over the rows of -log(softmax(logits)(i, labels(i, 0))), computed as logsumexp(row) - row[label] so that
+	// neither exp nor log can overflow. labels has one class index per row of logits; indices are not checked.
+	template<typename T, typename L>
+	inline T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels);
+	// Also writes the gradient of the mean loss w.r.t. the logits, (softmax(logits) - onehot(labels)) / iSize, into
+	// gradient, which must have the same size as logits and may be logits itself.
+	template<typename T, typename L>
+	inline T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels, Matrix<T>& gradient);
+	template<typename T, typename L>
+	inline T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels, Matrix<T>&& gradient);
+
+	class LossHelper
+	{
+		template<typename T>
+		friend Matrix<T>& softmaxInto(Matrix<T>& dst, const Matrix<T>& logits);
+		template<typename T, typename L>
+		friend T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels);
+		template<typename T, typename L>
+		friend T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels, Matrix<T>& gradient);
+
+		// Rows per task and per partial loss.
+		static constexpr size_t rowBlock = 64;
+
+		template<typename T>
+		static inline bool contiguous(const Matrix<T>& mat);
+
+		// Writes exp(x[j] - max) to e[j], which may be x, and returns their sum. max is the largest of the n > 0
+		// logits.
+		template<typename T>
+		static inline T exponentials(const T* x, size_t n, T* e, T& max);
+
+		// Runs row(i, x, dst) over every row of logits, where x points to the jSize logits of row i and dst to jSize
+		// elements to write, which land in row i of dst (or scratch space if dst is null). Rows of views that are
+		// not contiguous go through scratch space. Returns the sum of the values returned by row.
+		template<typename T, typename F>
+		static inline T apply(const Matrix<T>& logits, Matrix<T>* dst, const F& row);
+	};
+
+	template<typename T>
+	inline bool LossHelper::contiguous(const Matrix<T>& mat)
+	{
+		return mat.isAffine() && (mat.jStride() == 1 || mat.jSize() <= 1);
+	}
+
+	template<typename T>
+	inline T LossHelper::exponentials(const T* x, size_t n, T* e, T& max)
+	{
+		max = *std::max_element(x, x + n);
+		T sum = 0;
+		for (size_t j = 0; j < n; j++)
+		{
+			e[j] = std::exp(x[j] - max);
+			sum += e[j];
+		}
+		return sum;
+	}
+
+	template<typename T, typename F>
+	inline T LossHelper::apply(const Matrix<T>& logits, Matrix<T>* dst, const F& row)
+	{
+		size_t iSize = logits.iSize();
+		size_t jSize = logits.jSize();
+		if (iSize == 0 || jSize == 0)
+		{
+			return T(0);
+		}
+		bool xContiguous = contiguous(logits);
+		bool dstContiguous = dst != nullptr && contiguous(*dst);
+		if (dst != nullptr)
+		{
+			dst->unshare();
+		}
+		size_t blocks = (iSize + rowBlock - 1) / rowBlock;
+		std::vector<T> partials(blocks);
+		parallel::forRange(blocks, iSize * jSize, [&](size_t begin, size_t end)
+		{
+			std::vector<T> scratch(2 * jSize);
+			for (size_t b = begin; b < end; b++)
+			{
+				T partial = 0;
+				for (size_t i = b * rowBlock; i < std::min((b + 1) * rowBlock, iSize); i++)
+				{
+					const T* x = &logits(i, 0);
+					if (!xContiguous)
+					{
+						for (size_t j = 0; j < jSize; j++)
+						{
+							scratch[j] = logits(i, j);
+						}
+						x = scratch.data();
+					}
+					T* out = dstContiguous ? &(*dst)[i][0] : scratch.data() + jSize;
+					partial += row(i, x, out);
+					if (dst != nullptr && !dstContiguous)
+					{
+						typename Matrix<T>::RowCol dstRow = (*dst)[i];
+						for (size_t j = 0; j < jSize; j++)
+						{
+							dstRow[j] = out[j];
+						}
+					}
+				}
+				partials[b] = partial;
+			}
+		});
+		T sum = 0;
+		for (const T& partial : partials)
+		{
+			sum += partial;
+		}
+		return sum;
+	}
+
+	template<typename T>
+	inline Matrix<T>& softmaxInto(Matrix<T>& dst, const Matrix<T>& logits)
+	{
+		size_t n = logits.jSize();
+		LossHelper::apply(logits, &dst, [n](size_t, const T* x, T* p)
+		{
+			T max;
+			T scale = T(1) / LossHelper::exponentials(x, n, p, max);
+			for (size_t j = 0; j < n; j++)
+			{
+				p[j] *= scale;
+			}
+			return T(0);
+		});
+		return dst;
+	}
+
+	template<typename T>
+	inline void softmaxInto(Matrix<T>&& dst, const Matrix<T>& logits)
+	{
+		softmaxInto(dst, logits);
+	}
+
+	template<typename T, typename L>
+	inline T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels)
+	{
+		size_t n = logits.jSize();
+		T loss = LossHelper::apply(logits, static_cast<Matrix<T>*>(nullptr), [n, &labels](size_t i, const T* x, T* e)
+		{
+			T max;
+			T target = x[size_t(labels(i, 0))];
+			T sum = LossHelper::exponentials(x, n, e, max);
+			return max + std::log(sum) - target;
+		});
+		return logits.iSize() > 0 ? loss / logits.iSize() : T(0);
+	}
+
+	template<typename T, typename L>
+	inline T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels, Matrix<T>& gradient)
+	{
+		size_t n = logits.jSize();
+		T rowScale = logits.iSize() > 0 ? T(1) / logits.iSize() : T(0);
+		T loss = LossHelper::apply(logits, &gradient, [n, rowScale, &labels](size_t i, const T* x, T* g)
+		{
+			T max;
+			size_t label = size_t(labels(i, 0));
+			// Read before g, which may alias x, is overwritten.
+			T target = x[label];
+			T sum = LossHelper::exponentials(x, n, g, max);
+			T scale = rowScale / sum;
+			for (size_t j = 0; j < n; j++)
+			{
+				g[j] *= scale;
+			}
+			g[label] -= rowScale;
+			return max + std::log(sum) - target;
+		});
+		return logits.iSize() > 0 ? loss / logits.iSize() : T(0);
+	}
+
+	template<typename T, typename L>
+	inline T softmaxCrossEntropy(const Matrix<T>& logits, const Matrix<L>& labels, Matrix<T>&& gradient)
+	{
+		return softmaxCrossEntropy(logits, labels, gradient);
+	}
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Allocator.h"
+#include "Matrix.h"
+
+namespace io
+{
+	// A whole file mapped copy-on-write into memory. Pages are shared with the page cache (and so with every other
+	// process mapping the same file) until written to. Matrices returned by view() share ownership of the mapping,
+	// which is unmapped once the MappedFile and all such matrices are gone.
+	class MappedFile
+	{
+		// Owns the mapping. Releasing its external block unmaps the file and destroys the owner.
+		class Owner final : public alloc::Allocator
+		{
+		public:
+			uint8_t* m_data = nullptr;
+			size_t m_size = 0;
+#if defined(_WIN32)
+			HANDLE m_mapping = nullptr;
+#endif
+
+			inline ~Owner();
+
+			inline void* allocate(size_t bytes) override;
+			inline void deallocate(void* ptr, size_t bytes) override;
+			inline alloc::Stats stats() const override;
+		};
+
+		uint8_t* m_data;
+		size_t m_size;
+		alloc::ReferenceCount* m_referenceCount;
+
+	public:
+		// Throws std::runtime_error if the file cannot be opened or mapped.
+		inline explicit MappedFile(const std::string& path);
+		inline MappedFile(const MappedFile& file);
+		inline MappedFile& operator=(const MappedFile& file);
+		inline ~MappedFile();
+
+		inline uint8_t* data() const;
+		inline size_t size() const;
+
+		// An iSize x jSize matrix viewing the elements stored row by row from byte offset on, without copying.
+		// Throws std::out_of_range if they extend past the end of the file.
+		template<typename T>
+		inline math::Matrix<T> view(size_t offset, size_t iSize, size_t jSize) const;
+	};
+
+	inline MappedFile::Owner::~Owner()
+	{
+#if defined(_WIN32)
+		if (m_data != nullptr)
+		{
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping != nullptr)
+		{
+			CloseHandle(m_mapping);
+		}
+#else
+		if (m_data != nullptr)
+		{
+			munmap(m_data, m_size);
+		}
+#endif
+	}
+
+	inline void* MappedFile::Owner::allocate(size_t bytes)
+	{
+		return ::operator new(bytes, std::align_val_t(alloc::alignment));
+	}
+
+	inline void MappedFile::Owner::deallocate(void* ptr, size_t)
+	{
+		::operator delete(ptr, std::align_val_t(alloc::alignment));
+		delete this;
+	}
+
+	inline alloc::Stats MappedFile::Owner::stats() const
+	{
+		return {};
+	}
+
+	inline MappedFile::MappedFile(const std::string& path)
+	{
+		Owner* owner = new Owner();
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER size;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+		{
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+			}
+			delete owner;
+			throw std::runtime_error("cannot open " + path);
+		}
+		owner->m_size = size_t(size.QuadPart);
+		if (owner->m_size > 0)
+		{
+			owner->m_mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			if (owner->m_mapping != nullptr)
+			{
+				owner->m_data = static_cast<uint8_t*>(MapViewOfFile(owner->m_mapping, FILE_MAP_COPY, 0, 0, 0));
+			}
+		}
+		CloseHandle(file);
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (file < 0 || fstat(file, &info) != 0)
+		{
+			if (file >= 0)
+			{
+				close(file);
+			}
+			delete owner;
+			throw std::runtime_error("cannot open " + path);
+		}
+		owner->m_size = size_t(info.st_size);
+		if (owner->m_size > 0)
+		{
+			void* data = mmap(nullptr, owner->m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+			owner->m_data = data == MAP_FAILED ? nullptr : static_cast<uint8_t*>(data);
+		}
+		close(file);
+#endif
+		if (owner->m_size > 0 && owner->m_data == nullptr)
+		{
+			delete owner;
+			throw std::runtime_error("cannot map " + path);
+		}
+		m_data = owner->m_data;
+		m_size = owner->m_size;
+		m_referenceCount = alloc::external(*owner);
+	}
+
+	inline MappedFile::MappedFile(const MappedFile& file) :
+		m_data(file.m_data),
+		m_size(file.m_size),
+		m_referenceCount(file.m_referenceCount)
+	{
+		m_referenceCount->increment();
+	}
+
+	inline MappedFile& MappedFile::operator=(const MappedFile& file)
+	{
+		file.m_referenceCount->increment();
+		if (m_referenceCount->decrement())
+		{
+			alloc::release<uint8_t>(m_referenceCount);
+		}
+		m_data = file.m_data;
+		m_size = file.m_size;
+		m_referenceCount = file.m_referenceCount;
+		return *this;
+	}
+
+	inline MappedFile::~MappedFile()
+	{
+		if (m_referenceCount->decrement())
+		{
+			alloc::release<uint8_t>(m_referenceCount);
+		}
+	}
+
+	inline uint8_t* MappedFile::data() const
+	{
+		return m_data;
+	}
+
+	inline size_t MappedFile::size() const
+	{
+		return m_size;
+	}
+
+	template<typename T>
+	inline math::Matrix<T> MappedFile::view(size_t offset, size_t iSize, size_t jSize) const
+	{
+		if (offset > m_size || (jSize != 0 && iSize > (m_size - offset) / sizeof(T) / jSize))
+		{
+			throw std::out_of_range("view extends past the end of the file");
+		}
+		m_referenceCount->increment();
+		return math::Matrix<T>(iSize, jSize, reinterpret_cast<T*>(m_data + offset), m_referenceCount);
+	}
+}
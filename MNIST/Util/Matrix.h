@@ -1,17 +1,44 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iomanip>
+#include <locale>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 
+#include "Allocator.h"
 #include "Extra Type Traits.h"
 #include "Functional.h"
+#include "GEMM.h"
+#include "Half.h"
+#include "SIMD.h"
+#include "Span.h"
+#include "Thread Pool.h"
 
 // CLIENT CODE IS RESPONSIBLE FOR BOUNDS CHECKING UNLESS OTHERWISE STATED
 // SOME METHODS ASSUME T IS NOT ITSELF A MATRIX
 
 namespace math
 {
+	template<typename Op, typename... Ts>
+	class ElementWiseExpr;
+
+	class ElementWiseHelper;
+
+	class BitMatrix;
+
+	class ReductionHelper;
+
 	template<typename T>
 	class Matrix
 	{
@@ -20,77 +47,158 @@ namespace math
 		size_t m_iStride;
 		size_t m_jStride;
 		size_t m_size;
+		size_t m_offset;
 
+		// Element (i, j) lives at m_data[m_offset + iMap[i] * m_iStride + jMap[j] * m_jStride]. A null map stands for
+		// the identity, so plain matrices and rectangular/transposed views need no per-index storage. Maps are only
+		// materialized by swapRows/swapCols and the retain list submatrix methods.
 		size_t* m_iMap;
 		size_t* m_jMap;
 
 		T* m_data;
 
-		size_t* m_referenceCount;
+		alloc::ReferenceCount* m_referenceCount;
+		// Set if the reference is counted in the views of the block, see the copy constructor.
+		bool m_view;
+
+		enum class Sharing : uint8_t
+		{
+			Exclusive,
+			// The data may be shared with a copy, so the next write detaches (see unshare).
+			CopyOnWrite,
+			// Another thread is detaching the data.
+			Detaching
+		};
+
+		mutable std::atomic<Sharing> m_sharing;
 
 	public:
 		class RowCol
 		{
 			friend Matrix;
 
+			const size_t m_size;
 			const size_t m_stride;
 
 			size_t* const m_map;
 
 			T* const m_data;
 
-			inline constexpr RowCol(size_t stride, size_t* const map, T* const data);
+			inline constexpr RowCol(size_t size, size_t stride, size_t* const map, T* const data);
 
 		public:
+			inline constexpr size_t size() const;
 			inline constexpr T& get(size_t i);
 			inline constexpr const T& get(size_t i) const;
 			inline constexpr T& operator[](size_t i);
 			inline constexpr const T& operator[](size_t i) const;
 			inline constexpr T& operator()(size_t i);
 			inline constexpr const T& operator()(size_t i) const;
+
+			// Returns true if consecutive elements are evenly spaced in memory, which is always the case without an
+			// index map (see Matrix::isAffine).
+			inline constexpr bool isAffine() const;
+			// The elements without going through the index map for each one. isAffine() must be true. The span is
+			// contiguous for the rows of a row major matrix, and strided by iStride() for its columns.
+			inline constexpr StridedSpan<T> span();
+			inline constexpr StridedSpan<const T> span() const;
+			// Iterates through the index map, so unlike span() also works for rows and columns that are not affine.
+			inline constexpr MappedIterator<T> begin();
+			inline constexpr MappedIterator<const T> begin() const;
+			inline constexpr MappedIterator<T> end();
+			inline constexpr MappedIterator<const T> end() const;
 		};
 
 	private:
+		static inline constexpr size_t index(const size_t* map, size_t i);
 		static inline constexpr size_t* identityMap(size_t size);
 		static inline constexpr size_t* subMap(const size_t* map, size_t i, size_t size);
 		static inline constexpr size_t* subMap(const size_t* map, const size_t* retain, size_t size);
 
-		inline constexpr Matrix(size_t iSize, size_t jSize, size_t iStride, size_t jStride, size_t size, size_t* iMap, size_t* jMap, T* data, size_t* referenceCount);
-		inline constexpr Matrix(size_t iSize, size_t jSize, size_t size, T* data, size_t* referenceCount);
+		inline constexpr Matrix(size_t iSize, size_t jSize, size_t iStride, size_t jStride, size_t size, size_t offset, size_t* iMap, size_t* jMap, T* data, alloc::ReferenceCount* referenceCount);
+		inline constexpr Matrix(size_t iSize, size_t jSize, size_t size, T* data);
 
 	public:
 		inline constexpr Matrix();
 		inline constexpr Matrix(size_t iSize, size_t jSize);
 		inline constexpr Matrix(size_t iSize, size_t jSize, const T& fill);
 		inline constexpr Matrix(size_t iSise, size_t jSize, const std::vector<T>& data);
+		// Views iSize x jSize elements stored row by row at data, which is kept alive by referenceCount (see
+		// alloc::external). Takes over one reference. Counts as a writable view, as other matrices may view the same data.
+		inline constexpr Matrix(size_t iSize, size_t jSize, T* data, alloc::ReferenceCount* referenceCount);
 		inline ~Matrix();
 
+		// Copies are copy-on-write: a copy shares the data, however many copies already do, and whichever matrix is
+		// written first (through any non-const accessor) detaches onto a private contiguous copy. Only data that is
+		// also referenced by writable views (see shareSubmatrix and the constructor above) is copied eagerly, as
+		// views write without detaching. Pointers and references into a matrix are invalidated by copying it. Moves
+		// take over the data, maps and reference in O(1) and leave mat empty.
 		inline constexpr Matrix(const Matrix& mat);
 		inline constexpr Matrix(Matrix&& mat) noexcept;
 		inline constexpr Matrix& operator=(const Matrix& mat);
 		inline constexpr Matrix& operator=(Matrix&& mat) noexcept;
 		inline constexpr Matrix& operator=(const std::vector<T>& data);
 
+		// Evaluates the expression. Assignment writes into the existing storage (visible through shared instances)
+		// when the size matches, going through a temporary if an operand overlaps it (see elementWiseInto).
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator=(const ElementWiseExpr<Op, Ts...>& expr);
+
+		inline constexpr void swap(Matrix& mat) noexcept;
+
 	private:
 		inline constexpr void addRef() const;
-		inline constexpr void remRef() const;
+		// Returns true if this released the last reference to the data.
+		inline constexpr bool remRef() const;
+		// Exchanges everything but the sharing state.
+		inline constexpr void swapData(Matrix& mat) noexcept;
+		// Replaces shared data with a private copy of the elements of this matrix. Only the first of several threads
+		// writing the same matrix at once detaches it, the others wait for it to finish.
+		inline void detach();
+		// Counts this matrix among the writable views of its data, so copies of the data are made eagerly.
+		inline constexpr void countView();
+		// Makes a view created by a const share method copy-on-write if this matrix is, see shareSubmatrix, and
+		// counts it as a writable view otherwise.
+		inline constexpr Matrix shareConst(Matrix&& view) const;
+
+		inline constexpr size_t subOffset(size_t i, size_t j) const;
 
 	public:
 		inline constexpr void clear();
+		// Called before every write through a non-const accessor. Detaches the data if it is shared with a copy, see
+		// detach. Parallel loops call it once before their workers write, which then go through RowCols or pointers
+		// taken afterwards, so that no worker detaches a matrix that others are reading.
+		inline constexpr void unshare();
 
 		inline constexpr size_t iSize() const;
 		inline constexpr size_t jSize() const;
 		inline constexpr size_t iStride() const;
 		inline constexpr size_t jStride() const;
 		inline constexpr size_t size() const;
+		inline constexpr size_t offset() const;
+		// Null if rows/columns are not reordered, see m_iMap.
 		inline constexpr size_t* iMap();
 		inline constexpr const size_t* iMap() const;
 		inline constexpr size_t* jMap();
 		inline constexpr const size_t* jMap() const;
 		inline constexpr T* data();
 		inline constexpr const T* data() const;
+		// Number of matrices (copies and views) referencing the data, 0 for an empty matrix.
 		inline constexpr size_t referenceCount() const;
 
+		// Returns true if consecutive rows and consecutive columns are evenly spaced in memory, i.e. element (i, j)
+		// lives at &get(0, 0) + i * iStride() + j * jStride(). Always true without index maps. Views reordered
+		// through swapRows/swapCols or retain lists are generally not affine.
+		inline constexpr bool isAffine() const;
+		// Returns true if the elements are stored row by row without gaps, i.e. element (i, j) lives at
+		// &get(0, 0) + i * jSize() + j, as for every newly allocated matrix and its views of whole rows.
+		inline constexpr bool isContiguous() const;
+		// All elements row by row, e.g. for standard algorithms. isContiguous() must be true.
+		inline constexpr Span<T> span();
+		inline constexpr Span<const T> span() const;
+
 		inline constexpr RowCol row(size_t i);
 		inline constexpr const RowCol row(size_t i) const;
 		inline constexpr RowCol col(size_t j);
@@ -118,9 +226,13 @@ namespace math
 		inline constexpr Matrix copySubmatrix(const size_t* iRetain, const size_t* jRetain, size_t iSize, size_t jSize) const;
 		inline constexpr Matrix copyTranspose() const;
 
-		// Produces a submatrix/transpose sharing memory with this matrix. The memory sharing persists through
-		// further share method calls and move assigment/construction, but is destroyed by copying. Note that
-		// shared instances have their own iMaps and jMaps which are initially based on this matrix's iMap and jMap
+		// Produces a submatrix/transpose sharing memory with this matrix. Unlike copies, views write through to the
+		// shared memory. The memory sharing persists through further share method calls and move
+		// assignment/construction, but not through copies, which share lazily (see the copy constructor). Sharing a
+		// non-const matrix first detaches it from any copy. A const matrix cannot detach, so views of one that shares
+		// its data with a copy are copy-on-write themselves: writing such a view detaches it instead of reaching the
+		// copy. Note that shared instances have their own iMaps and jMaps (if any) which are initially based on this
+		// matrix's iMap and jMap. Without maps, sharing is O(1).
 		inline constexpr Matrix shareSubmatrix(size_t i, size_t j, size_t iSize, size_t jSize);
 		inline constexpr const Matrix shareSubmatrix(size_t i, size_t j, size_t iSize, size_t jSize) const;
 		inline constexpr Matrix shareSubmatrix(const size_t* iRetain, const size_t* jRetain, size_t iSize, size_t jSize);
@@ -153,186 +265,435 @@ namespace math
 		inline constexpr Matrix& operator<<=(const T& val);
 		inline constexpr Matrix& operator>>=(const Matrix& mat);
 		inline constexpr Matrix& operator>>=(const T& val);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator+=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator-=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator*=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator/=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator%=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator&=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator|=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator^=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator<<=(const ElementWiseExpr<Op, Ts...>& expr);
+		template<typename Op, typename... Ts>
+		inline constexpr Matrix& operator>>=(const ElementWiseExpr<Op, Ts...>& expr);
 	};
 
-	template<typename Op, typename... Ts>
-	using ElementWiseRes = extra_traits::remove_const_reference_t<std::invoke_result_t<Op, extra_traits::remove_template_t<Ts, Matrix>...>>;
+	template<typename T>
+	struct ElementWiseValue
+	{
+		using type = T;
+	};
 
-	// At least one of Types must be a matrix type and all matrix parameters must have the same size.
-	// Otherwise, behavior is undefined.
-	template<typename Op, typename... Ts>
-	inline constexpr Matrix<ElementWiseRes<Op, Ts...>> elementWise(const Op& op, const Ts&... params);
+	template<typename T>
+	struct ElementWiseValue<Matrix<T>>
+	{
+		using type = T;
+	};
 
-	template<typename Mul, typename T, typename U>
-	using MatMulRes = extra_traits::remove_const_reference_t<std::invoke_result_t<Mul, T, U>>;
+	// Element type of a matrix or expression operand, or the type itself for scalar operands.
+	template<typename T>
+	using ElementWiseValue_t = typename ElementWiseValue<T>::type;
 
-	template<typename Add, typename Mul, typename T, typename U>
-	inline constexpr Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const Matrix<T>& lhs, const Matrix<U>& rhs);
+	template<typename Op, typename... Ts>
+	using ElementWiseRes = extra_traits::remove_const_reference_t<std::invoke_result_t<Op, ElementWiseValue_t<Ts>...>>;
 
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const Matrix<T>& mat);
-	template<typename T>
-	inline constexpr Matrix<T> operator+(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator+(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator+(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator*(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator*(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator*(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator/(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator/(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator/(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator%(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator%(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator%(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator&(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator&(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator&(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator|(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator|(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator|(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator^(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator^(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator^(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator~(const Matrix<T>& mat);
-	template<typename T>
-	inline constexpr Matrix<bool> operator!(const Matrix<T>& mat);
-	template<typename T>
-	inline constexpr Matrix<T> operator<<(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator<<(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator<<(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator>>(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator>>(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> operator>>(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> min(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> min(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> min(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> max(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> max(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<T> max(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator==(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator==(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator==(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator!=(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator!=(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator!=(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator>(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator>(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator>(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator<(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator<(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator<(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator>=(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator>=(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator>=(const T& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator<=(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator<=(const Matrix<T>& lhs, const T& rhs);
-	template<typename T>
-	inline constexpr Matrix<bool> operator<=(const T& lhs, const Matrix<T>& rhs);
+	template<typename Op, typename... Ts>
+	struct ElementWiseValue<ElementWiseExpr<Op, Ts...>>
+	{
+		using type = ElementWiseRes<Op, Ts...>;
+	};
 
-	// Matrix multiplication, not logical and. For bool matrices, this performs the boolean product.
 	template<typename T>
-	inline constexpr Matrix<T> operator&&(const Matrix<T>& lhs, const Matrix<T>& rhs);
-	template<>
-	inline constexpr Matrix<bool> operator&&(const Matrix<bool>& lhs, const Matrix<bool>& rhs);
+	inline constexpr bool isElementWiseOperand = false;
 
 	template<typename T>
-	inline std::istream& operator>>(std::istream& stream, Matrix<T>& mat);
-	template<typename T>
-	inline std::ostream& operator<<(std::ostream& stream, const Matrix<T>& mat);
+	inline constexpr bool isElementWiseOperand<Matrix<T>> = true;
+
+	template<typename Op, typename... Ts>
+	inline constexpr bool isElementWiseOperand<ElementWiseExpr<Op, Ts...>> = true;
+
+	// Two matrices/expressions with the same element type, or one of them and a scalar of its element type.
+	template<typename L, typename R>
+	inline constexpr bool isElementWisePair =
+		isElementWiseOperand<L> && isElementWiseOperand<R> && std::is_same_v<ElementWiseValue_t<L>, ElementWiseValue_t<R>> ||
+		isElementWiseOperand<L> && std::is_same_v<R, ElementWiseValue_t<L>> ||
+		isElementWiseOperand<R> && std::is_same_v<L, ElementWiseValue_t<R>>;
 
 	class ElementWiseHelper
 	{
 		template<typename Op, typename... Ts>
-		friend inline constexpr Matrix<ElementWiseRes<Op, Ts...>> elementWise(const Op& op, const Ts&... params);
+		friend class ElementWiseExpr;
+		friend ReductionHelper;
+
+	public:
+		// Number of elements per operand that an expression evaluates at once.
+		static constexpr size_t chunkSize = 1024;
+
+		// Matrices are referenced, expressions and scalars copied.
+		template<typename T>
+		struct Storage
+		{
+			using type = T;
+		};
+
+		template<typename T>
+		struct Storage<Matrix<T>>
+		{
+			using type = const Matrix<T>&;
+		};
+
+		// Per-operand scratch memory for one chunk. Scalars need none.
+		template<typename T>
+		struct Scratch
+		{
+			using type = std::array<T, 0>;
+		};
+
+		template<typename T>
+		struct Scratch<Matrix<T>>
+		{
+			using type = std::array<T, chunkSize>;
+		};
+
+		template<typename Op, typename... Ts>
+		struct Scratch<ElementWiseExpr<Op, Ts...>>
+		{
+			using type = std::array<ElementWiseRes<Op, Ts...>, chunkSize>;
+		};
+
+		// Whether an operand reads memory that writing dst changes, other than through a view identical to dst.
+		// Evaluating straight into dst is then unsafe, as an element could be overwritten before it is read.
+		// Affine matrices are compared by address range, others conservatively by storage.
+		template<typename T, typename U>
+		static inline constexpr bool aliases(const Matrix<T>& dst, const U& val);
+		template<typename T, typename U>
+		static inline constexpr bool aliases(const Matrix<T>& dst, const Matrix<U>& mat);
+		template<typename T, typename Op, typename... Ts>
+		static inline constexpr bool aliases(const Matrix<T>& dst, const ElementWiseExpr<Op, Ts...>& expr);
 
+	private:
 		template<typename T>
-		friend class Matrix;
+		static inline constexpr void shape(const T& val, size_t& iSize, size_t& jSize);
 
-		template<typename R, typename T0, typename... Ts>
-		static inline constexpr Matrix<R> init(const T0& t0, const Ts&... ts);
+		template<typename T>
+		static inline constexpr void shape(const Matrix<T>& mat, size_t& iSize, size_t& jSize);
 
-		template<typename R, typename T0, typename... Ts>
-		static inline constexpr Matrix<R> init(const Matrix<T0>& t0, const Ts&... ts);
+		template<typename Op, typename... Ts>
+		static inline constexpr void shape(const ElementWiseExpr<Op, Ts...>& expr, size_t& iSize, size_t& jSize);
 
 		template<typename T>
 		static inline constexpr const T& index(const T& val, size_t i, size_t j);
 
 		template<typename T>
 		static inline constexpr const T& index(const Matrix<T>& mat, size_t i, size_t j);
+
+		template<typename Op, typename... Ts>
+		static inline constexpr ElementWiseRes<Op, Ts...> index(const ElementWiseExpr<Op, Ts...>& expr, size_t i, size_t j);
+
+		template<typename T>
+		static inline constexpr bool contiguous(const T& val);
+
+		template<typename T>
+		static inline constexpr bool contiguous(const Matrix<T>& mat);
+
+		template<typename Op, typename... Ts>
+		static inline constexpr bool contiguous(const ElementWiseExpr<Op, Ts...>& expr);
+
+		// Whether elements j to j + n - 1 of a row are adjacent in memory.
+		template<typename T>
+		static inline constexpr bool contiguous(const Matrix<T>& mat, size_t j, size_t n);
+
+		// Elements j to j + n - 1 of row i of an operand (see ElementWiseExpr::evaluate), pointing straight into
+		// the matrix when possible and into scratch otherwise.
+		template<typename T>
+		static inline simd::Operand<T> chunk(const T& val, size_t i, size_t j, size_t n, bool flat, T* scratch);
+
+		template<typename T>
+		static inline simd::Operand<T> chunk(const Matrix<T>& mat, size_t i, size_t j, size_t n, bool flat, T* scratch);
+
+		template<typename Op, typename... Ts>
+		static inline simd::Operand<ElementWiseRes<Op, Ts...>> chunk(const ElementWiseExpr<Op, Ts...>& expr, size_t i, size_t j, size_t n, bool flat, ElementWiseRes<Op, Ts...>* scratch);
+
+		// out[k] = op(operands[k]...) for k < n, through a SIMD loop if simd recognizes op.
+		template<typename Op, typename R, typename... Ts>
+		static inline void apply(const Op& op, size_t n, R* out, simd::Operand<Ts>... operands);
+
+		template<typename T>
+		static inline constexpr const T& at(const simd::Operand<T>& operand, size_t k);
+	};
+
+	// A lazily evaluated element-wise operation. The free operators below build trees of these instead of matrices;
+	// a tree is computed in a single pass, a chunk at a time and without intermediate matrices, when it is assigned
+	// to a matrix, converted to one or passed to elementWise/assignElementWise. Matrix operands are held by
+	// reference, so an expression must not outlive them. In particular, an expression kept in an auto variable must
+	// not refer to temporary matrices.
+	template<typename Op, typename... Ts>
+	class ElementWiseExpr
+	{
+		Op m_op;
+		std::tuple<typename ElementWiseHelper::Storage<Ts>::type...> m_params;
+		size_t m_iSize;
+		size_t m_jSize;
+
+		friend ElementWiseHelper;
+		friend BitMatrix;
+
+		template<size_t... Is>
+		inline constexpr ElementWiseRes<Op, Ts...> get(size_t i, size_t j, std::index_sequence<Is...>) const;
+		template<typename R, size_t... Is>
+		inline void evaluate(size_t i, size_t j, size_t n, bool flat, R* out, std::index_sequence<Is...>) const;
+		template<size_t... Is>
+		inline constexpr bool contiguous(std::index_sequence<Is...>) const;
+
+		// Writes elements j to j + n - 1 of row i to out. If flat, every matrix involved is contiguous and j indexes
+		// the whole matrix rather than a row.
+		template<typename R>
+		inline void evaluate(size_t i, size_t j, size_t n, bool flat, R* out) const;
+		inline constexpr bool contiguous() const;
+
+	public:
+		using value_type = ElementWiseRes<Op, Ts...>;
+
+		inline constexpr ElementWiseExpr(const Op& op, const Ts&... params);
+
+		inline constexpr size_t iSize() const;
+		inline constexpr size_t jSize() const;
+		inline constexpr value_type get(size_t i, size_t j) const;
+		inline constexpr value_type operator()(size_t i, size_t j) const;
+
+		// Writes the value of this expression to mat, which must already have the right size. mat may be one of the
+		// operands only if no element is read after the element at the same position in mat was written.
+		template<typename T>
+		inline void assignTo(Matrix<T>& mat) const;
+		inline constexpr Matrix<value_type> evaluate() const;
+		inline constexpr operator Matrix<value_type>() const;
+	};
+
+	// At least one of Types must be a matrix or expression type and all such parameters must have the same size.
+	// Otherwise, behavior is undefined. Expression parameters are fused into the same pass.
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<ElementWiseRes<Op, Ts...>> elementWise(const Op& op, const Ts&... params);
+
+	// Evaluates op over params into dst, which must already have their size and may be any view, e.g. one of a set of
+	// buffers reused for every batch. dst may overlap any operand: aliased evaluations go through a temporary (see
+	// ElementWiseHelper::aliases). Assignment and assignElementWise evaluate the same way.
+	template<typename T, typename Op, typename... Ts>
+	inline Matrix<T>& elementWiseInto(Matrix<T>& dst, const Op& op, const Ts&... params);
+	template<typename T, typename Op, typename... Ts>
+	inline void elementWiseInto(Matrix<T>&& dst, const Op& op, const Ts&... params);
+	// Evaluates an expression built from the free operators, e.g. elementWiseInto(dst, a * b + c).
+	template<typename T, typename Op, typename... Ts>
+	inline Matrix<T>& elementWiseInto(Matrix<T>& dst, const ElementWiseExpr<Op, Ts...>& expr);
+	template<typename T, typename Op, typename... Ts>
+	inline void elementWiseInto(Matrix<T>&& dst, const ElementWiseExpr<Op, Ts...>& expr);
+
+	template<typename Mul, typename T, typename U>
+	using MatMulRes = extra_traits::remove_const_reference_t<std::invoke_result_t<Mul, T, U>>;
+
+	template<typename Add, typename Mul, typename T, typename U>
+	inline constexpr Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const Matrix<T>& lhs, const Matrix<U>& rhs);
+
+	// res = alpha * op(lhs) * op(rhs) + beta * res, where op transposes its operand if the matching flag is set. res
+	// is written in place, so it may be a view such as a shareSubmatrix, and must not overlap lhs or rhs. res must
+	// have exactly the size of the product and the sizes of the operands must agree. Throws std::invalid_argument
+	// otherwise. res is only read if beta is nonzero. Affine float and double operands go through gemm without
+	// allocating, as do half and bfloat16 operands with a float res.
+	template<typename T, typename U, typename V>
+	inline constexpr Matrix<T>& matMulInto(const T& alpha, const Matrix<U>& lhs, const Matrix<V>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose = false, bool rhsTranspose = false);
+	template<typename T, typename U, typename V>
+	inline constexpr void matMulInto(const T& alpha, const Matrix<U>& lhs, const Matrix<V>& rhs, const T& beta, Matrix<T>&& res, bool lhsTranspose = false, bool rhsTranspose = false);
+
+	// Converts every element to U, e.g. convert<half>(weights) to halve their size. Contiguous rows of float and half
+	// or bfloat16 go through simd's bulk conversions.
+	template<typename U, typename T>
+	inline Matrix<U> convert(const Matrix<T>& mat);
+	// dst must have the same size as src.
+	template<typename U, typename T>
+	inline Matrix<U>& convertInto(Matrix<U>& dst, const Matrix<T>& src);
+	template<typename U, typename T>
+	inline void convertInto(Matrix<U>&& dst, const Matrix<T>& src);
+
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline constexpr ElementWiseExpr<std::negate<>, T> operator-(const T& mat);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::plus<>, L, R> operator+(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::minus<>, L, R> operator-(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::multiplies<>, L, R> operator*(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::divides<>, L, R> operator/(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::modulus<>, L, R> operator%(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::bit_and<>, L, R> operator&(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::bit_or<>, L, R> operator|(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::bit_xor<>, L, R> operator^(const L& lhs, const R& rhs);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline constexpr ElementWiseExpr<std::bit_not<>, T> operator~(const T& mat);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline constexpr ElementWiseExpr<std::logical_not<>, T> operator!(const T& mat);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<func::left_shift<>, L, R> operator<<(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<func::right_shift<>, L, R> operator>>(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<func::min<>, L, R> min(const L& lhs, const R& rhs);
+	// Overloads for operands of identical type, which would otherwise be ambiguous with std::min.
+	template<typename T>
+	inline constexpr ElementWiseExpr<func::min<>, Matrix<T>, Matrix<T>> min(const Matrix<T>& lhs, const Matrix<T>& rhs);
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseExpr<func::min<>, ElementWiseExpr<Op, Ts...>, ElementWiseExpr<Op, Ts...>> min(const ElementWiseExpr<Op, Ts...>& lhs, const ElementWiseExpr<Op, Ts...>& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<func::max<>, L, R> max(const L& lhs, const R& rhs);
+	template<typename T>
+	inline constexpr ElementWiseExpr<func::max<>, Matrix<T>, Matrix<T>> max(const Matrix<T>& lhs, const Matrix<T>& rhs);
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseExpr<func::max<>, ElementWiseExpr<Op, Ts...>, ElementWiseExpr<Op, Ts...>> max(const ElementWiseExpr<Op, Ts...>& lhs, const ElementWiseExpr<Op, Ts...>& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::equal_to<>, L, R> operator==(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::not_equal_to<>, L, R> operator!=(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::greater<>, L, R> operator>(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::less<>, L, R> operator<(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::greater_equal<>, L, R> operator>=(const L& lhs, const R& rhs);
+	template<typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline constexpr ElementWiseExpr<std::less_equal<>, L, R> operator<=(const L& lhs, const R& rhs);
+
+	// Destination-passing counterparts of the operators above: xInto(dst, operands...) is elementWiseInto(dst, op,
+	// operands...) for the function object x of the operator. dst may be a matrix or a view temporary.
+	template<typename D, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline decltype(auto) negateInto(D&& dst, const T& mat);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) plusInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) minusInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) multipliesInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) dividesInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) modulusInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) bitAndInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) bitOrInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) bitXorInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline decltype(auto) bitNotInto(D&& dst, const T& mat);
+	template<typename D, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline decltype(auto) logicalNotInto(D&& dst, const T& mat);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) leftShiftInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) rightShiftInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) minInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) maxInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) equalToInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) notEqualToInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) greaterInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) lessInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) greaterEqualInto(D&& dst, const L& lhs, const R& rhs);
+	template<typename D, typename L, typename R, typename = std::enable_if_t<isElementWisePair<L, R>>>
+	inline decltype(auto) lessEqualInto(D&& dst, const L& lhs, const R& rhs);
+
+	// Matrix multiplication, not logical and. For bool matrices, this performs the boolean product on bit-packed
+	// copies of the operands (see Bit Matrix.h). Otherwise the elements have the type of a product of two of them,
+	// so half precision operands give a float product and 8 bit integers an int one.
+	template<typename T>
+	using ProductRes = std::conditional_t<std::is_same_v<T, bool>, bool, MatMulRes<std::multiplies<>, T, T>>;
+
+	template<typename T>
+	inline constexpr Matrix<ProductRes<T>> operator&&(const Matrix<T>& lhs, const Matrix<T>& rhs);
+	template<>
+	inline Matrix<bool> operator&&(const Matrix<bool>& lhs, const Matrix<bool>& rhs);
+
+	// Formats matrices for operator<< with std::to_chars into buffers that are written in large pieces. to_chars
+	// matches the stream's own numeric output for the default locale and the common flags (dec, fixed, scientific,
+	// left/right adjustment, any width, precision and fill); anything else is left to the stream.
+	class FormatHelper
+	{
+	public:
+		struct Style
+		{
+			std::chars_format format;
+			int precision;
+			size_t width;
+			char fill;
+			bool left;
+		};
+
+		// Elements per block of rows formatted at once.
+		static constexpr size_t blockSize = 1 << 16;
+
+		// Returns false if stream needs formatting that to_chars cannot reproduce.
+		template<typename T>
+		static inline bool style(const std::ostream& stream, Style& style);
+		template<typename T>
+		static inline void append(std::string& text, const T& val, const Style& style);
+		// Appends rows [begin, end) of mat to text, each but the first row of mat preceded by a newline.
+		template<typename T>
+		static inline void appendRows(std::string& text, const Matrix<T>& mat, size_t begin, size_t end, const Style& style);
+		// Formats blocks of rows in parallel and writes them in order.
+		template<typename T>
+		static inline void write(std::ostream& stream, const Matrix<T>& mat, const Style& style);
 	};
 
 	template<typename T>
-	inline constexpr Matrix<T>::RowCol::RowCol(size_t jStride, size_t* const map, T* const data) :
-		m_stride(jStride),
+	inline std::istream& operator>>(std::istream& stream, Matrix<T>& mat);
+	// Rows are separated by newlines and elements by spaces, each element formatted with the stream's width and
+	// precision. The stream is flushed once at the end.
+	template<typename T>
+	inline std::ostream& operator<<(std::ostream& stream, const Matrix<T>& mat);
+	template<typename Op, typename... Ts>
+	inline std::ostream& operator<<(std::ostream& stream, const ElementWiseExpr<Op, Ts...>& expr);
+
+	template<typename T>
+	inline constexpr Matrix<T>::RowCol::RowCol(size_t size, size_t stride, size_t* const map, T* const data) :
+		m_size(size),
+		m_stride(stride),
 		m_map(map),
 		m_data(data)
 	{}
 
+	template<typename T>
+	inline constexpr size_t Matrix<T>::RowCol::size() const
+	{
+		return m_size;
+	}
+
 	template<typename T>
 	inline constexpr T& Matrix<T>::RowCol::get(size_t i)
 	{
-		return m_data[m_map[i] * m_stride];
+		return m_data[index(m_map, i) * m_stride];
 	}
 
 	template<typename T>
 	inline constexpr const T& Matrix<T>::RowCol::get(size_t i) const
 	{
-		return m_data[m_map[i] * m_stride];
+		return m_data[index(m_map, i) * m_stride];
 	}
 
 	template<typename T>
@@ -359,10 +720,67 @@ namespace math
 		return get(i);
 	}
 
+	template<typename T>
+	inline constexpr bool Matrix<T>::RowCol::isAffine() const
+	{
+		for (size_t i = 1; m_map != nullptr && i < m_size; i++)
+		{
+			if (m_map[i] != m_map[i - 1] + 1)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<typename T>
+	inline constexpr StridedSpan<T> Matrix<T>::RowCol::span()
+	{
+		assert(isAffine());
+		return StridedSpan<T>(m_data + (m_size > 0 ? index(m_map, 0) * m_stride : 0), m_size, m_stride);
+	}
+
+	template<typename T>
+	inline constexpr StridedSpan<const T> Matrix<T>::RowCol::span() const
+	{
+		assert(isAffine());
+		return StridedSpan<const T>(m_data + (m_size > 0 ? index(m_map, 0) * m_stride : 0), m_size, m_stride);
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> Matrix<T>::RowCol::begin()
+	{
+		return MappedIterator<T>(m_data, m_stride, m_map, 0);
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<const T> Matrix<T>::RowCol::begin() const
+	{
+		return MappedIterator<const T>(m_data, m_stride, m_map, 0);
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> Matrix<T>::RowCol::end()
+	{
+		return MappedIterator<T>(m_data, m_stride, m_map, m_size);
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<const T> Matrix<T>::RowCol::end() const
+	{
+		return MappedIterator<const T>(m_data, m_stride, m_map, m_size);
+	}
+
+	template<typename T>
+	inline constexpr size_t Matrix<T>::index(const size_t* map, size_t i)
+	{
+		return map == nullptr ? i : map[i];
+	}
+
 	template<typename T>
 	inline constexpr size_t* Matrix<T>::identityMap(size_t size)
 	{
-		size_t* ret = new size_t[size];
+		size_t* ret = alloc::allocate<size_t>(size);
 		for (size_t i = 0; i < size; i++)
 		{
 			ret[i] = i;
@@ -373,7 +791,11 @@ namespace math
 	template<typename T>
 	inline constexpr size_t* Matrix<T>::subMap(const size_t* map, size_t i, size_t size)
 	{
-		size_t* ret = new size_t[size];
+		if (map == nullptr)
+		{
+			return nullptr;
+		}
+		size_t* ret = alloc::allocate<size_t>(size);
 		memcpy(ret, map + i, sizeof(size_t) * size);
 		return ret;
 	}
@@ -381,40 +803,43 @@ namespace math
 	template<typename T>
 	inline constexpr size_t* Matrix<T>::subMap(const size_t* map, const size_t* retain, size_t size)
 	{
-		size_t* ret = new size_t[size];
+		size_t* ret = alloc::allocate<size_t>(size);
 		for (size_t i = 0; i < size; i++)
 		{
-			ret[i] = map[retain[i]];
+			ret[i] = index(map, retain[i]);
 		}
 		return ret;
 	}
 
 	template<typename T>
-	inline constexpr Matrix<T>::Matrix(size_t iSize, size_t jSize, size_t iStride, size_t jStride, size_t size, size_t* iMap, size_t* jMap, T* data, size_t* referenceCount) :
+	inline constexpr Matrix<T>::Matrix(size_t iSize, size_t jSize, size_t iStride, size_t jStride, size_t size, size_t offset, size_t* iMap, size_t* jMap, T* data, alloc::ReferenceCount* referenceCount) :
 		m_iSize(iSize),
 		m_jSize(jSize),
 		m_iStride(iStride),
 		m_jStride(jStride),
+		m_size(size),
+		m_offset(offset),
 		m_iMap(iMap),
 		m_jMap(jMap),
-		m_size(size),
 		m_data(data),
-		m_referenceCount(referenceCount)
+		m_referenceCount(referenceCount),
+		m_view(false),
+		m_sharing(Sharing::Exclusive)
 	{}
 
 	template<typename T>
-	inline constexpr Matrix<T>::Matrix(size_t iSize, size_t jSize, size_t size, T* data, size_t* referenceCount) :
-		Matrix(iSize, jSize, jSize, 1, size, identityMap(iSize), identityMap(jSize), data, referenceCount)
+	inline constexpr Matrix<T>::Matrix(size_t iSize, size_t jSize, size_t size, T* data) :
+		Matrix(iSize, jSize, jSize, 1, size, 0, nullptr, nullptr, data, &alloc::block(data).referenceCount)
 	{}
 
 	template<typename T>
 	inline constexpr Matrix<T>::Matrix() :
-		Matrix(0, 0, 0, 1, 0, nullptr, nullptr, nullptr, nullptr)
+		Matrix(0, 0, 0, 1, 0, 0, nullptr, nullptr, nullptr, nullptr)
 	{}
 
 	template<typename T>
 	inline constexpr Matrix<T>::Matrix(size_t iSize, size_t jSize) :
-		Matrix(iSize, jSize, iSize * jSize, new T[iSize * jSize], new size_t(1))
+		Matrix(iSize, jSize, iSize * jSize, alloc::allocate<T>(iSize * jSize))
 	{}
 
 	template<typename T>
@@ -441,6 +866,14 @@ namespace math
 		std::fill(m_data + idx, m_data + m_size, 0);
 	}
 
+	template<typename T>
+	inline constexpr Matrix<T>::Matrix(size_t iSize, size_t jSize, T* data, alloc::ReferenceCount* referenceCount) :
+		Matrix(iSize, jSize, jSize, 1, iSize * jSize, 0, nullptr, nullptr, data, referenceCount)
+	{
+		// Other matrices may view the same external data.
+		countView();
+	}
+
 	template<typename T>
 	inline Matrix<T>::~Matrix()
 	{
@@ -450,62 +883,137 @@ namespace math
 	template<typename T>
 	inline constexpr void Matrix<T>::addRef() const
 	{
-		(*m_referenceCount)++;
+		if (m_referenceCount != nullptr)
+		{
+			m_referenceCount->increment();
+		}
 	}
 
 	template<typename T>
-	inline constexpr void Matrix<T>::remRef() const
+	inline constexpr bool Matrix<T>::remRef() const
 	{
-		(*m_referenceCount)--;
+		return m_referenceCount->decrement();
 	}
 
 	template<typename T>
-	inline constexpr Matrix<T>::Matrix(const Matrix& mat) :
-		Matrix(mat.m_iSize, mat.m_jSize)
+	inline constexpr size_t Matrix<T>::subOffset(size_t i, size_t j) const
 	{
-		for (size_t i = 0; i < m_jSize; i++)
+		return m_offset + (m_iMap == nullptr ? i * m_iStride : 0) + (m_jMap == nullptr ? j * m_jStride : 0);
+	}
+
+	template<typename T>
+	inline constexpr void Matrix<T>::swapData(Matrix& mat) noexcept
+	{
+		std::swap(m_iSize, mat.m_iSize);
+		std::swap(m_jSize, mat.m_jSize);
+		std::swap(m_iStride, mat.m_iStride);
+		std::swap(m_jStride, mat.m_jStride);
+		std::swap(m_size, mat.m_size);
+		std::swap(m_offset, mat.m_offset);
+		std::swap(m_iMap, mat.m_iMap);
+		std::swap(m_jMap, mat.m_jMap);
+		std::swap(m_data, mat.m_data);
+		std::swap(m_referenceCount, mat.m_referenceCount);
+		std::swap(m_view, mat.m_view);
+	}
+
+	template<typename T>
+	inline constexpr void Matrix<T>::unshare()
+	{
+		if (m_sharing.load(std::memory_order_acquire) != Sharing::Exclusive)
 		{
-			RowCol thisRow = row(i);
-			RowCol matRow = mat.row(i);
-			for (size_t j = 0; j < m_iSize; j++)
+			detach();
+		}
+	}
+
+	template<typename T>
+	inline void Matrix<T>::detach()
+	{
+		Sharing expected = Sharing::CopyOnWrite;
+		if (!m_sharing.compare_exchange_strong(expected, Sharing::Detaching, std::memory_order_acquire))
+		{
+			while (m_sharing.load(std::memory_order_acquire) != Sharing::Exclusive)
 			{
-				thisRow[j] = matRow[j];
+				std::this_thread::yield();
 			}
+			return;
+		}
+		// The copy may have detached or gone away already.
+		if (referenceCount() > 1)
+		{
+			Matrix mat = copySubmatrix((size_t)0, (size_t)0, m_iSize, m_jSize);
+			swapData(mat);
+		}
+		m_sharing.store(Sharing::Exclusive, std::memory_order_release);
+	}
+
+	template<typename T>
+	inline constexpr void Matrix<T>::countView()
+	{
+		if (m_referenceCount != nullptr && !m_view)
+		{
+			alloc::block(m_referenceCount).views.increment();
+			m_view = true;
+		}
+	}
+
+	template<typename T>
+	inline constexpr Matrix<T> Matrix<T>::shareConst(Matrix&& view) const
+	{
+		if (m_sharing.load(std::memory_order_acquire) != Sharing::Exclusive)
+		{
+			view.m_sharing.store(Sharing::CopyOnWrite, std::memory_order_relaxed);
+		}
+		else
+		{
+			view.countView();
+		}
+		return std::move(view);
+	}
+
+	template<typename T>
+	inline constexpr Matrix<T>::Matrix(const Matrix& mat) :
+		Matrix()
+	{
+		if (mat.m_data == nullptr)
+		{
+			return;
 		}
+		if (alloc::block(mat.m_referenceCount).views.get() > 0)
+		{
+			Matrix copy = mat.copySubmatrix((size_t)0, (size_t)0, mat.m_iSize, mat.m_jSize);
+			swapData(copy);
+			return;
+		}
+		m_iSize = mat.m_iSize;
+		m_jSize = mat.m_jSize;
+		m_iStride = mat.m_iStride;
+		m_jStride = mat.m_jStride;
+		m_size = mat.m_size;
+		m_offset = mat.m_offset;
+		m_iMap = subMap(mat.m_iMap, (size_t)0, mat.m_iSize);
+		m_jMap = subMap(mat.m_jMap, (size_t)0, mat.m_jSize);
+		m_data = mat.m_data;
+		m_referenceCount = mat.m_referenceCount;
+		addRef();
+		m_sharing.store(Sharing::CopyOnWrite, std::memory_order_relaxed);
+		mat.m_sharing.store(Sharing::CopyOnWrite, std::memory_order_relaxed);
 	}
 
 	template<typename T>
 	inline constexpr Matrix<T>::Matrix(Matrix&& mat) noexcept :
-		Matrix(mat.m_iSize, mat.m_jSize, mat.m_iStride, mat.m_jStride, mat.m_size, subMap(mat.m_iMap, (size_t)0, mat.m_iSize), subMap(mat.m_jMap, (size_t)0, mat.m_jSize), mat.m_data, mat.m_referenceCount)
+		Matrix()
 	{
-		addRef();
+		swap(mat);
 	}
 
 	template<typename T>
 	inline constexpr Matrix<T>& Matrix<T>::operator=(const Matrix& mat)
 	{
-		if (&mat == this)
-		{
-			return;
-		}
-		clear();
-		m_iSize = mat.m_iSize;
-		m_jSize = mat.m_jSize;
-		m_iStride = mat.m_iStride;
-		m_jStride = mat.m_jStride;
-		m_size = mat.m_size;
-		m_iMap = identityMap(m_iSize);
-		m_jMap = identityMap(m_jSize);
-		m_data = new T[m_size];
-		m_referenceCount = new size_t(1);
-		for (size_t i = 0; i < m_jSize; i++)
+		if (&mat != this)
 		{
-			RowCol thisRow = row(i);
-			RowCol matRow = mat.row(i);
-			for (size_t j = 0; j < m_iSize; j++)
-			{
-				thisRow[j] = matRow[j];
-			}
+			Matrix copy(mat);
+			swap(copy);
 		}
 		return *this;
 	}
@@ -513,21 +1021,11 @@ namespace math
 	template<typename T>
 	inline constexpr Matrix<T>& Matrix<T>::operator=(Matrix&& mat) noexcept
 	{
-		if (&mat == this)
+		if (&mat != this)
 		{
-			return;
+			clear();
+			swap(mat);
 		}
-		clear();
-		m_iSize = mat.m_iSize;
-		m_jSize = mat.m_jSize;
-		m_iStride = mat.m_iStride;
-		m_jStride = mat.m_jStride;
-		m_size = mat.m_size;
-		m_iMap = mat.m_iMap;
-		m_jMap = mat.m_jMap;
-		m_data = mat.m_data;
-		m_referenceCount = mat.m_referenceCount;
-		addRef();
 		return *this;
 	}
 
@@ -554,6 +1052,34 @@ namespace math
 		return *this;
 	}
 
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>::Matrix(const ElementWiseExpr<Op, Ts...>& expr) :
+		Matrix(expr.iSize(), expr.jSize())
+	{
+		expr.assignTo(*this);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		if (m_data == nullptr || m_iSize != expr.iSize() || m_jSize != expr.jSize())
+		{
+			Matrix mat(expr);
+			swap(mat);
+			return *this;
+		}
+		return elementWiseInto(*this, expr);
+	}
+
+	template<typename T>
+	inline constexpr void Matrix<T>::swap(Matrix& mat) noexcept
+	{
+		swapData(mat);
+		m_sharing.store(mat.m_sharing.exchange(m_sharing.load(std::memory_order_relaxed), std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
 	template<typename T>
 	inline constexpr void Matrix<T>::clear()
 	{
@@ -561,22 +1087,28 @@ namespace math
 		{
 			return;
 		}
-		remRef();
-		if (*m_referenceCount == 0)
+		if (m_view)
 		{
-			delete[] m_data;
+			alloc::block(m_referenceCount).views.decrement();
+			m_view = false;
 		}
-		delete[] m_iMap;
-		delete[] m_jMap;
+		if (remRef())
+		{
+			alloc::release<T>(m_referenceCount);
+		}
+		alloc::deallocate(m_iMap);
+		alloc::deallocate(m_jMap);
 		m_jSize = 0;
 		m_iSize = 0;
 		m_iStride = 0;
 		m_jStride = 1;
 		m_size = 0;
+		m_offset = 0;
 		m_iMap = nullptr;
 		m_jMap = nullptr;
 		m_data = nullptr;
 		m_referenceCount = nullptr;
+		m_sharing.store(Sharing::Exclusive, std::memory_order_relaxed);
 	}
 
 	template<typename T>
@@ -609,6 +1141,12 @@ namespace math
 		return m_size;
 	}
 
+	template<typename T>
+	inline constexpr size_t Matrix<T>::offset() const
+	{
+		return m_offset;
+	}
+
 	template<typename T>
 	inline constexpr size_t* Matrix<T>::iMap()
 	{
@@ -636,6 +1174,7 @@ namespace math
 	template<typename T>
 	inline constexpr T* Matrix<T>::data()
 	{
+		unshare();
 		return m_data;
 	}
 
@@ -648,43 +1187,90 @@ namespace math
 	template<typename T>
 	inline constexpr size_t Matrix<T>::referenceCount() const
 	{
-		return *m_referenceCount;
+		return m_referenceCount == nullptr ? 0 : m_referenceCount->get();
+	}
+
+	template<typename T>
+	inline constexpr bool Matrix<T>::isAffine() const
+	{
+		if (m_iMap == nullptr && m_jMap == nullptr)
+		{
+			return true;
+		}
+		for (size_t i = 1; m_iMap != nullptr && i < m_iSize; i++)
+		{
+			if (m_iMap[i] != m_iMap[i - 1] + 1)
+			{
+				return false;
+			}
+		}
+		for (size_t j = 1; m_jMap != nullptr && j < m_jSize; j++)
+		{
+			if (m_jMap[j] != m_jMap[j - 1] + 1)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<typename T>
+	inline constexpr bool Matrix<T>::isContiguous() const
+	{
+		return isAffine() && (m_jSize <= 1 || m_jStride == 1) && (m_iSize <= 1 || m_iStride == m_jSize);
+	}
+
+	template<typename T>
+	inline constexpr Span<T> Matrix<T>::span()
+	{
+		assert(isContiguous());
+		return m_iSize > 0 && m_jSize > 0 ? Span<T>(&get(0, 0), m_iSize * m_jSize) : Span<T>();
+	}
+
+	template<typename T>
+	inline constexpr Span<const T> Matrix<T>::span() const
+	{
+		assert(isContiguous());
+		return m_iSize > 0 && m_jSize > 0 ? Span<const T>(&get(0, 0), m_iSize * m_jSize) : Span<const T>();
 	}
 
 	template<typename T>
 	inline constexpr typename Matrix<T>::RowCol Matrix<T>::row(size_t i)
 	{
-		return RowCol(m_jStride, m_jMap, m_data + m_iMap[i] * m_iStride);
+		unshare();
+		return RowCol(m_jSize, m_jStride, m_jMap, m_data + m_offset + index(m_iMap, i) * m_iStride);
 	}
 
 	template<typename T>
-	inline constexpr typename const Matrix<T>::RowCol Matrix<T>::row(size_t i) const
+	inline constexpr const typename Matrix<T>::RowCol Matrix<T>::row(size_t i) const
 	{
-		return RowCol(m_jStride, m_jMap, m_data + m_iMap[i] * m_iStride);
+		return RowCol(m_jSize, m_jStride, m_jMap, m_data + m_offset + index(m_iMap, i) * m_iStride);
 	}
 
 	template<typename T>
 	inline constexpr typename Matrix<T>::RowCol Matrix<T>::col(size_t j)
 	{
-		return RowCol(m_iStride, m_iMap, m_data + m_jMap[j] * m_jStride);
+		unshare();
+		return RowCol(m_iSize, m_iStride, m_iMap, m_data + m_offset + index(m_jMap, j) * m_jStride);
 	}
 
 	template<typename T>
-	inline constexpr typename const Matrix<T>::RowCol Matrix<T>::col(size_t j) const
+	inline constexpr const typename Matrix<T>::RowCol Matrix<T>::col(size_t j) const
 	{
-		return RowCol(m_iStride, m_iMap, m_data + m_jMap[j] * m_jStride);
+		return RowCol(m_iSize, m_iStride, m_iMap, m_data + m_offset + index(m_jMap, j) * m_jStride);
 	}
 
 	template<typename T>
 	inline constexpr T& Matrix<T>::get(size_t i, size_t j)
 	{
-		return m_data[m_iMap[i] * m_iStride + m_jMap[j] * m_jStride];
+		unshare();
+		return m_data[m_offset + index(m_iMap, i) * m_iStride + index(m_jMap, j) * m_jStride];
 	}
 
 	template<typename T>
 	inline constexpr const T& Matrix<T>::get(size_t i, size_t j) const
 	{
-		return m_data[m_iMap[i] * m_iStride + m_jMap[j] * m_jStride];
+		return m_data[m_offset + index(m_iMap, i) * m_iStride + index(m_jMap, j) * m_jStride];
 	}
 
 	template<typename T>
@@ -729,12 +1315,13 @@ namespace math
 		m_iSize = iSize;
 		m_jSize = jSize;
 		m_size = iSize * jSize;
+		m_offset = subOffset(i, j);
 		size_t* temp = m_iMap;
 		m_iMap = subMap(m_iMap, i, iSize);
-		delete[] temp;
+		alloc::deallocate(temp);
 		temp = m_jMap;
-		m_jMap = subMap(m_iMap, j, jSize);
-		delete[] temp;
+		m_jMap = subMap(m_jMap, j, jSize);
+		alloc::deallocate(temp);
 		return *this;
 	}
 
@@ -746,10 +1333,10 @@ namespace math
 		m_size = iSize * jSize;
 		size_t* temp = m_iMap;
 		m_iMap = subMap(m_iMap, iRetain, iSize);
-		delete[] temp;
+		alloc::deallocate(temp);
 		temp = m_jMap;
-		m_jMap = subMap(m_iMap, jRetain, jSize);
-		delete[] temp;
+		m_jMap = subMap(m_jMap, jRetain, jSize);
+		alloc::deallocate(temp);
 		return *this;
 	}
 
@@ -766,8 +1353,24 @@ namespace math
 	inline constexpr Matrix<T> Matrix<T>::copySubmatrix(size_t i, size_t j, size_t iSize, size_t jSize) const
 	{
 		Matrix mat(iSize, jSize);
+		bool affine = isAffine();
 		for (size_t k = 0; k < iSize; k++)
 		{
+			if (affine)
+			{
+				// Contiguous rows copy as a block.
+				StridedSpan<const T> src = row(k + i).span().subspan(j, jSize);
+				T* dst = mat.row(k).span().data();
+				if (src.isContiguous())
+				{
+					std::copy(src.contiguous().begin(), src.contiguous().end(), dst);
+				}
+				else
+				{
+					std::copy(src.begin(), src.end(), dst);
+				}
+				continue;
+			}
 			RowCol matRow = mat.row(k);
 			RowCol thisRow = row(k + i);
 			for (size_t l = 0; l < jSize; l++)
@@ -813,48 +1416,61 @@ namespace math
 	template<typename T>
 	inline constexpr Matrix<T> Matrix<T>::shareSubmatrix(size_t i, size_t j, size_t iSize, size_t jSize)
 	{
+		unshare();
 		addRef();
-		return Matrix(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, subMap(m_iMap, i, iSize), subMap(m_jMap, j, jSize), m_data, m_referenceCount);
+		Matrix view(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, subOffset(i, j), subMap(m_iMap, i, iSize), subMap(m_jMap, j, jSize), m_data, m_referenceCount);
+		view.countView();
+		return view;
 	}
 
 	template<typename T>
 	inline constexpr const Matrix<T> Matrix<T>::shareSubmatrix(size_t i, size_t j, size_t iSize, size_t jSize) const
 	{
 		addRef();
-		return Matrix(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, subMap(m_iMap, i, iSize), subMap(m_jMap, j, jSize), m_data, m_referenceCount);
+		return shareConst(Matrix(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, subOffset(i, j), subMap(m_iMap, i, iSize), subMap(m_jMap, j, jSize), m_data, m_referenceCount));
 	}
 
 	template<typename T>
 	inline constexpr Matrix<T> Matrix<T>::shareSubmatrix(const size_t* iRetain, const size_t* jRetain, size_t iSize, size_t jSize)
 	{
+		unshare();
 		addRef();
-		return Matrix(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, subMap(m_iMap, iRetain, iSize), subMap(m_jMap, jRetain, jSize), m_data, m_referenceCount);
+		Matrix view(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, m_offset, subMap(m_iMap, iRetain, iSize), subMap(m_jMap, jRetain, jSize), m_data, m_referenceCount);
+		view.countView();
+		return view;
 	}
 
 	template<typename T>
 	inline constexpr const Matrix<T> Matrix<T>::shareSubmatrix(const size_t* iRetain, const size_t* jRetain, size_t iSize, size_t jSize) const
 	{
 		addRef();
-		return Matrix(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, subMap(m_iMap, iRetain, iSize), subMap(m_jMap, jRetain, jSize), m_data, m_referenceCount);
+		return shareConst(Matrix(iSize, jSize, m_iStride, m_jStride, m_iSize * m_jSize, m_offset, subMap(m_iMap, iRetain, iSize), subMap(m_jMap, jRetain, jSize), m_data, m_referenceCount));
 	}
 
 	template<typename T>
 	inline constexpr Matrix<T> Matrix<T>::shareTranspose()
 	{
+		unshare();
 		addRef();
-		return Matrix(m_jSize, m_iSize, m_jStride, m_iStride, m_iSize * m_jSize, subMap(m_jMap, (size_t)0, m_jSize), subMap(m_iMap, (size_t)0, m_iSize), m_data, m_referenceCount);
+		Matrix view(m_jSize, m_iSize, m_jStride, m_iStride, m_iSize * m_jSize, m_offset, subMap(m_jMap, (size_t)0, m_jSize), subMap(m_iMap, (size_t)0, m_iSize), m_data, m_referenceCount);
+		view.countView();
+		return view;
 	}
 
 	template<typename T>
 	inline constexpr const Matrix<T> Matrix<T>::shareTranspose() const
 	{
 		addRef();
-		return Matrix(m_jSize, m_iSize, m_jStride, m_iStride, m_iSize * m_jSize, subMap(m_jMap, (size_t)0, m_jSize), subMap(m_iMap, (size_t)0, m_iSize), m_data, m_referenceCount);
+		return shareConst(Matrix(m_jSize, m_iSize, m_jStride, m_iStride, m_iSize * m_jSize, m_offset, subMap(m_jMap, (size_t)0, m_jSize), subMap(m_iMap, (size_t)0, m_iSize), m_data, m_referenceCount));
 	}
 
 	template<typename T>
 	inline constexpr Matrix<T>& Matrix<T>::swapRows(size_t i1, size_t i2)
 	{
+		if (m_iMap == nullptr)
+		{
+			m_iMap = identityMap(m_iSize);
+		}
 		std::swap(m_iMap[i1], m_iMap[i2]);
 		return *this;
 	}
@@ -862,421 +1478,773 @@ namespace math
 	template<typename T>
 	inline constexpr Matrix<T>& Matrix<T>::swapCols(size_t j1, size_t j2)
 	{
-		std::swap(m_jMap[j1], m_jMap[j2]);
-		return *this;
+		if (m_jMap == nullptr)
+		{
+			m_jMap = identityMap(m_jSize);
+		}
+		std::swap(m_jMap[j1], m_jMap[j2]);
+		return *this;
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseExpr<Op, Ts...>::ElementWiseExpr(const Op& op, const Ts&... params) :
+		m_op(op),
+		m_params(params...),
+		m_iSize(0),
+		m_jSize(0)
+	{
+		(ElementWiseHelper::shape(params, m_iSize, m_jSize), ...);
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr size_t ElementWiseExpr<Op, Ts...>::iSize() const
+	{
+		return m_iSize;
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr size_t ElementWiseExpr<Op, Ts...>::jSize() const
+	{
+		return m_jSize;
+	}
+
+	template<typename Op, typename... Ts>
+	template<size_t... Is>
+	inline constexpr ElementWiseRes<Op, Ts...> ElementWiseExpr<Op, Ts...>::get(size_t i, size_t j, std::index_sequence<Is...>) const
+	{
+		return m_op(ElementWiseHelper::index(std::get<Is>(m_params), i, j)...);
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr typename ElementWiseExpr<Op, Ts...>::value_type ElementWiseExpr<Op, Ts...>::get(size_t i, size_t j) const
+	{
+		return get(i, j, std::index_sequence_for<Ts...>());
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr typename ElementWiseExpr<Op, Ts...>::value_type ElementWiseExpr<Op, Ts...>::operator()(size_t i, size_t j) const
+	{
+		return get(i, j);
+	}
+
+	template<typename Op, typename... Ts>
+	template<size_t... Is>
+	inline constexpr bool ElementWiseExpr<Op, Ts...>::contiguous(std::index_sequence<Is...>) const
+	{
+		return (ElementWiseHelper::contiguous(std::get<Is>(m_params)) && ...);
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr bool ElementWiseExpr<Op, Ts...>::contiguous() const
+	{
+		return contiguous(std::index_sequence_for<Ts...>());
+	}
+
+	template<typename Op, typename... Ts>
+	template<typename R, size_t... Is>
+	inline void ElementWiseExpr<Op, Ts...>::evaluate(size_t i, size_t j, size_t n, bool flat, R* out, std::index_sequence<Is...>) const
+	{
+		std::tuple<typename ElementWiseHelper::Scratch<Ts>::type...> scratch;
+		ElementWiseHelper::apply(m_op, n, out, ElementWiseHelper::chunk(std::get<Is>(m_params), i, j, n, flat, std::get<Is>(scratch).data())...);
+	}
+
+	template<typename Op, typename... Ts>
+	template<typename R>
+	inline void ElementWiseExpr<Op, Ts...>::evaluate(size_t i, size_t j, size_t n, bool flat, R* out) const
+	{
+		evaluate(i, j, n, flat, out, std::index_sequence_for<Ts...>());
+	}
+
+	template<typename Op, typename... Ts>
+	template<typename T>
+	inline void ElementWiseExpr<Op, Ts...>::assignTo(Matrix<T>& mat) const
+	{
+		constexpr size_t chunkSize = ElementWiseHelper::chunkSize;
+		if (mat.iSize() == 0 || mat.jSize() == 0)
+		{
+			return;
+		}
+		mat.unshare();
+		bool flat = ElementWiseHelper::contiguous(mat) && contiguous();
+		size_t iSize = flat ? 1 : mat.iSize();
+		size_t jSize = flat ? mat.iSize() * mat.jSize() : mat.jSize();
+		size_t chunks = (jSize + chunkSize - 1) / chunkSize;
+		T* first = &mat(0, 0);
+		// Chunks are independent, so they are spread over the thread pool for large matrices.
+		parallel::forRange(iSize * chunks, mat.iSize() * mat.jSize(), [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				size_t i = c / chunks;
+				size_t j = c % chunks * chunkSize;
+				size_t n = std::min(chunkSize, jSize - j);
+				if (flat)
+				{
+					evaluate(i, j, n, flat, first + j);
+					continue;
+				}
+				typename Matrix<T>::RowCol row = mat[i];
+				if (ElementWiseHelper::contiguous(mat, j, n))
+				{
+					evaluate(i, j, n, flat, &row[j]);
+				}
+				else
+				{
+					std::array<T, chunkSize> buffer;
+					evaluate(i, j, n, flat, buffer.data());
+					for (size_t k = 0; k < n; k++)
+					{
+						row[j + k] = buffer[k];
+					}
+				}
+			}
+		});
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<typename ElementWiseExpr<Op, Ts...>::value_type> ElementWiseExpr<Op, Ts...>::evaluate() const
+	{
+		return Matrix<value_type>(*this);
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseExpr<Op, Ts...>::operator Matrix<typename ElementWiseExpr<Op, Ts...>::value_type>() const
+	{
+		return evaluate();
+	}
+
+	template<typename T>
+	inline constexpr void ElementWiseHelper::shape(const T&, size_t&, size_t&)
+	{}
+
+	template<typename T>
+	inline constexpr void ElementWiseHelper::shape(const Matrix<T>& mat, size_t& iSize, size_t& jSize)
+	{
+		iSize = mat.iSize();
+		jSize = mat.jSize();
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr void ElementWiseHelper::shape(const ElementWiseExpr<Op, Ts...>& expr, size_t& iSize, size_t& jSize)
+	{
+		iSize = expr.iSize();
+		jSize = expr.jSize();
+	}
+
+	template<typename T>
+	inline constexpr const T& ElementWiseHelper::index(const T& val, size_t, size_t)
+	{
+		return val;
+	}
+
+	template<typename T>
+	inline constexpr const T& ElementWiseHelper::index(const Matrix<T>& mat, size_t i, size_t j)
+	{
+		return mat(i, j);
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseRes<Op, Ts...> ElementWiseHelper::index(const ElementWiseExpr<Op, Ts...>& expr, size_t i, size_t j)
+	{
+		return expr(i, j);
+	}
+
+	template<typename T, typename U>
+	inline constexpr bool ElementWiseHelper::aliases(const Matrix<T>&, const U&)
+	{
+		return false;
+	}
+
+	template<typename T, typename U>
+	inline constexpr bool ElementWiseHelper::aliases(const Matrix<T>& dst, const Matrix<U>& mat)
+	{
+		if (dst.iSize() == 0 || dst.jSize() == 0 || mat.iSize() == 0 || mat.jSize() == 0 ||
+			static_cast<const void*>(dst.data()) != static_cast<const void*>(mat.data()))
+		{
+			return false;
+		}
+		if (static_cast<const void*>(&dst) == static_cast<const void*>(&mat))
+		{
+			return false;
+		}
+		if (!std::is_same_v<T, U> || !dst.isAffine() || !mat.isAffine())
+		{
+			return true;
+		}
+		const T* dstFirst = &dst(0, 0);
+		const T* dstLast = &dst(dst.iSize() - 1, dst.jSize() - 1);
+		const T* matFirst = reinterpret_cast<const T*>(&mat(0, 0));
+		const T* matLast = reinterpret_cast<const T*>(&mat(mat.iSize() - 1, mat.jSize() - 1));
+		if (dstLast < matFirst || matLast < dstFirst)
+		{
+			return false;
+		}
+		// Strides only matter along dimensions with more than one element.
+		bool sameRows = dst.iSize() == 1 || dst.iStride() == mat.iStride();
+		bool sameCols = dst.jSize() == 1 || dst.jStride() == mat.jStride();
+		return !(dstFirst == matFirst && dst.iSize() == mat.iSize() && dst.jSize() == mat.jSize() && sameRows && sameCols);
+	}
+
+	template<typename T, typename Op, typename... Ts>
+	inline constexpr bool ElementWiseHelper::aliases(const Matrix<T>& dst, const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return std::apply([&](const auto&... params)
+		{
+			return (aliases(dst, params) || ...);
+		}, expr.m_params);
+	}
+
+	template<typename T>
+	inline constexpr bool ElementWiseHelper::contiguous(const T&)
+	{
+		return true;
+	}
+
+	template<typename T>
+	inline constexpr bool ElementWiseHelper::contiguous(const Matrix<T>& mat)
+	{
+		return mat.isAffine() && (mat.jStride() == 1 || mat.jSize() <= 1) && (mat.iStride() == mat.jSize() || mat.iSize() <= 1);
+	}
+
+	template<typename Op, typename... Ts>
+	inline constexpr bool ElementWiseHelper::contiguous(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return expr.contiguous();
+	}
+
+	template<typename T>
+	inline constexpr bool ElementWiseHelper::contiguous(const Matrix<T>& mat, size_t j, size_t n)
+	{
+		if (n <= 1)
+		{
+			return true;
+		}
+		if (mat.jStride() != 1)
+		{
+			return false;
+		}
+		const size_t* jMap = mat.jMap();
+		for (size_t k = 1; jMap != nullptr && k < n; k++)
+		{
+			if (jMap[j + k] != jMap[j] + k)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<typename T>
+	inline simd::Operand<T> ElementWiseHelper::chunk(const T& val, size_t, size_t, size_t, bool, T*)
+	{
+		return { &val, true };
+	}
+
+	template<typename T>
+	inline simd::Operand<T> ElementWiseHelper::chunk(const Matrix<T>& mat, size_t i, size_t j, size_t n, bool flat, T* scratch)
+	{
+		if (flat)
+		{
+			return { &mat(0, 0) + j, false };
+		}
+		if (contiguous(mat, j, n))
+		{
+			return { &mat(i, j), false };
+		}
+		for (size_t k = 0; k < n; k++)
+		{
+			scratch[k] = mat(i, j + k);
+		}
+		return { scratch, false };
+	}
+
+	template<typename Op, typename... Ts>
+	inline simd::Operand<ElementWiseRes<Op, Ts...>> ElementWiseHelper::chunk(const ElementWiseExpr<Op, Ts...>& expr, size_t i, size_t j, size_t n, bool flat, ElementWiseRes<Op, Ts...>* scratch)
+	{
+		expr.evaluate(i, j, n, flat, scratch);
+		return { scratch, false };
+	}
+
+	template<typename Op, typename R, typename... Ts>
+	inline void ElementWiseHelper::apply(const Op& op, size_t n, R* out, simd::Operand<Ts>... operands)
+	{
+		if constexpr (simd::isVectorizable<Op, R, Ts...>)
+		{
+			if (simd::isAvailable<std::common_type_t<Ts...>, simd::OpKind<Op>::kind>())
+			{
+				simd::apply(op, n, out, operands...);
+				return;
+			}
+		}
+		for (size_t k = 0; k < n; k++)
+		{
+			out[k] = op(at(operands, k)...);
+		}
+	}
+
+	template<typename T>
+	inline constexpr const T& ElementWiseHelper::at(const simd::Operand<T>& operand, size_t k)
+	{
+		return operand.data[operand.broadcast ? 0 : k];
+	}
+
+	template<typename Op, typename ...Ts>
+	inline constexpr Matrix<ElementWiseRes<Op, Ts...>> elementWise(const Op& op, const Ts & ...params)
+	{
+		return ElementWiseExpr<Op, Ts...>(op, params...).evaluate();
 	}
 
-	template<typename R, typename T0, typename... Ts>
-	inline constexpr Matrix<R> ElementWiseHelper::init(const T0& t0, const Ts&... ts)
+	template<typename T, typename Op, typename... Ts>
+	inline Matrix<T>& elementWiseInto(Matrix<T>& dst, const Op& op, const Ts&... params)
 	{
-		return init<R>(ts...);
+		return elementWiseInto(dst, ElementWiseExpr<Op, Ts...>(op, params...));
 	}
 
-	template<typename R, typename T0, typename... Ts>
-	inline constexpr Matrix<R> ElementWiseHelper::init(const Matrix<T0>& t0, const Ts&... ts)
+	template<typename T, typename Op, typename... Ts>
+	inline void elementWiseInto(Matrix<T>&& dst, const Op& op, const Ts&... params)
 	{
-		return Matrix<R>(t0.iSize(), t0.jSize());
+		elementWiseInto(dst, op, params...);
 	}
 
-	template<typename T>
-	inline constexpr const T& ElementWiseHelper::index(const T& val, size_t i, size_t j)
+	template<typename T, typename Op, typename... Ts>
+	inline Matrix<T>& elementWiseInto(Matrix<T>& dst, const ElementWiseExpr<Op, Ts...>& expr)
 	{
-		return val;
+		if (ElementWiseHelper::aliases(dst, expr))
+		{
+			Matrix<typename ElementWiseExpr<Op, Ts...>::value_type> res(expr);
+			ElementWiseExpr<func::identity<>, decltype(res)>(func::identity<>(), res).assignTo(dst);
+			return dst;
+		}
+		expr.assignTo(dst);
+		return dst;
 	}
 
-	template<typename T>
-	inline constexpr const T& ElementWiseHelper::index(const Matrix<T>& mat, size_t i, size_t j)
+	template<typename T, typename Op, typename... Ts>
+	inline void elementWiseInto(Matrix<T>&& dst, const ElementWiseExpr<Op, Ts...>& expr)
 	{
-		return mat(i, j);
+		elementWiseInto(dst, expr);
 	}
 
-	template<typename Op, typename ...Ts>
-	inline constexpr Matrix<ElementWiseRes<Op, Ts...>> elementWise(const Op& op, const Ts & ...params)
+	template<typename Add, typename Mul, typename T, typename U>
+	constexpr Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const Matrix<T>& lhs, const Matrix<U>& rhs)
 	{
-		Matrix<ElementWiseRes<Op, Ts...>> mat = ElementWiseHelper::init<ElementWiseRes<Op, Ts...>>(params...);
-		for (size_t i = 0; i < mat.iSize(); i++)
+		if constexpr (gemm::isAccelerated<Add, Mul, T, U>)
 		{
-			for (size_t j = 0; j < mat.jSize(); j++)
+			if (lhs.iSize() > 0 && lhs.jSize() > 0 && rhs.jSize() > 0 && lhs.isAffine() && rhs.isAffine())
 			{
-				mat(i, j) = op(ElementWiseHelper::index(params, i, j)...);
+				using R = MatMulRes<Mul, T, U>;
+				Matrix<R> res(lhs.iSize(), rhs.jSize());
+				gemm::gemm(lhs.iSize(), rhs.jSize(), lhs.jSize(),
+					R(1), &lhs(0, 0), lhs.iStride(), lhs.jStride(), &rhs(0, 0), rhs.iStride(), rhs.jStride(),
+					R(0), res.data(), res.iStride(), res.jStride());
+				return res;
 			}
 		}
-		return mat;
+		Matrix<MatMulRes<Mul, T, U>> res(lhs.iSize(), rhs.jSize(), 0);
+		parallel::forRange(lhs.iSize(), lhs.iSize() * rhs.jSize() * lhs.jSize(), [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				typename Matrix<T>::RowCol lhsRow = lhs[i];
+				typename Matrix<MatMulRes<Mul, T, U>>::RowCol resRow = res[i];
+				for (size_t j = 0; j < rhs.jSize(); j++)
+				{
+					MatMulRes<Mul, T, U>& resVal = resRow[j];
+					typename Matrix<U>::RowCol rhsCol = rhs(j);
+					for (size_t k = 0; k < lhs.jSize(); k++)
+					{
+						resVal = add(resVal, mul(lhsRow[k], rhsCol[k]));
+					}
+				}
+			}
+		});
+		return res;
 	}
 
-	template<typename Add, typename Mul, typename T, typename U>
-	constexpr Matrix<MatMulRes<Mul, T, U>> matMul(const Add& add, const Mul& mul, const Matrix<T>& lhs, const Matrix<U>& rhs)
+	template<typename T, typename U, typename V>
+	inline constexpr Matrix<T>& matMulInto(const T& alpha, const Matrix<U>& lhs, const Matrix<V>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose, bool rhsTranspose)
 	{
-		Matrix<MatMulRes<Mul, T, U>> res(lhs.iSize(), rhs.jSize(), 0);
-		for (size_t i = 0; i < lhs.iSize(); i++)
+		size_t kSize = lhsTranspose ? lhs.iSize() : lhs.jSize();
+		if ((rhsTranspose ? rhs.jSize() : rhs.iSize()) != kSize || res.iSize() != (lhsTranspose ? lhs.jSize() : lhs.iSize()) || res.jSize() != (rhsTranspose ? rhs.iSize() : rhs.jSize()))
 		{
-			typename Matrix<T>::RowCol lhsRow = lhs[i];
-			typename Matrix<MatMulRes<Mul, T, U>>::RowCol resRow = res[i];
-			for (size_t j = 0; j < rhs.jSize(); j++)
+			throw std::invalid_argument("matMulInto operands and result must have matching sizes");
+		}
+		if constexpr (gemm::isAccelerated<std::plus<>, std::multiplies<>, U, V> && std::is_same_v<Accumulator<U>, T>)
+		{
+			if (lhs.isAffine() && rhs.isAffine() && res.isAffine())
 			{
-				MatMulRes<Mul, T, U>& resVal = resRow[j];
-				typename Matrix<T>::RowCol rhsCol = rhs(j);
-				for (size_t k = 0; k < lhs.jSize(); k++)
+				if (res.iSize() > 0 && res.jSize() > 0)
 				{
-					resVal = add(resVal, mul(lhsRow[k], rhsCol[k]));
+					// Transposing an operand only swaps its strides.
+					size_t rsA = lhsTranspose ? lhs.jStride() : lhs.iStride();
+					size_t csA = lhsTranspose ? lhs.iStride() : lhs.jStride();
+					size_t rsB = rhsTranspose ? rhs.jStride() : rhs.iStride();
+					size_t csB = rhsTranspose ? rhs.iStride() : rhs.jStride();
+					gemm::gemm(res.iSize(), res.jSize(), kSize,
+						alpha, kSize > 0 ? &lhs(0, 0) : nullptr, rsA, csA, kSize > 0 ? &rhs(0, 0) : nullptr, rsB, csB,
+						beta, &res(0, 0), res.iStride(), res.jStride());
 				}
+				return res;
 			}
 		}
+		res.unshare();
+		parallel::forRange(res.iSize(), res.iSize() * res.jSize() * std::max<size_t>(kSize, 1), [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				typename Matrix<T>::RowCol resRow = res[i];
+				for (size_t j = 0; j < res.jSize(); j++)
+				{
+					T sum = 0;
+					for (size_t k = 0; k < kSize; k++)
+					{
+						sum += T(lhsTranspose ? lhs(k, i) : lhs(i, k)) * T(rhsTranspose ? rhs(j, k) : rhs(k, j));
+					}
+					resRow[j] = beta == T(0) ? alpha * sum : alpha * sum + beta * resRow[j];
+				}
+			}
+		});
 		return res;
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const Matrix<T>& mat)
+	template<typename T, typename U, typename V>
+	inline constexpr void matMulInto(const T& alpha, const Matrix<U>& lhs, const Matrix<V>& rhs, const T& beta, Matrix<T>&& res, bool lhsTranspose, bool rhsTranspose)
 	{
-		return elementWise(std::negate(), mat);
+		matMulInto(alpha, lhs, rhs, beta, res, lhsTranspose, rhsTranspose);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator+(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename U, typename T>
+	inline Matrix<U> convert(const Matrix<T>& mat)
 	{
-		return elementWise(std::plus(), lhs, rhs);
+		Matrix<U> res(mat.iSize(), mat.jSize());
+		convertInto(res, mat);
+		return res;
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator+(const Matrix<T>& lhs, const T& rhs)
+	template<typename U, typename T>
+	inline Matrix<U>& convertInto(Matrix<U>& dst, const Matrix<T>& src)
 	{
-		return elementWise(std::plus(), lhs, rhs);
+		size_t jSize = src.jSize();
+		if (jSize == 0)
+		{
+			return dst;
+		}
+		bool rows = src.isAffine() && dst.isAffine() && ((src.jStride() == 1 && dst.jStride() == 1) || jSize == 1);
+		dst.unshare();
+		parallel::forRange(src.iSize(), src.iSize() * jSize, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				typename Matrix<U>::RowCol dstRow = dst[i];
+				if (rows)
+				{
+					convert(jSize, &src(i, 0), &dstRow[0]);
+				}
+				else
+				{
+					for (size_t j = 0; j < jSize; j++)
+					{
+						dstRow[j] = U(src(i, j));
+					}
+				}
+			}
+		});
+		return dst;
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator+(const T& lhs, const Matrix<T>& rhs)
+	template<typename U, typename T>
+	inline void convertInto(Matrix<U>&& dst, const Matrix<T>& src)
 	{
-		return elementWise(std::plus(), lhs, rhs);
+		convertInto(dst, src);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename T, typename>
+	inline constexpr ElementWiseExpr<std::negate<>, T> operator-(const T& mat)
 	{
-		return elementWise(std::minus(), lhs, rhs);
+		return ElementWiseExpr<std::negate<>, T>(std::negate<>(), mat);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::plus<>, L, R> operator+(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::minus(), lhs, rhs);
+		return ElementWiseExpr<std::plus<>, L, R>(std::plus<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator-(const T& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::minus<>, L, R> operator-(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::minus(), lhs, rhs);
+		return ElementWiseExpr<std::minus<>, L, R>(std::minus<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator*(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::multiplies<>, L, R> operator*(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::multiplies(), lhs, rhs);
+		return ElementWiseExpr<std::multiplies<>, L, R>(std::multiplies<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator*(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::divides<>, L, R> operator/(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::multiplies(), lhs, rhs);
+		return ElementWiseExpr<std::divides<>, L, R>(std::divides<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator*(const T& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::modulus<>, L, R> operator%(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::multiplies(), lhs, rhs);
+		return ElementWiseExpr<std::modulus<>, L, R>(std::modulus<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator/(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::bit_and<>, L, R> operator&(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::divides(), lhs, rhs);
+		return ElementWiseExpr<std::bit_and<>, L, R>(std::bit_and<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator/(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::bit_or<>, L, R> operator|(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::divides(), lhs, rhs);
+		return ElementWiseExpr<std::bit_or<>, L, R>(std::bit_or<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator/(const T& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::bit_xor<>, L, R> operator^(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::divides(), lhs, rhs);
+		return ElementWiseExpr<std::bit_xor<>, L, R>(std::bit_xor<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator%(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename T, typename>
+	inline constexpr ElementWiseExpr<std::bit_not<>, T> operator~(const T& mat)
 	{
-		return elementWise(std::modulus(), lhs, rhs);
+		return ElementWiseExpr<std::bit_not<>, T>(std::bit_not<>(), mat);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator%(const Matrix<T>& lhs, const T& rhs)
+	template<typename T, typename>
+	inline constexpr ElementWiseExpr<std::logical_not<>, T> operator!(const T& mat)
 	{
-		return elementWise(std::modulus(), lhs, rhs);
+		return ElementWiseExpr<std::logical_not<>, T>(std::logical_not<>(), mat);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator%(const T& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<func::left_shift<>, L, R> operator<<(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::modulus(), lhs, rhs);
+		return ElementWiseExpr<func::left_shift<>, L, R>(func::left_shift<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator&(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<func::right_shift<>, L, R> operator>>(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::bit_and(), lhs, rhs);
+		return ElementWiseExpr<func::right_shift<>, L, R>(func::right_shift<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator&(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<func::min<>, L, R> min(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::bit_and(), lhs, rhs);
+		return ElementWiseExpr<func::min<>, L, R>(func::min<>(), lhs, rhs);
 	}
 
 	template<typename T>
-	inline constexpr Matrix<T> operator&(const T& lhs, const Matrix<T>& rhs)
+	inline constexpr ElementWiseExpr<func::min<>, Matrix<T>, Matrix<T>> min(const Matrix<T>& lhs, const Matrix<T>& rhs)
 	{
-		return elementWise(std::bit_and(), lhs, rhs);
+		return ElementWiseExpr<func::min<>, Matrix<T>, Matrix<T>>(func::min<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator|(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseExpr<func::min<>, ElementWiseExpr<Op, Ts...>, ElementWiseExpr<Op, Ts...>> min(const ElementWiseExpr<Op, Ts...>& lhs, const ElementWiseExpr<Op, Ts...>& rhs)
 	{
-		return elementWise(std::bit_or(), lhs, rhs);
+		return ElementWiseExpr<func::min<>, ElementWiseExpr<Op, Ts...>, ElementWiseExpr<Op, Ts...>>(func::min<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator|(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<func::max<>, L, R> max(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::bit_or(), lhs, rhs);
+		return ElementWiseExpr<func::max<>, L, R>(func::max<>(), lhs, rhs);
 	}
 
 	template<typename T>
-	inline constexpr Matrix<T> operator|(const T& lhs, const Matrix<T>& rhs)
+	inline constexpr ElementWiseExpr<func::max<>, Matrix<T>, Matrix<T>> max(const Matrix<T>& lhs, const Matrix<T>& rhs)
 	{
-		return elementWise(std::bit_or(), lhs, rhs);
+		return ElementWiseExpr<func::max<>, Matrix<T>, Matrix<T>>(func::max<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator^(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename Op, typename... Ts>
+	inline constexpr ElementWiseExpr<func::max<>, ElementWiseExpr<Op, Ts...>, ElementWiseExpr<Op, Ts...>> max(const ElementWiseExpr<Op, Ts...>& lhs, const ElementWiseExpr<Op, Ts...>& rhs)
 	{
-		return elementWise(std::bit_xor(), lhs, rhs);
+		return ElementWiseExpr<func::max<>, ElementWiseExpr<Op, Ts...>, ElementWiseExpr<Op, Ts...>>(func::max<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator^(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::equal_to<>, L, R> operator==(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::bit_xor(), lhs, rhs);
+		return ElementWiseExpr<std::equal_to<>, L, R>(std::equal_to<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator^(const T& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::not_equal_to<>, L, R> operator!=(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::bit_xor(), lhs, rhs);
+		return ElementWiseExpr<std::not_equal_to<>, L, R>(std::not_equal_to<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator~(const Matrix<T>& mat)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::greater<>, L, R> operator>(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::bit_not(), mat);
+		return ElementWiseExpr<std::greater<>, L, R>(std::greater<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<bool> operator!(const Matrix<T>& mat)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::less<>, L, R> operator<(const L& lhs, const R& rhs)
 	{
-		return elementWise(std::logical_not(), mat);
+		return ElementWiseExpr<std::less<>, L, R>(std::less<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator<<(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::greater_equal<>, L, R> operator>=(const L& lhs, const R& rhs)
 	{
-		return elementWise(func::left_shift(), lhs, rhs);
+		return ElementWiseExpr<std::greater_equal<>, L, R>(std::greater_equal<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator<<(const Matrix<T>& lhs, const T& rhs)
+	template<typename L, typename R, typename>
+	inline constexpr ElementWiseExpr<std::less_equal<>, L, R> operator<=(const L& lhs, const R& rhs)
 	{
-		return elementWise(func::left_shift(), lhs, rhs);
+		return ElementWiseExpr<std::less_equal<>, L, R>(std::less_equal<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator<<(const T& lhs, const Matrix<T>& rhs)
+	template<typename D, typename T, typename>
+	inline decltype(auto) negateInto(D&& dst, const T& mat)
 	{
-		return elementWise(func::left_shift(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::negate<>(), mat);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator>>(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) plusInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::right_shift(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::plus<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator>>(const Matrix<T>& lhs, const T& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) minusInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::right_shift(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::minus<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator>>(const T& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) multipliesInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::right_shift(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::multiplies<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> min(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) dividesInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::min(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::divides<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> min(const Matrix<T>& lhs, const T& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) modulusInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::min(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::modulus<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> min(const T& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) bitAndInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::min(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::bit_and<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> max(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) bitOrInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::max(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::bit_or<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> max(const Matrix<T>& lhs, const T& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) bitXorInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(func::max(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::bit_xor<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> max(const T& lhs, const Matrix<T>& rhs)
+	template<typename D, typename T, typename>
+	inline decltype(auto) bitNotInto(D&& dst, const T& mat)
 	{
-		return elementWise(func::max(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::bit_not<>(), mat);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<bool> operator==(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename D, typename T, typename>
+	inline decltype(auto) logicalNotInto(D&& dst, const T& mat)
 	{
-		return elementWise(std::equal_to(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::logical_not<>(), mat);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<bool> operator==(const Matrix<T>& lhs, const T& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) leftShiftInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::equal_to(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), func::left_shift<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<bool> operator==(const T& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) rightShiftInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::equal_to(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), func::right_shift<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<bool> operator!=(const Matrix<T>& lhs, const Matrix<T>& rhs)
-	{
-		return elementWise(std::not_equal_to(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator!=(const Matrix<T>& lhs, const T& rhs)
-	{
-		return elementWise(std::not_equal_to(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator!=(const T& lhs, const Matrix<T>& rhs)
-	{
-		return elementWise(std::not_equal_to(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator>(const Matrix<T>& lhs, const Matrix<T>& rhs)
-	{
-		return elementWise(std::greater(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator>(const Matrix<T>& lhs, const T& rhs)
-	{
-		return elementWise(std::greater(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator>(const T& lhs, const Matrix<T>& rhs)
-	{
-		return elementWise(std::greater(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator<(const Matrix<T>& lhs, const Matrix<T>& rhs)
-	{
-		return elementWise(std::less(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator<(const Matrix<T>& lhs, const T& rhs)
-	{
-		return elementWise(std::less(), lhs, rhs);
-	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator<(const T& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) minInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::less(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), func::min<>(), lhs, rhs);
 	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator>=(const Matrix<T>& lhs, const Matrix<T>& rhs)
+
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) maxInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::greater_equal(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), func::max<>(), lhs, rhs);
 	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator>=(const Matrix<T>& lhs, const T& rhs)
+
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) equalToInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::greater_equal(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::equal_to<>(), lhs, rhs);
 	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator>=(const T& lhs, const Matrix<T>& rhs)
+
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) notEqualToInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::greater_equal(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::not_equal_to<>(), lhs, rhs);
 	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator<=(const Matrix<T>& lhs, const Matrix<T>& rhs)
+
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) greaterInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::less_equal(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::greater<>(), lhs, rhs);
 	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator<=(const Matrix<T>& lhs, const T& rhs)
+
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) lessInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::less_equal(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::less<>(), lhs, rhs);
 	}
-	template<typename T>
-	inline constexpr Matrix<bool> operator<=(const T& lhs, const Matrix<T>& rhs)
+
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) greaterEqualInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return elementWise(std::less_equal(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::greater_equal<>(), lhs, rhs);
 	}
 
-	template<typename T>
-	inline constexpr Matrix<T> operator&&(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename D, typename L, typename R, typename>
+	inline decltype(auto) lessEqualInto(D&& dst, const L& lhs, const R& rhs)
 	{
-		return matMul(std::plus(), std::multiplies(), lhs, rhs);
+		return elementWiseInto(std::forward<D>(dst), std::less_equal<>(), lhs, rhs);
 	}
 
 	template<typename T>
-	inline constexpr Matrix<bool> operator&&(const Matrix<bool>& lhs, const Matrix<bool>& rhs)
+	inline constexpr Matrix<ProductRes<T>> operator&&(const Matrix<T>& lhs, const Matrix<T>& rhs)
 	{
-		return matMul(std::bit_or(), std::bit_and(), lhs, rhs);
+		return matMul(std::plus(), std::multiplies(), lhs, rhs);
 	}
 
 	template<typename T>
 	template<typename Op, typename... Ts>
 	inline constexpr Matrix<T>& Matrix<T>::assignElementWise(const Op& op, const Ts&... params)
 	{
-		for (size_t i = 0; i < m_iSize; i++)
-		{
-			for (size_t j = 0; j < m_jSize; j++)
-			{
-				get(i, j) = op(get(i, j), ElementWiseHelper::index(params, i, j)...);
-			}
-		}
-		return *this;
+		return elementWiseInto(*this, ElementWiseExpr<Op, Matrix, Ts...>(op, *this, params...));
 	}
 
 	template<typename T>
@@ -1399,6 +2367,76 @@ namespace math
 		return assignElementWise(func::right_shift(), val);
 	}
 
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator+=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::plus(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator-=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::minus(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator*=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::multiplies(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator/=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::divides(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator%=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::modulus(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator&=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::bit_and(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator|=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::bit_or(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator^=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(std::bit_xor(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator<<=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(func::left_shift(), expr);
+	}
+
+	template<typename T>
+	template<typename Op, typename... Ts>
+	inline constexpr Matrix<T>& Matrix<T>::operator>>=(const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return assignElementWise(func::right_shift(), expr);
+	}
+
 	template<typename T>
 	inline std::istream& operator>>(std::istream& stream, Matrix<T>& mat)
 	{
@@ -1415,16 +2453,158 @@ namespace math
 		return stream;
 	}
 
+	template<typename T>
+	inline bool FormatHelper::style(const std::ostream& stream, Style& style)
+	{
+		constexpr bool character = std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char> ||
+			std::is_same_v<T, wchar_t> || std::is_same_v<T, char16_t> || std::is_same_v<T, char32_t>;
+		if constexpr (!std::is_arithmetic_v<T> || character)
+		{
+			return false;
+		}
+		else
+		{
+			std::ios_base::fmtflags flags = stream.flags();
+			if (flags & (std::ios_base::showpos | std::ios_base::showbase | std::ios_base::showpoint | std::ios_base::uppercase | std::ios_base::boolalpha))
+			{
+				return false;
+			}
+			std::ios_base::fmtflags base = flags & std::ios_base::basefield;
+			std::ios_base::fmtflags adjust = flags & std::ios_base::adjustfield;
+			std::ios_base::fmtflags floatField = flags & std::ios_base::floatfield;
+			if ((base != 0 && base != std::ios_base::dec) || adjust == std::ios_base::internal)
+			{
+				return false;
+			}
+			style.format = std::chars_format::general;
+			style.precision = int(stream.precision());
+			if constexpr (std::is_floating_point_v<T>)
+			{
+				if (floatField == std::ios_base::fixed)
+				{
+					style.format = std::chars_format::fixed;
+				}
+				else if (floatField == std::ios_base::scientific)
+				{
+					style.format = std::chars_format::scientific;
+				}
+				else if (floatField != 0)
+				{
+					return false;
+				}
+				// Bounds the length of an element, see append.
+				if (style.precision < 0 || style.precision > 128)
+				{
+					return false;
+				}
+			}
+			style.width = size_t(std::max<std::streamsize>(stream.width(), 0));
+			style.fill = stream.fill();
+			style.left = adjust == std::ios_base::left;
+			const std::numpunct<char>& punct = std::use_facet<std::numpunct<char>>(stream.getloc());
+			return punct.decimal_point() == '.' && punct.grouping().empty();
+		}
+	}
+
+	template<typename T>
+	inline void FormatHelper::append(std::string& text, const T& val, const Style& style)
+	{
+		// Enough for any fixed double with the precision style() allows.
+		char buffer[512];
+		std::to_chars_result result;
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			result = std::to_chars(buffer, buffer + sizeof(buffer), int(val));
+		}
+		else if constexpr (std::is_floating_point_v<T>)
+		{
+			result = std::to_chars(buffer, buffer + sizeof(buffer), val, style.format, style.precision);
+		}
+		else
+		{
+			result = std::to_chars(buffer, buffer + sizeof(buffer), val);
+		}
+		size_t size = size_t(result.ptr - buffer);
+		size_t padding = style.width > size ? style.width - size : 0;
+		if (!style.left)
+		{
+			text.append(padding, style.fill);
+		}
+		text.append(buffer, size);
+		if (style.left)
+		{
+			text.append(padding, style.fill);
+		}
+	}
+
+	template<typename T>
+	inline void FormatHelper::appendRows(std::string& text, const Matrix<T>& mat, size_t begin, size_t end, const Style& style)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (i > 0)
+			{
+				text += '\n';
+			}
+			const typename Matrix<T>::RowCol matRow = mat[i];
+			for (size_t j = 0; j < mat.jSize(); j++)
+			{
+				if (j > 0)
+				{
+					text += ' ';
+				}
+				append(text, matRow[j], style);
+			}
+		}
+	}
+
+	template<typename T>
+	inline void FormatHelper::write(std::ostream& stream, const Matrix<T>& mat, const Style& style)
+	{
+		size_t rows = std::max<size_t>(blockSize / std::max<size_t>(mat.jSize(), 1), 1);
+		size_t blocks = (mat.iSize() + rows - 1) / rows;
+		// A group of blocks is formatted in parallel, then written, so memory stays bounded for huge matrices.
+		std::vector<std::string> texts(std::min(blocks, 4 * parallel::pool().size()));
+		for (size_t first = 0; first < blocks; first += texts.size())
+		{
+			size_t count = std::min(texts.size(), blocks - first);
+			parallel::forRange(count, count * rows * mat.jSize() * 16, [&](size_t begin, size_t end)
+			{
+				for (size_t k = begin; k < end; k++)
+				{
+					size_t block = first + k;
+					texts[k].clear();
+					appendRows(texts[k], mat, block * rows, std::min((block + 1) * rows, mat.iSize()), style);
+				}
+			});
+			for (size_t k = 0; k < count; k++)
+			{
+				stream.write(texts[k].data(), std::streamsize(texts[k].size()));
+			}
+		}
+		if (mat.iSize() > 0 && mat.jSize() > 0)
+		{
+			// Like formatted output, the width applies to one element and is consumed by it.
+			stream.width(0);
+		}
+	}
+
 	template<typename T>
 	inline std::ostream& operator<<(std::ostream& stream, const Matrix<T>& mat)
 	{
+		FormatHelper::Style style;
+		if (FormatHelper::style<T>(stream, style))
+		{
+			FormatHelper::write(stream, mat, style);
+			return stream.flush();
+		}
 		std::streamsize width = stream.width();
 		std::streamsize precision = stream.precision();
 		for (size_t i = 0; i < mat.iSize(); i++)
 		{
 			if (i > 0)
 			{
-				stream << std::endl;
+				stream.put('\n');
 			}
 			typename Matrix<T>::RowCol matRow = mat[i];
 			for (size_t j = 0; j < mat.jSize(); j++)
@@ -1436,6 +2616,14 @@ namespace math
 				stream << std::setw(width) << std::setprecision(precision) << matRow[j];
 			}
 		}
-		return stream;
+		return stream.flush();
+	}
+	template<typename Op, typename... Ts>
+	inline std::ostream& operator<<(std::ostream& stream, const ElementWiseExpr<Op, Ts...>& expr)
+	{
+		return stream << expr.evaluate();
 	}
 }
+
+// BitMatrix depends on Matrix and completes operator&& for Matrix<bool>.
+#include "Bit Matrix.h"
\ No newline at end of file
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include "Matrix.h"
+#include "SIMD.h"
+#include "Thread Pool.h"
+
+// 8 bit quantized matrices for inference. Element (i, j) of a QuantizedMatrix stands for
+// scale(i) * (values(i, j) - zeroPoint(i)), with one scale and zero point for the whole matrix or one per row.
+// Products of unsigned activations with signed weights accumulate exactly in int32 (see simd::dotPacked). Converting
+// back to float, bias, ReLU and requantizing to 8 bits happen while each output row is still in cache, so no int32
+// or float matrix of the whole product is ever written.
+
+namespace math
+{
+	enum class Granularity
+	{
+		Tensor,
+		Row
+	};
+
+	template<typename T>
+	class QuantizedMatrix
+	{
+		static_assert(std::is_same_v<T, uint8_t> || std::is_same_v<T, int8_t>, "QuantizedMatrix holds 8 bit integers");
+
+		Matrix<T> m_values;
+		Granularity m_granularity;
+		// One element per row, or a single one for the whole matrix.
+		std::vector<float> m_scales;
+		std::vector<int32_t> m_zeroPoints;
+
+	public:
+		static constexpr int32_t lowest = std::numeric_limits<T>::min();
+		static constexpr int32_t highest = std::numeric_limits<T>::max();
+
+		inline QuantizedMatrix();
+		// Zero values with scale 1 and zero point 0.
+		inline QuantizedMatrix(size_t iSize, size_t jSize, Granularity granularity);
+		// Shares values, e.g. MNIST pixels with a scale of 1 / 255.
+		inline QuantizedMatrix(const Matrix<T>& values, float scale, int32_t zeroPoint);
+		// Shares values, with one scale and zero point per row.
+		inline QuantizedMatrix(const Matrix<T>& values, std::vector<float> scales, std::vector<int32_t> zeroPoints);
+
+		// Maps the range of mat (of each row of mat) onto T. Unsigned values cover [min(lo, 0), max(hi, 0)] with a zero
+		// point, signed ones [-max(|lo|, |hi|), max(|lo|, |hi|)] with a zero point of 0, so 0 is always exact.
+		static inline QuantizedMatrix quantize(const Matrix<float>& mat, Granularity granularity);
+		// Parameters that map [lo, hi] onto T as quantize does.
+		static inline void parameters(float lo, float hi, float& scale, int32_t& zeroPoint);
+
+		inline size_t iSize() const;
+		inline size_t jSize() const;
+		inline Granularity granularity() const;
+		inline Matrix<T>& values();
+		inline const Matrix<T>& values() const;
+
+		// Parameters of row i, which is ignored for a single set.
+		inline float scale(size_t i) const;
+		inline int32_t zeroPoint(size_t i) const;
+		inline void setParameters(size_t i, float scale, int32_t zeroPoint);
+
+		inline float operator()(size_t i, size_t j) const;
+		inline Matrix<float> dequantize() const;
+	};
+
+	// Signed weights with one output per row, like Solver's weights, packed once for simd::dotPacked together with
+	// their row sums. A QuantizedMatrix converts implicitly, which packs it for a single call.
+	class PackedWeights
+	{
+		size_t m_iSize;
+		size_t m_jSize;
+		std::vector<int8_t> m_packed;
+		std::vector<float> m_scales;
+		std::vector<int32_t> m_zeroPoints;
+		std::vector<int32_t> m_sums;
+
+	public:
+		inline PackedWeights();
+		inline PackedWeights(const QuantizedMatrix<int8_t>& weights);
+
+		inline size_t iSize() const;
+		inline size_t jSize() const;
+		inline const int8_t* data() const;
+		inline float scale(size_t i) const;
+		inline int32_t zeroPoint(size_t i) const;
+		inline bool hasZeroPoints() const;
+		// Sum of the values of row i.
+		inline int32_t sum(size_t i) const;
+	};
+
+	// dst = x * w^T + bias, through ReLU if relu. bias is 1 x w.iSize() and dst is x.iSize() x w.iSize().
+	inline Matrix<float>& linearInto(Matrix<float>& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu = false);
+	inline void linearInto(Matrix<float>&& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu = false);
+	// The same, requantized into dst. A dst with one scale per row gets parameters chosen from the range of each
+	// output row; a single scale is kept, e.g. one calibrated in advance, and values outside its range saturate.
+	inline QuantizedMatrix<uint8_t>& linearInto(QuantizedMatrix<uint8_t>& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu = false);
+
+	class QuantizeHelper
+	{
+		friend Matrix<float>& linearInto(Matrix<float>& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu);
+		friend QuantizedMatrix<uint8_t>& linearInto(QuantizedMatrix<uint8_t>& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu);
+
+		// Rows per task.
+		static constexpr size_t rowBlock = 16;
+
+		template<typename T>
+		static inline bool contiguous(const Matrix<T>& mat);
+
+		// Runs row(i, res) over every row i of x * w^T + bias (through ReLU if relu), where res points to its
+		// w.iSize() elements in float.
+		template<typename F>
+		static inline void apply(const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu, const F& row);
+	};
+
+	template<typename T>
+	inline QuantizedMatrix<T>::QuantizedMatrix() :
+		m_granularity(Granularity::Tensor),
+		m_scales(1, 1.0f),
+		m_zeroPoints(1, 0)
+	{}
+
+	template<typename T>
+	inline QuantizedMatrix<T>::QuantizedMatrix(size_t iSize, size_t jSize, Granularity granularity) :
+		m_values(iSize, jSize, T(0)),
+		m_granularity(granularity),
+		m_scales(granularity == Granularity::Row ? iSize : 1, 1.0f),
+		m_zeroPoints(granularity == Granularity::Row ? iSize : 1, 0)
+	{}
+
+	template<typename T>
+	inline QuantizedMatrix<T>::QuantizedMatrix(const Matrix<T>& values, float scale, int32_t zeroPoint) :
+		m_values(values.shareSubmatrix((size_t)0, (size_t)0, values.iSize(), values.jSize())),
+		m_granularity(Granularity::Tensor),
+		m_scales(1, scale),
+		m_zeroPoints(1, zeroPoint)
+	{}
+
+	template<typename T>
+	inline QuantizedMatrix<T>::QuantizedMatrix(const Matrix<T>& values, std::vector<float> scales, std::vector<int32_t> zeroPoints) :
+		m_values(values.shareSubmatrix((size_t)0, (size_t)0, values.iSize(), values.jSize())),
+		m_granularity(Granularity::Row),
+		m_scales(std::move(scales)),
+		m_zeroPoints(std::move(zeroPoints))
+	{}
+
+	template<typename T>
+	inline QuantizedMatrix<T> QuantizedMatrix<T>::quantize(const Matrix<float>& mat, Granularity granularity)
+	{
+		QuantizedMatrix res(mat.iSize(), mat.jSize(), granularity);
+		size_t groups = granularity == Granularity::Row ? mat.iSize() : 1;
+		size_t groupRows = granularity == Granularity::Row ? 1 : mat.iSize();
+		for (size_t g = 0; g < groups; g++)
+		{
+			float lo = 0;
+			float hi = 0;
+			for (size_t i = g * groupRows; i < (g + 1) * groupRows; i++)
+			{
+				for (size_t j = 0; j < mat.jSize(); j++)
+				{
+					lo = std::min(lo, mat(i, j));
+					hi = std::max(hi, mat(i, j));
+				}
+			}
+			float scale;
+			int32_t zeroPoint;
+			parameters(lo, hi, scale, zeroPoint);
+			res.setParameters(g, scale, zeroPoint);
+			float inverse = 1 / scale;
+			for (size_t i = g * groupRows; i < (g + 1) * groupRows; i++)
+			{
+				for (size_t j = 0; j < mat.jSize(); j++)
+				{
+					res.m_values(i, j) = T(std::clamp(int32_t(std::lrint(mat(i, j) * inverse)) + zeroPoint, lowest, highest));
+				}
+			}
+		}
+		return res;
+	}
+
+	template<typename T>
+	inline void QuantizedMatrix<T>::parameters(float lo, float hi, float& scale, int32_t& zeroPoint)
+	{
+		lo = std::min(lo, 0.0f);
+		hi = std::max(hi, 0.0f);
+		if constexpr (std::is_signed_v<T>)
+		{
+			scale = std::max(-lo, hi) / highest;
+			zeroPoint = 0;
+		}
+		else
+		{
+			scale = (hi - lo) / highest;
+			zeroPoint = scale > 0 ? std::clamp(int32_t(std::lrint(-lo / scale)), lowest, highest) : 0;
+		}
+		// All zeros: any scale represents them.
+		if (!(scale > 0))
+		{
+			scale = 1;
+		}
+	}
+
+	template<typename T>
+	inline size_t QuantizedMatrix<T>::iSize() const
+	{
+		return m_values.iSize();
+	}
+
+	template<typename T>
+	inline size_t QuantizedMatrix<T>::jSize() const
+	{
+		return m_values.jSize();
+	}
+
+	template<typename T>
+	inline Granularity QuantizedMatrix<T>::granularity() const
+	{
+		return m_granularity;
+	}
+
+	template<typename T>
+	inline Matrix<T>& QuantizedMatrix<T>::values()
+	{
+		return m_values;
+	}
+
+	template<typename T>
+	inline const Matrix<T>& QuantizedMatrix<T>::values() const
+	{
+		return m_values;
+	}
+
+	template<typename T>
+	inline float QuantizedMatrix<T>::scale(size_t i) const
+	{
+		return m_scales[m_granularity == Granularity::Row ? i : 0];
+	}
+
+	template<typename T>
+	inline int32_t QuantizedMatrix<T>::zeroPoint(size_t i) const
+	{
+		return m_zeroPoints[m_granularity == Granularity::Row ? i : 0];
+	}
+
+	template<typename T>
+	inline void QuantizedMatrix<T>::setParameters(size_t i, float scale, int32_t zeroPoint)
+	{
+		size_t index = m_granularity == Granularity::Row ? i : 0;
+		m_scales[index] = scale;
+		m_zeroPoints[index] = zeroPoint;
+	}
+
+	template<typename T>
+	inline float QuantizedMatrix<T>::operator()(size_t i, size_t j) const
+	{
+		return scale(i) * (int32_t(m_values(i, j)) - zeroPoint(i));
+	}
+
+	template<typename T>
+	inline Matrix<float> QuantizedMatrix<T>::dequantize() const
+	{
+		Matrix<float> res(iSize(), jSize());
+		for (size_t i = 0; i < iSize(); i++)
+		{
+			for (size_t j = 0; j < jSize(); j++)
+			{
+				res(i, j) = (*this)(i, j);
+			}
+		}
+		return res;
+	}
+
+	inline PackedWeights::PackedWeights() :
+		m_iSize(0),
+		m_jSize(0)
+	{}
+
+	inline PackedWeights::PackedWeights(const QuantizedMatrix<int8_t>& weights) :
+		m_iSize(weights.iSize()),
+		m_jSize(weights.jSize()),
+		m_packed(simd::packedSize(weights.jSize(), weights.iSize())),
+		m_scales(weights.iSize()),
+		m_zeroPoints(weights.iSize()),
+		m_sums(weights.iSize(), 0)
+	{
+		const Matrix<int8_t>& values = weights.values();
+		if (values.isAffine() && m_iSize > 0 && m_jSize > 0)
+		{
+			simd::packRows(m_jSize, &values(0, 0), values.iStride(), values.jStride(), m_iSize, m_packed.data());
+		}
+		else if (m_iSize > 0 && m_jSize > 0)
+		{
+			Matrix<int8_t> copy = values.copySubmatrix((size_t)0, (size_t)0, m_iSize, m_jSize);
+			simd::packRows(m_jSize, &copy(0, 0), copy.iStride(), copy.jStride(), m_iSize, m_packed.data());
+		}
+		for (size_t i = 0; i < m_iSize; i++)
+		{
+			m_scales[i] = weights.scale(i);
+			m_zeroPoints[i] = weights.zeroPoint(i);
+			for (size_t j = 0; j < m_jSize; j++)
+			{
+				m_sums[i] += values(i, j);
+			}
+		}
+	}
+
+	inline size_t PackedWeights::iSize() const
+	{
+		return m_iSize;
+	}
+
+	inline size_t PackedWeights::jSize() const
+	{
+		return m_jSize;
+	}
+
+	inline const int8_t* PackedWeights::data() const
+	{
+		return m_packed.data();
+	}
+
+	inline float PackedWeights::scale(size_t i) const
+	{
+		return m_scales[i];
+	}
+
+	inline int32_t PackedWeights::zeroPoint(size_t i) const
+	{
+		return m_zeroPoints[i];
+	}
+
+	inline bool PackedWeights::hasZeroPoints() const
+	{
+		return std::any_of(m_zeroPoints.begin(), m_zeroPoints.end(), [](int32_t zeroPoint) { return zeroPoint != 0; });
+	}
+
+	inline int32_t PackedWeights::sum(size_t i) const
+	{
+		return m_sums[i];
+	}
+
+	template<typename T>
+	inline bool QuantizeHelper::contiguous(const Matrix<T>& mat)
+	{
+		return mat.isAffine() && (mat.jStride() == 1 || mat.jSize() <= 1);
+	}
+
+	template<typename F>
+	inline void QuantizeHelper::apply(const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu, const F& row)
+	{
+		size_t iSize = x.iSize();
+		size_t jSize = w.iSize();
+		size_t n = x.jSize();
+		if (iSize == 0 || jSize == 0)
+		{
+			return;
+		}
+		bool xContiguous = contiguous(x.values()) && n > 0;
+		size_t rsX = xContiguous ? x.values().iStride() : n;
+		// (x - zx)(w - zw) summed over k is x . w - zw * sum(x) - zx * sum(w) + n * zx * zw. The sums are only needed
+		// for nonzero zero points, which the usual pair of ReLU outputs and symmetric weights does not have.
+		bool wOffsets = w.hasZeroPoints();
+		std::vector<float> scales(jSize);
+		std::vector<float> biases(jSize);
+		for (size_t j = 0; j < jSize; j++)
+		{
+			scales[j] = w.scale(j);
+			biases[j] = bias(0, j);
+		}
+		size_t blocks = (iSize + rowBlock - 1) / rowBlock;
+		parallel::forRange(blocks, iSize * jSize * n, [&](size_t begin, size_t end)
+		{
+			std::vector<uint8_t> scratch(xContiguous ? 0 : rowBlock * n);
+			std::vector<int32_t> dots(rowBlock * jSize);
+			std::vector<float> res(jSize);
+			for (size_t b = begin; b < end; b++)
+			{
+				size_t first = b * rowBlock;
+				size_t rows = std::min(rowBlock, iSize - first);
+				const uint8_t* xRows = scratch.data();
+				if (xContiguous)
+				{
+					xRows = &x.values()(first, 0);
+				}
+				else
+				{
+					for (size_t i = 0; i < rows; i++)
+					{
+						for (size_t k = 0; k < n; k++)
+						{
+							scratch[i * n + k] = x.values()(first + i, k);
+						}
+					}
+				}
+				simd::dotPacked(rows, n, xRows, rsX, w.data(), jSize, dots.data(), jSize);
+				for (size_t i = first; i < first + rows; i++)
+				{
+					const uint8_t* xRow = xRows + (i - first) * rsX;
+					int32_t* dot = dots.data() + (i - first) * jSize;
+					int32_t zx = x.zeroPoint(i);
+					if (zx != 0 || wOffsets)
+					{
+						int32_t xSum = std::accumulate(xRow, xRow + n, int32_t(0));
+						for (size_t j = 0; j < jSize; j++)
+						{
+							dot[j] += int32_t(n) * zx * w.zeroPoint(j) - w.zeroPoint(j) * xSum - zx * w.sum(j);
+						}
+					}
+					float sx = x.scale(i);
+					for (size_t j = 0; j < jSize; j++)
+					{
+						res[j] = sx * scales[j] * float(dot[j]) + biases[j];
+					}
+					if (relu)
+					{
+						for (size_t j = 0; j < jSize; j++)
+						{
+							res[j] = std::max(res[j], 0.0f);
+						}
+					}
+					row(i, res.data());
+				}
+			}
+		});
+	}
+
+	inline Matrix<float>& linearInto(Matrix<float>& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu)
+	{
+		size_t jSize = w.iSize();
+		bool dstContiguous = QuantizeHelper::contiguous(dst) && jSize > 0;
+		dst.unshare();
+		QuantizeHelper::apply(x, w, bias, relu, [&dst, jSize, dstContiguous](size_t i, const float* res)
+		{
+			Matrix<float>::RowCol dstRow = dst[i];
+			if (dstContiguous)
+			{
+				std::copy(res, res + jSize, &dstRow[0]);
+				return;
+			}
+			for (size_t j = 0; j < jSize; j++)
+			{
+				dstRow[j] = res[j];
+			}
+		});
+		return dst;
+	}
+
+	inline void linearInto(Matrix<float>&& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu)
+	{
+		linearInto(dst, x, w, bias, relu);
+	}
+
+	inline QuantizedMatrix<uint8_t>& linearInto(QuantizedMatrix<uint8_t>& dst, const QuantizedMatrix<uint8_t>& x, const PackedWeights& w, const Matrix<float>& bias, bool relu)
+	{
+		using Q = QuantizedMatrix<uint8_t>;
+		size_t jSize = w.iSize();
+		bool perRow = dst.granularity() == Granularity::Row;
+		bool dstContiguous = QuantizeHelper::contiguous(dst.values()) && jSize > 0;
+		dst.values().unshare();
+		QuantizeHelper::apply(x, w, bias, relu, [&dst, jSize, perRow, dstContiguous](size_t i, const float* res)
+		{
+			if (perRow)
+			{
+				float lo = 0;
+				float hi = 0;
+				for (size_t j = 0; j < jSize; j++)
+				{
+					lo = std::min(lo, res[j]);
+					hi = std::max(hi, res[j]);
+				}
+				float scale;
+				int32_t zeroPoint;
+				Q::parameters(lo, hi, scale, zeroPoint);
+				dst.setParameters(i, scale, zeroPoint);
+			}
+			float inverse = 1 / dst.scale(i);
+			float zeroPoint = float(dst.zeroPoint(i));
+			// Clamped first, so rounding is a plain conversion of a nonnegative value.
+			auto quantize = [inverse, zeroPoint](float val)
+			{
+				return uint8_t(std::clamp(val * inverse + zeroPoint, float(Q::lowest), float(Q::highest)) + 0.5f);
+			};
+			Matrix<uint8_t>::RowCol dstRow = dst.values()[i];
+			if (dstContiguous)
+			{
+				std::transform(res, res + jSize, &dstRow[0], quantize);
+				return;
+			}
+			for (size_t j = 0; j < jSize; j++)
+			{
+				dstRow[j] = quantize(res[j]);
+			}
+		});
+		return dst;
+	}
+}
@@ -0,0 +1,759 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Functional.h"
+#include "Half.h"
+#include "Matrix.h"
+#include "SIMD.h"
+#include "Thread Pool.h"
+
+// Reductions of matrices and element-wise expressions: of all elements, or of each row or each column. Operands are
+// read a chunk at a time as in ElementWiseExpr, so an expression such as a * b is reduced in a single pass without an
+// intermediate matrix, and chunks are folded by SIMD loops when simd recognizes the operation. Column reductions fold
+// whole rows into a row of accumulators instead, which vectorizes across columns. Work is partitioned over the thread
+// pool independently of its size, and partial results are always combined in the same order, so results do not
+// depend on the number of threads.
+
+namespace math
+{
+	// Axis::Rows reduces every row to one value (an iSize x 1 result), Axis::Cols every column (1 x jSize).
+	enum class Axis
+	{
+		Rows,
+		Cols
+	};
+
+	// Pairwise folds each chunk with several SIMD accumulators and adds the chunk sums in a balanced tree, which keeps
+	// the rounding error growing with the logarithm of the number of elements. Kahan compensates every addition
+	// instead, for an error independent of the number of elements at a few times the cost.
+	enum class Summation
+	{
+		Pairwise,
+		Kahan
+	};
+
+	// Element type of the reduced operand, widened to float for half and bfloat16.
+	template<typename T>
+	using ReductionRes = Accumulator<ElementWiseValue_t<T>>;
+
+	// Result of mean and the norms: the element type if it is floating point, double otherwise.
+	template<typename T>
+	using ReductionReal = std::conditional_t<std::is_floating_point_v<ReductionRes<T>>, ReductionRes<T>, double>;
+
+	// A running compensated sum; the exact sum is approximately sum - compensation.
+	template<typename T>
+	struct KahanSum
+	{
+		T sum = 0;
+		T compensation = 0;
+
+		inline void add(const T& val);
+		inline void add(const KahanSum& other);
+	};
+
+	// Value and position (column for row reductions, row for column reductions, flat index otherwise) of an extreme.
+	template<typename T>
+	struct ArgValue
+	{
+		T val;
+		size_t pos;
+	};
+
+	class ReductionHelper
+	{
+	public:
+		static constexpr size_t chunkSize = ElementWiseHelper::chunkSize;
+		// Rows per task of a column reduction.
+		static constexpr size_t rowBlock = 256;
+
+		// Reducers turn runs of elements into partial results (chunk), fold one row of elements into a row of
+		// per-column partials (initRow, mergeRow) and combine partials of consecutive runs (merge).
+		template<typename Op, typename T>
+		struct Fold
+		{
+			using Partial = T;
+
+			Op op;
+
+			inline T chunk(const T* data, size_t n, size_t pos) const;
+			inline void initRow(T* partials, const T* row, size_t n, size_t i) const;
+			inline void mergeRow(T* partials, const T* row, size_t n, size_t i) const;
+			inline void merge(T& lhs, const T& rhs) const;
+		};
+
+		template<typename T>
+		struct Kahan
+		{
+			using Partial = KahanSum<T>;
+
+			inline KahanSum<T> chunk(const T* data, size_t n, size_t pos) const;
+			inline void initRow(KahanSum<T>* partials, const T* row, size_t n, size_t i) const;
+			inline void mergeRow(KahanSum<T>* partials, const T* row, size_t n, size_t i) const;
+			inline void merge(KahanSum<T>& lhs, const KahanSum<T>& rhs) const;
+		};
+
+		// First position of the least element under Compare, e.g. std::greater for the maximum.
+		template<typename Compare, typename T>
+		struct Arg
+		{
+			using Partial = ArgValue<T>;
+
+			Compare compare;
+
+			inline ArgValue<T> chunk(const T* data, size_t n, size_t pos) const;
+			inline void initRow(ArgValue<T>* partials, const T* row, size_t n, size_t i) const;
+			inline void mergeRow(ArgValue<T>* partials, const T* row, size_t n, size_t i) const;
+			inline void merge(ArgValue<T>& lhs, const ArgValue<T>& rhs) const;
+		};
+
+		// Converts integer elements for the norms, which accumulate in ReductionReal.
+		template<typename R>
+		struct Convert
+		{
+			template<typename T>
+			inline constexpr R operator()(const T& val) const;
+		};
+
+		template<typename T>
+		static inline ElementWiseExpr<Convert<ReductionReal<T>>, T> real(const T& x);
+
+		// Elements j to j + n - 1 of row i, or of the whole matrix if flat, see ElementWiseExpr::evaluate. Half precision
+		// elements are widened into scratch.
+		template<typename T>
+		static inline const ReductionRes<T>* chunk(const T& x, size_t i, size_t j, size_t n, bool flat, ReductionRes<T>* scratch);
+
+		// Combines partials[0], partials[stride], ... partials[(n - 1) * stride] in a balanced tree. n must be positive.
+		template<typename Reducer>
+		static inline typename Reducer::Partial pairwise(const Reducer& reducer, const typename Reducer::Partial* partials, size_t n, size_t stride);
+
+		// Reduces every element of x, which must not be empty. Positions are flat indices.
+		template<typename Reducer, typename T>
+		static inline typename Reducer::Partial all(const Reducer& reducer, const T& x);
+		// Calls finish(i, partial) for every row of x, which must have at least one column.
+		template<typename Reducer, typename T, typename F>
+		static inline void rows(const Reducer& reducer, const T& x, const F& finish);
+		// Calls finish(j, partial) for every column of x, which must have at least one row.
+		template<typename Reducer, typename T, typename F>
+		static inline void cols(const Reducer& reducer, const T& x, const F& finish);
+		// rows or cols, by axis.
+		template<typename Reducer, typename T, typename F>
+		static inline void axis(const Reducer& reducer, const T& x, Axis axis, const F& finish);
+
+		template<typename T>
+		static inline size_t iSize(const T& x);
+		template<typename T>
+		static inline size_t jSize(const T& x);
+	};
+
+	// op(init, elements...) for an associative and commutative op, e.g. reduce(std::plus<>(), 0.0f, a * b) for a dot
+	// product. Returns init if x is empty.
+	template<typename Op, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionRes<T> reduce(const Op& op, const ReductionRes<T>& init, const T& x);
+	template<typename Op, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionRes<T>> reduce(const Op& op, const ReductionRes<T>& init, const T& x, Axis axis);
+	// Writes the row or column results to dst, which must already be iSize x 1 or 1 x jSize and may be a view.
+	template<typename Op, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionRes<T>>& reduceInto(Matrix<ReductionRes<T>>& dst, const Op& op, const ReductionRes<T>& init, const T& x, Axis axis);
+	template<typename Op, typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline void reduceInto(Matrix<ReductionRes<T>>&& dst, const Op& op, const ReductionRes<T>& init, const T& x, Axis axis);
+
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionRes<T> sum(const T& x, Summation summation = Summation::Pairwise);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionRes<T>> sum(const T& x, Axis axis, Summation summation = Summation::Pairwise);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionRes<T>>& sumInto(Matrix<ReductionRes<T>>& dst, const T& x, Axis axis, Summation summation = Summation::Pairwise);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline void sumInto(Matrix<ReductionRes<T>>&& dst, const T& x, Axis axis, Summation summation = Summation::Pairwise);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionReal<T> mean(const T& x, Summation summation = Summation::Pairwise);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionReal<T>> mean(const T& x, Axis axis, Summation summation = Summation::Pairwise);
+
+	// Named minimum and maximum, as min and max are the element-wise operations. x must not be empty.
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionRes<T> minimum(const T& x);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionRes<T>> minimum(const T& x, Axis axis);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionRes<T> maximum(const T& x);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionRes<T>> maximum(const T& x, Axis axis);
+	// Position (i, j) of the first least/greatest element. x must not be empty.
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline std::pair<size_t, size_t> argmin(const T& x);
+	// Column of the first least element of every row, or row of the first least element of every column.
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<size_t> argmin(const T& x, Axis axis);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline std::pair<size_t, size_t> argmax(const T& x);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<size_t> argmax(const T& x, Axis axis);
+
+	// Sum of absolute values and square root of the sum of squares, without rescaling, so the latter overflows where
+	// the squares do. Integer elements are converted to double first and half precision ones to float.
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionReal<T> norm1(const T& x);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionReal<T>> norm1(const T& x, Axis axis);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline ReductionReal<T> norm2(const T& x);
+	template<typename T, typename = std::enable_if_t<isElementWiseOperand<T>>>
+	inline Matrix<ReductionReal<T>> norm2(const T& x, Axis axis);
+
+	template<typename T>
+	inline void KahanSum<T>::add(const T& val)
+	{
+		T y = val - compensation;
+		T t = sum + y;
+		compensation = (t - sum) - y;
+		sum = t;
+	}
+
+	template<typename T>
+	inline void KahanSum<T>::add(const KahanSum& other)
+	{
+		add(other.sum);
+		compensation += other.compensation;
+	}
+
+	template<typename Op, typename T>
+	inline T ReductionHelper::Fold<Op, T>::chunk(const T* data, size_t n, size_t) const
+	{
+		if constexpr (simd::isReducible<Op, T>)
+		{
+			if (simd::isAvailable<T, simd::OpKind<Op>::kind>())
+			{
+				return simd::reduce(op, n - 1, data + 1, data[0]);
+			}
+		}
+		T res = data[0];
+		for (size_t k = 1; k < n; k++)
+		{
+			res = op(res, data[k]);
+		}
+		return res;
+	}
+
+	template<typename Op, typename T>
+	inline void ReductionHelper::Fold<Op, T>::initRow(T* partials, const T* row, size_t n, size_t) const
+	{
+		std::copy(row, row + n, partials);
+	}
+
+	template<typename Op, typename T>
+	inline void ReductionHelper::Fold<Op, T>::mergeRow(T* partials, const T* row, size_t n, size_t) const
+	{
+		if constexpr (simd::isVectorizable<Op, T, T, T>)
+		{
+			if (simd::isAvailable<T, simd::OpKind<Op>::kind>())
+			{
+				simd::apply(op, n, partials, simd::Operand<T>{ partials, false }, simd::Operand<T>{ row, false });
+				return;
+			}
+		}
+		for (size_t k = 0; k < n; k++)
+		{
+			partials[k] = op(partials[k], row[k]);
+		}
+	}
+
+	template<typename Op, typename T>
+	inline void ReductionHelper::Fold<Op, T>::merge(T& lhs, const T& rhs) const
+	{
+		lhs = op(lhs, rhs);
+	}
+
+	template<typename T>
+	inline KahanSum<T> ReductionHelper::Kahan<T>::chunk(const T* data, size_t n, size_t) const
+	{
+		KahanSum<T> res;
+		for (size_t k = 0; k < n; k++)
+		{
+			res.add(data[k]);
+		}
+		return res;
+	}
+
+	template<typename T>
+	inline void ReductionHelper::Kahan<T>::initRow(KahanSum<T>* partials, const T* row, size_t n, size_t) const
+	{
+		for (size_t k = 0; k < n; k++)
+		{
+			partials[k] = KahanSum<T>{ row[k], 0 };
+		}
+	}
+
+	template<typename T>
+	inline void ReductionHelper::Kahan<T>::mergeRow(KahanSum<T>* partials, const T* row, size_t n, size_t) const
+	{
+		for (size_t k = 0; k < n; k++)
+		{
+			partials[k].add(row[k]);
+		}
+	}
+
+	template<typename T>
+	inline void ReductionHelper::Kahan<T>::merge(KahanSum<T>& lhs, const KahanSum<T>& rhs) const
+	{
+		lhs.add(rhs);
+	}
+
+	template<typename Compare, typename T>
+	inline ArgValue<T> ReductionHelper::Arg<Compare, T>::chunk(const T* data, size_t n, size_t pos) const
+	{
+		using Extreme = std::conditional_t<std::is_same_v<Compare, std::greater<>>, func::max<>, func::min<>>;
+		size_t best = 0;
+		if constexpr (simd::isReducible<Extreme, T> && (std::is_same_v<Compare, std::greater<>> || std::is_same_v<Compare, std::less<>>))
+		{
+			// Finding the extreme with SIMD and then its first occurrence beats tracking positions in every lane.
+			if (simd::isAvailable<T, simd::OpKind<Extreme>::kind>())
+			{
+				T val = simd::reduce(Extreme(), n - 1, data + 1, data[0]);
+				while (best < n && !(data[best] == val))
+				{
+					best++;
+				}
+				if (best < n)
+				{
+					return { val, pos + best };
+				}
+				// Only NaNs compare unequal to themselves; fall back to the ordinary scan.
+				best = 0;
+			}
+		}
+		for (size_t k = 1; k < n; k++)
+		{
+			if (compare(data[k], data[best]))
+			{
+				best = k;
+			}
+		}
+		return { data[best], pos + best };
+	}
+
+	template<typename Compare, typename T>
+	inline void ReductionHelper::Arg<Compare, T>::initRow(ArgValue<T>* partials, const T* row, size_t n, size_t i) const
+	{
+		for (size_t k = 0; k < n; k++)
+		{
+			partials[k] = { row[k], i };
+		}
+	}
+
+	template<typename Compare, typename T>
+	inline void ReductionHelper::Arg<Compare, T>::mergeRow(ArgValue<T>* partials, const T* row, size_t n, size_t i) const
+	{
+		for (size_t k = 0; k < n; k++)
+		{
+			if (compare(row[k], partials[k].val))
+			{
+				partials[k] = { row[k], i };
+			}
+		}
+	}
+
+	template<typename Compare, typename T>
+	inline void ReductionHelper::Arg<Compare, T>::merge(ArgValue<T>& lhs, const ArgValue<T>& rhs) const
+	{
+		if (compare(rhs.val, lhs.val))
+		{
+			lhs = rhs;
+		}
+	}
+
+	template<typename R>
+	template<typename T>
+	inline constexpr R ReductionHelper::Convert<R>::operator()(const T& val) const
+	{
+		return R(val);
+	}
+
+	template<typename T>
+	inline ElementWiseExpr<ReductionHelper::Convert<ReductionReal<T>>, T> ReductionHelper::real(const T& x)
+	{
+		return ElementWiseExpr<Convert<ReductionReal<T>>, T>(Convert<ReductionReal<T>>(), x);
+	}
+
+	template<typename T>
+	inline const ReductionRes<T>* ReductionHelper::chunk(const T& x, size_t i, size_t j, size_t n, bool flat, ReductionRes<T>* scratch)
+	{
+		if constexpr (std::is_same_v<ElementWiseValue_t<T>, ReductionRes<T>>)
+		{
+			return ElementWiseHelper::chunk(x, i, j, n, flat, scratch).data;
+		}
+		else
+		{
+			std::array<ElementWiseValue_t<T>, chunkSize> narrow;
+			convert(n, ElementWiseHelper::chunk(x, i, j, n, flat, narrow.data()).data, scratch);
+			return scratch;
+		}
+	}
+
+	template<typename Reducer>
+	inline typename Reducer::Partial ReductionHelper::pairwise(const Reducer& reducer, const typename Reducer::Partial* partials, size_t n, size_t stride)
+	{
+		if (n == 1)
+		{
+			return partials[0];
+		}
+		size_t half = n / 2;
+		typename Reducer::Partial res = pairwise(reducer, partials, half, stride);
+		reducer.merge(res, pairwise(reducer, partials + half * stride, n - half, stride));
+		return res;
+	}
+
+	template<typename Reducer, typename T>
+	inline typename Reducer::Partial ReductionHelper::all(const Reducer& reducer, const T& x)
+	{
+		size_t iSize = ReductionHelper::iSize(x);
+		size_t jSize = ReductionHelper::jSize(x);
+		bool flat = ElementWiseHelper::contiguous(x);
+		size_t rows = flat ? 1 : iSize;
+		size_t cols = flat ? iSize * jSize : jSize;
+		size_t chunks = (cols + chunkSize - 1) / chunkSize;
+		std::vector<typename Reducer::Partial> partials(rows * chunks);
+		parallel::forRange(rows * chunks, iSize * jSize, [&](size_t begin, size_t end)
+		{
+			std::array<ReductionRes<T>, chunkSize> scratch;
+			for (size_t c = begin; c < end; c++)
+			{
+				size_t i = c / chunks;
+				size_t j = c % chunks * chunkSize;
+				size_t n = std::min(chunkSize, cols - j);
+				partials[c] = reducer.chunk(chunk(x, i, j, n, flat, scratch.data()), n, i * jSize + j);
+			}
+		});
+		return pairwise(reducer, partials.data(), partials.size(), 1);
+	}
+
+	template<typename Reducer, typename T, typename F>
+	inline void ReductionHelper::rows(const Reducer& reducer, const T& x, const F& finish)
+	{
+		size_t iSize = ReductionHelper::iSize(x);
+		size_t jSize = ReductionHelper::jSize(x);
+		size_t chunks = (jSize + chunkSize - 1) / chunkSize;
+		parallel::forRange(iSize, iSize * jSize, [&](size_t begin, size_t end)
+		{
+			std::array<ReductionRes<T>, chunkSize> scratch;
+			std::vector<typename Reducer::Partial> partials(chunks);
+			for (size_t i = begin; i < end; i++)
+			{
+				for (size_t c = 0; c < chunks; c++)
+				{
+					size_t j = c * chunkSize;
+					size_t n = std::min(chunkSize, jSize - j);
+					partials[c] = reducer.chunk(chunk(x, i, j, n, false, scratch.data()), n, j);
+				}
+				finish(i, pairwise(reducer, partials.data(), chunks, 1));
+			}
+		});
+	}
+
+	template<typename Reducer, typename T, typename F>
+	inline void ReductionHelper::cols(const Reducer& reducer, const T& x, const F& finish)
+	{
+		size_t iSize = ReductionHelper::iSize(x);
+		size_t jSize = ReductionHelper::jSize(x);
+		size_t blocks = (iSize + rowBlock - 1) / rowBlock;
+		size_t chunks = (jSize + chunkSize - 1) / chunkSize;
+		// Row blocks are folded independently into their own row of partials, which are then combined per column.
+		std::vector<typename Reducer::Partial> partials(blocks * jSize);
+		parallel::forRange(blocks * chunks, iSize * jSize, [&](size_t begin, size_t end)
+		{
+			std::array<ReductionRes<T>, chunkSize> scratch;
+			for (size_t t = begin; t < end; t++)
+			{
+				size_t first = t / chunks * rowBlock;
+				size_t last = std::min(first + rowBlock, iSize);
+				size_t j = t % chunks * chunkSize;
+				size_t n = std::min(chunkSize, jSize - j);
+				typename Reducer::Partial* blockPartials = partials.data() + first / rowBlock * jSize + j;
+				reducer.initRow(blockPartials, chunk(x, first, j, n, false, scratch.data()), n, first);
+				for (size_t i = first + 1; i < last; i++)
+				{
+					reducer.mergeRow(blockPartials, chunk(x, i, j, n, false, scratch.data()), n, i);
+				}
+			}
+		});
+		parallel::forRange(jSize, blocks * jSize, [&](size_t begin, size_t end)
+		{
+			for (size_t j = begin; j < end; j++)
+			{
+				finish(j, pairwise(reducer, partials.data() + j, blocks, jSize));
+			}
+		});
+	}
+
+	template<typename Reducer, typename T, typename F>
+	inline void ReductionHelper::axis(const Reducer& reducer, const T& x, Axis axis, const F& finish)
+	{
+		if (axis == Axis::Rows)
+		{
+			rows(reducer, x, finish);
+		}
+		else
+		{
+			cols(reducer, x, finish);
+		}
+	}
+
+	template<typename T>
+	inline size_t ReductionHelper::iSize(const T& x)
+	{
+		size_t iSize = 0;
+		size_t jSize = 0;
+		ElementWiseHelper::shape(x, iSize, jSize);
+		return iSize;
+	}
+
+	template<typename T>
+	inline size_t ReductionHelper::jSize(const T& x)
+	{
+		size_t iSize = 0;
+		size_t jSize = 0;
+		ElementWiseHelper::shape(x, iSize, jSize);
+		return jSize;
+	}
+
+	template<typename Op, typename T, typename>
+	inline ReductionRes<T> reduce(const Op& op, const ReductionRes<T>& init, const T& x)
+	{
+		if (ReductionHelper::iSize(x) == 0 || ReductionHelper::jSize(x) == 0)
+		{
+			return init;
+		}
+		return op(init, ReductionHelper::all(ReductionHelper::Fold<Op, ReductionRes<T>>{ op }, x));
+	}
+
+	template<typename Op, typename T, typename>
+	inline Matrix<ReductionRes<T>> reduce(const Op& op, const ReductionRes<T>& init, const T& x, Axis axis)
+	{
+		Matrix<ReductionRes<T>> res(axis == Axis::Rows ? ReductionHelper::iSize(x) : 1, axis == Axis::Rows ? 1 : ReductionHelper::jSize(x));
+		reduceInto(res, op, init, x, axis);
+		return res;
+	}
+
+	template<typename Op, typename T, typename>
+	inline Matrix<ReductionRes<T>>& reduceInto(Matrix<ReductionRes<T>>& dst, const Op& op, const ReductionRes<T>& init, const T& x, Axis axis)
+	{
+		if ((axis == Axis::Rows ? ReductionHelper::jSize(x) : ReductionHelper::iSize(x)) == 0)
+		{
+			for (size_t k = 0; k < (axis == Axis::Rows ? dst.iSize() : dst.jSize()); k++)
+			{
+				(axis == Axis::Rows ? dst(k, 0) : dst(0, k)) = init;
+			}
+			return dst;
+		}
+		// Taken once, so pool threads write through it without touching the sharing state of dst.
+		typename Matrix<ReductionRes<T>>::RowCol out = axis == Axis::Rows ? dst.col(0) : dst.row(0);
+		ReductionHelper::axis(ReductionHelper::Fold<Op, ReductionRes<T>>{ op }, x, axis, [&](size_t k, const ReductionRes<T>& val)
+		{
+			out[k] = op(init, val);
+		});
+		return dst;
+	}
+
+	template<typename Op, typename T, typename>
+	inline void reduceInto(Matrix<ReductionRes<T>>&& dst, const Op& op, const ReductionRes<T>& init, const T& x, Axis axis)
+	{
+		reduceInto(dst, op, init, x, axis);
+	}
+
+	template<typename T, typename>
+	inline ReductionRes<T> sum(const T& x, Summation summation)
+	{
+		using R = ReductionRes<T>;
+		if constexpr (std::is_floating_point_v<R>)
+		{
+			if (summation == Summation::Kahan && ReductionHelper::iSize(x) > 0 && ReductionHelper::jSize(x) > 0)
+			{
+				KahanSum<R> res = ReductionHelper::all(ReductionHelper::Kahan<R>(), x);
+				return res.sum - res.compensation;
+			}
+		}
+		return reduce(std::plus<>(), R(0), x);
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionRes<T>> sum(const T& x, Axis axis, Summation summation)
+	{
+		Matrix<ReductionRes<T>> res(axis == Axis::Rows ? ReductionHelper::iSize(x) : 1, axis == Axis::Rows ? 1 : ReductionHelper::jSize(x));
+		sumInto(res, x, axis, summation);
+		return res;
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionRes<T>>& sumInto(Matrix<ReductionRes<T>>& dst, const T& x, Axis axis, Summation summation)
+	{
+		using R = ReductionRes<T>;
+		if constexpr (std::is_floating_point_v<R>)
+		{
+			if (summation == Summation::Kahan && (axis == Axis::Rows ? ReductionHelper::jSize(x) : ReductionHelper::iSize(x)) > 0)
+			{
+				typename Matrix<R>::RowCol out = axis == Axis::Rows ? dst.col(0) : dst.row(0);
+				ReductionHelper::axis(ReductionHelper::Kahan<R>(), x, axis, [&](size_t k, const KahanSum<R>& val)
+				{
+					out[k] = val.sum - val.compensation;
+				});
+				return dst;
+			}
+		}
+		return reduceInto(dst, std::plus<>(), R(0), x, axis);
+	}
+
+	template<typename T, typename>
+	inline void sumInto(Matrix<ReductionRes<T>>&& dst, const T& x, Axis axis, Summation summation)
+	{
+		sumInto(dst, x, axis, summation);
+	}
+
+	template<typename T, typename>
+	inline ReductionReal<T> mean(const T& x, Summation summation)
+	{
+		return ReductionReal<T>(sum(x, summation)) / ReductionReal<T>(ReductionHelper::iSize(x) * ReductionHelper::jSize(x));
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionReal<T>> mean(const T& x, Axis axis, Summation summation)
+	{
+		using R = ReductionReal<T>;
+		R count = R(axis == Axis::Rows ? ReductionHelper::jSize(x) : ReductionHelper::iSize(x));
+		return elementWise([count](const ReductionRes<T>& val) { return R(val) / count; }, sum(x, axis, summation));
+	}
+
+	template<typename T, typename>
+	inline ReductionRes<T> minimum(const T& x)
+	{
+		return ReductionHelper::all(ReductionHelper::Fold<func::min<>, ReductionRes<T>>(), x);
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionRes<T>> minimum(const T& x, Axis axis)
+	{
+		Matrix<ReductionRes<T>> res(axis == Axis::Rows ? ReductionHelper::iSize(x) : 1, axis == Axis::Rows ? 1 : ReductionHelper::jSize(x));
+		typename Matrix<ReductionRes<T>>::RowCol out = axis == Axis::Rows ? res.col(0) : res.row(0);
+		ReductionHelper::axis(ReductionHelper::Fold<func::min<>, ReductionRes<T>>(), x, axis, [&](size_t k, const ReductionRes<T>& val)
+		{
+			out[k] = val;
+		});
+		return res;
+	}
+
+	template<typename T, typename>
+	inline ReductionRes<T> maximum(const T& x)
+	{
+		return ReductionHelper::all(ReductionHelper::Fold<func::max<>, ReductionRes<T>>(), x);
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionRes<T>> maximum(const T& x, Axis axis)
+	{
+		Matrix<ReductionRes<T>> res(axis == Axis::Rows ? ReductionHelper::iSize(x) : 1, axis == Axis::Rows ? 1 : ReductionHelper::jSize(x));
+		typename Matrix<ReductionRes<T>>::RowCol out = axis == Axis::Rows ? res.col(0) : res.row(0);
+		ReductionHelper::axis(ReductionHelper::Fold<func::max<>, ReductionRes<T>>(), x, axis, [&](size_t k, const ReductionRes<T>& val)
+		{
+			out[k] = val;
+		});
+		return res;
+	}
+
+	template<typename T, typename>
+	inline std::pair<size_t, size_t> argmin(const T& x)
+	{
+		size_t pos = ReductionHelper::all(ReductionHelper::Arg<std::less<>, ReductionRes<T>>(), x).pos;
+		return { pos / ReductionHelper::jSize(x), pos % ReductionHelper::jSize(x) };
+	}
+
+	template<typename T, typename>
+	inline Matrix<size_t> argmin(const T& x, Axis axis)
+	{
+		Matrix<size_t> res(axis == Axis::Rows ? ReductionHelper::iSize(x) : 1, axis == Axis::Rows ? 1 : ReductionHelper::jSize(x));
+		Matrix<size_t>::RowCol out = axis == Axis::Rows ? res.col(0) : res.row(0);
+		ReductionHelper::axis(ReductionHelper::Arg<std::less<>, ReductionRes<T>>(), x, axis, [&](size_t k, const ArgValue<ReductionRes<T>>& val)
+		{
+			out[k] = val.pos;
+		});
+		return res;
+	}
+
+	template<typename T, typename>
+	inline std::pair<size_t, size_t> argmax(const T& x)
+	{
+		size_t pos = ReductionHelper::all(ReductionHelper::Arg<std::greater<>, ReductionRes<T>>(), x).pos;
+		return { pos / ReductionHelper::jSize(x), pos % ReductionHelper::jSize(x) };
+	}
+
+	template<typename T, typename>
+	inline Matrix<size_t> argmax(const T& x, Axis axis)
+	{
+		Matrix<size_t> res(axis == Axis::Rows ? ReductionHelper::iSize(x) : 1, axis == Axis::Rows ? 1 : ReductionHelper::jSize(x));
+		Matrix<size_t>::RowCol out = axis == Axis::Rows ? res.col(0) : res.row(0);
+		ReductionHelper::axis(ReductionHelper::Arg<std::greater<>, ReductionRes<T>>(), x, axis, [&](size_t k, const ArgValue<ReductionRes<T>>& val)
+		{
+			out[k] = val.pos;
+		});
+		return res;
+	}
+
+	template<typename T, typename>
+	inline ReductionReal<T> norm1(const T& x)
+	{
+		if constexpr (!std::is_floating_point_v<ElementWiseValue_t<T>>)
+		{
+			return norm1(ReductionHelper::real(x));
+		}
+		else
+		{
+			// max(x, -x) keeps the whole expression vectorizable.
+			return sum(max(x, -x));
+		}
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionReal<T>> norm1(const T& x, Axis axis)
+	{
+		if constexpr (!std::is_floating_point_v<ElementWiseValue_t<T>>)
+		{
+			return norm1(ReductionHelper::real(x), axis);
+		}
+		else
+		{
+			return sum(max(x, -x), axis);
+		}
+	}
+
+	template<typename T, typename>
+	inline ReductionReal<T> norm2(const T& x)
+	{
+		if constexpr (!std::is_floating_point_v<ElementWiseValue_t<T>>)
+		{
+			return norm2(ReductionHelper::real(x));
+		}
+		else
+		{
+			return std::sqrt(sum(x * x));
+		}
+	}
+
+	template<typename T, typename>
+	inline Matrix<ReductionReal<T>> norm2(const T& x, Axis axis)
+	{
+		if constexpr (!std::is_floating_point_v<ElementWiseValue_t<T>>)
+		{
+			return norm2(ReductionHelper::real(x), axis);
+		}
+		else
+		{
+			Matrix<ReductionReal<T>> res = sum(x * x, axis);
+			res.assignElementWise([](const ReductionReal<T>& val) { return std::sqrt(val); });
+			return res;
+		}
+	}
+}
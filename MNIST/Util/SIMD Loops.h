@@ -0,0 +1,204 @@
+// No include guard: SIMD.h includes this file once per instruction set, inside that instruction set's namespace
+// and target region, after its Vec<float>, Vec<double> and Vec<int> definitions. Every function here must be
+// compiled for the instruction set of the Vec it is instantiated with, hence the repetition.
+
+template<typename V, Kind K>
+inline typename V::Reg arithmetic(typename V::Reg lhs, typename V::Reg rhs)
+{
+	if constexpr (K == Kind::Plus)
+	{
+		return V::add(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Minus)
+	{
+		return V::sub(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Multiplies)
+	{
+		return V::mul(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Divides)
+	{
+		return V::div(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Min)
+	{
+		return V::min(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Max)
+	{
+		return V::max(lhs, rhs);
+	}
+	else if constexpr (K == Kind::BitAnd)
+	{
+		return V::bitAnd(lhs, rhs);
+	}
+	else if constexpr (K == Kind::BitOr)
+	{
+		return V::bitOr(lhs, rhs);
+	}
+	else if constexpr (K == Kind::BitXor)
+	{
+		return V::bitXor(lhs, rhs);
+	}
+	else if constexpr (K == Kind::LeftShift)
+	{
+		return V::shl(lhs, rhs);
+	}
+	else
+	{
+		static_assert(K == Kind::RightShift, "not an arithmetic operation");
+		return V::shr(lhs, rhs);
+	}
+}
+
+template<typename V, Kind K>
+inline unsigned compare(typename V::Reg lhs, typename V::Reg rhs)
+{
+	if constexpr (K == Kind::EqualTo)
+	{
+		return V::eq(lhs, rhs);
+	}
+	else if constexpr (K == Kind::NotEqualTo)
+	{
+		return V::ne(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Greater)
+	{
+		return V::gt(lhs, rhs);
+	}
+	else if constexpr (K == Kind::Less)
+	{
+		return V::lt(lhs, rhs);
+	}
+	else if constexpr (K == Kind::GreaterEqual)
+	{
+		return V::ge(lhs, rhs);
+	}
+	else
+	{
+		static_assert(K == Kind::LessEqual, "not a comparison");
+		return V::le(lhs, rhs);
+	}
+}
+
+template<typename V, bool Broadcast>
+inline typename V::Reg load(const Operand<typename V::Elem>& operand, typename V::Reg splat, size_t i)
+{
+	if constexpr (Broadcast)
+	{
+		return splat;
+	}
+	else
+	{
+		return V::load(operand.data + i);
+	}
+}
+
+template<typename V, Kind K, bool LhsBroadcast, bool RhsBroadcast, typename Op, typename R>
+inline void binaryLoop(const Op& op, size_t n, R* out, Operand<typename V::Elem> a, Operand<typename V::Elem> b)
+{
+	using Reg = typename V::Reg;
+	constexpr size_t width = V::width;
+	Reg aSplat = V::set1(a.data[0]);
+	Reg bSplat = V::set1(b.data[0]);
+	size_t i = 0;
+	for (; i + width <= n; i += width)
+	{
+		Reg lhs = load<V, LhsBroadcast>(a, aSplat, i);
+		Reg rhs = load<V, RhsBroadcast>(b, bSplat, i);
+		if constexpr (isComparison(K))
+		{
+			storeMask(out + i, compare<V, K>(lhs, rhs), width);
+		}
+		else
+		{
+			V::store(out + i, arithmetic<V, K>(lhs, rhs));
+		}
+	}
+	for (; i < n; i++)
+	{
+		out[i] = op(a.data[LhsBroadcast ? 0 : i], b.data[RhsBroadcast ? 0 : i]);
+	}
+}
+
+template<typename V, Kind K, typename Op, typename R>
+inline void binary(const Op& op, size_t n, R* out, Operand<typename V::Elem> a, Operand<typename V::Elem> b)
+{
+	if (a.broadcast)
+	{
+		binaryLoop<V, K, true, false>(op, n, out, a, b);
+	}
+	else if (b.broadcast)
+	{
+		binaryLoop<V, K, false, true>(op, n, out, a, b);
+	}
+	else
+	{
+		binaryLoop<V, K, false, false>(op, n, out, a, b);
+	}
+}
+
+template<typename V, Kind K, typename Op, typename R>
+inline void unary(const Op& op, size_t n, R* out, Operand<typename V::Elem> a)
+{
+	using Reg = typename V::Reg;
+	constexpr size_t width = V::width;
+	size_t i = 0;
+	for (; i + width <= n; i += width)
+	{
+		Reg val = V::load(a.data + i);
+		if constexpr (K == Kind::Negate)
+		{
+			V::store(out + i, V::neg(val));
+		}
+		else if constexpr (K == Kind::BitNot)
+		{
+			V::store(out + i, V::bitNot(val));
+		}
+		else
+		{
+			static_assert(K == Kind::LogicalNot, "not a unary operation");
+			storeMask(out + i, V::eq(val, V::set1(0)), width);
+		}
+	}
+	for (; i < n; i++)
+	{
+		out[i] = op(a.data[i]);
+	}
+}
+
+template<typename V, Kind K, typename Op>
+inline typename V::Elem reduce(const Op& op, size_t n, const typename V::Elem* a, typename V::Elem init)
+{
+	using Reg = typename V::Reg;
+	constexpr size_t width = V::width;
+	typename V::Elem res = init;
+	size_t i = 0;
+	if (n >= 4 * width)
+	{
+		// Independent accumulators hide the latency of the operation.
+		Reg acc0 = V::load(a);
+		Reg acc1 = V::load(a + width);
+		Reg acc2 = V::load(a + 2 * width);
+		Reg acc3 = V::load(a + 3 * width);
+		for (i = 4 * width; i + 4 * width <= n; i += 4 * width)
+		{
+			acc0 = arithmetic<V, K>(acc0, V::load(a + i));
+			acc1 = arithmetic<V, K>(acc1, V::load(a + i + width));
+			acc2 = arithmetic<V, K>(acc2, V::load(a + i + 2 * width));
+			acc3 = arithmetic<V, K>(acc3, V::load(a + i + 3 * width));
+		}
+		typename V::Elem lanes[width];
+		V::store(lanes, arithmetic<V, K>(arithmetic<V, K>(acc0, acc1), arithmetic<V, K>(acc2, acc3)));
+		for (size_t l = 0; l < width; l++)
+		{
+			res = op(res, lanes[l]);
+		}
+	}
+	for (; i < n; i++)
+	{
+		res = op(res, a[i]);
+	}
+	return res;
+}
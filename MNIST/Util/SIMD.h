@@ -0,0 +1,1347 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+#include "Functional.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Vector loops for element-wise operations on contiguous float, double and int arrays. The instruction set is
+// chosen at runtime from CPUID, so one binary runs everywhere and still uses AVX-512 where it exists.
+// Operations are recognized by functor type (std::plus, func::min, std::less, ...); anything else, and any
+// operation the CPU cannot vectorize, is left to the caller's scalar loop.
+
+namespace simd
+{
+	enum class Level
+	{
+		Scalar,
+		SSE41,
+		AVX2,
+		AVX512
+	};
+
+	enum class Kind
+	{
+		None,
+		Plus,
+		Minus,
+		Multiplies,
+		Divides,
+		Min,
+		Max,
+		BitAnd,
+		BitOr,
+		BitXor,
+		LeftShift,
+		RightShift,
+		EqualTo,
+		NotEqualTo,
+		Greater,
+		Less,
+		GreaterEqual,
+		LessEqual,
+		Negate,
+		BitNot,
+		LogicalNot
+	};
+
+	// One operand of a loop: either an array read element by element or a single value used for every element.
+	template<typename T>
+	struct Operand
+	{
+		const T* data;
+		bool broadcast;
+	};
+
+	template<Kind K, typename T>
+	struct OpKindOf
+	{
+		static constexpr Kind kind = K;
+		using Arg = T;
+	};
+
+	template<typename Op>
+	struct OpKind : OpKindOf<Kind::None, void> {};
+	template<typename T>
+	struct OpKind<std::plus<T>> : OpKindOf<Kind::Plus, T> {};
+	template<typename T>
+	struct OpKind<std::minus<T>> : OpKindOf<Kind::Minus, T> {};
+	template<typename T>
+	struct OpKind<std::multiplies<T>> : OpKindOf<Kind::Multiplies, T> {};
+	template<typename T>
+	struct OpKind<std::divides<T>> : OpKindOf<Kind::Divides, T> {};
+	template<typename T>
+	struct OpKind<func::min<T, std::less<T>>> : OpKindOf<Kind::Min, T> {};
+	template<typename T>
+	struct OpKind<func::max<T, std::less<T>>> : OpKindOf<Kind::Max, T> {};
+	template<typename T>
+	struct OpKind<std::bit_and<T>> : OpKindOf<Kind::BitAnd, T> {};
+	template<typename T>
+	struct OpKind<std::bit_or<T>> : OpKindOf<Kind::BitOr, T> {};
+	template<typename T>
+	struct OpKind<std::bit_xor<T>> : OpKindOf<Kind::BitXor, T> {};
+	template<typename T>
+	struct OpKind<func::left_shift<T>> : OpKindOf<Kind::LeftShift, T> {};
+	template<typename T>
+	struct OpKind<func::right_shift<T>> : OpKindOf<Kind::RightShift, T> {};
+	template<typename T>
+	struct OpKind<std::equal_to<T>> : OpKindOf<Kind::EqualTo, T> {};
+	template<typename T>
+	struct OpKind<std::not_equal_to<T>> : OpKindOf<Kind::NotEqualTo, T> {};
+	template<typename T>
+	struct OpKind<std::greater<T>> : OpKindOf<Kind::Greater, T> {};
+	template<typename T>
+	struct OpKind<std::less<T>> : OpKindOf<Kind::Less, T> {};
+	template<typename T>
+	struct OpKind<std::greater_equal<T>> : OpKindOf<Kind::GreaterEqual, T> {};
+	template<typename T>
+	struct OpKind<std::less_equal<T>> : OpKindOf<Kind::LessEqual, T> {};
+	template<typename T>
+	struct OpKind<std::negate<T>> : OpKindOf<Kind::Negate, T> {};
+	template<typename T>
+	struct OpKind<std::bit_not<T>> : OpKindOf<Kind::BitNot, T> {};
+	template<typename T>
+	struct OpKind<std::logical_not<T>> : OpKindOf<Kind::LogicalNot, T> {};
+
+	inline constexpr size_t arity(Kind kind)
+	{
+		return kind == Kind::Negate || kind == Kind::BitNot || kind == Kind::LogicalNot ? 1 : 2;
+	}
+
+	inline constexpr bool isComparison(Kind kind)
+	{
+		return (kind >= Kind::EqualTo && kind <= Kind::LessEqual) || kind == Kind::LogicalNot;
+	}
+
+	inline constexpr bool isBitwise(Kind kind)
+	{
+		return (kind >= Kind::BitAnd && kind <= Kind::RightShift) || kind == Kind::BitNot;
+	}
+
+	template<typename T>
+	inline constexpr bool isElement = std::is_same_v<T, float> || std::is_same_v<T, double> || std::is_same_v<T, int> && sizeof(int) == 4;
+
+	template<typename T, Kind K>
+	inline constexpr bool supports = K != Kind::None && (std::is_integral_v<T> ? K != Kind::Divides : !isBitwise(K));
+
+	// True if elementWise(Op(), params...) with element types T, Ts... and result type R maps onto a vector loop.
+	template<typename Op, typename R, typename T, typename... Ts>
+	inline constexpr bool isVectorizable =
+		(std::is_same_v<T, Ts> && ...) &&
+		isElement<T> &&
+		supports<T, OpKind<Op>::kind> &&
+		arity(OpKind<Op>::kind) == 1 + sizeof...(Ts) &&
+		(std::is_void_v<typename OpKind<Op>::Arg> || std::is_same_v<typename OpKind<Op>::Arg, T>) &&
+		std::is_same_v<R, std::conditional_t<isComparison(OpKind<Op>::kind), bool, T>>;
+
+	// True if reduce(Op(), ...) over T maps onto a vector loop, i.e. Op is an associative arithmetic operation.
+	template<typename Op, typename T>
+	inline constexpr bool isReducible =
+		isElement<T> &&
+		supports<T, OpKind<Op>::kind> &&
+		(OpKind<Op>::kind == Kind::Plus || OpKind<Op>::kind == Kind::Multiplies || OpKind<Op>::kind == Kind::Min ||
+			OpKind<Op>::kind == Kind::Max || isBitwise(OpKind<Op>::kind) && arity(OpKind<Op>::kind) == 2 &&
+			OpKind<Op>::kind != Kind::LeftShift && OpKind<Op>::kind != Kind::RightShift) &&
+		(std::is_void_v<typename OpKind<Op>::Arg> || std::is_same_v<typename OpKind<Op>::Arg, T>);
+
+	inline Level detectLevel();
+	inline std::atomic<Level>& activeLevel();
+	inline Level level();
+	// Caps dispatch at the given level (never above what the CPU supports), e.g. to compare instruction sets.
+	inline void setLevel(Level level);
+
+	// Whether the current level has a vector loop for K on T. Without AVX2, only shifts are missing.
+	template<typename T, Kind K>
+	inline bool isAvailable();
+
+	// Conversion instructions outside the level ladder. F16C is only used from Level::AVX2 up and AVX-512 BF16 only
+	// at Level::AVX512, so setLevel caps them too.
+	inline bool detectF16C();
+	inline bool detectBF16();
+	inline bool hasF16C();
+	inline bool hasBF16();
+	// AVX-512 VNNI together with the AVX-512 BW byte loads it needs, again only at Level::AVX512.
+	inline bool detectVNNI();
+	inline bool hasVNNI();
+	// Fused multiply-add, which the gemm micro-kernels need on top of AVX2. Only used from Level::AVX2 up.
+	inline bool detectFMA();
+	inline bool hasFMA();
+
+	// out[i] = op(a[i]) and out[i] = op(a[i], b[i]) for i < n. Only valid when isVectorizable and isAvailable.
+	template<typename Op, typename R, typename T>
+	inline void apply(const Op& op, size_t n, R* out, Operand<T> a);
+	template<typename Op, typename R, typename T>
+	inline void apply(const Op& op, size_t n, R* out, Operand<T> a, Operand<T> b);
+	// op(init, a[0], ..., a[n - 1]) folded in an unspecified order. Only valid when isReducible and isAvailable.
+	template<typename Op, typename T>
+	inline T reduce(const Op& op, size_t n, const T* a, T init);
+
+	// Conversions between float and the bit patterns of IEEE binary16 (half) and bfloat16 values. Narrowing rounds to
+	// nearest even, saturates to infinity and keeps NaNs quiet. The bulk versions use F16C, AVX-512 and AVX-512 BF16
+	// where available; the latter flushes subnormal floats to zero, which bfloat16 can barely represent anyway.
+	inline float halfToFloat(uint16_t val);
+	inline uint16_t floatToHalf(float val);
+	inline float bfloat16ToFloat(uint16_t val);
+	inline uint16_t floatToBfloat16(float val);
+	inline void halfToFloat(size_t n, const uint16_t* in, float* out);
+	inline void floatToHalf(size_t n, const float* in, uint16_t* out);
+	inline void bfloat16ToFloat(size_t n, const uint16_t* in, float* out);
+	inline void floatToBfloat16(size_t n, const float* in, uint16_t* out);
+
+	// Products of unsigned with signed bytes, the inner loop of quantized matrix products. b is packed once so that
+	// each 64 byte block holds 4 consecutive k of 16 consecutive rows (row by row), blocks running along k first and
+	// zero padded past n and rows. A multiply-add of 4 bytes of a broadcast to every 32 bit lane with one block then
+	// updates 16 dot products at once, with nothing to add across lanes at the end. AVX-512 VNNI does this in one
+	// instruction; AVX2 widens both sides to 16 bits and uses pmaddwd, as pmaddubsw would saturate.
+	inline size_t packedSize(size_t n, size_t rows);
+	// Packs the rows x n matrix whose element (r, k) is b[r * rsB + k * csB] into packed, which holds packedSize bytes.
+	inline void packRows(size_t n, const int8_t* b, size_t rsB, size_t csB, size_t rows, int8_t* packed);
+	// out[i * rsOut + r] = a[i * rsA] * b(r, 0) + ... + a[i * rsA + n - 1] * b(r, n - 1) for i < m and r < rows, with b
+	// packed by packRows. Exact in 32 bits for n up to 2^16.
+	inline void dotPacked(size_t m, size_t n, const uint8_t* a, size_t rsA, const int8_t* packed, size_t rows, int32_t* out, size_t rsOut);
+
+	// Bytes k to k + 3 of a as one little endian word, zero past n.
+	inline uint32_t quadAt(const uint8_t* a, size_t k, size_t n);
+
+	inline constexpr std::array<uint64_t, 256> makeMaskBytes()
+	{
+		std::array<uint64_t, 256> ret{};
+		for (size_t mask = 0; mask < 256; mask++)
+		{
+			for (size_t bit = 0; bit < 8; bit++)
+			{
+				if ((mask >> bit) & 1)
+				{
+					ret[mask] |= uint64_t(1) << (8 * bit);
+				}
+			}
+		}
+		return ret;
+	}
+
+	// maskBytes[m] holds byte b == 1 exactly when bit b of m is set, i.e. eight bools at once.
+	inline constexpr std::array<uint64_t, 256> maskBytes = makeMaskBytes();
+
+	inline void storeMask(bool* out, unsigned mask, size_t width)
+	{
+		for (size_t i = 0; i < width; i += 8)
+		{
+			uint64_t bytes = maskBytes[(mask >> i) & 0xFF];
+			std::memcpy(out + i, &bytes, width - i < 8 ? width - i : 8);
+		}
+	}
+
+#ifdef SIMD_X86
+	inline void cpuid(int leaf, int subleaf, unsigned regs[4])
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, leaf, subleaf);
+		for (size_t i = 0; i < 4; i++)
+		{
+			regs[i] = static_cast<unsigned>(info[i]);
+		}
+#else
+		if (!__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3]))
+		{
+			regs[0] = regs[1] = regs[2] = regs[3] = 0;
+		}
+#endif
+	}
+
+	// Register state the OS saves on context switch (XCR0). AVX needs bits 1-2, AVX-512 also bits 5-7.
+	inline uint64_t xgetbv()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return (uint64_t(hi) << 32) | lo;
+#endif
+	}
+#endif
+
+	inline Level detectLevel()
+	{
+#ifdef SIMD_X86
+		unsigned regs[4];
+		cpuid(0, 0, regs);
+		unsigned maxLeaf = regs[0];
+		cpuid(1, 0, regs);
+		bool sse41 = (regs[2] >> 19) & 1;
+		bool osxsave = (regs[2] >> 27) & 1;
+		bool avx = (regs[2] >> 28) & 1;
+		if (!sse41)
+		{
+			return Level::Scalar;
+		}
+		if (!osxsave || !avx || maxLeaf < 7)
+		{
+			return Level::SSE41;
+		}
+		uint64_t xcr0 = xgetbv();
+		cpuid(7, 0, regs);
+		bool avx2 = (regs[1] >> 5) & 1;
+		bool avx512 = (regs[1] >> 16) & 1;
+		if (avx512 && (xcr0 & 0xE6) == 0xE6)
+		{
+			return Level::AVX512;
+		}
+		if (avx2 && (xcr0 & 0x6) == 0x6)
+		{
+			return Level::AVX2;
+		}
+		return Level::SSE41;
+#else
+		return Level::Scalar;
+#endif
+	}
+
+	inline std::atomic<Level>& activeLevel()
+	{
+		static std::atomic<Level> level(detectLevel());
+		return level;
+	}
+
+	inline Level level()
+	{
+		return activeLevel().load(std::memory_order_relaxed);
+	}
+
+	inline void setLevel(Level level)
+	{
+		Level detected = detectLevel();
+		activeLevel().store(level < detected ? level : detected, std::memory_order_relaxed);
+	}
+
+	inline bool detectF16C()
+	{
+#ifdef SIMD_X86
+		unsigned regs[4];
+		cpuid(1, 0, regs);
+		return (regs[2] >> 29) & 1;
+#else
+		return false;
+#endif
+	}
+
+	inline bool detectBF16()
+	{
+#ifdef SIMD_X86
+		unsigned regs[4];
+		cpuid(0, 0, regs);
+		if (regs[0] < 7)
+		{
+			return false;
+		}
+		cpuid(7, 0, regs);
+		if (regs[0] < 1)
+		{
+			return false;
+		}
+		cpuid(7, 1, regs);
+		return (regs[0] >> 5) & 1;
+#else
+		return false;
+#endif
+	}
+
+	inline bool detectVNNI()
+	{
+#ifdef SIMD_X86
+		unsigned regs[4];
+		cpuid(0, 0, regs);
+		if (regs[0] < 7)
+		{
+			return false;
+		}
+		cpuid(7, 0, regs);
+		return ((regs[1] >> 30) & 1) && ((regs[2] >> 11) & 1);
+#else
+		return false;
+#endif
+	}
+
+	inline bool detectFMA()
+	{
+#ifdef SIMD_X86
+		unsigned regs[4];
+		cpuid(1, 0, regs);
+		return (regs[2] >> 12) & 1;
+#else
+		return false;
+#endif
+	}
+
+	inline bool hasF16C()
+	{
+		static const bool f16c = detectF16C();
+		return f16c && level() >= Level::AVX2;
+	}
+
+	inline bool hasBF16()
+	{
+		static const bool bf16 = detectBF16();
+		return bf16 && level() == Level::AVX512;
+	}
+
+	inline bool hasVNNI()
+	{
+		static const bool vnni = detectVNNI();
+		return vnni && level() == Level::AVX512;
+	}
+
+	inline bool hasFMA()
+	{
+		static const bool fma = detectFMA();
+		return fma && level() >= Level::AVX2;
+	}
+
+	inline uint32_t floatBits(float val)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &val, sizeof(bits));
+		return bits;
+	}
+
+	inline float bitsFloat(uint32_t bits)
+	{
+		float val;
+		std::memcpy(&val, &bits, sizeof(val));
+		return val;
+	}
+
+	inline float halfToFloat(uint16_t val)
+	{
+		uint32_t sign = uint32_t(val & 0x8000) << 16;
+		uint32_t exponent = (val >> 10) & 0x1F;
+		uint32_t mantissa = val & 0x3FF;
+		if (exponent == 0x1F)
+		{
+			return bitsFloat(sign | 0x7F800000 | (mantissa << 13));
+		}
+		if (exponent == 0)
+		{
+			if (mantissa == 0)
+			{
+				return bitsFloat(sign);
+			}
+			// Subnormal: shift the leading one into the implicit bit position.
+			exponent = 113;
+			while ((mantissa & 0x400) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			return bitsFloat(sign | (exponent << 23) | ((mantissa & 0x3FF) << 13));
+		}
+		return bitsFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+	}
+
+	inline uint16_t floatToHalf(float val)
+	{
+		uint32_t bits = floatBits(val);
+		uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+		bits &= 0x7FFFFFFF;
+		if (bits > 0x7F800000)
+		{
+			return uint16_t(sign | 0x7E00 | ((bits >> 13) & 0x3FF));
+		}
+		// 65520 and up round to infinity.
+		if (bits >= 0x477FF000)
+		{
+			return uint16_t(sign | 0x7C00);
+		}
+		if (bits < 0x38800000)
+		{
+			// Below 2^-14 the result is subnormal, and 2^-25 and below round to zero.
+			if (bits <= 0x33000000)
+			{
+				return sign;
+			}
+			uint32_t mantissa = (bits & 0x7FFFFF) | 0x800000;
+			uint32_t shift = 126 - (bits >> 23);
+			uint32_t res = mantissa >> shift;
+			uint32_t rest = mantissa & ((uint32_t(1) << shift) - 1);
+			uint32_t halfway = uint32_t(1) << (shift - 1);
+			res += rest > halfway || (rest == halfway && (res & 1));
+			return uint16_t(sign | res);
+		}
+		bits -= 0x38000000;
+		return uint16_t(sign | ((bits + 0xFFF + ((bits >> 13) & 1)) >> 13));
+	}
+
+	inline float bfloat16ToFloat(uint16_t val)
+	{
+		return bitsFloat(uint32_t(val) << 16);
+	}
+
+	inline uint16_t floatToBfloat16(float val)
+	{
+		uint32_t bits = floatBits(val);
+		if ((bits & 0x7FFFFFFF) > 0x7F800000)
+		{
+			return uint16_t((bits >> 16) | 0x40);
+		}
+		return uint16_t((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+	}
+
+	template<typename T, Kind K>
+	inline bool isAvailable()
+	{
+		Level cur = level();
+		if (cur == Level::Scalar)
+		{
+			return false;
+		}
+		if (K == Kind::LeftShift || K == Kind::RightShift)
+		{
+			return cur >= Level::AVX2;
+		}
+		return true;
+	}
+
+#ifdef SIMD_X86
+	namespace sse41
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+		template<typename T>
+		struct Vec;
+
+		template<>
+		struct Vec<float>
+		{
+			using Elem = float;
+			using Reg = __m128;
+			static constexpr size_t width = 4;
+
+			static inline Reg load(const Elem* ptr) { return _mm_loadu_ps(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm_storeu_ps(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm_set1_ps(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm_add_ps(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm_sub_ps(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm_mul_ps(lhs, rhs); }
+			static inline Reg div(Reg lhs, Reg rhs) { return _mm_div_ps(lhs, rhs); }
+			// Operands swapped so that ties and NaNs resolve to lhs, as in func::min and func::max.
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm_min_ps(rhs, lhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm_max_ps(rhs, lhs); }
+			static inline Reg neg(Reg val) { return _mm_xor_ps(val, _mm_set1_ps(-0.0f)); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_cmpeq_ps(lhs, rhs)); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_cmpneq_ps(lhs, rhs)); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_cmpgt_ps(lhs, rhs)); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_cmplt_ps(lhs, rhs)); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_cmpge_ps(lhs, rhs)); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_cmple_ps(lhs, rhs)); }
+		};
+
+		template<>
+		struct Vec<double>
+		{
+			using Elem = double;
+			using Reg = __m128d;
+			static constexpr size_t width = 2;
+
+			static inline Reg load(const Elem* ptr) { return _mm_loadu_pd(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm_storeu_pd(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm_set1_pd(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm_add_pd(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm_sub_pd(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm_mul_pd(lhs, rhs); }
+			static inline Reg div(Reg lhs, Reg rhs) { return _mm_div_pd(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm_min_pd(rhs, lhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm_max_pd(rhs, lhs); }
+			static inline Reg neg(Reg val) { return _mm_xor_pd(val, _mm_set1_pd(-0.0)); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm_movemask_pd(_mm_cmpeq_pd(lhs, rhs)); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm_movemask_pd(_mm_cmpneq_pd(lhs, rhs)); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm_movemask_pd(_mm_cmpgt_pd(lhs, rhs)); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm_movemask_pd(_mm_cmplt_pd(lhs, rhs)); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm_movemask_pd(_mm_cmpge_pd(lhs, rhs)); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm_movemask_pd(_mm_cmple_pd(lhs, rhs)); }
+		};
+
+		// SSE has no per-lane variable shifts, so shifts stay scalar at this level.
+		template<>
+		struct Vec<int>
+		{
+			using Elem = int;
+			using Reg = __m128i;
+			static constexpr size_t width = 4;
+
+			static inline Reg load(const Elem* ptr) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)); }
+			static inline void store(Elem* ptr, Reg val) { _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), val); }
+			static inline Reg set1(Elem val) { return _mm_set1_epi32(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm_add_epi32(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm_sub_epi32(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm_mullo_epi32(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm_min_epi32(lhs, rhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm_max_epi32(lhs, rhs); }
+			static inline Reg bitAnd(Reg lhs, Reg rhs) { return _mm_and_si128(lhs, rhs); }
+			static inline Reg bitOr(Reg lhs, Reg rhs) { return _mm_or_si128(lhs, rhs); }
+			static inline Reg bitXor(Reg lhs, Reg rhs) { return _mm_xor_si128(lhs, rhs); }
+			static inline Reg bitNot(Reg val) { return _mm_xor_si128(val, _mm_set1_epi32(-1)); }
+			static inline Reg neg(Reg val) { return _mm_sub_epi32(_mm_setzero_si128(), val); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lhs, rhs))); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return eq(lhs, rhs) ^ 0xF; }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(lhs, rhs))); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return gt(rhs, lhs); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return lt(lhs, rhs) ^ 0xF; }
+			static inline unsigned le(Reg lhs, Reg rhs) { return gt(lhs, rhs) ^ 0xF; }
+		};
+
+#include "SIMD Loops.h"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+
+	namespace avx2
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+		template<typename T>
+		struct Vec;
+
+		template<>
+		struct Vec<float>
+		{
+			using Elem = float;
+			using Reg = __m256;
+			static constexpr size_t width = 8;
+
+			static inline Reg load(const Elem* ptr) { return _mm256_loadu_ps(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm256_storeu_ps(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm256_set1_ps(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm256_add_ps(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm256_sub_ps(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm256_mul_ps(lhs, rhs); }
+			static inline Reg div(Reg lhs, Reg rhs) { return _mm256_div_ps(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm256_min_ps(rhs, lhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm256_max_ps(rhs, lhs); }
+			static inline Reg neg(Reg val) { return _mm256_xor_ps(val, _mm256_set1_ps(-0.0f)); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_EQ_OQ)); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_NEQ_UQ)); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_GT_OQ)); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_LT_OQ)); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_GE_OQ)); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_LE_OQ)); }
+		};
+
+		template<>
+		struct Vec<double>
+		{
+			using Elem = double;
+			using Reg = __m256d;
+			static constexpr size_t width = 4;
+
+			static inline Reg load(const Elem* ptr) { return _mm256_loadu_pd(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm256_storeu_pd(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm256_set1_pd(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm256_add_pd(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm256_sub_pd(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm256_mul_pd(lhs, rhs); }
+			static inline Reg div(Reg lhs, Reg rhs) { return _mm256_div_pd(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm256_min_pd(rhs, lhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm256_max_pd(rhs, lhs); }
+			static inline Reg neg(Reg val) { return _mm256_xor_pd(val, _mm256_set1_pd(-0.0)); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_EQ_OQ)); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_NEQ_UQ)); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_GT_OQ)); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_LT_OQ)); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_GE_OQ)); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_LE_OQ)); }
+		};
+
+		template<>
+		struct Vec<int>
+		{
+			using Elem = int;
+			using Reg = __m256i;
+			static constexpr size_t width = 8;
+
+			static inline Reg load(const Elem* ptr) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)); }
+			static inline void store(Elem* ptr, Reg val) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), val); }
+			static inline Reg set1(Elem val) { return _mm256_set1_epi32(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm256_add_epi32(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm256_sub_epi32(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm256_mullo_epi32(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm256_min_epi32(lhs, rhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm256_max_epi32(lhs, rhs); }
+			static inline Reg bitAnd(Reg lhs, Reg rhs) { return _mm256_and_si256(lhs, rhs); }
+			static inline Reg bitOr(Reg lhs, Reg rhs) { return _mm256_or_si256(lhs, rhs); }
+			static inline Reg bitXor(Reg lhs, Reg rhs) { return _mm256_xor_si256(lhs, rhs); }
+			static inline Reg shl(Reg lhs, Reg rhs) { return _mm256_sllv_epi32(lhs, rhs); }
+			static inline Reg shr(Reg lhs, Reg rhs) { return _mm256_srav_epi32(lhs, rhs); }
+			static inline Reg bitNot(Reg val) { return _mm256_xor_si256(val, _mm256_set1_epi32(-1)); }
+			static inline Reg neg(Reg val) { return _mm256_sub_epi32(_mm256_setzero_si256(), val); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lhs, rhs))); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return eq(lhs, rhs) ^ 0xFF; }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(lhs, rhs))); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return gt(rhs, lhs); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return lt(lhs, rhs) ^ 0xFF; }
+			static inline unsigned le(Reg lhs, Reg rhs) { return gt(lhs, rhs) ^ 0xFF; }
+		};
+
+#include "SIMD Loops.h"
+
+		// Conversion loops return how many leading elements they handled, always a multiple of the width.
+		inline size_t bfloat16ToFloat(size_t n, const uint16_t* in, float* out)
+		{
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				__m256i val = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+				_mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_slli_epi32(val, 16)));
+			}
+			return i;
+		}
+
+		inline size_t floatToBfloat16(size_t n, const float* in, uint16_t* out)
+		{
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				__m256i bits = _mm256_castps_si256(_mm256_loadu_ps(in + i));
+				__m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+				__m256i res = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(bits, _mm256_set1_epi32(0x7FFF)), odd), 16);
+				__m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, _mm256_set1_epi32(0x7FFFFFFF)), _mm256_set1_epi32(0x7F800000));
+				res = _mm256_blendv_epi8(res, _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40)), nan);
+				// packus works within 128 bit lanes, so the low quadwords of both lanes are gathered afterwards.
+				res = _mm256_permute4x64_epi64(_mm256_packus_epi32(res, res), 0x08);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(res));
+			}
+			return i;
+		}
+
+		// lo and hi are 4 rows of b each, widened to 16 bits. The 32 bit lanes of c0 and c1 collect the products of the
+		// first and the last two bytes of every quad separately.
+		inline void multiplyAdd(__m256i& c0, __m256i& c1, uint32_t quad, __m256i lo, __m256i hi)
+		{
+			__m256i x = _mm256_cvtepu8_epi16(_mm_set1_epi32(int(quad)));
+			c0 = _mm256_add_epi32(c0, _mm256_madd_epi16(x, lo));
+			c1 = _mm256_add_epi32(c1, _mm256_madd_epi16(x, hi));
+		}
+
+		// Adds up the halves and stores the dot products of rows j to j + 7 of b, as far as they go below rows.
+		inline void storeTile(int32_t* out, size_t j, size_t rows, __m256i c0, __m256i c1)
+		{
+			// hadd leaves rows 0, 1, 4, 5 | 2, 3, 6, 7.
+			__m256i sums = _mm256_permute4x64_epi64(_mm256_hadd_epi32(c0, c1), 0xD8);
+			if (rows - j >= 8)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), sums);
+			}
+			else
+			{
+				alignas(32) int32_t lanes[8];
+				_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+				std::memcpy(out + j, lanes, (rows - j) * sizeof(int32_t));
+			}
+		}
+
+		// Tiles of 4 rows of a by half a block (8 rows) of b, in 8 accumulators.
+		inline void dotPacked(size_t m, size_t n, const uint8_t* a, size_t rsA, const int8_t* packed, size_t rows, int32_t* out, size_t rsOut)
+		{
+			size_t quads = (n + 3) / 4;
+			for (size_t i = 0; i < m; i += 4)
+			{
+				// Rows past m repeat the last one and are not stored, so every tile is 4 x 8.
+				const uint8_t* a0 = a + i * rsA;
+				const uint8_t* a1 = a + std::min(i + 1, m - 1) * rsA;
+				const uint8_t* a2 = a + std::min(i + 2, m - 1) * rsA;
+				const uint8_t* a3 = a + std::min(i + 3, m - 1) * rsA;
+				for (size_t j = 0; j < rows; j += 8)
+				{
+					const int8_t* half = packed + (j / 16) * quads * 64 + (j % 16) * 4;
+					__m256i c00 = _mm256_setzero_si256(), c01 = c00, c10 = c00, c11 = c00;
+					__m256i c20 = c00, c21 = c00, c30 = c00, c31 = c00;
+					for (size_t q = 0; q < quads; q++)
+					{
+						__m256i lo = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(half + q * 64)));
+						__m256i hi = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(half + q * 64 + 16)));
+						multiplyAdd(c00, c01, quadAt(a0, 4 * q, n), lo, hi);
+						multiplyAdd(c10, c11, quadAt(a1, 4 * q, n), lo, hi);
+						multiplyAdd(c20, c21, quadAt(a2, 4 * q, n), lo, hi);
+						multiplyAdd(c30, c31, quadAt(a3, 4 * q, n), lo, hi);
+					}
+					storeTile(out + i * rsOut, j, rows, c00, c01);
+					if (i + 1 < m)
+					{
+						storeTile(out + (i + 1) * rsOut, j, rows, c10, c11);
+					}
+					if (i + 2 < m)
+					{
+						storeTile(out + (i + 2) * rsOut, j, rows, c20, c21);
+					}
+					if (i + 3 < m)
+					{
+						storeTile(out + (i + 3) * rsOut, j, rows, c30, c31);
+					}
+				}
+			}
+		}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+
+	namespace avx512
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+		template<typename T>
+		struct Vec;
+
+		template<>
+		struct Vec<float>
+		{
+			using Elem = float;
+			using Reg = __m512;
+			static constexpr size_t width = 16;
+
+			static inline Reg load(const Elem* ptr) { return _mm512_loadu_ps(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm512_storeu_ps(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm512_set1_ps(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm512_add_ps(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm512_sub_ps(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm512_mul_ps(lhs, rhs); }
+			static inline Reg div(Reg lhs, Reg rhs) { return _mm512_div_ps(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm512_min_ps(rhs, lhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm512_max_ps(rhs, lhs); }
+			static inline Reg neg(Reg val) { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(val), _mm512_set1_epi32(INT32_MIN))); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_EQ_OQ); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_NEQ_UQ); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_GT_OQ); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_LT_OQ); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_GE_OQ); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_LE_OQ); }
+		};
+
+		template<>
+		struct Vec<double>
+		{
+			using Elem = double;
+			using Reg = __m512d;
+			static constexpr size_t width = 8;
+
+			static inline Reg load(const Elem* ptr) { return _mm512_loadu_pd(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm512_storeu_pd(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm512_set1_pd(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm512_add_pd(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm512_sub_pd(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm512_mul_pd(lhs, rhs); }
+			static inline Reg div(Reg lhs, Reg rhs) { return _mm512_div_pd(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm512_min_pd(rhs, lhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm512_max_pd(rhs, lhs); }
+			static inline Reg neg(Reg val) { return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(val), _mm512_set1_epi64(INT64_MIN))); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_EQ_OQ); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_NEQ_UQ); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_GT_OQ); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LT_OQ); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_GE_OQ); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LE_OQ); }
+		};
+
+		template<>
+		struct Vec<int>
+		{
+			using Elem = int;
+			using Reg = __m512i;
+			static constexpr size_t width = 16;
+
+			static inline Reg load(const Elem* ptr) { return _mm512_loadu_si512(ptr); }
+			static inline void store(Elem* ptr, Reg val) { _mm512_storeu_si512(ptr, val); }
+			static inline Reg set1(Elem val) { return _mm512_set1_epi32(val); }
+			static inline Reg add(Reg lhs, Reg rhs) { return _mm512_add_epi32(lhs, rhs); }
+			static inline Reg sub(Reg lhs, Reg rhs) { return _mm512_sub_epi32(lhs, rhs); }
+			static inline Reg mul(Reg lhs, Reg rhs) { return _mm512_mullo_epi32(lhs, rhs); }
+			static inline Reg min(Reg lhs, Reg rhs) { return _mm512_min_epi32(lhs, rhs); }
+			static inline Reg max(Reg lhs, Reg rhs) { return _mm512_max_epi32(lhs, rhs); }
+			static inline Reg bitAnd(Reg lhs, Reg rhs) { return _mm512_and_si512(lhs, rhs); }
+			static inline Reg bitOr(Reg lhs, Reg rhs) { return _mm512_or_si512(lhs, rhs); }
+			static inline Reg bitXor(Reg lhs, Reg rhs) { return _mm512_xor_si512(lhs, rhs); }
+			static inline Reg shl(Reg lhs, Reg rhs) { return _mm512_sllv_epi32(lhs, rhs); }
+			static inline Reg shr(Reg lhs, Reg rhs) { return _mm512_srav_epi32(lhs, rhs); }
+			static inline Reg bitNot(Reg val) { return _mm512_xor_si512(val, _mm512_set1_epi32(-1)); }
+			static inline Reg neg(Reg val) { return _mm512_sub_epi32(_mm512_setzero_si512(), val); }
+			static inline unsigned eq(Reg lhs, Reg rhs) { return _mm512_cmpeq_epi32_mask(lhs, rhs); }
+			static inline unsigned ne(Reg lhs, Reg rhs) { return _mm512_cmpneq_epi32_mask(lhs, rhs); }
+			static inline unsigned gt(Reg lhs, Reg rhs) { return _mm512_cmpgt_epi32_mask(lhs, rhs); }
+			static inline unsigned lt(Reg lhs, Reg rhs) { return _mm512_cmplt_epi32_mask(lhs, rhs); }
+			static inline unsigned ge(Reg lhs, Reg rhs) { return _mm512_cmpge_epi32_mask(lhs, rhs); }
+			static inline unsigned le(Reg lhs, Reg rhs) { return _mm512_cmple_epi32_mask(lhs, rhs); }
+		};
+
+#include "SIMD Loops.h"
+
+		inline size_t halfToFloat(size_t n, const uint16_t* in, float* out)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				_mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i))));
+			}
+			return i;
+		}
+
+		inline size_t floatToHalf(size_t n, const float* in, uint16_t* out)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				__m256i res = _mm512_cvtps_ph(_mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), res);
+			}
+			return i;
+		}
+
+		inline size_t bfloat16ToFloat(size_t n, const uint16_t* in, float* out)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				__m512i val = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+				_mm512_storeu_ps(out + i, _mm512_castsi512_ps(_mm512_slli_epi32(val, 16)));
+			}
+			return i;
+		}
+
+		inline size_t floatToBfloat16(size_t n, const float* in, uint16_t* out)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				__m512i bits = _mm512_castps_si512(_mm512_loadu_ps(in + i));
+				__m512i odd = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+				__m512i res = _mm512_srli_epi32(_mm512_add_epi32(_mm512_add_epi32(bits, _mm512_set1_epi32(0x7FFF)), odd), 16);
+				__mmask16 nan = _mm512_cmpgt_epi32_mask(_mm512_and_si512(bits, _mm512_set1_epi32(0x7FFFFFFF)), _mm512_set1_epi32(0x7F800000));
+				res = _mm512_mask_mov_epi32(res, nan, _mm512_or_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(0x40)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm512_cvtepi32_epi16(res));
+			}
+			return i;
+		}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+
+	// F16C is a feature flag of its own, although every AVX2 CPU has it.
+	namespace f16c
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,f16c")
+#endif
+		inline size_t halfToFloat(size_t n, const uint16_t* in, float* out)
+		{
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+			}
+			return i;
+		}
+
+		inline size_t floatToHalf(size_t n, const float* in, uint16_t* out)
+		{
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+			}
+			return i;
+		}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+
+	namespace avx512bf16
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bf16"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bf16")
+#endif
+		inline size_t floatToBfloat16(size_t n, const float* in, uint16_t* out)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				__m256bh res = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+				std::memcpy(out + i, &res, sizeof(res));
+			}
+			return i;
+		}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+
+	namespace avx512vnni
+	{
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx512vnni"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni")
+#endif
+		// c[t] += the 4 bytes of quad times block t in every 32 bit lane, for the 4 blocks of a tile.
+		inline void multiplyAdd(__m512i& c0, __m512i& c1, __m512i& c2, __m512i& c3, uint32_t quad, __m512i w0, __m512i w1, __m512i w2, __m512i w3)
+		{
+			__m512i x = _mm512_set1_epi32(int(quad));
+			c0 = _mm512_dpbusd_epi32(c0, x, w0);
+			c1 = _mm512_dpbusd_epi32(c1, x, w1);
+			c2 = _mm512_dpbusd_epi32(c2, x, w2);
+			c3 = _mm512_dpbusd_epi32(c3, x, w3);
+		}
+
+		// Stores the dot products of blocks starting at row j of b, as far as they go below rows.
+		inline void storeTile(int32_t* out, size_t j, size_t rows, __m512i c0, __m512i c1, __m512i c2, __m512i c3)
+		{
+			__m512i c[4] = { c0, c1, c2, c3 };
+			for (size_t t = 0; t < 4 && j + 16 * t < rows; t++)
+			{
+				size_t left = rows - j - 16 * t;
+				_mm512_mask_storeu_epi32(out + j + 16 * t, left >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << left) - 1), c[t]);
+			}
+		}
+
+		// Tiles of 4 rows of a by 4 blocks (64 rows) of b, in 16 accumulators.
+		inline void dotPacked(size_t m, size_t n, const uint8_t* a, size_t rsA, const int8_t* packed, size_t rows, int32_t* out, size_t rsOut)
+		{
+			size_t quads = (n + 3) / 4;
+			size_t blocks = (rows + 15) / 16;
+			for (size_t i = 0; i < m; i += 4)
+			{
+				// Rows past m and blocks past the last repeat the last one and are not stored, so every tile is 4 x 4.
+				const uint8_t* a0 = a + i * rsA;
+				const uint8_t* a1 = a + std::min(i + 1, m - 1) * rsA;
+				const uint8_t* a2 = a + std::min(i + 2, m - 1) * rsA;
+				const uint8_t* a3 = a + std::min(i + 3, m - 1) * rsA;
+				for (size_t b = 0; b < blocks; b += 4)
+				{
+					const int8_t* p0 = packed + b * quads * 64;
+					const int8_t* p1 = packed + std::min(b + 1, blocks - 1) * quads * 64;
+					const int8_t* p2 = packed + std::min(b + 2, blocks - 1) * quads * 64;
+					const int8_t* p3 = packed + std::min(b + 3, blocks - 1) * quads * 64;
+					__m512i c00 = _mm512_setzero_si512(), c01 = c00, c02 = c00, c03 = c00;
+					__m512i c10 = c00, c11 = c00, c12 = c00, c13 = c00;
+					__m512i c20 = c00, c21 = c00, c22 = c00, c23 = c00;
+					__m512i c30 = c00, c31 = c00, c32 = c00, c33 = c00;
+					for (size_t q = 0; q < quads; q++)
+					{
+						__m512i w0 = _mm512_loadu_si512(p0 + q * 64);
+						__m512i w1 = _mm512_loadu_si512(p1 + q * 64);
+						__m512i w2 = _mm512_loadu_si512(p2 + q * 64);
+						__m512i w3 = _mm512_loadu_si512(p3 + q * 64);
+						multiplyAdd(c00, c01, c02, c03, quadAt(a0, 4 * q, n), w0, w1, w2, w3);
+						multiplyAdd(c10, c11, c12, c13, quadAt(a1, 4 * q, n), w0, w1, w2, w3);
+						multiplyAdd(c20, c21, c22, c23, quadAt(a2, 4 * q, n), w0, w1, w2, w3);
+						multiplyAdd(c30, c31, c32, c33, quadAt(a3, 4 * q, n), w0, w1, w2, w3);
+					}
+					storeTile(out + i * rsOut, b * 16, rows, c00, c01, c02, c03);
+					if (i + 1 < m)
+					{
+						storeTile(out + (i + 1) * rsOut, b * 16, rows, c10, c11, c12, c13);
+					}
+					if (i + 2 < m)
+					{
+						storeTile(out + (i + 2) * rsOut, b * 16, rows, c20, c21, c22, c23);
+					}
+					if (i + 3 < m)
+					{
+						storeTile(out + (i + 3) * rsOut, b * 16, rows, c30, c31, c32, c33);
+					}
+				}
+			}
+		}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+	}
+#endif
+
+	template<typename Op, typename R, typename T>
+	inline void apply(const Op& op, size_t n, R* out, Operand<T> a)
+	{
+		constexpr Kind K = OpKind<Op>::kind;
+		if (n == 0)
+		{
+			return;
+		}
+		switch (level())
+		{
+#ifdef SIMD_X86
+		case Level::AVX512:
+			avx512::unary<avx512::Vec<T>, K>(op, n, out, a);
+			return;
+		case Level::AVX2:
+			avx2::unary<avx2::Vec<T>, K>(op, n, out, a);
+			return;
+		case Level::SSE41:
+			sse41::unary<sse41::Vec<T>, K>(op, n, out, a);
+			return;
+#endif
+		default:
+			for (size_t i = 0; i < n; i++)
+			{
+				out[i] = op(a.data[i]);
+			}
+		}
+	}
+
+	template<typename Op, typename R, typename T>
+	inline void apply(const Op& op, size_t n, R* out, Operand<T> a, Operand<T> b)
+	{
+		constexpr Kind K = OpKind<Op>::kind;
+		if (n == 0)
+		{
+			return;
+		}
+		switch (level())
+		{
+#ifdef SIMD_X86
+		case Level::AVX512:
+			avx512::binary<avx512::Vec<T>, K>(op, n, out, a, b);
+			return;
+		case Level::AVX2:
+			avx2::binary<avx2::Vec<T>, K>(op, n, out, a, b);
+			return;
+		case Level::SSE41:
+			if constexpr (K != Kind::LeftShift && K != Kind::RightShift)
+			{
+				sse41::binary<sse41::Vec<T>, K>(op, n, out, a, b);
+				return;
+			}
+#endif
+		default:
+			for (size_t i = 0; i < n; i++)
+			{
+				out[i] = op(a.data[a.broadcast ? 0 : i], b.data[b.broadcast ? 0 : i]);
+			}
+		}
+	}
+
+	template<typename Op, typename T>
+	inline T reduce(const Op& op, size_t n, const T* a, T init)
+	{
+		constexpr Kind K = OpKind<Op>::kind;
+		switch (level())
+		{
+#ifdef SIMD_X86
+		case Level::AVX512:
+			return avx512::reduce<avx512::Vec<T>, K>(op, n, a, init);
+		case Level::AVX2:
+			return avx2::reduce<avx2::Vec<T>, K>(op, n, a, init);
+		case Level::SSE41:
+			return sse41::reduce<sse41::Vec<T>, K>(op, n, a, init);
+#endif
+		default:
+			for (size_t i = 0; i < n; i++)
+			{
+				init = op(init, a[i]);
+			}
+			return init;
+		}
+	}
+
+	inline void halfToFloat(size_t n, const uint16_t* in, float* out)
+	{
+		size_t i = 0;
+#ifdef SIMD_X86
+		if (level() == Level::AVX512)
+		{
+			i = avx512::halfToFloat(n, in, out);
+		}
+		else if (hasF16C())
+		{
+			i = f16c::halfToFloat(n, in, out);
+		}
+#endif
+		for (; i < n; i++)
+		{
+			out[i] = halfToFloat(in[i]);
+		}
+	}
+
+	inline void floatToHalf(size_t n, const float* in, uint16_t* out)
+	{
+		size_t i = 0;
+#ifdef SIMD_X86
+		if (level() == Level::AVX512)
+		{
+			i = avx512::floatToHalf(n, in, out);
+		}
+		else if (hasF16C())
+		{
+			i = f16c::floatToHalf(n, in, out);
+		}
+#endif
+		for (; i < n; i++)
+		{
+			out[i] = floatToHalf(in[i]);
+		}
+	}
+
+	inline void bfloat16ToFloat(size_t n, const uint16_t* in, float* out)
+	{
+		size_t i = 0;
+#ifdef SIMD_X86
+		if (level() == Level::AVX512)
+		{
+			i = avx512::bfloat16ToFloat(n, in, out);
+		}
+		else if (level() == Level::AVX2)
+		{
+			i = avx2::bfloat16ToFloat(n, in, out);
+		}
+#endif
+		for (; i < n; i++)
+		{
+			out[i] = bfloat16ToFloat(in[i]);
+		}
+	}
+
+	inline void floatToBfloat16(size_t n, const float* in, uint16_t* out)
+	{
+		size_t i = 0;
+#ifdef SIMD_X86
+		if (hasBF16())
+		{
+			i = avx512bf16::floatToBfloat16(n, in, out);
+		}
+		else if (level() == Level::AVX512)
+		{
+			i = avx512::floatToBfloat16(n, in, out);
+		}
+		else if (level() == Level::AVX2)
+		{
+			i = avx2::floatToBfloat16(n, in, out);
+		}
+#endif
+		for (; i < n; i++)
+		{
+			out[i] = floatToBfloat16(in[i]);
+		}
+	}
+
+	inline size_t packedSize(size_t n, size_t rows)
+	{
+		return (rows + 15) / 16 * 16 * ((n + 3) / 4 * 4);
+	}
+
+	inline void packRows(size_t n, const int8_t* b, size_t rsB, size_t csB, size_t rows, int8_t* packed)
+	{
+		size_t quads = (n + 3) / 4;
+		std::memset(packed, 0, packedSize(n, rows));
+		for (size_t r = 0; r < rows; r++)
+		{
+			int8_t* dst = packed + (r / 16) * quads * 64 + (r % 16) * 4;
+			for (size_t k = 0; k < n; k++)
+			{
+				dst[(k / 4) * 64 + k % 4] = b[r * rsB + k * csB];
+			}
+		}
+	}
+
+	inline uint32_t quadAt(const uint8_t* a, size_t k, size_t n)
+	{
+		uint32_t quad = 0;
+		if (k + 4 <= n)
+		{
+			std::memcpy(&quad, a + k, 4);
+		}
+		else
+		{
+			for (size_t t = 0; k + t < n; t++)
+			{
+				quad |= uint32_t(a[k + t]) << (8 * t);
+			}
+		}
+		return quad;
+	}
+
+	inline void dotPacked(size_t m, size_t n, const uint8_t* a, size_t rsA, const int8_t* packed, size_t rows, int32_t* out, size_t rsOut)
+	{
+		if (m == 0 || rows == 0)
+		{
+			return;
+		}
+#ifdef SIMD_X86
+		if (hasVNNI())
+		{
+			avx512vnni::dotPacked(m, n, a, rsA, packed, rows, out, rsOut);
+			return;
+		}
+		if (level() >= Level::AVX2)
+		{
+			avx2::dotPacked(m, n, a, rsA, packed, rows, out, rsOut);
+			return;
+		}
+#endif
+		size_t quads = (n + 3) / 4;
+		for (size_t i = 0; i < m; i++)
+		{
+			for (size_t r = 0; r < rows; r++)
+			{
+				const int8_t* row = packed + (r / 16) * quads * 64 + (r % 16) * 4;
+				int32_t sum = 0;
+				for (size_t k = 0; k < n; k++)
+				{
+					sum += int32_t(a[i * rsA + k]) * row[(k / 4) * 64 + k % 4];
+				}
+				out[i * rsOut + r] = sum;
+			}
+		}
+	}
+}
@@ -0,0 +1,618 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+
+// Non-owning views of evenly spaced elements, in place of C++20's std::span. A Span is contiguous and iterates with
+// plain pointers, so loops and standard algorithms over it vectorize. A StridedSpan steps a fixed number of elements
+// at a time, e.g. down a column of a row major matrix. Both stay valid only as long as the memory they view. A
+// MappedIterator looks every element up through an index map, for rows and columns that are not evenly spaced.
+
+namespace math
+{
+	template<typename T>
+	class StridedIterator
+	{
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = std::remove_cv_t<T>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T*;
+		using reference = T&;
+
+	private:
+		T* m_ptr;
+		difference_type m_stride;
+
+	public:
+		inline constexpr StridedIterator();
+		inline constexpr StridedIterator(T* ptr, size_t stride);
+		inline constexpr operator StridedIterator<const T>() const;
+
+		inline constexpr T* base() const;
+		inline constexpr size_t stride() const;
+
+		inline constexpr T& operator*() const;
+		inline constexpr T* operator->() const;
+		inline constexpr T& operator[](difference_type n) const;
+
+		inline constexpr StridedIterator& operator++();
+		inline constexpr StridedIterator operator++(int);
+		inline constexpr StridedIterator& operator--();
+		inline constexpr StridedIterator operator--(int);
+		inline constexpr StridedIterator& operator+=(difference_type n);
+		inline constexpr StridedIterator& operator-=(difference_type n);
+		inline constexpr StridedIterator operator+(difference_type n) const;
+		inline constexpr StridedIterator operator-(difference_type n) const;
+		// Both iterators must come from the same span.
+		inline constexpr difference_type operator-(const StridedIterator& it) const;
+
+		inline constexpr bool operator==(const StridedIterator& it) const;
+		inline constexpr bool operator!=(const StridedIterator& it) const;
+		inline constexpr bool operator<(const StridedIterator& it) const;
+		inline constexpr bool operator>(const StridedIterator& it) const;
+		inline constexpr bool operator<=(const StridedIterator& it) const;
+		inline constexpr bool operator>=(const StridedIterator& it) const;
+	};
+
+	template<typename T>
+	inline constexpr StridedIterator<T> operator+(typename StridedIterator<T>::difference_type n, const StridedIterator<T>& it);
+
+	template<typename T>
+	class MappedIterator
+	{
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = std::remove_cv_t<T>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T*;
+		using reference = T&;
+
+	private:
+		T* m_data;
+		size_t m_stride;
+		const size_t* m_map;
+		difference_type m_index;
+
+	public:
+		inline constexpr MappedIterator();
+		// Element i lives at data[map[i] * stride], or at data[i * stride] without a map. index is the element the
+		// iterator points to.
+		inline constexpr MappedIterator(T* data, size_t stride, const size_t* map, size_t index);
+		inline constexpr operator MappedIterator<const T>() const;
+
+		inline constexpr size_t index() const;
+
+		inline constexpr T& operator*() const;
+		inline constexpr T* operator->() const;
+		inline constexpr T& operator[](difference_type n) const;
+
+		inline constexpr MappedIterator& operator++();
+		inline constexpr MappedIterator operator++(int);
+		inline constexpr MappedIterator& operator--();
+		inline constexpr MappedIterator operator--(int);
+		inline constexpr MappedIterator& operator+=(difference_type n);
+		inline constexpr MappedIterator& operator-=(difference_type n);
+		inline constexpr MappedIterator operator+(difference_type n) const;
+		inline constexpr MappedIterator operator-(difference_type n) const;
+		// Both iterators must come from the same row or column.
+		inline constexpr difference_type operator-(const MappedIterator& it) const;
+
+		inline constexpr bool operator==(const MappedIterator& it) const;
+		inline constexpr bool operator!=(const MappedIterator& it) const;
+		inline constexpr bool operator<(const MappedIterator& it) const;
+		inline constexpr bool operator>(const MappedIterator& it) const;
+		inline constexpr bool operator<=(const MappedIterator& it) const;
+		inline constexpr bool operator>=(const MappedIterator& it) const;
+	};
+
+	template<typename T>
+	inline constexpr MappedIterator<T> operator+(typename MappedIterator<T>::difference_type n, const MappedIterator<T>& it);
+
+	template<typename T>
+	class Span
+	{
+		T* m_data;
+		size_t m_size;
+
+	public:
+		using element_type = T;
+		using value_type = std::remove_cv_t<T>;
+		using iterator = T*;
+
+		inline constexpr Span();
+		inline constexpr Span(T* data, size_t size);
+		inline constexpr operator Span<const T>() const;
+
+		inline constexpr T* data() const;
+		inline constexpr size_t size() const;
+		inline constexpr bool empty() const;
+		inline constexpr T& operator[](size_t i) const;
+
+		inline constexpr T* begin() const;
+		inline constexpr T* end() const;
+
+		inline constexpr Span subspan(size_t offset, size_t count) const;
+	};
+
+	template<typename T>
+	class StridedSpan
+	{
+		T* m_data;
+		size_t m_size;
+		size_t m_stride;
+
+	public:
+		using element_type = T;
+		using value_type = std::remove_cv_t<T>;
+		using iterator = StridedIterator<T>;
+
+		inline constexpr StridedSpan();
+		// Element i lives at data[i * stride]. The stride of a span of at most one element is irrelevant and
+		// becomes 1.
+		inline constexpr StridedSpan(T* data, size_t size, size_t stride);
+		inline constexpr StridedSpan(const Span<T>& span);
+		inline constexpr operator StridedSpan<const T>() const;
+
+		inline constexpr T* data() const;
+		inline constexpr size_t size() const;
+		inline constexpr size_t stride() const;
+		inline constexpr bool empty() const;
+		inline constexpr T& operator[](size_t i) const;
+
+		inline constexpr StridedIterator<T> begin() const;
+		inline constexpr StridedIterator<T> end() const;
+
+		inline constexpr StridedSpan subspan(size_t offset, size_t count) const;
+
+		inline constexpr bool isContiguous() const;
+		// The same elements as a Span, for which isContiguous() must be true.
+		inline constexpr Span<T> contiguous() const;
+	};
+
+	template<typename T>
+	inline constexpr StridedIterator<T>::StridedIterator() :
+		m_ptr(nullptr),
+		m_stride(1)
+	{}
+
+	template<typename T>
+	inline constexpr StridedIterator<T>::StridedIterator(T* ptr, size_t stride) :
+		m_ptr(ptr),
+		m_stride(difference_type(stride))
+	{}
+
+	template<typename T>
+	inline constexpr StridedIterator<T>::operator StridedIterator<const T>() const
+	{
+		return StridedIterator<const T>(m_ptr, size_t(m_stride));
+	}
+
+	template<typename T>
+	inline constexpr T* StridedIterator<T>::base() const
+	{
+		return m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr size_t StridedIterator<T>::stride() const
+	{
+		return size_t(m_stride);
+	}
+
+	template<typename T>
+	inline constexpr T& StridedIterator<T>::operator*() const
+	{
+		return *m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr T* StridedIterator<T>::operator->() const
+	{
+		return m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr T& StridedIterator<T>::operator[](difference_type n) const
+	{
+		return m_ptr[n * m_stride];
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T>& StridedIterator<T>::operator++()
+	{
+		m_ptr += m_stride;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> StridedIterator<T>::operator++(int)
+	{
+		StridedIterator it = *this;
+		m_ptr += m_stride;
+		return it;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T>& StridedIterator<T>::operator--()
+	{
+		m_ptr -= m_stride;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> StridedIterator<T>::operator--(int)
+	{
+		StridedIterator it = *this;
+		m_ptr -= m_stride;
+		return it;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T>& StridedIterator<T>::operator+=(difference_type n)
+	{
+		m_ptr += n * m_stride;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T>& StridedIterator<T>::operator-=(difference_type n)
+	{
+		m_ptr -= n * m_stride;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> StridedIterator<T>::operator+(difference_type n) const
+	{
+		return StridedIterator(m_ptr + n * m_stride, size_t(m_stride));
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> StridedIterator<T>::operator-(difference_type n) const
+	{
+		return StridedIterator(m_ptr - n * m_stride, size_t(m_stride));
+	}
+
+	template<typename T>
+	inline constexpr typename StridedIterator<T>::difference_type StridedIterator<T>::operator-(const StridedIterator& it) const
+	{
+		return (m_ptr - it.m_ptr) / m_stride;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedIterator<T>::operator==(const StridedIterator& it) const
+	{
+		return m_ptr == it.m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedIterator<T>::operator!=(const StridedIterator& it) const
+	{
+		return m_ptr != it.m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedIterator<T>::operator<(const StridedIterator& it) const
+	{
+		return m_ptr < it.m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedIterator<T>::operator>(const StridedIterator& it) const
+	{
+		return m_ptr > it.m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedIterator<T>::operator<=(const StridedIterator& it) const
+	{
+		return m_ptr <= it.m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedIterator<T>::operator>=(const StridedIterator& it) const
+	{
+		return m_ptr >= it.m_ptr;
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> operator+(typename StridedIterator<T>::difference_type n, const StridedIterator<T>& it)
+	{
+		return it + n;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>::MappedIterator() :
+		m_data(nullptr),
+		m_stride(1),
+		m_map(nullptr),
+		m_index(0)
+	{}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>::MappedIterator(T* data, size_t stride, const size_t* map, size_t index) :
+		m_data(data),
+		m_stride(stride),
+		m_map(map),
+		m_index(difference_type(index))
+	{}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>::operator MappedIterator<const T>() const
+	{
+		return MappedIterator<const T>(m_data, m_stride, m_map, size_t(m_index));
+	}
+
+	template<typename T>
+	inline constexpr size_t MappedIterator<T>::index() const
+	{
+		return size_t(m_index);
+	}
+
+	template<typename T>
+	inline constexpr T& MappedIterator<T>::operator*() const
+	{
+		return m_data[(m_map == nullptr ? size_t(m_index) : m_map[m_index]) * m_stride];
+	}
+
+	template<typename T>
+	inline constexpr T* MappedIterator<T>::operator->() const
+	{
+		return &**this;
+	}
+
+	template<typename T>
+	inline constexpr T& MappedIterator<T>::operator[](difference_type n) const
+	{
+		return *(*this + n);
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>& MappedIterator<T>::operator++()
+	{
+		m_index++;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> MappedIterator<T>::operator++(int)
+	{
+		MappedIterator it = *this;
+		m_index++;
+		return it;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>& MappedIterator<T>::operator--()
+	{
+		m_index--;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> MappedIterator<T>::operator--(int)
+	{
+		MappedIterator it = *this;
+		m_index--;
+		return it;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>& MappedIterator<T>::operator+=(difference_type n)
+	{
+		m_index += n;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T>& MappedIterator<T>::operator-=(difference_type n)
+	{
+		m_index -= n;
+		return *this;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> MappedIterator<T>::operator+(difference_type n) const
+	{
+		return MappedIterator(m_data, m_stride, m_map, size_t(m_index + n));
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> MappedIterator<T>::operator-(difference_type n) const
+	{
+		return MappedIterator(m_data, m_stride, m_map, size_t(m_index - n));
+	}
+
+	template<typename T>
+	inline constexpr typename MappedIterator<T>::difference_type MappedIterator<T>::operator-(const MappedIterator& it) const
+	{
+		return m_index - it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr bool MappedIterator<T>::operator==(const MappedIterator& it) const
+	{
+		return m_index == it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr bool MappedIterator<T>::operator!=(const MappedIterator& it) const
+	{
+		return m_index != it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr bool MappedIterator<T>::operator<(const MappedIterator& it) const
+	{
+		return m_index < it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr bool MappedIterator<T>::operator>(const MappedIterator& it) const
+	{
+		return m_index > it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr bool MappedIterator<T>::operator<=(const MappedIterator& it) const
+	{
+		return m_index <= it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr bool MappedIterator<T>::operator>=(const MappedIterator& it) const
+	{
+		return m_index >= it.m_index;
+	}
+
+	template<typename T>
+	inline constexpr MappedIterator<T> operator+(typename MappedIterator<T>::difference_type n, const MappedIterator<T>& it)
+	{
+		return it + n;
+	}
+
+	template<typename T>
+	inline constexpr Span<T>::Span() :
+		m_data(nullptr),
+		m_size(0)
+	{}
+
+	template<typename T>
+	inline constexpr Span<T>::Span(T* data, size_t size) :
+		m_data(data),
+		m_size(size)
+	{}
+
+	template<typename T>
+	inline constexpr Span<T>::operator Span<const T>() const
+	{
+		return Span<const T>(m_data, m_size);
+	}
+
+	template<typename T>
+	inline constexpr T* Span<T>::data() const
+	{
+		return m_data;
+	}
+
+	template<typename T>
+	inline constexpr size_t Span<T>::size() const
+	{
+		return m_size;
+	}
+
+	template<typename T>
+	inline constexpr bool Span<T>::empty() const
+	{
+		return m_size == 0;
+	}
+
+	template<typename T>
+	inline constexpr T& Span<T>::operator[](size_t i) const
+	{
+		return m_data[i];
+	}
+
+	template<typename T>
+	inline constexpr T* Span<T>::begin() const
+	{
+		return m_data;
+	}
+
+	template<typename T>
+	inline constexpr T* Span<T>::end() const
+	{
+		return m_data + m_size;
+	}
+
+	template<typename T>
+	inline constexpr Span<T> Span<T>::subspan(size_t offset, size_t count) const
+	{
+		return Span(m_data + offset, count);
+	}
+
+	template<typename T>
+	inline constexpr StridedSpan<T>::StridedSpan() :
+		StridedSpan(nullptr, 0, 1)
+	{}
+
+	template<typename T>
+	inline constexpr StridedSpan<T>::StridedSpan(T* data, size_t size, size_t stride) :
+		m_data(data),
+		m_size(size),
+		m_stride(size > 1 ? stride : 1)
+	{}
+
+	template<typename T>
+	inline constexpr StridedSpan<T>::StridedSpan(const Span<T>& span) :
+		StridedSpan(span.data(), span.size(), 1)
+	{}
+
+	template<typename T>
+	inline constexpr StridedSpan<T>::operator StridedSpan<const T>() const
+	{
+		return StridedSpan<const T>(m_data, m_size, m_stride);
+	}
+
+	template<typename T>
+	inline constexpr T* StridedSpan<T>::data() const
+	{
+		return m_data;
+	}
+
+	template<typename T>
+	inline constexpr size_t StridedSpan<T>::size() const
+	{
+		return m_size;
+	}
+
+	template<typename T>
+	inline constexpr size_t StridedSpan<T>::stride() const
+	{
+		return m_stride;
+	}
+
+	template<typename T>
+	inline constexpr bool StridedSpan<T>::empty() const
+	{
+		return m_size == 0;
+	}
+
+	template<typename T>
+	inline constexpr T& StridedSpan<T>::operator[](size_t i) const
+	{
+		return m_data[i * m_stride];
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> StridedSpan<T>::begin() const
+	{
+		return StridedIterator<T>(m_data, m_stride);
+	}
+
+	template<typename T>
+	inline constexpr StridedIterator<T> StridedSpan<T>::end() const
+	{
+		return StridedIterator<T>(m_data + m_size * m_stride, m_stride);
+	}
+
+	template<typename T>
+	inline constexpr StridedSpan<T> StridedSpan<T>::subspan(size_t offset, size_t count) const
+	{
+		return StridedSpan(m_data + offset * m_stride, count, m_stride);
+	}
+
+	template<typename T>
+	inline constexpr bool StridedSpan<T>::isContiguous() const
+	{
+		return m_stride == 1;
+	}
+
+	template<typename T>
+	inline constexpr Span<T> StridedSpan<T>::contiguous() const
+	{
+		return Span<T>(m_data, m_size);
+	}
+}
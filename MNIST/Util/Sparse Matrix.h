@@ -0,0 +1,800 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Matrix.h"
+#include "Thread Pool.h"
+
+// Compressed sparse matrices. Only the nonzero elements are stored, grouped into lines: the rows of a matrix in the
+// Rows layout (CSR) or its columns in the Cols layout (CSC). Line r holds the entries starts()[r] to
+// starts()[r + 1] - 1 of indices() (their column or row, increasing) and values(). Products with a dense Matrix and
+// the element-wise operators below only visit stored entries, so their work is proportional to nonZeros(), not to
+// the size of the matrix: a batch of MNIST images is about 80% zeros.
+
+namespace math
+{
+	enum class SparseLayout
+	{
+		Rows,
+		Cols
+	};
+
+	template<typename T>
+	class SparseMatrix
+	{
+		friend class SparseHelper;
+
+	public:
+		using Index = uint32_t;
+
+	private:
+		size_t m_iSize;
+		size_t m_jSize;
+		SparseLayout m_layout;
+
+		std::vector<size_t> m_starts;
+		std::vector<Index> m_indices;
+		std::vector<T> m_values;
+
+		static inline bool kept(const T& val, const T& threshold);
+
+	public:
+		inline SparseMatrix();
+		// An all zero matrix.
+		inline SparseMatrix(size_t iSize, size_t jSize, SparseLayout layout = SparseLayout::Rows);
+		// Keeps the elements of mat whose magnitude is above threshold.
+		inline explicit SparseMatrix(const Matrix<T>& mat, const T& threshold = T(0), SparseLayout layout = SparseLayout::Rows);
+		// Takes compressed arrays as described above. Throws std::invalid_argument if they are inconsistent.
+		inline SparseMatrix(size_t iSize, size_t jSize, SparseLayout layout, std::vector<size_t> starts, std::vector<Index> indices, std::vector<T> values);
+
+		inline void swap(SparseMatrix& mat) noexcept;
+
+		inline size_t iSize() const;
+		inline size_t jSize() const;
+		inline SparseLayout layout() const;
+		// Number of rows in the Rows layout, of columns in the Cols layout.
+		inline size_t lines() const;
+		inline size_t nonZeros() const;
+		// Fraction of the elements that are stored.
+		inline double density() const;
+
+		inline const std::vector<size_t>& starts() const;
+		inline const std::vector<Index>& indices() const;
+		// Values may be changed in place, which keeps the stored positions even for zeros.
+		inline std::vector<T>& values();
+		inline const std::vector<T>& values() const;
+
+		// Binary search within the line of the element.
+		inline T operator()(size_t i, size_t j) const;
+
+		// The same matrix in the other layout, sorted by counting in O(nonZeros() + lines()).
+		inline SparseMatrix toLayout(SparseLayout layout) const;
+		// Only relabels the lines: the rows of a matrix in one layout are the columns of its transpose in the other.
+		inline SparseMatrix copyTranspose() const;
+		inline Matrix<T> toMatrix() const;
+		// Drops the stored entries whose magnitude is at most threshold, e.g. the zeros left by values() or the
+		// element-wise operators.
+		inline SparseMatrix& prune(const T& threshold = T(0));
+
+		inline SparseMatrix& operator*=(const T& val);
+		inline SparseMatrix& operator/=(const T& val);
+	};
+
+	// res = alpha * op(lhs) * op(rhs) + beta * res, as for dense operands (see Matrix.h), but res must have exactly
+	// the size of the product and the sizes of the operands must agree. Throws std::invalid_argument otherwise. The
+	// work is proportional to the nonzeros of the sparse operand times the other dimension of res, e.g. the first
+	// layer of a network on a sparse batch of inputs.
+	template<typename T>
+	inline Matrix<T>& matMulInto(const T& alpha, const SparseMatrix<T>& lhs, const Matrix<T>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose = false, bool rhsTranspose = false);
+	template<typename T>
+	inline void matMulInto(const T& alpha, const SparseMatrix<T>& lhs, const Matrix<T>& rhs, const T& beta, Matrix<T>&& res, bool lhsTranspose = false, bool rhsTranspose = false);
+	template<typename T>
+	inline Matrix<T>& matMulInto(const T& alpha, const Matrix<T>& lhs, const SparseMatrix<T>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose = false, bool rhsTranspose = false);
+	template<typename T>
+	inline void matMulInto(const T& alpha, const Matrix<T>& lhs, const SparseMatrix<T>& rhs, const T& beta, Matrix<T>&& res, bool lhsTranspose = false, bool rhsTranspose = false);
+
+	template<typename T>
+	inline Matrix<T> operator&&(const SparseMatrix<T>& lhs, const Matrix<T>& rhs);
+	template<typename T>
+	inline Matrix<T> operator&&(const Matrix<T>& lhs, const SparseMatrix<T>& rhs);
+
+	// Applies op to the stored values only, so op(0) must be 0 for the result to mean op of every element, like
+	// negation, scaling or ReLU.
+	template<typename Op, typename T>
+	inline SparseMatrix<ElementWiseRes<Op, T>> elementWise(const Op& op, const SparseMatrix<T>& mat);
+
+	// Operators that keep the sparsity of their operands: scaling, the product with a dense matrix (stored entries of
+	// the sparse one), and sums and products of two sparse matrices (union and intersection of their entries). Two
+	// sparse operands may have different layouts, the result has the layout of lhs. Sizes must agree, otherwise
+	// std::invalid_argument is thrown.
+	template<typename T>
+	inline SparseMatrix<T> operator-(const SparseMatrix<T>& mat);
+	template<typename T>
+	inline SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const T& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator*(const T& lhs, const SparseMatrix<T>& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator/(const SparseMatrix<T>& lhs, const T& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const Matrix<T>& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator*(const Matrix<T>& lhs, const SparseMatrix<T>& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator+(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator-(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs);
+	template<typename T>
+	inline SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs);
+
+	class SparseHelper
+	{
+		template<typename T>
+		friend class SparseMatrix;
+		template<typename T>
+		friend Matrix<T>& matMulInto(const T& alpha, const SparseMatrix<T>& lhs, const Matrix<T>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose, bool rhsTranspose);
+		template<typename T>
+		friend Matrix<T>& matMulInto(const T& alpha, const Matrix<T>& lhs, const SparseMatrix<T>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose, bool rhsTranspose);
+		template<typename T>
+		friend SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const Matrix<T>& rhs);
+		template<typename T>
+		friend SparseMatrix<T> operator+(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs);
+		template<typename T>
+		friend SparseMatrix<T> operator-(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs);
+		template<typename T>
+		friend SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs);
+
+		// A dense operand or result as a pointer and strides, with element (i, j) at data[i * iStride + j * jStride].
+		template<typename T>
+		struct Dense
+		{
+			T* data;
+			size_t iStride;
+			size_t jStride;
+
+			inline T& operator()(size_t i, size_t j) const;
+		};
+
+		template<typename T>
+		static inline Dense<T> dense(Matrix<T>& mat, bool transpose);
+		template<typename T>
+		static inline Dense<const T> dense(const Matrix<T>& mat, bool transpose);
+		// Throws std::length_error if a size does not fit an Index.
+		template<typename T>
+		static inline void checkIndex(size_t iSize, size_t jSize);
+		template<typename T>
+		static inline void checkSize(const SparseMatrix<T>& lhs, size_t iSize, size_t jSize);
+		// Calls product with affine views of the dense operand and of res, copying them first if they are not.
+		template<typename T, typename F>
+		static inline Matrix<T>& affine(const Matrix<T>& operand, Matrix<T>& res, const F& product);
+		// res (m x n) = alpha * S * rhs + beta * res, where the lines of sparse are the rows of S (m x k) if byRows and
+		// its columns otherwise. Every entry of S adds a multiple of a row of rhs to a row of res, so rhs is copied to
+		// contiguous rows first unless they already are, which costs k * n against the nonZeros() * n of the product.
+		template<typename T>
+		static inline void product(const T& alpha, const SparseMatrix<T>& sparse, bool byRows, const Dense<const T>& rhs, const T& beta, const Dense<T>& res, size_t m, size_t k, size_t n);
+
+		// Merges the entries of two matrices of the same layout line by line. Entries in only one of them are
+		// combined with a zero from the other if union, and dropped otherwise.
+		template<typename T, typename Op>
+		static inline SparseMatrix<T> merge(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs, const Op& op, bool unite);
+	};
+
+	template<typename T>
+	inline bool SparseMatrix<T>::kept(const T& val, const T& threshold)
+	{
+		if constexpr (std::is_unsigned_v<T>)
+		{
+			return val > threshold;
+		}
+		else
+		{
+			return val > threshold || val < -threshold;
+		}
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>::SparseMatrix() :
+		SparseMatrix(0, 0)
+	{
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>::SparseMatrix(size_t iSize, size_t jSize, SparseLayout layout) :
+		m_iSize(iSize),
+		m_jSize(jSize),
+		m_layout(layout),
+		m_starts((layout == SparseLayout::Rows ? iSize : jSize) + 1, 0)
+	{
+		SparseHelper::checkIndex<T>(iSize, jSize);
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>::SparseMatrix(const Matrix<T>& mat, const T& threshold, SparseLayout layout) :
+		SparseMatrix(mat.iSize(), mat.jSize())
+	{
+		// Rows are counted and then filled in parallel, with the prefix sum of the counts in between.
+		size_t jSize = m_jSize;
+		parallel::forRange(m_iSize, m_iSize * jSize, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				size_t count = 0;
+				for (size_t j = 0; j < jSize; j++)
+				{
+					count += kept(mat(i, j), threshold);
+				}
+				m_starts[i + 1] = count;
+			}
+		});
+		for (size_t i = 0; i < m_iSize; i++)
+		{
+			m_starts[i + 1] += m_starts[i];
+		}
+		m_indices.resize(m_starts.back());
+		m_values.resize(m_starts.back());
+		parallel::forRange(m_iSize, m_iSize * jSize, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				size_t p = m_starts[i];
+				for (size_t j = 0; j < jSize; j++)
+				{
+					const T& val = mat(i, j);
+					if (kept(val, threshold))
+					{
+						m_indices[p] = Index(j);
+						m_values[p] = val;
+						p++;
+					}
+				}
+			}
+		});
+		if (layout != SparseLayout::Rows)
+		{
+			toLayout(layout).swap(*this);
+		}
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>::SparseMatrix(size_t iSize, size_t jSize, SparseLayout layout, std::vector<size_t> starts, std::vector<Index> indices, std::vector<T> values) :
+		m_iSize(iSize),
+		m_jSize(jSize),
+		m_layout(layout),
+		m_starts(std::move(starts)),
+		m_indices(std::move(indices)),
+		m_values(std::move(values))
+	{
+		SparseHelper::checkIndex<T>(iSize, jSize);
+		size_t lines = this->lines();
+		size_t span = layout == SparseLayout::Rows ? jSize : iSize;
+		if (m_starts.size() != lines + 1 || m_starts[0] != 0 || m_starts.back() != m_indices.size() || m_values.size() != m_indices.size())
+		{
+			throw std::invalid_argument("starts must have lines() + 1 offsets from 0 to the number of indices and values");
+		}
+		for (size_t r = 0; r < lines; r++)
+		{
+			if (m_starts[r] > m_starts[r + 1])
+			{
+				throw std::invalid_argument("starts must be nondecreasing");
+			}
+			for (size_t p = m_starts[r]; p < m_starts[r + 1]; p++)
+			{
+				if (m_indices[p] >= span || (p > m_starts[r] && m_indices[p] <= m_indices[p - 1]))
+				{
+					throw std::invalid_argument("the indices of a line must be increasing and within the matrix");
+				}
+			}
+		}
+	}
+
+	template<typename T>
+	inline void SparseMatrix<T>::swap(SparseMatrix& mat) noexcept
+	{
+		std::swap(m_iSize, mat.m_iSize);
+		std::swap(m_jSize, mat.m_jSize);
+		std::swap(m_layout, mat.m_layout);
+		m_starts.swap(mat.m_starts);
+		m_indices.swap(mat.m_indices);
+		m_values.swap(mat.m_values);
+	}
+
+	template<typename T>
+	inline size_t SparseMatrix<T>::iSize() const
+	{
+		return m_iSize;
+	}
+
+	template<typename T>
+	inline size_t SparseMatrix<T>::jSize() const
+	{
+		return m_jSize;
+	}
+
+	template<typename T>
+	inline SparseLayout SparseMatrix<T>::layout() const
+	{
+		return m_layout;
+	}
+
+	template<typename T>
+	inline size_t SparseMatrix<T>::lines() const
+	{
+		return m_layout == SparseLayout::Rows ? m_iSize : m_jSize;
+	}
+
+	template<typename T>
+	inline size_t SparseMatrix<T>::nonZeros() const
+	{
+		return m_values.size();
+	}
+
+	template<typename T>
+	inline double SparseMatrix<T>::density() const
+	{
+		return m_iSize > 0 && m_jSize > 0 ? double(nonZeros()) / (double(m_iSize) * m_jSize) : 0;
+	}
+
+	template<typename T>
+	inline const std::vector<size_t>& SparseMatrix<T>::starts() const
+	{
+		return m_starts;
+	}
+
+	template<typename T>
+	inline const std::vector<typename SparseMatrix<T>::Index>& SparseMatrix<T>::indices() const
+	{
+		return m_indices;
+	}
+
+	template<typename T>
+	inline std::vector<T>& SparseMatrix<T>::values()
+	{
+		return m_values;
+	}
+
+	template<typename T>
+	inline const std::vector<T>& SparseMatrix<T>::values() const
+	{
+		return m_values;
+	}
+
+	template<typename T>
+	inline T SparseMatrix<T>::operator()(size_t i, size_t j) const
+	{
+		size_t line = m_layout == SparseLayout::Rows ? i : j;
+		size_t index = m_layout == SparseLayout::Rows ? j : i;
+		typename std::vector<Index>::const_iterator begin = m_indices.begin() + m_starts[line];
+		typename std::vector<Index>::const_iterator end = m_indices.begin() + m_starts[line + 1];
+		typename std::vector<Index>::const_iterator it = std::lower_bound(begin, end, Index(index));
+		return it != end && *it == index ? m_values[it - m_indices.begin()] : T(0);
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> SparseMatrix<T>::toLayout(SparseLayout layout) const
+	{
+		if (layout == m_layout)
+		{
+			return *this;
+		}
+		SparseMatrix res(m_iSize, m_jSize, layout);
+		std::vector<size_t>& starts = res.m_starts;
+		for (Index index : m_indices)
+		{
+			starts[index + 1]++;
+		}
+		for (size_t r = 0; r + 1 < starts.size(); r++)
+		{
+			starts[r + 1] += starts[r];
+		}
+		res.m_indices.resize(nonZeros());
+		res.m_values.resize(nonZeros());
+		// Visiting the old lines in order appends to every new line in increasing index order.
+		std::vector<size_t> next(starts.begin(), starts.end() - 1);
+		for (size_t r = 0; r < lines(); r++)
+		{
+			for (size_t p = m_starts[r]; p < m_starts[r + 1]; p++)
+			{
+				size_t q = next[m_indices[p]]++;
+				res.m_indices[q] = Index(r);
+				res.m_values[q] = m_values[p];
+			}
+		}
+		return res;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> SparseMatrix<T>::copyTranspose() const
+	{
+		SparseMatrix res = *this;
+		std::swap(res.m_iSize, res.m_jSize);
+		res.m_layout = m_layout == SparseLayout::Rows ? SparseLayout::Cols : SparseLayout::Rows;
+		return res;
+	}
+
+	template<typename T>
+	inline Matrix<T> SparseMatrix<T>::toMatrix() const
+	{
+		Matrix<T> res(m_iSize, m_jSize, T(0));
+		for (size_t r = 0; r < lines(); r++)
+		{
+			for (size_t p = m_starts[r]; p < m_starts[r + 1]; p++)
+			{
+				if (m_layout == SparseLayout::Rows)
+				{
+					res(r, m_indices[p]) = m_values[p];
+				}
+				else
+				{
+					res(m_indices[p], r) = m_values[p];
+				}
+			}
+		}
+		return res;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>& SparseMatrix<T>::prune(const T& threshold)
+	{
+		size_t q = 0;
+		size_t begin = 0;
+		for (size_t r = 0; r < lines(); r++)
+		{
+			size_t end = m_starts[r + 1];
+			for (size_t p = begin; p < end; p++)
+			{
+				if (kept(m_values[p], threshold))
+				{
+					m_indices[q] = m_indices[p];
+					m_values[q] = m_values[p];
+					q++;
+				}
+			}
+			begin = end;
+			m_starts[r + 1] = q;
+		}
+		m_indices.resize(q);
+		m_values.resize(q);
+		return *this;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>& SparseMatrix<T>::operator*=(const T& val)
+	{
+		for (T& x : m_values)
+		{
+			x *= val;
+		}
+		return *this;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T>& SparseMatrix<T>::operator/=(const T& val)
+	{
+		for (T& x : m_values)
+		{
+			x /= val;
+		}
+		return *this;
+	}
+
+	template<typename T>
+	inline T& SparseHelper::Dense<T>::operator()(size_t i, size_t j) const
+	{
+		return data[i * iStride + j * jStride];
+	}
+
+	template<typename T>
+	inline SparseHelper::Dense<T> SparseHelper::dense(Matrix<T>& mat, bool transpose)
+	{
+		T* data = mat.iSize() > 0 && mat.jSize() > 0 ? &mat(0, 0) : nullptr;
+		return transpose ? Dense<T>{ data, mat.jStride(), mat.iStride() } : Dense<T>{ data, mat.iStride(), mat.jStride() };
+	}
+
+	template<typename T>
+	inline SparseHelper::Dense<const T> SparseHelper::dense(const Matrix<T>& mat, bool transpose)
+	{
+		const T* data = mat.iSize() > 0 && mat.jSize() > 0 ? &mat(0, 0) : nullptr;
+		return transpose ? Dense<const T>{ data, mat.jStride(), mat.iStride() } : Dense<const T>{ data, mat.iStride(), mat.jStride() };
+	}
+
+	template<typename T>
+	inline void SparseHelper::checkIndex(size_t iSize, size_t jSize)
+	{
+		if (std::max(iSize, jSize) > std::numeric_limits<typename SparseMatrix<T>::Index>::max())
+		{
+			throw std::length_error("sparse matrix sizes must fit SparseMatrix::Index");
+		}
+	}
+
+	template<typename T>
+	inline void SparseHelper::checkSize(const SparseMatrix<T>& lhs, size_t iSize, size_t jSize)
+	{
+		if (lhs.iSize() != iSize || lhs.jSize() != jSize)
+		{
+			throw std::invalid_argument("element-wise operands must have the same size");
+		}
+	}
+
+	template<typename T, typename F>
+	inline Matrix<T>& SparseHelper::affine(const Matrix<T>& operand, Matrix<T>& res, const F& product)
+	{
+		if (!operand.isAffine())
+		{
+			return affine(operand.copySubmatrix((size_t)0, (size_t)0, operand.iSize(), operand.jSize()), res, product);
+		}
+		if (!res.isAffine())
+		{
+			Matrix<T> copy = res.copySubmatrix((size_t)0, (size_t)0, res.iSize(), res.jSize());
+			product(operand, copy);
+			for (size_t i = 0; i < res.iSize(); i++)
+			{
+				for (size_t j = 0; j < res.jSize(); j++)
+				{
+					res(i, j) = copy(i, j);
+				}
+			}
+			return res;
+		}
+		product(operand, res);
+		return res;
+	}
+
+	template<typename T>
+	inline void SparseHelper::product(const T& alpha, const SparseMatrix<T>& sparse, bool byRows, const Dense<const T>& rhs, const T& beta, const Dense<T>& res, size_t m, size_t k, size_t n)
+	{
+		if (!byRows)
+		{
+			// Relabeling by counting is linear in the entries, the product is n times that.
+			product(alpha, sparse.toLayout(sparse.layout() == SparseLayout::Rows ? SparseLayout::Cols : SparseLayout::Rows), true, rhs, beta, res, m, k, n);
+			return;
+		}
+		if (m == 0 || n == 0)
+		{
+			return;
+		}
+		const T* rows = rhs.data;
+		size_t rowStride = rhs.iStride;
+		thread_local std::vector<T> packed;
+		if (rhs.jStride != 1 && n > 1)
+		{
+			// Row by row, the strided reads of a transposed row major rhs walk along the same few cache lines.
+			packed.resize(k * n);
+			// Named inside the workers, packed would be their own thread_local copies.
+			T* pack = packed.data();
+			parallel::forRange(k, k * n, [&](size_t begin, size_t end)
+			{
+				for (size_t l = begin; l < end; l++)
+				{
+					for (size_t j = 0; j < n; j++)
+					{
+						pack[l * n + j] = rhs(l, j);
+					}
+				}
+			});
+			rows = pack;
+			rowStride = n;
+		}
+		const size_t* starts = sparse.m_starts.data();
+		const typename SparseMatrix<T>::Index* indices = sparse.m_indices.data();
+		const T* values = sparse.m_values.data();
+		parallel::forRange(m, std::max<size_t>(sparse.nonZeros(), m) * n, [&](size_t begin, size_t end)
+		{
+			// Rows of res are accumulated contiguously whatever its strides and only then scaled and written.
+			thread_local std::vector<T> buffer;
+			buffer.resize(n);
+			T* sum = buffer.data();
+			for (size_t i = begin; i < end; i++)
+			{
+				std::fill(sum, sum + n, T(0));
+				for (size_t p = starts[i]; p < starts[i + 1]; p++)
+				{
+					T val = values[p];
+					const T* row = rows + indices[p] * rowStride;
+					for (size_t j = 0; j < n; j++)
+					{
+						sum[j] += val * row[j];
+					}
+				}
+				for (size_t j = 0; j < n; j++)
+				{
+					T& out = res(i, j);
+					out = beta == T(0) ? alpha * sum[j] : alpha * sum[j] + beta * out;
+				}
+			}
+		});
+	}
+
+	template<typename T, typename Op>
+	inline SparseMatrix<T> SparseHelper::merge(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs, const Op& op, bool unite)
+	{
+		using Index = typename SparseMatrix<T>::Index;
+		SparseMatrix<T> res(lhs.iSize(), lhs.jSize(), lhs.layout());
+		res.m_indices.reserve(unite ? lhs.nonZeros() + rhs.nonZeros() : std::min(lhs.nonZeros(), rhs.nonZeros()));
+		res.m_values.reserve(res.m_indices.capacity());
+		for (size_t r = 0; r < lhs.lines(); r++)
+		{
+			size_t p = lhs.m_starts[r];
+			size_t q = rhs.m_starts[r];
+			size_t pEnd = lhs.m_starts[r + 1];
+			size_t qEnd = rhs.m_starts[r + 1];
+			while (p < pEnd || q < qEnd)
+			{
+				Index a = p < pEnd ? lhs.m_indices[p] : std::numeric_limits<Index>::max();
+				Index b = q < qEnd ? rhs.m_indices[q] : std::numeric_limits<Index>::max();
+				if (a == b)
+				{
+					res.m_indices.push_back(a);
+					res.m_values.push_back(op(lhs.m_values[p++], rhs.m_values[q++]));
+				}
+				else if (a < b)
+				{
+					if (unite)
+					{
+						res.m_indices.push_back(a);
+						res.m_values.push_back(op(lhs.m_values[p], T(0)));
+					}
+					p++;
+				}
+				else
+				{
+					if (unite)
+					{
+						res.m_indices.push_back(b);
+						res.m_values.push_back(op(T(0), rhs.m_values[q]));
+					}
+					q++;
+				}
+			}
+			res.m_starts[r + 1] = res.m_indices.size();
+		}
+		return res;
+	}
+
+	template<typename T>
+	inline Matrix<T>& matMulInto(const T& alpha, const SparseMatrix<T>& lhs, const Matrix<T>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose, bool rhsTranspose)
+	{
+		size_t m = lhsTranspose ? lhs.jSize() : lhs.iSize();
+		size_t k = lhsTranspose ? lhs.iSize() : lhs.jSize();
+		if ((rhsTranspose ? rhs.jSize() : rhs.iSize()) != k || res.iSize() != m || res.jSize() != (rhsTranspose ? rhs.iSize() : rhs.jSize()))
+		{
+			throw std::invalid_argument("matMulInto operands and result must have matching sizes");
+		}
+		bool byRows = (lhs.layout() == SparseLayout::Rows) != lhsTranspose;
+		return SparseHelper::affine(rhs, res, [&](const Matrix<T>& dense, Matrix<T>& out)
+		{
+			SparseHelper::product(alpha, lhs, byRows, SparseHelper::dense(dense, rhsTranspose), beta, SparseHelper::dense(out, false), m, k, out.jSize());
+		});
+	}
+
+	template<typename T>
+	inline void matMulInto(const T& alpha, const SparseMatrix<T>& lhs, const Matrix<T>& rhs, const T& beta, Matrix<T>&& res, bool lhsTranspose, bool rhsTranspose)
+	{
+		matMulInto(alpha, lhs, rhs, beta, res, lhsTranspose, rhsTranspose);
+	}
+
+	template<typename T>
+	inline Matrix<T>& matMulInto(const T& alpha, const Matrix<T>& lhs, const SparseMatrix<T>& rhs, const T& beta, Matrix<T>& res, bool lhsTranspose, bool rhsTranspose)
+	{
+		size_t k = rhsTranspose ? rhs.jSize() : rhs.iSize();
+		size_t n = rhsTranspose ? rhs.iSize() : rhs.jSize();
+		if ((lhsTranspose ? lhs.iSize() : lhs.jSize()) != k || res.iSize() != (lhsTranspose ? lhs.jSize() : lhs.iSize()) || res.jSize() != n)
+		{
+			throw std::invalid_argument("matMulInto operands and result must have matching sizes");
+		}
+		// The transposed product res^T = op(rhs)^T * op(lhs)^T has the sparse operand on the left, whose rows are the
+		// columns of op(rhs).
+		bool byRows = (rhs.layout() == SparseLayout::Rows) == rhsTranspose;
+		return SparseHelper::affine(lhs, res, [&](const Matrix<T>& dense, Matrix<T>& out)
+		{
+			SparseHelper::product(alpha, rhs, byRows, SparseHelper::dense(dense, !lhsTranspose), beta, SparseHelper::dense(out, true), n, k, out.iSize());
+		});
+	}
+
+	template<typename T>
+	inline void matMulInto(const T& alpha, const Matrix<T>& lhs, const SparseMatrix<T>& rhs, const T& beta, Matrix<T>&& res, bool lhsTranspose, bool rhsTranspose)
+	{
+		matMulInto(alpha, lhs, rhs, beta, res, lhsTranspose, rhsTranspose);
+	}
+
+	template<typename T>
+	inline Matrix<T> operator&&(const SparseMatrix<T>& lhs, const Matrix<T>& rhs)
+	{
+		Matrix<T> res(lhs.iSize(), rhs.jSize());
+		matMulInto(T(1), lhs, rhs, T(0), res);
+		return res;
+	}
+
+	template<typename T>
+	inline Matrix<T> operator&&(const Matrix<T>& lhs, const SparseMatrix<T>& rhs)
+	{
+		Matrix<T> res(lhs.iSize(), rhs.jSize());
+		matMulInto(T(1), lhs, rhs, T(0), res);
+		return res;
+	}
+
+	template<typename Op, typename T>
+	inline SparseMatrix<ElementWiseRes<Op, T>> elementWise(const Op& op, const SparseMatrix<T>& mat)
+	{
+		using R = ElementWiseRes<Op, T>;
+		std::vector<R> values(mat.nonZeros());
+		std::transform(mat.values().begin(), mat.values().end(), values.begin(), op);
+		return SparseMatrix<R>(mat.iSize(), mat.jSize(), mat.layout(), mat.starts(), mat.indices(), std::move(values));
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator-(const SparseMatrix<T>& mat)
+	{
+		return elementWise(std::negate<>(), mat);
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const T& rhs)
+	{
+		SparseMatrix<T> res = lhs;
+		return res *= rhs;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator*(const T& lhs, const SparseMatrix<T>& rhs)
+	{
+		return rhs * lhs;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator/(const SparseMatrix<T>& lhs, const T& rhs)
+	{
+		SparseMatrix<T> res = lhs;
+		return res /= rhs;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const Matrix<T>& rhs)
+	{
+		SparseHelper::checkSize(lhs, rhs.iSize(), rhs.jSize());
+		SparseMatrix<T> res = lhs;
+		bool rows = lhs.layout() == SparseLayout::Rows;
+		const std::vector<size_t>& starts = res.starts();
+		const std::vector<typename SparseMatrix<T>::Index>& indices = res.indices();
+		std::vector<T>& values = res.values();
+		for (size_t r = 0; r < res.lines(); r++)
+		{
+			for (size_t p = starts[r]; p < starts[r + 1]; p++)
+			{
+				values[p] *= rows ? rhs(r, indices[p]) : rhs(indices[p], r);
+			}
+		}
+		return res;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator*(const Matrix<T>& lhs, const SparseMatrix<T>& rhs)
+	{
+		return rhs * lhs;
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator+(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs)
+	{
+		SparseHelper::checkSize(lhs, rhs.iSize(), rhs.jSize());
+		return SparseHelper::merge(lhs, rhs.toLayout(lhs.layout()), std::plus<>(), true);
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator-(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs)
+	{
+		SparseHelper::checkSize(lhs, rhs.iSize(), rhs.jSize());
+		return SparseHelper::merge(lhs, rhs.toLayout(lhs.layout()), std::minus<>(), true);
+	}
+
+	template<typename T>
+	inline SparseMatrix<T> operator*(const SparseMatrix<T>& lhs, const SparseMatrix<T>& rhs)
+	{
+		SparseHelper::checkSize(lhs, rhs.iSize(), rhs.jSize());
+		return SparseHelper::merge(lhs, rhs.toLayout(lhs.layout()), std::multiplies<>(), false);
+	}
+}
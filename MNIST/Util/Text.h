@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Mapped File.h"
+#include "Matrix.h"
+#include "Thread Pool.h"
+
+// Bulk text ingest for matrices stored one row per line, with values separated by whitespace and/or a delimiter
+// (whitespace separated and CSV exports). Unlike operator>>, these functions take the whole input at once: the text
+// is split into chunks of whole lines, the chunks are parsed in parallel with std::from_chars (which skips the
+// locale and stream state machinery entirely) and values are written straight into the new matrix's storage.
+
+namespace io
+{
+	struct TextFormat
+	{
+		// Separator besides spaces and tabs, e.g. ',' for CSV. 0 for whitespace only.
+		char delimiter = 0;
+		// Splits the input across the thread pool. Inputs smaller than parallel::config().threshold bytes are always
+		// parsed inline.
+		bool parallel = true;
+	};
+
+	// The number of columns is that of the first non-empty line, which every other non-empty line must match. Lines
+	// without values are skipped. Throws std::runtime_error on malformed input.
+	template<typename T>
+	inline math::Matrix<T> parseText(const char* begin, const char* end, const TextFormat& format = TextFormat());
+	// Reads the rest of stream in large blocks, then parses it.
+	template<typename T>
+	inline math::Matrix<T> readText(std::istream& stream, const TextFormat& format = TextFormat());
+	// Maps the file and parses it in place.
+	template<typename T>
+	inline math::Matrix<T> loadText(const std::string& path, const TextFormat& format = TextFormat());
+
+	class TextParser
+	{
+		template<typename T>
+		friend math::Matrix<T> parseText(const char* begin, const char* end, const TextFormat& format);
+
+		// Input below this size per chunk is not worth a thread.
+		static constexpr size_t minChunk = 1 << 16;
+
+		static inline bool isSeparator(char c, char delimiter);
+		static inline const char* lineEnd(const char* begin, const char* end);
+		// Skips separators and returns the first character of the next value, or end.
+		static inline const char* skip(const char* begin, const char* end, char delimiter);
+
+		template<typename T>
+		static inline const char* parse(const char* begin, const char* end, T& val);
+
+		static inline size_t countValues(const char* begin, const char* end, char delimiter);
+		// Number of lines with at least one value.
+		static inline size_t countRows(const char* begin, const char* end, char delimiter);
+		// Parses the lines in [begin, end) into rows row, row + 1, ... of the contiguous matrix data. Returns an
+		// error message, or an empty string on success.
+		template<typename T>
+		static inline std::string parseRows(const char* begin, const char* end, char delimiter, size_t row, size_t jSize, T* data);
+	};
+
+	inline bool TextParser::isSeparator(char c, char delimiter)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || (c == delimiter && delimiter != 0);
+	}
+
+	inline const char* TextParser::lineEnd(const char* begin, const char* end)
+	{
+		const void* newline = memchr(begin, '\n', size_t(end - begin));
+		return newline == nullptr ? end : static_cast<const char*>(newline);
+	}
+
+	inline const char* TextParser::skip(const char* begin, const char* end, char delimiter)
+	{
+		while (begin < end && isSeparator(*begin, delimiter))
+		{
+			begin++;
+		}
+		return begin;
+	}
+
+	template<typename T>
+	inline const char* TextParser::parse(const char* begin, const char* end, T& val)
+	{
+		// from_chars rejects the leading '+' that other writers emit.
+		if (begin < end && *begin == '+')
+		{
+			begin++;
+		}
+		std::from_chars_result result;
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			unsigned int word = 0;
+			result = std::from_chars(begin, end, word);
+			val = word != 0;
+		}
+		else
+		{
+			static_assert(std::is_arithmetic_v<T>, "text parsing needs an arithmetic element type");
+			result = std::from_chars(begin, end, val);
+		}
+		return result.ec == std::errc() ? result.ptr : nullptr;
+	}
+
+	inline size_t TextParser::countValues(const char* begin, const char* end, char delimiter)
+	{
+		size_t count = 0;
+		begin = skip(begin, end, delimiter);
+		while (begin < end)
+		{
+			count++;
+			while (begin < end && !isSeparator(*begin, delimiter))
+			{
+				begin++;
+			}
+			begin = skip(begin, end, delimiter);
+		}
+		return count;
+	}
+
+	inline size_t TextParser::countRows(const char* begin, const char* end, char delimiter)
+	{
+		size_t rows = 0;
+		while (begin < end)
+		{
+			const char* last = lineEnd(begin, end);
+			rows += skip(begin, last, delimiter) < last;
+			begin = last < end ? last + 1 : end;
+		}
+		return rows;
+	}
+
+	template<typename T>
+	inline std::string TextParser::parseRows(const char* begin, const char* end, char delimiter, size_t row, size_t jSize, T* data)
+	{
+		while (begin < end)
+		{
+			const char* last = lineEnd(begin, end);
+			const char* pos = skip(begin, last, delimiter);
+			if (pos < last)
+			{
+				T* dst = data + row * jSize;
+				size_t j = 0;
+				while (pos < last)
+				{
+					if (j == jSize)
+					{
+						return "row " + std::to_string(row) + " has more than " + std::to_string(jSize) + " values";
+					}
+					const char* next = parse(pos, last, dst[j]);
+					if (next == nullptr || (next < last && !isSeparator(*next, delimiter)))
+					{
+						return "row " + std::to_string(row) + ": bad value at column " + std::to_string(j);
+					}
+					j++;
+					pos = skip(next, last, delimiter);
+				}
+				if (j < jSize)
+				{
+					return "row " + std::to_string(row) + " has only " + std::to_string(j) + " values";
+				}
+				row++;
+			}
+			begin = last < end ? last + 1 : end;
+		}
+		return std::string();
+	}
+
+	template<typename T>
+	inline math::Matrix<T> parseText(const char* begin, const char* end, const TextFormat& format)
+	{
+		size_t bytes = size_t(end - begin);
+		char delimiter = format.delimiter;
+		size_t chunks = 1;
+		if (format.parallel && bytes >= parallel::config().threshold)
+		{
+			chunks = std::max<size_t>(std::min(bytes / TextParser::minChunk, 4 * parallel::pool().size()), 1);
+		}
+		// Every chunk boundary is moved forward to the start of a line.
+		std::vector<const char*> bounds(chunks + 1, end);
+		bounds[0] = begin;
+		for (size_t c = 1; c < chunks; c++)
+		{
+			const char* last = TextParser::lineEnd(std::max(begin + bytes / chunks * c, bounds[c - 1]), end);
+			bounds[c] = last < end ? last + 1 : end;
+		}
+		// First pass: rows per chunk, turned into the index of each chunk's first row.
+		std::vector<size_t> rows(chunks + 1, 0);
+		parallel::forRange(chunks, bytes, [&](size_t first, size_t last)
+		{
+			for (size_t c = first; c < last; c++)
+			{
+				rows[c + 1] = TextParser::countRows(bounds[c], bounds[c + 1], delimiter);
+			}
+		});
+		for (size_t c = 0; c < chunks; c++)
+		{
+			rows[c + 1] += rows[c];
+		}
+		size_t jSize = 0;
+		for (const char* pos = begin; pos < end && jSize == 0;)
+		{
+			const char* last = TextParser::lineEnd(pos, end);
+			jSize = TextParser::countValues(pos, last, delimiter);
+			pos = last < end ? last + 1 : end;
+		}
+		math::Matrix<T> mat(rows[chunks], jSize);
+		// Second pass. Errors come back as messages, so the one reported is the first in the text whichever thread
+		// finds it first.
+		std::vector<std::string> errors(chunks);
+		T* data = mat.data();
+		parallel::forRange(chunks, bytes, [&](size_t first, size_t last)
+		{
+			for (size_t c = first; c < last; c++)
+			{
+				errors[c] = TextParser::parseRows(bounds[c], bounds[c + 1], delimiter, rows[c], jSize, data);
+			}
+		});
+		for (const std::string& error : errors)
+		{
+			if (!error.empty())
+			{
+				throw std::runtime_error(error);
+			}
+		}
+		return mat;
+	}
+
+	template<typename T>
+	inline math::Matrix<T> readText(std::istream& stream, const TextFormat& format)
+	{
+		constexpr size_t blockSize = 1 << 20;
+		std::vector<char> text;
+		while (stream)
+		{
+			size_t size = text.size();
+			text.resize(size + blockSize);
+			stream.read(text.data() + size, std::streamsize(blockSize));
+			text.resize(size + size_t(stream.gcount()));
+		}
+		return parseText<T>(text.data(), text.data() + text.size(), format);
+	}
+
+	template<typename T>
+	inline math::Matrix<T> loadText(const std::string& path, const TextFormat& format)
+	{
+		MappedFile file(path);
+		const char* text = reinterpret_cast<const char*>(file.data());
+		return parseText<T>(text, text + file.size(), format);
+	}
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Process wide thread pool used by the Matrix operations. A parallel loop hands out consecutive ranges of its
+// iteration space to the workers and to the calling thread, which takes part instead of sleeping. Loops started from
+// inside a worker run inline, so nested parallel operations cannot deadlock. An exception thrown by a range stops the
+// loop from handing out more and is rethrown to the caller once the ranges already running have finished.
+
+namespace parallel
+{
+	struct Config
+	{
+		// Total number of threads including the caller. 0 means one per hardware thread.
+		size_t threads = 0;
+		// Pins worker k to logical core k + 1 (the calling thread is left alone).
+		bool pin = false;
+		// Loops with less total work than this, counted in element operations (multiply-adds for matMul), run inline.
+		size_t threshold = 1 << 16;
+	};
+
+	class ThreadPool
+	{
+		std::vector<std::thread> m_workers;
+
+		std::mutex m_submit;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		bool m_stop = false;
+
+		// The loop currently being run. m_task is null while idle.
+		void (*m_task)(const void*, size_t, size_t) = nullptr;
+		const void* m_context = nullptr;
+		size_t m_count = 0;
+		size_t m_grain = 0;
+		size_t m_generation = 0;
+		size_t m_active = 0;
+		std::atomic<size_t> m_next{ 0 };
+		// The first exception thrown by the current loop.
+		std::exception_ptr m_error;
+
+		static inline bool& insideWorker();
+		static inline void pin(std::thread& thread, size_t core);
+
+		inline void work(size_t index);
+		inline void runRanges();
+
+	public:
+		inline explicit ThreadPool(size_t threads, bool pin = false);
+		inline ThreadPool(const ThreadPool&) = delete;
+		inline ThreadPool& operator=(const ThreadPool&) = delete;
+		inline ~ThreadPool();
+
+		// Number of threads taking part in a loop, including the caller.
+		inline size_t size() const;
+
+		// Calls task(begin, end) for consecutive ranges covering [0, count) and returns once all of them are done. If
+		// task throws, the remaining ranges are skipped and the first exception is rethrown.
+		template<typename F>
+		inline void forRange(size_t count, const F& task);
+	};
+
+	inline Config& config();
+	inline std::unique_ptr<ThreadPool>& poolSlot();
+	// Replaces the process wide pool. Must not be called while a parallel operation is running.
+	inline void configure(const Config& config);
+	inline ThreadPool& pool();
+
+	// Runs task(begin, end) over [0, count) on the process wide pool if work reaches the configured threshold and
+	// inline otherwise.
+	template<typename F>
+	inline void forRange(size_t count, size_t work, const F& task);
+
+	inline ThreadPool::ThreadPool(size_t threads, bool pin)
+	{
+		if (threads == 0)
+		{
+			threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+		}
+		for (size_t k = 1; k < threads; k++)
+		{
+			m_workers.emplace_back(&ThreadPool::work, this, k);
+			if (pin)
+			{
+				ThreadPool::pin(m_workers.back(), k);
+			}
+		}
+	}
+
+	inline ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	inline bool& ThreadPool::insideWorker()
+	{
+		thread_local bool inside = false;
+		return inside;
+	}
+
+	inline void ThreadPool::pin(std::thread& thread, size_t core)
+	{
+#if defined(_WIN32)
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core % CPU_SETSIZE, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+	}
+
+	inline void ThreadPool::work(size_t)
+	{
+		insideWorker() = true;
+		size_t seen = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wake.wait(lock, [&] { return m_stop || (m_task != nullptr && m_generation != seen); });
+			if (m_stop)
+			{
+				return;
+			}
+			seen = m_generation;
+			m_active++;
+			lock.unlock();
+			runRanges();
+			lock.lock();
+			m_active--;
+			if (m_active == 0)
+			{
+				m_done.notify_one();
+			}
+		}
+	}
+
+	inline void ThreadPool::runRanges()
+	{
+		while (true)
+		{
+			size_t begin = m_next.fetch_add(m_grain, std::memory_order_relaxed);
+			if (begin >= m_count)
+			{
+				return;
+			}
+			try
+			{
+				m_task(m_context, begin, std::min(begin + m_grain, m_count));
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_error == nullptr)
+				{
+					m_error = std::current_exception();
+				}
+				// No thread starts another range.
+				m_next.store(m_count, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+
+	inline size_t ThreadPool::size() const
+	{
+		return m_workers.size() + 1;
+	}
+
+	template<typename F>
+	inline void ThreadPool::forRange(size_t count, const F& task)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		if (count == 1 || m_workers.empty() || insideWorker())
+		{
+			task(size_t(0), count);
+			return;
+		}
+		// Several ranges per thread even out uneven progress without making the shared counter hot.
+		size_t grain = std::max<size_t>((count + 4 * size() - 1) / (4 * size()), 1);
+		std::lock_guard<std::mutex> submit(m_submit);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_task = [](const void* context, size_t begin, size_t end)
+			{
+				(*static_cast<const F*>(context))(begin, end);
+			};
+			m_context = &task;
+			m_count = count;
+			m_grain = grain;
+			m_next.store(0, std::memory_order_relaxed);
+			m_error = nullptr;
+			m_generation++;
+		}
+		m_wake.notify_all();
+		{
+			// Waits for the workers and returns the pool to idle however the caller leaves the loop, as task and its
+			// context live in the caller's frame.
+			struct Finish
+			{
+				ThreadPool& pool;
+
+				inline ~Finish()
+				{
+					insideWorker() = false;
+					std::unique_lock<std::mutex> lock(pool.m_mutex);
+					pool.m_done.wait(lock, [this] { return pool.m_active == 0; });
+					pool.m_task = nullptr;
+					pool.m_context = nullptr;
+				}
+			} finish{ *this };
+			insideWorker() = true;
+			runRanges();
+		}
+		if (m_error != nullptr)
+		{
+			std::exception_ptr error = nullptr;
+			std::swap(error, m_error);
+			std::rethrow_exception(error);
+		}
+	}
+
+	inline Config& config()
+	{
+		static Config config;
+		return config;
+	}
+
+	inline std::unique_ptr<ThreadPool>& poolSlot()
+	{
+		static std::unique_ptr<ThreadPool> pool;
+		return pool;
+	}
+
+	inline void configure(const Config& config)
+	{
+		parallel::config() = config;
+		poolSlot() = std::make_unique<ThreadPool>(config.threads, config.pin);
+	}
+
+	inline ThreadPool& pool()
+	{
+		static std::once_flag once;
+		std::call_once(once, []
+		{
+			if (poolSlot() == nullptr)
+			{
+				poolSlot() = std::make_unique<ThreadPool>(config().threads, config().pin);
+			}
+		});
+		return *poolSlot();
+	}
+
+	template<typename F>
+	inline void forRange(size_t count, size_t work, const F& task)
+	{
+		if (work < config().threshold)
+		{
+			if (count > 0)
+			{
+				task(size_t(0), count);
+			}
+			return;
+		}
+		pool().forRange(count, task);
+	}
+}
@@ -1,8 +1,20 @@
+#include <array>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "FFNN/Quantized Network.h"
 #include "FFNN/Solver.h"
+#include "Util/Benchmark.h"
+#include "Util/Fixed Matrix.h"
+#include "Util/IDX.h"
+#include "Util/Reduction.h"
 
 // Conventions:
 // Gradients are represented as row matrices (d[0][j] is the derivative of y w.r.t. x[j]).
@@ -13,107 +25,428 @@ const char* const TST_IMG_PATH = "dataset/t10k-images.idx3-ubyte";
 const char* const TRN_OUT_PATH = "dataset/train-labels.idx1-ubyte";
 const char* const TRN_IMG_PATH = "dataset/train-images.idx3-ubyte";
 
-void testMatrices()
+enum class View
 {
+	Contiguous,
+	Transposed,
+	// Rows reordered through swapRows, so every access goes through the row map.
+	Permuted
+};
 
-	using namespace std;
-	using namespace math;
-	Matrix<int> m1(3, 4, { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 });
-	Matrix<int> m2(3, 4, { 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24 });
-	int s1 = 5;
-	cout << setw(3) << m1 << endl << endl;
-	cout << setw(3) << m2 << endl << endl;
-	cout << setw(3) << -m1 << endl << endl;
-	cout << setw(3) << m1 + m2 << endl << endl;
-	cout << setw(3) << m1 + s1 << endl << endl;
-	cout << setw(3) << s1 + m2 << endl << endl;
-	cout << setw(3) << m1 - m2 << endl << endl;
-	cout << setw(3) << m1 - s1 << endl << endl;
-	cout << setw(3) << s1 - m2 << endl << endl;
-	cout << setw(3) << m1 * m2 << endl << endl;
-	cout << setw(3) << m1 * s1 << endl << endl;
-	cout << setw(3) << s1 * m2 << endl << endl;
-	cout << setw(3) << m1 / m2 << endl << endl;
-	cout << setw(3) << m1 / s1 << endl << endl;
-	cout << setw(3) << s1 / m2 << endl << endl;
-	cout << setw(3) << m1 % m2 << endl << endl;
-	cout << setw(3) << m1 % s1 << endl << endl;
-	cout << setw(3) << s1 % m2 << endl << endl;
-	cout << setw(3) << (m1 & m2) << endl << endl;
-	cout << setw(3) << (m1 & s1) << endl << endl;
-	cout << setw(3) << (s1 & m2) << endl << endl;
-	cout << setw(3) << (m1 | m2) << endl << endl;
-	cout << setw(3) << (m1 | s1) << endl << endl;
-	cout << setw(3) << (s1 | m2) << endl << endl;
-	cout << setw(3) << (m1 ^ m2) << endl << endl;
-	cout << setw(3) << (m1 ^ s1) << endl << endl;
-	cout << setw(3) << (s1 ^ m2) << endl << endl;
-	cout << setw(3) << ~m1 << endl << endl;
-	cout << setw(3) << !m1 << endl << endl;
-	cout << setw(3) << (m1 << m2) << endl << endl;
-	cout << setw(3) << (m1 << s1) << endl << endl;
-	cout << setw(3) << (s1 << m2) << endl << endl;
-	cout << setw(3) << (m1 >> m2) << endl << endl;
-	cout << setw(3) << (m1 >> s1) << endl << endl;
-	cout << setw(3) << (s1 >> m2) << endl << endl;
-	cout << setw(3) << min(m1, m2) << endl << endl;
-	cout << setw(3) << min(m1, s1) << endl << endl;
-	cout << setw(3) << min(s1, m2) << endl << endl;
-	cout << setw(3) << max(m1, m2) << endl << endl;
-	cout << setw(3) << max(m1, s1) << endl << endl;
-	cout << setw(3) << max(s1, m2) << endl << endl;
+const char* viewName(View view)
+{
+	switch (view)
+	{
+	case View::Contiguous:
+		return "contiguous";
+	case View::Transposed:
+		return "transposed";
+	default:
+		return "permuted";
+	}
+}
 
-	cout << setw(3) << m2.transpose() << endl << endl;
-	cout << setw(3) << (m1 && m2) << endl << endl;
+template<typename T>
+math::Matrix<T> benchmarkMatrix(size_t size, View view, std::mt19937_64& random)
+{
+	math::Matrix<T> mat(size, size);
+	// Small positive values keep division and repeated products well defined for every type.
+	std::uniform_int_distribution<int> distribution(1, 9);
+	for (size_t i = 0; i < size; i++)
+	{
+		for (size_t j = 0; j < size; j++)
+		{
+			mat(i, j) = T(distribution(random));
+		}
+	}
+	if (view == View::Transposed)
+	{
+		return mat.shareTranspose();
+	}
+	if (view == View::Permuted)
+	{
+		for (size_t i = 0; i < size / 2; i++)
+		{
+			mat.swapRows(i, size - 1 - i);
+		}
+	}
+	return mat;
+}
 
-	m2.transpose();
-	m2 = { 2, 2, 2, 5, 5, 5, 8, 8, 8, 11, 11, 11 };
-	cout << setw(3) << (m1 == m2) << endl << endl;
-	cout << setw(3) << (m1 == s1) << endl << endl;
-	cout << setw(3) << (s1 == m2) << endl << endl;
-	cout << setw(3) << (m1 != m2) << endl << endl;
-	cout << setw(3) << (m1 != s1) << endl << endl;
-	cout << setw(3) << (s1 != m2) << endl << endl;
-	cout << setw(3) << (m1 > m2) << endl << endl;
-	cout << setw(3) << (m1 > s1) << endl << endl;
-	cout << setw(3) << (s1 > m2) << endl << endl;
-	cout << setw(3) << (m1 < m2) << endl << endl;
-	cout << setw(3) << (m1 < s1) << endl << endl;
-	cout << setw(3) << (s1 < m2) << endl << endl;
-	cout << setw(3) << (m1 >= m2) << endl << endl;
-	cout << setw(3) << (m1 >= s1) << endl << endl;
-	cout << setw(3) << (s1 >= m2) << endl << endl;
-	cout << setw(3) << (m1 <= m2) << endl << endl;
-	cout << setw(3) << (m1 <= s1) << endl << endl;
-	cout << setw(3) << (s1 <= m2) << endl << endl;
+template<typename T, typename F>
+void benchmarkCase(const bench::Config& config, bench::Report& report, const char* name, View view, size_t size, double flops, double bytes, const F& op)
+{
+	bench::Result result;
+	result.name = name;
+	result.dtype = bench::typeName<T>();
+	result.view = viewName(view);
+	result.iSize = size;
+	result.jSize = size;
+	result.flops = flops;
+	result.bytes = bytes;
+	bench::measure(config, op, result);
+	report.add(result);
+}
 
-	m2 = { 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24 };
-	cout << setw(3) << (m1 += m2) << endl << endl;
-	cout << setw(3) << (m1 += s1) << endl << endl;
-	cout << setw(3) << (m1 -= m2) << endl << endl;
-	cout << setw(3) << (m1 -= s1) << endl << endl;
-	cout << setw(3) << (m1 *= m2) << endl << endl;
-	cout << setw(3) << (m1 *= s1) << endl << endl;
-	cout << setw(3) << (m1 /= m2) << endl << endl;
-	cout << setw(3) << (m1 /= s1) << endl << endl;
-	cout << setw(3) << (m1 %= m2) << endl << endl;
-	cout << setw(3) << (m1 %= s1) << endl << endl;
-	cout << setw(3) << (m1 &= m2) << endl << endl;
-	cout << setw(3) << (m1 &= s1) << endl << endl;
-	cout << setw(3) << (m1 |= m2) << endl << endl;
-	cout << setw(3) << (m1 |= s1) << endl << endl;
-	cout << setw(3) << (m1 ^= m2) << endl << endl;
-	cout << setw(3) << (m1 ^= s1) << endl << endl;
-	cout << setw(3) << (m1 <<= m2) << endl << endl;
-	cout << setw(3) << (m1 <<= s1) << endl << endl;
-	cout << setw(3) << (m1 >>= m2) << endl << endl;
-	cout << setw(3) << (m1 >>= s1) << endl << endl;
+template<typename T>
+void benchmarkType(const bench::Config& config, size_t maxSize, bench::Report& report)
+{
+	using namespace math;
+	// Cases are skipped beyond these operation counts. Products that cannot use gemm (integers, permuted views) and
+	// stream I/O run scalar code that would take minutes at the largest sizes.
+	const double maxOps = double(1ull << 37);
+	const double maxScalarOps = double(1ull << 31);
+	std::mt19937_64 random(0);
+	for (size_t size = 4; size <= maxSize; size *= 4)
+	{
+		for (View view : { View::Contiguous, View::Transposed, View::Permuted })
+		{
+			Matrix<T> a = benchmarkMatrix<T>(size, view, random);
+			Matrix<T> b = benchmarkMatrix<T>(size, view, random);
+			Matrix<T> c = benchmarkMatrix<T>(size, view, random);
+			double n = double(size) * size;
+			double bytes = n * sizeof(T);
+			benchmarkCase<T>(config, report, "add", view, size, n, 3 * bytes, [&]
+			{
+				Matrix<T> res = a + b;
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "scale", view, size, n, 2 * bytes, [&]
+			{
+				Matrix<T> res = a * T(3);
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "negate", view, size, n, 2 * bytes, [&]
+			{
+				Matrix<T> res = -a;
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "divide", view, size, n, 3 * bytes, [&]
+			{
+				Matrix<T> res = a / b;
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "min", view, size, n, 3 * bytes, [&]
+			{
+				Matrix<T> res = math::min(a, b);
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "less", view, size, n, 2 * bytes + n, [&]
+			{
+				Matrix<bool> res = a < b;
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "multiplyAdd", view, size, 2 * n, 4 * bytes, [&]
+			{
+				Matrix<T> res = a * b + c;
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "copyTranspose", view, size, 0, 2 * bytes, [&]
+			{
+				Matrix<T> res = a.copyTranspose();
+				bench::keep(res);
+			});
+			benchmarkCase<T>(config, report, "shareSubmatrix", view, size, 0, 0, [&]
+			{
+				Matrix<T> res = a.shareSubmatrix(size / 4, size / 4, size / 2, size / 2);
+				bench::keep(res);
+			});
+			bool accelerated = gemm::isAccelerated<std::plus<>, std::multiplies<>, T, T> && view != View::Permuted;
+			if (2 * n * size <= (accelerated ? maxOps : maxScalarOps))
+			{
+				benchmarkCase<T>(config, report, "matMul", view, size, 2 * n * size, 3 * bytes, [&]
+				{
+					Matrix<T> res = a && b;
+					bench::keep(res);
+				});
+			}
+			if (100 * n <= maxScalarOps)
+			{
+				std::ostringstream text;
+				text << a;
+				std::string str = text.str();
+				benchmarkCase<T>(config, report, "write", view, size, 0, double(str.size()), [&]
+				{
+					std::ostringstream stream;
+					stream << a;
+					bench::keep(stream);
+				});
+				benchmarkCase<T>(config, report, "read", view, size, 0, double(str.size()), [&]
+				{
+					std::istringstream stream(str);
+					Matrix<T> res(size, size);
+					stream >> res;
+					bench::keep(res);
+				});
+			}
+		}
+	}
+}
 
-	cin >> m1 >> m2;
+// Sweeps the Matrix operations over square sizes from 4 up to maxSize, element types and view kinds, and writes the
+// results as JSON.
+void benchmark(size_t maxSize, std::ostream& stream)
+{
+	bench::Config config;
+	bench::Report report;
+	benchmarkType<float>(config, maxSize, report);
+	benchmarkType<double>(config, maxSize, report);
+	benchmarkType<int32_t>(config, maxSize, report);
+	report.writeJson(stream, parallel::pool().size());
+}
+
+void train()
+{
+	using namespace std;
+	using namespace math;
+	const size_t epochs = 5;
+	const float learningRate = 0.1f;
+	Matrix<uint8_t> trainImages = io::loadIdx(TRN_IMG_PATH);
+	Matrix<uint8_t> trainLabels = io::loadIdx(TRN_OUT_PATH);
+	Matrix<uint8_t> testImages = io::loadIdx(TST_IMG_PATH);
+	Matrix<uint8_t> testLabels = io::loadIdx(TST_OUT_PATH);
+	Solver<float> solver({ trainImages.jSize(), 128, 64, 10 }, 64);
+	io::BatchLoader::Config config;
+	config.batchSize = solver.batchSize();
+	config.epochs = epochs;
+	io::BatchLoader loader(trainImages, trainLabels, config);
+	for (size_t epoch = 0; epoch < epochs; epoch++)
+	{
+		Solver<float>::Stats trained = solver.fit(loader, learningRate, loader.batchesPerEpoch());
+		Solver<float>::Stats tested = solver.evaluate(testImages, testLabels);
+		cout << "epoch " << epoch + 1 << ": " << trained.samplesPerSecond() << " samples/s, loss " << trained.loss
+			<< ", train accuracy " << trained.accuracy() << ", test accuracy " << tested.accuracy() << endl;
+	}
+	QuantizedNetwork quantized(solver);
+	Solver<float>::Stats exact = solver.evaluate(testImages, testLabels);
+	Solver<float>::Stats approximate = quantized.evaluate(testImages, testLabels);
+	cout << "int8 inference: " << approximate.samplesPerSecond() << " samples/s (float " << exact.samplesPerSecond()
+		<< "), test accuracy " << approximate.accuracy() << " (float " << exact.accuracy() << ")" << endl;
+}
+
+// Regression checks for cases that fast paths have got wrong. Prints each failure and returns how many there were.
+size_t test()
+{
+	using namespace math;
+	size_t failures = 0;
+	auto check = [&](bool passed, const char* name)
+	{
+		if (!passed)
+		{
+			std::cout << "FAILED: " << name << std::endl;
+			failures++;
+		}
+	};
+	// Every element of an operand that overlaps the destination must be read before it is overwritten.
+	Matrix<int> original(3, 3);
+	for (size_t i = 0; i < 3; i++)
+	{
+		for (size_t j = 0; j < 3; j++)
+		{
+			original(i, j) = int(i * 3 + j) - 4;
+		}
+	}
+	Matrix<int> sum = original.copySubmatrix((size_t)0, (size_t)0, 3, 3);
+	sum = sum + sum.shareTranspose();
+	Matrix<int> compound = original.copySubmatrix((size_t)0, (size_t)0, 3, 3);
+	compound += compound.shareTranspose();
+	bool symmetric = true;
+	for (size_t i = 0; i < 3; i++)
+	{
+		for (size_t j = 0; j < 3; j++)
+		{
+			int expected = original(i, j) + original(j, i);
+			symmetric = symmetric && sum(i, j) == expected && compound(i, j) == expected;
+		}
+	}
+	check(symmetric, "adding the transpose of a matrix to itself");
+	// Views of a const matrix must not write into the copies it shares its data with.
+	Matrix<int> shared(2, 2, 1);
+	Matrix<int> copy = shared;
+	Matrix<int> view = std::as_const(copy).shareSubmatrix((size_t)0, (size_t)0, 2, 2);
+	view(0, 0) = 9;
+	check(shared(0, 0) == 1 && copy(0, 0) == 1 && view(0, 0) == 9, "writing a view of a const copy-on-write copy");
+	// An exception thrown by a parallel task reaches the caller, whichever thread ran the task.
+	bool caught = false;
+	try
+	{
+		parallel::forRange(1000, size_t(1) << 30, [](size_t begin, size_t)
+		{
+			if (begin == 0)
+			{
+				throw std::runtime_error("task failed");
+			}
+		});
+	}
+	catch (const std::runtime_error&)
+	{
+		caught = true;
+	}
+	check(caught, "exception thrown by a parallel task");
+	// A dense product into a result of the wrong size is rejected instead of reading past its operands.
+	Matrix<float> lhs(2, 3, 1.0f);
+	Matrix<float> rhs(3, 4, 1.0f);
+	bool rejected = false;
+	try
+	{
+		matMulInto(1.0f, lhs, rhs, 0.0f, Matrix<float>(3, 4));
+	}
+	catch (const std::invalid_argument&)
+	{
+		rejected = true;
+	}
+	check(rejected, "matMulInto into a result of the wrong size");
+	// Products of 8 bit integers are summed in int.
+	Matrix<int8_t> bytes(2, 2, int8_t(100));
+	Matrix<int> products = bytes && bytes;
+	Matrix<int> mixed = FixedMatrix<int8_t, 2, 2>(int8_t(100)) && bytes;
+	check(products(0, 0) == 20000 && products(1, 1) == 20000 && mixed(1, 0) == 20000, "product of 8 bit integer matrices");
+	// Norms of half precision matrices are accumulated in float.
+	Matrix<half> halves(2, 2, half(-1.5f));
+	Matrix<float> rowNorms = norm1(halves, Axis::Rows);
+	check(norm1(halves) == 6.0f && rowNorms(1, 0) == 3.0f, "norm of a half precision matrix");
+	// Iterating a row goes through the index map of a view that reorders the columns.
+	size_t reversed[] = { 2, 1, 0 };
+	Matrix<int> reorder = original.shareSubmatrix(reversed, reversed, 3, 3);
+	std::vector<int> row(reorder.row(0).begin(), reorder.row(0).end());
+	check(row == std::vector<int>{ original(2, 2), original(2, 1), original(2, 0) }, "iterating a row of a reordered view");
+	// The product of bool matrices is the boolean one, whether their size is fixed or not.
+	FixedMatrix<bool, 2, 2> diagonal(std::array<bool, 4>{ true, false, false, true });
+	FixedMatrix<bool, 2, 2> booleanProduct = diagonal && FixedMatrix<bool, 2, 2>(true);
+	check(booleanProduct(0, 1) && booleanProduct(1, 0), "product of fixed size bool matrices");
+	// Copies of copies share the data lazily, while copies of data a writable view writes into are made eagerly.
+	Matrix<int> lazy(2, 2, 1);
+	Matrix<int> lazyCopy = lazy;
+	Matrix<int> copyOfCopy = lazyCopy;
+	Matrix<int> viewed(2, 2, 1);
+	Matrix<int> viewedCopy;
+	{
+		Matrix<int> column = viewed.shareSubmatrix(size_t(0), size_t(0), 2, 1);
+		viewedCopy = viewed;
+		column(1, 0) = 2;
+	}
+	Matrix<int> unviewedCopy = viewed;
+	check(&std::as_const(copyOfCopy)(0, 0) == &std::as_const(lazy)(0, 0) && viewedCopy(1, 0) == 1 &&
+		&std::as_const(unviewedCopy)(0, 0) == &std::as_const(viewed)(0, 0), "copying copies and views");
+	// A pool keeps neither blocks above its block limit nor more free bytes per size class than its class limit.
+	alloc::Pool limited(1024, 256);
+	for (size_t bytes : { size_t(2048), size_t(2048), size_t(64), size_t(64) })
+	{
+		void* blocks[] = { limited.allocate(bytes), limited.allocate(bytes), limited.allocate(bytes),
+			limited.allocate(bytes), limited.allocate(bytes) };
+		for (void* block : blocks)
+		{
+			limited.deallocate(block, bytes);
+		}
+	}
+	check(limited.stats().hits == 4 && limited.stats().live == 0, "limits of a pool");
+	// A loader refuses labels for fewer rows than it has inputs, rather than gathering past their end.
+	bool mismatched = false;
+	try
+	{
+		io::BatchLoader loader(Matrix<uint8_t>(4, 2, 0), Matrix<uint8_t>(3, 1, 0), io::BatchLoader::Config());
+	}
+	catch (const std::invalid_argument&)
+	{
+		mismatched = true;
+	}
+	check(mismatched, "batch loader with fewer labels than inputs");
+	// Once the batches it started with are in circulation, the loader gathers into the ones the consumer passes back.
+	io::BatchLoader::Config circulating;
+	circulating.batchSize = 2;
+	circulating.depth = 2;
+	io::BatchLoader loader(Matrix<uint8_t>(8, 3, 1), Matrix<uint8_t>(8, 1, 0), circulating);
+	io::Batch batch;
+	for (size_t b = 0; b < circulating.depth + 2; b++)
+	{
+		loader.next(batch);
+	}
+	alloc::Stats before = alloc::pool().stats();
+	for (size_t b = 0; b < 20; b++)
+	{
+		loader.next(batch);
+	}
+	alloc::Stats after = alloc::pool().stats();
+	check(after.hits + after.misses == before.hits + before.misses && batch.inputs(1, 2) == 1.0f / 255.0f,
+		"batches allocated by the loader in steady state");
+	// Saving over the checkpoint a solver was loaded from leaves its mapped weights readable. Windows refuses to
+	// replace a mapped file, so there the save may fail instead, but must leave the old checkpoint intact.
+	const std::string checkpoint = "test.checkpoint";
+	Solver<float> trained({ 784, 512, 10 }, 8, 1);
+	trained.save(checkpoint);
+	Solver<float> resumed({ 784, 512, 10 }, 8, 2);
+	resumed.load(checkpoint);
+	bool saved = true;
+	try
+	{
+		resumed.save(checkpoint);
+	}
+	catch (const std::runtime_error&)
+	{
+		saved = false;
+	}
+	Solver<float> reloaded({ 784, 512, 10 }, 8, 3);
+	reloaded.load(checkpoint);
+	bool restored = true;
+	for (size_t l = 0; l < trained.layers(); l++)
+	{
+		for (const Solver<float>* solver : { &resumed, &reloaded })
+		{
+			for (size_t i = 0; i < trained.weights(l).iSize(); i++)
+			{
+				for (size_t j = 0; j < trained.weights(l).jSize(); j++)
+				{
+					restored = restored && solver->weights(l)(i, j) == trained.weights(l)(i, j);
+				}
+			}
+			for (size_t j = 0; j < trained.biases(l).jSize(); j++)
+			{
+				restored = restored && solver->biases(l)(0, j) == trained.biases(l)(0, j);
+			}
+		}
+	}
+#if !defined(_WIN32)
+	restored = restored && saved;
+#endif
+	check(restored, "saving a checkpoint over the file it was loaded from");
+	std::remove(checkpoint.c_str());
+	std::remove((checkpoint + ".tmp").c_str());
+	std::cout << failures << " failures" << std::endl;
+	return failures;
 }
 
-int main()
+// Trains by default. "bench [max size] [output path]" runs the benchmarks instead, writing to stdout if no path is
+// given, and "test" runs the regression checks.
+int main(int argc, char** argv)
 {
-	testMatrices();
+	try
+	{
+		if (argc > 1 && std::string(argv[1]) == "test")
+		{
+			return test() == 0 ? 0 : 1;
+		}
+		if (argc > 1 && std::string(argv[1]) == "bench")
+		{
+			size_t maxSize = argc > 2 ? std::stoul(argv[2]) : 4096;
+			if (argc > 3)
+			{
+				std::ofstream file(argv[3]);
+				benchmark(maxSize, file);
+			}
+			else
+			{
+				benchmark(maxSize, std::cout);
+			}
+		}
+		else
+		{
+			train();
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
 	return 0;
 }
\ No newline at end of file